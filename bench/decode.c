@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../dist/tinybits.h"
+
+// unpack_value() cost per value type: a buffer of one kind of value is decoded over and over,
+// then the cost of getting two fields out of a larger message: decoding it all, skipping the rest or with path queries,
+// of visiting every value of it and of parsing it into a document for random access
+// Build with: gcc -O2 bench/decode.c -o decode_bench -lm
+
+#define VALUES 4096
+#define ROUNDS 2000
+
+// Timing helper
+static inline long get_time_diff(struct timeval *start, struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+static uint64_t rng_state = 88172645463325252ULL;
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static const char *keys[] = { "id", "name", "email", "created_at", "status", "price", "quantity", "tags",
+                              "owner_id", "country", "city", "zip", "latitude", "longitude", "version", "enabled" };
+
+static char text[256];
+
+static void pack_kind(tiny_bits_packer *enc, int kind, int i) {
+    switch (kind) {
+    case 0: pack_int(enc, (int64_t)(next_random() % 120)); break;
+    case 1: pack_int(enc, (int64_t)(next_random() % 1000000000000ULL) - 500000000000LL); break;
+    case 2: pack_double(enc, (double)(next_random() % 100000) / 100.0); break;
+    case 3: pack_double(enc, (double)next_random() / 3.0); break;
+    case 4: pack_str(enc, text, 4 + next_random() % 20); break;
+    case 5: pack_str(enc, text, 40 + next_random() % 200); break;
+    case 6: pack_str(enc, (char *)keys[i % 16], strlen(keys[i % 16])); break;
+    case 7: pack_arr(enc, next_random() % 7); break;
+    case 8: pack_map(enc, next_random() % 15); break;
+    case 9: switch (next_random() % 3) { case 0: pack_null(enc); break; case 1: pack_true(enc); break; default: pack_false(enc); } break;
+    case 10: {
+        // a record like mix, where the type of the next value is not predictable
+        static const int mix[] = { 0, 0, 0, 1, 2, 4, 4, 6, 6, 6, 6, 7, 8, 9 };
+        pack_kind(enc, mix[next_random() % 14], i);
+        break;
+    }
+    }
+}
+
+// A message routers look into: a couple of header fields, then a body they don't need
+static void pack_message(tiny_bits_packer *enc) {
+    pack_map(enc, 3);
+    pack_str(enc, "type", 4);
+    pack_str(enc, "order", 5);
+    pack_str(enc, "tenant", 6);
+    pack_int(enc, 4242);
+    pack_str(enc, "body", 4);
+    pack_arr(enc, 64);
+    for (int i = 0; i < 64; i++) {
+        pack_map(enc, 4);
+        pack_str(enc, "sku", 3);
+        pack_int(enc, 100000 + i);
+        pack_str(enc, "name", 4);
+        pack_str(enc, text, 10 + i % 20);
+        pack_str(enc, "price", 5);
+        pack_double(enc, (double)i * 1.25);
+        pack_str(enc, "tags", 4);
+        pack_arr(enc, 2);
+        pack_str(enc, "new", 3);
+        pack_str(enc, "sale", 4);
+    }
+}
+
+// Reads the type and tenant fields, then either decodes everything left or skips it
+static int64_t route(tiny_bits_unpacker *dec, int skip) {
+    tiny_bits_value value;
+    int64_t tenant = 0;
+    if (tiny_bits_read_value(dec, &value) != TINY_BITS_MAP) return -1;
+    for (int field = 0; field < 2; field++) {
+        tiny_bits_read_value(dec, &value);
+        tiny_bits_read_value(dec, &value);
+        if (value.int_val < 100000) tenant = value.int_val;
+    }
+    if (skip) {
+        tiny_bits_leave_container(dec);
+    } else {
+        while (unpack_value(dec, &value) < TINY_BITS_FINISHED);
+    }
+    return tenant;
+}
+
+// A checksum over the whole message (integers, string lengths and container ends), by hand and with visitors
+typedef struct checksum {
+    int64_t sum;
+    long ends;
+} checksum;
+
+static int sum_int(void *context, int64_t value) { ((checksum *)context)->sum += value; return 1; }
+static int sum_str(void *context, const char *data, size_t length) { (void)data; ((checksum *)context)->sum += (int64_t)length; return 1; }
+static int count_end(void *context) { ((checksum *)context)->ends++; return 1; }
+
+static const tiny_bits_visitor checksum_visitor = {
+    .on_int = sum_int, .on_str = sum_str, .on_array_end = count_end, .on_map_end = count_end
+};
+TINY_BITS_WALKER(checksum_walk, checksum_visitor)
+
+static int checksum_by_hand(tiny_bits_unpacker *dec, checksum *total) {
+    size_t left[TB_MAX_DEPTH];
+    int depth = 0;
+    tiny_bits_value value;
+    do {
+        enum tiny_bits_type type = unpack_value(dec, &value);
+        if (type >= TINY_BITS_FINISHED) return 0;
+        if (depth) left[depth - 1]--;
+        if (type == TINY_BITS_INT) total->sum += value.int_val;
+        else if (type == TINY_BITS_STR) total->sum += (int64_t)value.str_blob_val.length;
+        else if (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) {
+            if (depth == TB_MAX_DEPTH) return 0;
+            left[depth++] = type == TINY_BITS_MAP ? 2 * value.length : value.length;
+        }
+        while (depth && left[depth - 1] == 0) {
+            depth--;
+            total->ends++;
+        }
+    } while (depth);
+    return 1;
+}
+
+int main() {
+    const char *names[] = { "small int", "int", "double (compressed)", "double (raw)", "short string",
+                            "long string", "string ref", "array header", "map header", "null/bool", "mixed" };
+    for (int c = 0; c < 255; c++) text[c] = 'a' + c % 26;
+    printf("%-20s %8s %12s\n", "type", "bytes", "ns/value");
+    for (int kind = 0; kind < 11; kind++) {
+        uint8_t features = kind == 2 ? TB_FEATURE_COMPRESS_FLOATS : kind == 6 ? TB_FEATURE_STRING_DEDUPE
+                         : kind == 10 ? TB_FEATURE_COMPRESS_FLOATS | TB_FEATURE_STRING_DEDUPE : 0;
+        tiny_bits_packer *enc = tiny_bits_packer_create(1024, features);
+        tiny_bits_unpacker *dec = tiny_bits_unpacker_create();
+        if (!enc || !dec) return 1;
+        for (int i = 0; i < VALUES; i++) pack_kind(enc, kind, i);
+
+        struct timeval start, end;
+        tiny_bits_value value;
+        long count = 0;
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < ROUNDS; r++) {
+            tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+            while (unpack_value(dec, &value) < TINY_BITS_FINISHED) count++;
+        }
+        gettimeofday(&end, NULL);
+        if (count != (long)VALUES * ROUNDS) fprintf(stderr, "%s: decoded %ld values\n", names[kind], count);
+        printf("%-20s %8zu %12.2f\n", names[kind], enc->current_pos,
+               (double)get_time_diff(&start, &end) * 1000.0 / ((double)VALUES * ROUNDS));
+        tiny_bits_unpacker_destroy(dec);
+        tiny_bits_packer_destroy(enc);
+    }
+
+    printf("\n%-20s %8s %12s\n", "header fields", "bytes", "ns/message");
+    for (int skip = 0; skip < 2; skip++) {
+        tiny_bits_packer *enc = tiny_bits_packer_create(4096, TB_FEATURE_STRING_DEDUPE);
+        tiny_bits_unpacker *dec = tiny_bits_unpacker_create();
+        if (!enc || !dec) return 1;
+        pack_message(enc);
+        struct timeval start, end;
+        int64_t tenants = 0;
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < ROUNDS * 100; r++) {
+            tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+            tenants += route(dec, skip);
+        }
+        gettimeofday(&end, NULL);
+        if (tenants != 4242L * ROUNDS * 100) fprintf(stderr, "route failed\n");
+        printf("%-20s %8zu %12.2f\n", skip ? "skip the body" : "decode the body", enc->current_pos,
+               (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+        tiny_bits_unpacker_destroy(dec);
+        tiny_bits_packer_destroy(enc);
+    }
+
+    // the same lookups as compiled paths
+    const char *expressions[3] = { "type", "tenant", "body[63].name" };
+    const tiny_bits_path *paths[3];
+    for (int i = 0; i < 3; i++) paths[i] = tiny_bits_path_compile(expressions[i]);
+    for (int deep = 0; deep < 2; deep++) {
+        tiny_bits_packer *enc = tiny_bits_packer_create(4096, TB_FEATURE_STRING_DEDUPE);
+        tiny_bits_unpacker *dec = tiny_bits_unpacker_create();
+        if (!enc || !dec || !paths[0] || !paths[1] || !paths[2]) return 1;
+        pack_message(enc);
+        struct timeval start, end;
+        tiny_bits_value values[2];
+        enum tiny_bits_type types[2];
+        long found = 0;
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < ROUNDS * 100; r++) {
+            tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+            found += tiny_bits_query_many(dec, deep ? paths + 1 : paths, 2, values, types);
+        }
+        gettimeofday(&end, NULL);
+        if (found != 2L * ROUNDS * 100) fprintf(stderr, "query failed\n");
+        printf("%-20s %8zu %12.2f\n", deep ? "query tenant, body" : "query type, tenant", enc->current_pos,
+               (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+        tiny_bits_unpacker_destroy(dec);
+        tiny_bits_packer_destroy(enc);
+    }
+    for (int i = 0; i < 3; i++) tiny_bits_path_destroy((tiny_bits_path *)paths[i]);
+
+    // visiting every value, through function pointers or with the visitor built in
+    const tiny_bits_visitor *volatile generic = &checksum_visitor;
+    for (int walker = 0; walker < 3; walker++) {
+        const char *labels[] = { "checksum by hand", "tiny_bits_walk", "TINY_BITS_WALKER" };
+        tiny_bits_packer *enc = tiny_bits_packer_create(4096, TB_FEATURE_STRING_DEDUPE);
+        tiny_bits_unpacker *dec = tiny_bits_unpacker_create();
+        if (!enc || !dec) return 1;
+        pack_message(enc);
+        struct timeval start, end;
+        checksum total = { 0, 0 };
+        gettimeofday(&start, NULL);
+        for (int r = 0; r < ROUNDS * 100; r++) {
+            tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+            if (walker == 0) checksum_by_hand(dec, &total);
+            else if (walker == 1) tiny_bits_walk(dec, generic, &total);
+            else checksum_walk(dec, &total);
+        }
+        gettimeofday(&end, NULL);
+        if (total.ends != 130L * ROUNDS * 100) fprintf(stderr, "%s failed\n", labels[walker]);
+        printf("%-20s %8zu %12.2f\n", labels[walker], enc->current_pos,
+               (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+        tiny_bits_unpacker_destroy(dec);
+        tiny_bits_packer_destroy(enc);
+    }
+
+    // parsed into a document, then random access
+    tiny_bits_packer *enc = tiny_bits_packer_create(4096, TB_FEATURE_STRING_DEDUPE);
+    tiny_bits_unpacker *dec = tiny_bits_unpacker_create();
+    tiny_bits_document *doc = tiny_bits_document_create();
+    if (!enc || !dec || !doc) return 1;
+    pack_message(enc);
+    struct timeval start, end;
+    long found = 0;
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS * 100; r++) {
+        tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+        found += tiny_bits_document_parse(doc, dec) == TINY_BITS_MAP;
+    }
+    gettimeofday(&end, NULL);
+    printf("%-20s %8zu %12.2f\n", "document parse", enc->current_pos,
+           (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+    const tiny_bits_node *root = tiny_bits_document_root(doc);
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS * 100; r++) {
+        const tiny_bits_node *item = tiny_bits_node_at(doc, tiny_bits_node_get(doc, root, "body", 4), r & 63);
+        found += tiny_bits_node_get(doc, item, "price", 5) != NULL;
+    }
+    gettimeofday(&end, NULL);
+    if (found != 2L * ROUNDS * 100) fprintf(stderr, "document lookups failed\n");
+    printf("%-20s %8s %12.2f\n", "body[i].price lookup", "", (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+
+    // checked before decoding, nothing materialized
+    tiny_bits_limits limits = { 16, 1 << 20, 100000, 65536 };
+    long valid = 0;
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS * 100; r++) {
+        valid += tiny_bits_validate(enc->buffer, enc->current_pos, NULL, &limits, NULL) == TINY_BITS_VALID;
+    }
+    gettimeofday(&end, NULL);
+    if (valid != ROUNDS * 100L) fprintf(stderr, "validation failed\n");
+    printf("%-20s %8zu %12.2f\n", "validate", enc->current_pos, (double)get_time_diff(&start, &end) * 1000.0 / (ROUNDS * 100.0));
+    tiny_bits_document_destroy(doc);
+    tiny_bits_unpacker_destroy(dec);
+    tiny_bits_packer_destroy(enc);
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../dist/tinybits.h"
+
+// Float compression microbenchmark: cost of finding the decimal places of a value,
+// one at a time (with and without the previous value's places as a guess) and in batches, and of packing whole arrays with TB_FEATURE_COMPRESS_FLOATS
+
+#define COUNT 4096
+#define ROUNDS 2000
+
+// The previous implementation, trying up to 12 scales in groups of 4
+static inline int decimal_places_count_before(double abs_val, double *scaled) {
+    *scaled = abs_val;
+    double temp = *scaled;
+    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 0;}
+
+    *scaled = abs_val * 10000;
+    temp = *scaled;
+    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
+        *scaled = abs_val * 10;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 1;}
+        *scaled = abs_val * 100;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 2;}
+        *scaled = abs_val * 1000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 3;}
+        *scaled = temp;
+        return 4;
+    }
+
+    *scaled = abs_val * 100000000;
+    temp = *scaled;
+    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
+        *scaled = abs_val * 100000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 5;}
+        *scaled = abs_val * 1000000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 6;}
+        *scaled = abs_val * 10000000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 7;}
+        *scaled = temp;
+        return 8;
+    }
+
+    *scaled = abs_val * 1000000000000;
+    temp = *scaled;
+    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
+        *scaled = abs_val * 1000000000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 9;}
+        *scaled = abs_val * 10000000000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 10;}
+        *scaled = abs_val * 100000000000;
+        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 11;}
+        *scaled = temp;
+        return 12;
+    }
+    return -1;
+}
+
+// Timing helper
+static inline long get_time_diff(struct timeval *start, struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+static double per_value(struct timeval *start, struct timeval *end) {
+    return (double)get_time_diff(start, end) * 1000.0 / ((double)ROUNDS * COUNT);
+}
+
+static void run(const char *name, const double *values) {
+    static double abs_vals[COUNT], scaled[COUNT];
+    static int8_t places[COUNT];
+    struct timeval start, end;
+    long sink = 0;
+    int lossy = 0, compressed = 0;
+
+    for (int i = 0; i < COUNT; i++) abs_vals[i] = fabs(values[i]);
+    // values the previous implementation would not unpack exactly
+    for (int i = 0; i < COUNT; i++) {
+        double s;
+        int k = decimal_places_count_before(abs_vals[i], &s);
+        if (k >= 0 && s < 281474976710656.0 && (double)(uint64_t)s / powers[k] != abs_vals[i]) lossy++;
+    }
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < COUNT; i++) sink += decimal_places_count_before(abs_vals[i], &scaled[i]);
+    }
+    gettimeofday(&end, NULL);
+    double before_ns = per_value(&start, &end);
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < COUNT; i++) sink += decimal_places_count(abs_vals[i], &scaled[i]);
+    }
+    gettimeofday(&end, NULL);
+    double single_ns = per_value(&start, &end);
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        int guess = -1;
+        for (int i = 0; i < COUNT; i++) {
+            guess = decimal_places_count_near(abs_vals[i], guess, &scaled[i]);
+            sink += guess;
+        }
+    }
+    gettimeofday(&end, NULL);
+    double near_ns = per_value(&start, &end);
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        decimal_places_count_batch(abs_vals, COUNT, places, scaled);
+        sink += places[r % COUNT];
+    }
+    gettimeofday(&end, NULL);
+    double batch_ns = per_value(&start, &end);
+    for (int i = 0; i < COUNT; i++) compressed += places[i] >= 0;
+
+    tiny_bits_packer *encoder = tiny_bits_packer_create(COUNT * 10, TB_FEATURE_COMPRESS_FLOATS);
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        tiny_bits_packer_reset(encoder);
+        pack_arr(encoder, COUNT);
+        for (int i = 0; i < COUNT; i++) pack_double(encoder, values[i]);
+    }
+    gettimeofday(&end, NULL);
+    double pack_ns = per_value(&start, &end);
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        tiny_bits_packer_reset(encoder);
+        pack_double_array(encoder, values, COUNT);
+    }
+    gettimeofday(&end, NULL);
+    double pack_array_ns = per_value(&start, &end);
+
+    printf("%-10s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %10.2f %11d %6d\n", name, before_ns, single_ns, near_ns, batch_ns,
+           pack_ns, pack_array_ns, (double)encoder->current_pos / COUNT, compressed, lossy);
+    tiny_bits_packer_destroy(encoder);
+    if (sink == 42) printf("\n");
+}
+
+int main() {
+    static double prices[COUNT], latencies[COUNT], telemetry[COUNT], readings[COUNT];
+    srand(42);
+    for (int i = 0; i < COUNT; i++) {
+        prices[i] = (rand() % 1000000) / 100.0;            // 0.00 - 9999.99
+        latencies[i] = (rand() % 250000) / 1000.0;         // milliseconds with microseconds
+        telemetry[i] = (rand() % 180000000 - 90000000) / 1e6; // coordinates, 6 decimals
+        readings[i] = (float)rand() / (float)RAND_MAX * 40.0f; // float sensor values
+    }
+    printf("%-10s %9s %9s %9s %9s %9s %9s %10s %11s %6s\n", "values", "ns before", "ns single", "ns near", "ns batch",
+           "ns pack", "ns array", "bytes/val", "compressed", "lossy");
+    run("prices", prices);
+    run("latencies", latencies);
+    run("telemetry", telemetry);
+    run("readings", readings);
+    printf("(lossy: values the previous implementation compressed but would not unpack exactly)\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../dist/tinybits.h"
+
+// Dedupe table microbenchmark: chain lengths and lookup cost per hash function
+// Build with: gcc -O2 -msse4.2 bench/hash.c -o hash_bench (crc32c needs SSE4.2)
+
+#define ROUNDS 2000
+#define MAX_KEYS 4096
+
+typedef uint32_t (*hash_fn)(const char *str, uint32_t len);
+
+static uint32_t hash_fast(const char *str, uint32_t len) { return fast_hash_32(str, len); }
+static uint32_t hash_wy(const char *str, uint32_t len) { return wy_hash_32(str, len); }
+static uint32_t hash_crc32c(const char *str, uint32_t len) { return crc32c_hash_32(str, len); }
+
+typedef struct key_set {
+    const char *name;
+    char data[MAX_KEYS * 64];
+    uint32_t offsets[MAX_KEYS];
+    uint32_t lengths[MAX_KEYS];
+    int count;
+    size_t size;
+} key_set;
+
+static void add_key(key_set *set, const char *key) {
+    uint32_t len = strlen(key);
+    memcpy(set->data + set->size, key, len);
+    set->offsets[set->count] = set->size;
+    set->lengths[set->count] = len;
+    set->size += len;
+    set->count++;
+}
+
+// Timing helper
+static inline long get_time_diff(struct timeval *start, struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+// The chain walk as it was before, comparing byte by byte
+static inline HashEntry *lookup_bytewise(HashTable *table, const unsigned char *base,
+                                         const char *str, uint32_t len, uint32_t hash_code) {
+    uint32_t index = table->bins[hash_table_bin(table, hash_code)];
+    while (index > 0) {
+        HashEntry *entry = &table->cache[index - 1];
+        if (hash_code == entry->hash && len == entry->length) {
+            const unsigned char *p = base + entry->offset;
+            uint32_t i = 0;
+            while (i < len && (unsigned char)str[i] == p[i]) i++;
+            if (i == len) return entry;
+        }
+        index = entry->next_index;
+    }
+    return NULL;
+}
+
+static void run(key_set *set, const char *hash_name, hash_fn hash) {
+    HashTable table;
+    const unsigned char *base = (const unsigned char *)set->data;
+    hash_table_init(&table, TB_HASH_CACHE_SIZE, set->count, TB_DEDUPE_POLICY_STOP);
+    for (int i = 0; i < set->count; i++) {
+        hash_table_insert(&table, hash(set->data + set->offsets[i], set->lengths[i]), set->lengths[i], set->offsets[i]);
+    }
+
+    // chain statistics: entries visited to find each key, longest chain, full hash collisions
+    long probes = 0;
+    uint32_t longest = 0;
+    int collisions = 0;
+    for (uint32_t bin = 0; bin <= table.bin_mask; bin++) {
+        uint32_t chain = 0;
+        for (uint32_t index = table.bins[bin]; index > 0; index = table.cache[index - 1].next_index) {
+            chain++;
+            probes += chain;
+            for (uint32_t other = table.cache[index - 1].next_index; other > 0; other = table.cache[other - 1].next_index) {
+                if (table.cache[other - 1].hash == table.cache[index - 1].hash) collisions++;
+            }
+        }
+        if (chain > longest) longest = chain;
+    }
+
+    struct timeval start, end;
+    long found = 0;
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < set->count; i++) {
+            const char *key = set->data + set->offsets[i];
+            found += lookup_bytewise(&table, base, key, set->lengths[i], hash(key, set->lengths[i])) != NULL;
+        }
+    }
+    gettimeofday(&end, NULL);
+    double bytewise_ns = (double)get_time_diff(&start, &end) * 1000.0 / ((double)ROUNDS * set->count);
+
+    gettimeofday(&start, NULL);
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < set->count; i++) {
+            const char *key = set->data + set->offsets[i];
+            found += hash_table_lookup(&table, base, key, set->lengths[i], hash(key, set->lengths[i])) != NULL;
+        }
+    }
+    gettimeofday(&end, NULL);
+    double vector_ns = (double)get_time_diff(&start, &end) * 1000.0 / ((double)ROUNDS * set->count);
+
+    if (found != 2L * ROUNDS * set->count) fprintf(stderr, "lookup failed\n");
+    printf("%-10s %-7s %5d %6u %10.2f %6u %11d %11.2f %11.2f\n", set->name, hash_name, set->count,
+           table.bin_mask + 1, (double)probes / set->count, longest, collisions, bytewise_ns, vector_ns);
+    hash_table_free(&table);
+}
+
+int main() {
+    static key_set schema = { .name = "schema" };
+    static key_set numbered = { .name = "numbered" };
+    static key_set metrics = { .name = "metrics" };
+    char key[128];
+
+    const char *fields[] = {
+        "id", "uuid", "type", "name", "first_name", "fast_name", "last_name", "full_name", "nickname",
+        "email", "email_verified", "phone", "phone_verified", "address", "address_line_1", "address_line_2",
+        "city", "state", "country", "country_code", "zip", "zip_code", "created_at", "updated_at",
+        "deleted_at", "created_by", "updated_by", "status", "state_code", "children", "parent_id",
+        "owner_id", "user_id", "user_name", "account_id", "account_type", "price", "price_currency",
+        "quantity", "total", "subtotal", "discount", "tax", "tax_rate", "description", "title", "tags",
+        "metadata", "version", "enabled", "visible", "priority", "score", "rank", "latitude", "longitude",
+        "timestamp", "timezone", "locale", "language", "avatar_url", "profile_url", "homepage_url"
+    };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) add_key(&schema, fields[i]);
+
+    for (int i = 1; i <= 1000; i++) {
+        sprintf(key, "user_id_%d", i);
+        add_key(&numbered, key);
+    }
+
+    const char *services[] = { "api", "auth", "billing", "search", "storage", "gateway", "mailer", "worker" };
+    const char *measures[] = { "request", "response", "db_query", "cache_get", "cache_set", "queue_wait", "render", "upstream" };
+    const char *suffixes[] = { "latency_ms.p50", "latency_ms.p90", "latency_ms.p99", "count" };
+    for (int s = 0; s < 8; s++) {
+        for (int m = 0; m < 8; m++) {
+            for (int x = 0; x < 4; x++) {
+                sprintf(key, "%s.%s.%s", services[s], measures[m], suffixes[x]);
+                add_key(&metrics, key);
+            }
+        }
+    }
+
+#if !defined(__SSE4_2__)
+    printf("note: built without SSE4.2, crc32c falls back to wy\n");
+#endif
+    printf("%-10s %-7s %5s %6s %10s %6s %11s %11s %11s\n", "keys", "hash", "count", "bins", "avg probes",
+           "chain", "collisions", "ns bytewise", "ns vector");
+    key_set *sets[] = { &schema, &numbered, &metrics };
+    for (int i = 0; i < 3; i++) {
+        run(sets[i], "fast", hash_fast);
+        run(sets[i], "wy", hash_wy);
+        run(sets[i], "crc32c", hash_crc32c);
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#define TB_WITH_THREADS
+#include "../dist/tinybits.h"
+
+// Frame index and parallel decode of a log of messages joined by separators
+// Build with: gcc -O2 bench/parallel.c -o parallel_bench -lm -lpthread
+
+#define MESSAGES 100000
+#define ROUNDS 10
+
+// Timing helper
+static inline long get_time_diff(struct timeval *start, struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+// A log line: a few header fields and a small body
+static void pack_message(tiny_bits_packer *packer, int i) {
+    static const char *levels[] = { "debug", "info", "warning", "error" };
+    char text[64];
+    pack_map(packer, 5);
+    pack_str(packer, "ts", 2);
+    pack_datetime(packer, 1700000000.0 + i * 0.001, 0);
+    pack_str(packer, "level", 5);
+    pack_str(packer, (char *)levels[i % 4], strlen(levels[i % 4]));
+    pack_str(packer, "service", 7);
+    int n = snprintf(text, sizeof text, "service-%d", i % 17);
+    pack_str(packer, text, n);
+    pack_str(packer, "latency", 7);
+    pack_double(packer, (i % 1000) * 0.125);
+    pack_str(packer, "tags", 4);
+    pack_arr(packer, 4);
+    for (int t = 0; t < 4; t++) {
+        n = snprintf(text, sizeof text, "tag-%d-%d", t, (i * 7 + t) % 50);
+        pack_str(packer, text, n);
+    }
+}
+
+// Decodes values up to the end of the buffer, summing what is easy to sum
+static uint64_t checksum(tiny_bits_unpacker *unpacker) {
+    tiny_bits_value value;
+    enum tiny_bits_type type;
+    uint64_t sum = 0;
+    while ((type = unpack_value(unpacker, &value)) != TINY_BITS_FINISHED && type != TINY_BITS_ERROR) {
+        if (type == TINY_BITS_STR) sum += value.str_blob_val.length;
+        else if (type == TINY_BITS_DOUBLE) sum += (uint64_t)value.double_val;
+        else if (type != TINY_BITS_SEP) sum++;
+    }
+    return sum;
+}
+
+static int checksum_frame(void *context, tiny_bits_unpacker *unpacker, size_t frame) {
+    ((uint64_t *)context)[frame] = checksum(unpacker);
+    return 1;
+}
+
+int main() {
+    tiny_bits_packer *packer = tiny_bits_packer_create(1 << 20, TB_FEATURE_STRING_DEDUPE | TB_FEATURE_COMPRESS_FLOATS);
+    for (int i = 0; i < MESSAGES; i++) {
+        if (i) {
+            pack_separator(packer);
+            pack_strings_reset(packer); // messages decode on their own
+        }
+        pack_message(packer, i);
+    }
+    const unsigned char *buffer = packer->buffer;
+    size_t size = packer->current_pos;
+    tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+    tiny_bits_frame_index *index = tiny_bits_frame_index_create();
+    uint64_t *sums = (uint64_t *)calloc(MESSAGES, sizeof(uint64_t));
+    struct timeval start, end;
+    long best;
+
+    printf("%d messages, %.1f MB\n", MESSAGES, size / 1e6);
+    uint64_t expected = 0;
+    best = -1;
+    for (int r = 0; r < ROUNDS; r++) {
+        gettimeofday(&start, NULL);
+        tiny_bits_unpacker_set_buffer(unpacker, buffer, size);
+        expected = checksum(unpacker);
+        gettimeofday(&end, NULL);
+        if (best < 0 || get_time_diff(&start, &end) < best) best = get_time_diff(&start, &end);
+    }
+    printf("%-24s %8.2f ms %8.0f MB/s\n", "sequential decode", best / 1e3, size / (double)best);
+
+    best = -1;
+    for (int r = 0; r < ROUNDS; r++) {
+        gettimeofday(&start, NULL);
+        if (!tiny_bits_frame_index_build(index, buffer, size, NULL)) {
+            fprintf(stderr, "index failed\n");
+            return 1;
+        }
+        gettimeofday(&end, NULL);
+        if (best < 0 || get_time_diff(&start, &end) < best) best = get_time_diff(&start, &end);
+    }
+    printf("%-24s %8.2f ms %8.0f MB/s (%zu frames)\n", "frame index", best / 1e3, size / (double)best, index->count);
+
+    unsigned int counts[] = { 1, 2, 4, 8, 0 };
+    for (int c = 0; c < 5; c++) {
+        char name[32];
+        snprintf(name, sizeof name, counts[c] ? "parallel, %u threads" : "parallel, all cores", counts[c]);
+        best = -1;
+        for (int r = 0; r < ROUNDS; r++) {
+            gettimeofday(&start, NULL);
+            tiny_bits_decode_frames(index, buffer, NULL, counts[c], checksum_frame, sums);
+            gettimeofday(&end, NULL);
+            if (best < 0 || get_time_diff(&start, &end) < best) best = get_time_diff(&start, &end);
+        }
+        uint64_t total = 0;
+        for (size_t i = 0; i < index->count; i++) total += sums[i];
+        if (total != expected) fprintf(stderr, "%s: checksums differ\n", name);
+        printf("%-24s %8.2f ms %8.0f MB/s\n", name, best / 1e3, size / (double)best);
+    }
+
+    free(sums);
+    tiny_bits_frame_index_destroy(index);
+    tiny_bits_unpacker_destroy(unpacker);
+    tiny_bits_packer_destroy(packer);
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <sys/time.h>
 #include "../dist/tinybits.h"
+#include "person.gen.h" // tinybits_gen -i ../dist/tinybits.h bench/person.tb bench/person.gen.h
 
 #define ITERATIONS 10000000 // Bump up since reset is faster
 
@@ -41,6 +42,64 @@ tiny_bits_packer *encode_structure(tiny_bits_packer *enc) {
     return enc;
 }
 
+// Same structure, one reserve then unchecked writes on a local cursor
+tiny_bits_packer *encode_structure_reserved(tiny_bits_packer *enc) {
+    uint8_t *c = tiny_bits_packer_reserve(enc, 256); // 24 values, 10 bytes each plus the string lengths
+    if (!c) return enc;
+    c = put_map(c, 3);
+    c = put_str(enc, c, "first_name", 11);
+    c = put_str(enc, c, "Homer", 5);
+    c = put_str(enc, c, "last_name", 10);
+    c = put_str(enc, c, "Simpson", 7);
+    c = put_str(enc, c, "children", 8);
+    c = put_arr(c, 3);
+    c = put_str(enc, c, "first_name", 11);
+    c = put_str(enc, c, "Bart", 4);
+    c = put_str(enc, c, "last_name", 10);
+    c = put_str(enc, c, "Simpson", 7);
+    c = put_str(enc, c, "children", 8);
+    c = put_arr(c, 0);
+    c = put_str(enc, c, "first_name", 11);
+    c = put_str(enc, c, "Lisa", 4);
+    c = put_str(enc, c, "last_name", 10);
+    c = put_str(enc, c, "Simpson", 7);
+    c = put_str(enc, c, "children", 8);
+    c = put_arr(c, 0);
+    c = put_str(enc, c, "first_name", 11);
+    c = put_str(enc, c, "Maggie", 6);
+    c = put_str(enc, c, "last_name", 10);
+    c = put_str(enc, c, "Simpson", 7);
+    c = put_str(enc, c, "children", 8);
+    c = put_arr(c, 0);
+    tiny_bits_packer_commit(enc, c);
+    return enc;
+}
+
+// Same structure as a generated person
+static person children[3] = {
+    { { "Bart", 4 }, { "Simpson", 7 }, NULL, 0 },
+    { { "Lisa", 4 }, { "Simpson", 7 }, NULL, 0 },
+    { { "Maggie", 6 }, { "Simpson", 7 }, NULL, 0 },
+};
+static person homer = { { "Homer", 5 }, { "Simpson", 7 }, children, 3 };
+
+// Times count runs of encode into enc, in ns per run
+static double time_encode(tiny_bits_packer *enc, tiny_bits_packer *(*encode)(tiny_bits_packer *)) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < ITERATIONS; i++) {
+        tiny_bits_packer_reset(enc);
+        encode(enc);
+    }
+    gettimeofday(&end, NULL);
+    return (double)get_time_diff(&start, &end) * 1000.0 / ITERATIONS;
+}
+
+tiny_bits_packer *encode_generated(tiny_bits_packer *enc) {
+    person_pack(enc, &homer);
+    return enc;
+}
+
 // Decode with get_data (copy mode)
 void decode_copy(tiny_bits_unpacker *dec) {
     tiny_bits_value val;
@@ -64,7 +123,7 @@ void decode_copy(tiny_bits_unpacker *dec) {
 
 int main() {
     struct timeval start, end;
-    long encode_time = 0, decode_time = 0;
+    long encode_time = 0, reserved_time = 0, decode_time = 0;
 
     uint8_t features = TB_FEATURE_STRING_DEDUPE | TB_FEATURE_COMPRESS_FLOATS;
     tiny_bits_packer *enc = tiny_bits_packer_create(256, features);
@@ -93,6 +152,19 @@ int main() {
     encode_time = get_time_diff(&start, &end);
     printf("Encoding: %ld us (%f ns/iter)\n", encode_time, (double)encode_time * 1000.0 / ITERATIONS);
     printf("Encoded size: %ld bytes\n", enc->current_pos);
+
+    // Benchmark encoding with reserve and put_*()
+    size_t checked_size = enc->current_pos;
+    printf("Benchmarking reserved encoding (%d iterations)...\n", ITERATIONS);
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < ITERATIONS; i++) {
+        tiny_bits_packer_reset(enc);
+        encode_structure_reserved(enc);
+    }
+    gettimeofday(&end, NULL);
+    reserved_time = get_time_diff(&start, &end);
+    printf("Encoding (reserved): %ld us (%f ns/iter)\n", reserved_time, (double)reserved_time * 1000.0 / ITERATIONS);
+    if (enc->current_pos != checked_size) fprintf(stderr, "Reserved encoding size mismatch\n");
     // Benchmark decode with get_data (copy)
     printf("Benchmarking decode with get_data (%d iterations)...\n", ITERATIONS);
     gettimeofday(&start, NULL);
@@ -104,14 +176,44 @@ int main() {
     decode_time = get_time_diff(&start, &end);
     printf("Decode (copy): %ld us (%f ns/iter)\n", decode_time, (double)decode_time * 1000.0 / ITERATIONS);
 
+    // Benchmark generated code, with and without dedupe
+    printf("Benchmarking generated code (%d iterations)...\n", ITERATIONS);
+    double generated_ns = time_encode(enc, encode_generated);
+    tiny_bits_packer *plain = tiny_bits_packer_create(256, 0);
+    double plain_ns = time_encode(plain, encode_structure);
+    double plain_generated_ns = time_encode(plain, encode_generated);
+    tiny_bits_arena *arena = tiny_bits_arena_create(0);
+    person decoded;
+    tiny_bits_packer_reset(enc);
+    person_pack(enc, &homer);
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < ITERATIONS; i++) {
+        tiny_bits_arena_reset(arena);
+        tiny_bits_unpacker_set_buffer(dec, enc->buffer, enc->current_pos);
+        if (person_unpack(dec, &decoded, &arena->allocator) != TINY_BITS_MAP) {
+            fprintf(stderr, "Generated decode error\n");
+            break;
+        }
+    }
+    gettimeofday(&end, NULL);
+    double generated_decode_ns = (double)get_time_diff(&start, &end) * 1000.0 / ITERATIONS;
+    if (decoded.children_count != 3 || decoded.children[2].first_name.length != 6) fprintf(stderr, "Generated decode mismatch\n");
+
     // Cleanup
+    tiny_bits_arena_destroy(arena);
+    tiny_bits_packer_destroy(plain);
     tiny_bits_unpacker_destroy(dec);
     tiny_bits_packer_destroy(enc);
 
     // Summary
     printf("\nSummary:\n");
     printf("Encoding: %f ns/iter\n", (double)encode_time * 1000.0 / ITERATIONS);
+    printf("Encoding (reserved): %f ns/iter\n", (double)reserved_time * 1000.0 / ITERATIONS);
     printf("Decoding: %f ns/iter\n", (double)decode_time * 1000.0 / ITERATIONS);
+    printf("Encoding (generated): %f ns/iter\n", generated_ns);
+    printf("Encoding (no dedupe): %f ns/iter\n", plain_ns);
+    printf("Encoding (generated, no dedupe): %f ns/iter\n", plain_generated_ns);
+    printf("Decoding (generated, into a person): %f ns/iter\n", generated_decode_ns);
 
     return 0;
 }
@@ -0,0 +1,219 @@
+// Generated by tinybits_gen from bench/person.tb, do not edit
+#ifndef TINY_BITS_GEN_PERSON_H
+#define TINY_BITS_GEN_PERSON_H
+
+#include "../dist/tinybits.h"
+
+#ifndef TINY_BITS_GENERATED
+#define TINY_BITS_GENERATED
+
+#ifndef TB_GEN_MAX_PACKED
+#define TB_GEN_MAX_PACKED (1 << 24) // most elements unpacked from a packed array, they may take no bytes at all
+#endif
+
+// A string or blob field, pointing into the buffer once unpacked
+typedef struct tiny_bits_bytes {
+    const char *data;
+    size_t length;
+} tiny_bits_bytes;
+
+// Index of the field named by key, the one expected next first (fields mostly come in schema order), -1 if unknown
+static inline int _tb_gen_field(const tiny_bits_value *key, const char *const *names, const uint8_t *lengths, int count,
+                                int expected) {
+    size_t length = key->str_blob_val.length;
+    if (expected < count && length == lengths[expected] && !memcmp(key->str_blob_val.data, names[expected], length)) {
+        return expected;
+    }
+    for (int i = 0; i < count; i++) {
+        if (length == lengths[i] && !memcmp(key->str_blob_val.data, names[i], length)) return i;
+    }
+    return -1;
+}
+
+// Writes a key, as pack_str() would: bytes encoded beforehand unless the packer may send a reference instead
+static inline uint8_t *_tb_gen_put_key(tiny_bits_packer *encoder, uint8_t *cursor, const char *encoded, size_t size,
+                                       const char *name, uint32_t length) {
+    if (!(encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->dictionary.next_id) {
+        memcpy(cursor, encoded, size);
+        return cursor + size;
+    }
+    return put_str(encoder, cursor, name, length);
+}
+
+// Zeroed room for count elements, not NULL for none either
+static inline void *_tb_gen_array(size_t count, size_t size, const tiny_bits_allocator *allocator) {
+    if (!count) count = 1;
+    return _tb_calloc(allocator, count, size);
+}
+
+// A value of the wrong type, or cut short (the input may go on, for an incremental unpacker)
+static inline enum tiny_bits_type _tb_gen_mismatch(enum tiny_bits_type type) {
+    return type == TINY_BITS_NEED_MORE || type == TINY_BITS_FINISHED ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;
+}
+
+#endif // TINY_BITS_GENERATED
+
+typedef struct person person;
+
+struct person {
+    tiny_bits_bytes first_name;
+    tiny_bits_bytes last_name;
+    person *children;
+    size_t children_count;
+};
+
+static inline size_t _person_bound(const person *value);
+static inline uint8_t *_person_put(tiny_bits_packer *encoder, uint8_t *cursor, const person *value);
+static inline void _person_release(person *value, const tiny_bits_allocator *allocator);
+static inline enum tiny_bits_type _person_read(tiny_bits_unpacker *decoder, size_t length, person *value,
+                                               const tiny_bits_allocator *allocator, uint32_t depth);
+
+static const char *const _person_names[] = { "first_name", "last_name", "children" };
+static const uint8_t _person_lengths[] = { 10, 9, 8 };
+
+static inline size_t _person_bound(const person *value) {
+    size_t size = 10;
+    size += 20;
+    size += 10 + value->first_name.length;
+    size += 19;
+    size += 10 + value->last_name.length;
+    size += 18;
+    size += 10;
+    for (size_t i = 0; i < value->children_count; i++) {
+        size += _person_bound(&value->children[i]);
+    }
+    return size;
+}
+
+static inline uint8_t *_person_put(tiny_bits_packer *encoder, uint8_t *cursor, const person *value) {
+    cursor = put_map(cursor, 3);
+    cursor = _tb_gen_put_key(encoder, cursor, "\x4a" "first_name", 11, "first_name", 10);
+    cursor = put_str(encoder, cursor, value->first_name.data ? value->first_name.data : "", (uint32_t)value->first_name.length);
+    cursor = _tb_gen_put_key(encoder, cursor, "\x49" "last_name", 10, "last_name", 9);
+    cursor = put_str(encoder, cursor, value->last_name.data ? value->last_name.data : "", (uint32_t)value->last_name.length);
+    cursor = _tb_gen_put_key(encoder, cursor, "\x48" "children", 9, "children", 8);
+    cursor = put_arr(cursor, value->children_count);
+    for (size_t i = 0; i < value->children_count; i++) {
+        cursor = _person_put(encoder, cursor, &value->children[i]);
+    }
+    return cursor;
+}
+
+static inline void _person_release(person *value, const tiny_bits_allocator *allocator) {
+    for (size_t i = 0; i < value->children_count; i++) _person_release(&value->children[i], allocator);
+    _tb_free(allocator, value->children);
+}
+
+static inline enum tiny_bits_type _person_read(tiny_bits_unpacker *decoder, size_t length, person *value,
+                                               const tiny_bits_allocator *allocator, uint32_t depth) {
+    if (depth >= TB_MAX_DEPTH) return TINY_BITS_ERROR;
+    tiny_bits_value key, item;
+    enum tiny_bits_type type;
+    int expected = 0;
+    for (size_t pair = 0; pair < length; pair++) {
+        type = unpack_value(decoder, &key);
+        if (type != TINY_BITS_STR) return _tb_gen_mismatch(type);
+        int field = _tb_gen_field(&key, _person_names, _person_lengths, 3, expected);
+        if (field < 0) {
+            // not in the schema (a newer one perhaps)
+            type = tiny_bits_skip_value(decoder);
+            if (type == TINY_BITS_ERROR || type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) {
+                return _tb_gen_mismatch(type);
+            }
+            continue;
+        }
+        expected = field + 1;
+        type = unpack_value(decoder, &item);
+        if (type == TINY_BITS_NULL) continue;
+        switch (field) {
+        case 0: {
+            if (type != TINY_BITS_STR) return _tb_gen_mismatch(type);
+            value->first_name.data = item.str_blob_val.data;
+            value->first_name.length = item.str_blob_val.length;
+            break;
+        }
+        case 1: {
+            if (type != TINY_BITS_STR) return _tb_gen_mismatch(type);
+            value->last_name.data = item.str_blob_val.data;
+            value->last_name.length = item.str_blob_val.length;
+            break;
+        }
+        case 2: {
+            if (value->children) return TINY_BITS_ERROR; // twice in the map
+            if (type != TINY_BITS_ARRAY) return _tb_gen_mismatch(type);
+            // every element takes a byte at least
+            if (item.length > decoder->size - decoder->current_pos) return TINY_BITS_NEED_MORE;
+            value->children = (person *)_tb_gen_array(item.length, sizeof(person), allocator);
+            if (!value->children) return TINY_BITS_ERROR;
+            value->children_count = item.length;
+            for (size_t i = 0; i < value->children_count; i++) {
+                type = unpack_value(decoder, &item);
+                if (type != TINY_BITS_MAP) return _tb_gen_mismatch(type);
+                type = _person_read(decoder, item.length, &value->children[i], allocator, depth + 1);
+                if (type != TINY_BITS_MAP) return type;
+            }
+            break;
+        }
+        }
+    }
+    return TINY_BITS_MAP;
+}
+
+/**
+ * @brief Packs a person as a map of its fields
+ *
+ * @param encoder The packer instance
+ * @param value The person
+ * @return Number of bytes written, or 0 on error
+ */
+static inline int person_pack(tiny_bits_packer *encoder, const person *value) {
+    if (!encoder || !value) return 0;
+    uint8_t *cursor = tiny_bits_packer_reserve(encoder, _person_bound(value));
+    if (!cursor) return 0;
+    return tiny_bits_packer_commit(encoder, _person_put(encoder, cursor, value));
+}
+
+/**
+ * @brief Unpacks the next value, a map of the fields of a person
+ *
+ * @param decoder The unpacker instance
+ * @param[out] value Set to the fields found, the others are zero
+ * @param allocator Where arrays come from, NULL for malloc()
+ * @return TINY_BITS_MAP, TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_NEED_MORE for an incremental
+ * unpacker (left before the map), or TINY_BITS_ERROR on malformed input or a field of the wrong type
+ *
+ * @note Strings and blobs point into the buffer. Free arrays with person_release(), unless allocator is an arena.
+ */
+static inline enum tiny_bits_type person_unpack(tiny_bits_unpacker *decoder, person *value, const tiny_bits_allocator *allocator) {
+    if (!decoder || !value) return TINY_BITS_ERROR;
+    memset(value, 0, sizeof(person));
+    tiny_bits_unpacker_mark mark;
+    tiny_bits_value header;
+    enum tiny_bits_type type;
+    do {
+        // an incremental unpacker waits for all of the map
+        if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+        _unpacker_mark(decoder, &mark);
+    } while ((type = unpack_value(decoder, &header)) == TINY_BITS_SEP);
+    if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE || type == TINY_BITS_ERROR) return type;
+    if (type != TINY_BITS_MAP) return TINY_BITS_ERROR;
+    type = _person_read(decoder, header.length, value, allocator, 0);
+    if (type == TINY_BITS_MAP) return type;
+    _person_release(value, allocator);
+    memset(value, 0, sizeof(person));
+    return type == TINY_BITS_NEED_MORE ? _unpacker_rewind(decoder, &mark) : TINY_BITS_ERROR;
+}
+
+/**
+ * @brief Frees the arrays of a person unpacked with a malloc() style allocator
+ *
+ * @param value The person
+ * @param allocator The allocator given to person_unpack()
+ */
+static inline void person_release(person *value, const tiny_bits_allocator *allocator) {
+    if (!value) return;
+    _person_release(value, allocator);
+    memset(value, 0, sizeof(person));
+}
+
+#endif // TINY_BITS_GEN_PERSON_H
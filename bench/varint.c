@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../dist/tinybits.h"
+
+// Varint codec microbenchmark: encode and decode cost per value distribution
+// Build with: gcc -O2 bench/varint.c -o varint_bench
+
+#define ROUNDS 2000
+#define COUNT 4096
+#define REPEATS 7 // each codec is timed this many times, in alternating order, and the fastest run is kept
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Timing helper
+static inline long get_time_diff(struct timeval *start, struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+// The codec as it was before, one branch per prefix and byte by byte
+static inline int encode_ladder(uint64_t value, uint8_t *buffer) {
+    if (value <= 240) {
+        buffer[0] = (uint8_t)value;
+        return 1;
+    } else if (value < 2288) {
+        value -= 240;
+        buffer[0] = (uint8_t)(241 + (value / 256));
+        buffer[1] = (uint8_t)(value % 256);
+        return 2;
+    } else if (value <= 67823) {
+        value -= 2288;
+        buffer[0] = 249;
+        buffer[1] = (uint8_t)(value / 256);
+        buffer[2] = (uint8_t)(value % 256);
+        return 3;
+    }
+    int bytes = value < (1ULL << 24) ? 3 : value < (1ULL << 32) ? 4 : value < (1ULL << 40) ? 5
+              : value < (1ULL << 48) ? 6 : value < (1ULL << 56) ? 7 : 8;
+    buffer[0] = (uint8_t)(247 + bytes);
+    for (int i = 0; i < bytes; i++) buffer[1 + i] = (uint8_t)(value >> (8 * (bytes - 1 - i)));
+    return bytes + 1;
+}
+
+static inline int8_t decode_ladder(const uint8_t *buffer, size_t size, size_t pos, uint64_t *value) {
+    if (pos >= size) return 0;
+    uint8_t prefix = buffer[pos];
+    if (prefix <= 240) {
+        *value = prefix;
+        return 1;
+    } else if (prefix <= 248) {
+        if (pos + 1 >= size) return 0;
+        *value = 240 + 256 * (prefix - 241) + buffer[pos + 1];
+        return 2;
+    } else if (prefix == 249) {
+        if (pos + 2 >= size) return 0;
+        *value = 2288 + 256 * buffer[pos + 1] + buffer[pos + 2];
+        return 3;
+    }
+    int bytes = prefix - 247;
+    if (pos + bytes >= size) return 0;
+    uint64_t result = 0;
+    for (int i = 1; i <= bytes; i++) result = (result << 8) | buffer[pos + i];
+    *value = result;
+    return (int8_t)(bytes + 1);
+}
+
+// Each codec runs in its own loop, so that they don't share branches. Codec 2 is the ladder again, in a loop of
+// its own: how far apart the two ladder columns are is how much code placement alone moves the numbers.
+static TB_NOINLINE size_t encode_all(int codec, const uint64_t *values, uint8_t *buffer) {
+    size_t size = 0;
+    if (codec == 1) {
+        for (int i = 0; i < COUNT; i++) size += encode_varint(values[i], buffer + size);
+    } else if (codec == 2) {
+        for (int i = 0; i < COUNT; i++) size += encode_ladder(values[i], buffer + size);
+    } else {
+        for (int i = 0; i < COUNT; i++) size += encode_ladder(values[i], buffer + size);
+    }
+    return size;
+}
+
+static TB_NOINLINE uint64_t decode_all(int codec, const uint8_t *buffer, size_t size) {
+    uint64_t sum = 0, value;
+    size_t pos = 0;
+    if (codec == 1) {
+        for (int i = 0; i < COUNT; i++) {
+            int8_t read = decode_varint(buffer, size, pos, &value);
+            if (read == 0) return 0;
+            pos += read;
+            sum += value;
+        }
+    } else if (codec == 2) {
+        for (int i = 0; i < COUNT; i++) {
+            int8_t read = decode_ladder(buffer, size, pos, &value);
+            if (read == 0) return 0;
+            pos += read;
+            sum += value;
+        }
+    } else {
+        for (int i = 0; i < COUNT; i++) {
+            int8_t read = decode_ladder(buffer, size, pos, &value);
+            if (read == 0) return 0;
+            pos += read;
+            sum += value;
+        }
+    }
+    return sum;
+}
+
+static uint64_t next_value(int kind) {
+    switch (kind) {
+    case 0: return next_random() % 241;                          // 1 byte
+    case 1: return 241 + next_random() % (2288 - 241);           // 2 bytes
+    case 2: return 2288 + next_random() % (67824 - 2288);        // 3 bytes
+    case 3: return 67824 + next_random() % ((1ULL << 32) - 67824); // 4 to 5 bytes
+    case 4: return next_random() | (1ULL << 63);                 // 9 bytes
+    case 5: return next_random() >> (next_random() % 64);        // any width
+    default: {
+        // lengths and ids: mostly small, sometimes large
+        uint64_t r = next_random();
+        return (r & 7) ? r % 200 : (r >> 8) % 100000;
+    }
+    }
+}
+
+int main() {
+    static uint64_t values[COUNT];
+    static uint8_t buffer[COUNT * 9 + 16];
+    const char *names[] = { "1 byte", "2 bytes", "3 bytes", "4-5 bytes", "9 bytes", "any width", "lengths" };
+    printf("%-12s %8s %10s %10s %10s %10s %10s %10s\n", "values", "bytes", "enc ladder", "(again)", "enc new",
+           "dec ladder", "(again)", "dec new");
+    for (int kind = 0; kind < 7; kind++) {
+        for (int i = 0; i < COUNT; i++) values[i] = next_value(kind);
+        struct timeval start, end;
+        size_t size = 0;
+        uint64_t check = 0;
+        double ns[6] = { 1e9, 1e9, 1e9, 1e9, 1e9, 1e9 };
+        // single runs on a busy machine vary by more than the codecs differ, whichever runs first included
+        for (int repeat = 0; repeat < REPEATS; repeat++) {
+            for (int i = 0; i < 3; i++) {
+                int codec = (i + repeat) % 3;
+                gettimeofday(&start, NULL);
+                for (int r = 0; r < ROUNDS; r++) size = encode_all(codec, values, buffer);
+                gettimeofday(&end, NULL);
+                double t = (double)get_time_diff(&start, &end) * 1000.0 / ((double)ROUNDS * COUNT);
+                if (t < ns[codec]) ns[codec] = t;
+            }
+            for (int i = 0; i < 3; i++) {
+                int codec = (i + repeat) % 3;
+                gettimeofday(&start, NULL);
+                for (int r = 0; r < ROUNDS; r++) check += decode_all(codec, buffer, size);
+                gettimeofday(&end, NULL);
+                double t = (double)get_time_diff(&start, &end) * 1000.0 / ((double)ROUNDS * COUNT);
+                if (t < ns[3 + codec]) ns[3 + codec] = t;
+            }
+        }
+        uint64_t expected = 0;
+        for (int i = 0; i < COUNT; i++) expected += values[i];
+        if (check != expected * 3 * ROUNDS * REPEATS) fprintf(stderr, "%s: decoded values differ\n", names[kind]);
+        printf("%-12s %8zu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", names[kind], size, ns[0], ns[2], ns[1],
+               ns[3], ns[5], ns[4]);
+    }
+    return 0;
+}
@@ -18,24 +18,74 @@ echo "#ifndef TINY_BITS_H" >> "$OUTPUT_FILE"
 echo "#define TINY_BITS_H" >> "$OUTPUT_FILE"
 echo "" >> "$OUTPUT_FILE"
 
-# Process common.h first (since it's included by others)
+# Only the include guards of each file are stripped, other conditionals are kept
+
+# Process allocator.h first (common.h and everything after it allocate through it)
+echo "/* Begin allocator.h */" >> "$OUTPUT_FILE"
+cat src/allocator.h | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End allocator.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process common.h (since it's included by others)
 echo "/* Begin common.h */" >> "$OUTPUT_FILE"
-cat src/common.h | sed '/^#ifndef/d' | sed '/^#define.*_H$/d' | sed '/^#endif/d' >> "$OUTPUT_FILE"
+cat src/common.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
 echo "/* End common.h */" >> "$OUTPUT_FILE"
 echo "" >> "$OUTPUT_FILE"
 
+# Process pool.h (used by packer.h)
+echo "/* Begin pool.h */" >> "$OUTPUT_FILE"
+cat src/pool.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End pool.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
 # Process packer.h
 echo "/* Begin packer.h */" >> "$OUTPUT_FILE"
-cat src/packer.h | grep -v "#include" | sed '/^#ifndef/d' | sed '/^#define.*_H/d' | sed '/^#endif/d' >> "$OUTPUT_FILE"
+cat src/packer.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
 echo "/* End packer.h */" >> "$OUTPUT_FILE"
 echo "" >> "$OUTPUT_FILE"
 
 # Process unpacker.h
 echo "/* Begin unpacker.h */" >> "$OUTPUT_FILE"
-cat src/unpacker.h | grep -v "#include" | sed '/^#ifndef/d' | sed '/^#define.*_H/d' | sed '/^#endif/d' >> "$OUTPUT_FILE"
+cat src/unpacker.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
 echo "/* End unpacker.h */" >> "$OUTPUT_FILE"
 echo "" >> "$OUTPUT_FILE"
 
+# Process dictionary.h (depends on both packer.h and unpacker.h)
+echo "/* Begin dictionary.h */" >> "$OUTPUT_FILE"
+cat src/dictionary.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End dictionary.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process query.h (depends on unpacker.h)
+echo "/* Begin query.h */" >> "$OUTPUT_FILE"
+cat src/query.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End query.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process document.h (depends on unpacker.h)
+echo "/* Begin document.h */" >> "$OUTPUT_FILE"
+cat src/document.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End document.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process walker.h (depends on unpacker.h)
+echo "/* Begin walker.h */" >> "$OUTPUT_FILE"
+cat src/walker.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End walker.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process parallel.h (depends on unpacker.h and dictionary.h)
+echo "/* Begin parallel.h */" >> "$OUTPUT_FILE"
+cat src/parallel.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End parallel.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
+# Process validator.h (depends on unpacker.h and dictionary.h)
+echo "/* Begin validator.h */" >> "$OUTPUT_FILE"
+cat src/validator.h | grep -v '#include "' | sed '/^#ifndef TINY_BITS_.*_H$/d' | sed '/^#define TINY_BITS_.*_H$/d' | sed '/^#endif.*TINY_BITS_.*_H$/d' >> "$OUTPUT_FILE"
+echo "/* End validator.h */" >> "$OUTPUT_FILE"
+echo "" >> "$OUTPUT_FILE"
+
 # End main include guard
 echo "#endif /* TINY_BIS_H */" >> "$OUTPUT_FILE"
 
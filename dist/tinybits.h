@@ -1,11 +1,208 @@
 /**
  * TinyBits Amalgamated Header
- * Generated on: Mon May 12 01:40:49 AM CEST 2025
+ * Generated on: Fri Oct 16 19:35:40 UTC 2026
  */
 
 #ifndef TINY_BITS_H
 #define TINY_BITS_H
 
+/* Begin allocator.h */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TB_ARENA_BLOCK_SIZE 65536 // default size of the blocks an arena carves allocations from
+#define TB_ARENA_ALIGN 16
+
+/**
+ * Memory functions used by a packer or unpacker for everything it allocates (buffers, dedupe tables, strings).
+ * They follow malloc(), realloc() and free(), with the context passed first. A NULL allocator means the
+ * standard ones.
+ */
+typedef struct tiny_bits_allocator {
+    void *(*alloc)(void *context, size_t size);
+    void *(*realloc)(void *context, void *ptr, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+} tiny_bits_allocator;
+
+static inline void *_tb_alloc(const tiny_bits_allocator *allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->context, size) : malloc(size);
+}
+
+static inline void *_tb_calloc(const tiny_bits_allocator *allocator, size_t count, size_t size) {
+    if (!allocator) return calloc(count, size);
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = allocator->alloc(allocator->context, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+static inline void *_tb_realloc(const tiny_bits_allocator *allocator, void *ptr, size_t size) {
+    return allocator ? allocator->realloc(allocator->context, ptr, size) : realloc(ptr, size);
+}
+
+static inline void _tb_free(const tiny_bits_allocator *allocator, void *ptr) {
+    if (allocator) {
+        if (ptr) allocator->free(allocator->context, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+typedef struct tiny_bits_arena_block {
+    struct tiny_bits_arena_block *next;
+    size_t used;
+    size_t size;
+    size_t padding;         // keeps data 16 byte aligned
+    unsigned char data[];
+} tiny_bits_arena_block;
+
+/**
+ * A region allocator: allocations are carved from large blocks and only released all at once, by
+ * tiny_bits_arena_reset() or tiny_bits_arena_destroy(). Use its allocator member with
+ * tiny_bits_packer_create_with() and tiny_bits_unpacker_create_with(). Not thread safe.
+ */
+typedef struct tiny_bits_arena {
+    tiny_bits_allocator allocator; // allocates from this arena
+    tiny_bits_arena_block *blocks; // newest first, allocations come from the first one
+    tiny_bits_arena_block *spare;  // blocks emptied by tiny_bits_arena_reset(), reused before allocating new ones
+    size_t block_size;
+    size_t allocated;              // bytes handed out since the last reset
+} tiny_bits_arena;
+
+// Each allocation is preceded by its size, realloc() needs it to copy
+typedef struct tiny_bits_arena_header {
+    size_t size;
+    size_t padding;
+} tiny_bits_arena_header;
+
+static inline void *_tb_arena_alloc(void *context, size_t size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)context;
+    size_t needed = sizeof(tiny_bits_arena_header) + ((size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+    if (needed < size) return NULL; // overflow
+    tiny_bits_arena_block *block = arena->blocks;
+    if (!block || block->used + needed > block->size) {
+        // a block emptied by a reset comes first, otherwise a new one (larger for large allocations)
+        tiny_bits_arena_block *fresh = arena->spare;
+        if (fresh && needed <= fresh->size) {
+            arena->spare = fresh->next;
+        } else {
+            size_t block_size = needed > arena->block_size ? needed : arena->block_size;
+            fresh = (tiny_bits_arena_block *)malloc(sizeof(tiny_bits_arena_block) + block_size);
+            if (!fresh) return NULL;
+            fresh->size = block_size;
+        }
+        fresh->next = block;
+        fresh->used = 0;
+        block = fresh;
+        arena->blocks = block;
+    }
+    tiny_bits_arena_header *header = (tiny_bits_arena_header *)(block->data + block->used);
+    header->size = size;
+    block->used += needed;
+    arena->allocated += size;
+    return header + 1;
+}
+
+static inline void *_tb_arena_realloc(void *context, void *ptr, size_t size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)context;
+    if (!ptr) return _tb_arena_alloc(context, size);
+    tiny_bits_arena_header *header = (tiny_bits_arena_header *)ptr - 1;
+    size_t old_size = header->size;
+    if (size <= old_size) {
+        header->size = size;
+        return ptr;
+    }
+    tiny_bits_arena_block *block = arena->blocks;
+    unsigned char *start = (unsigned char *)ptr;
+    if (start > block->data && start < block->data + block->used) {
+        size_t offset = (size_t)(start - block->data);
+        size_t old_end = offset + ((old_size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+        size_t new_end = offset + ((size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+        if (old_end == block->used && new_end <= block->size && new_end > offset) {
+            // the latest allocation grows in place
+            block->used = new_end;
+            arena->allocated += size - old_size;
+            header->size = size;
+            return ptr;
+        }
+    }
+    void *copy = _tb_arena_alloc(context, size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, old_size);
+    return copy;
+}
+
+static inline void _tb_arena_free(void *context, void *ptr) {
+    (void)context;
+    (void)ptr; // released with the whole arena
+}
+
+/**
+ * @brief allocates and initializes a new arena
+ *
+ * @param block_size Size of the blocks allocations are carved from, 0 for TB_ARENA_BLOCK_SIZE
+ * @return pointer to new arena instance
+ *
+ * @note the returned arena object must be freed using tiny_bits_arena_destroy()
+ */
+static inline tiny_bits_arena *tiny_bits_arena_create(size_t block_size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)malloc(sizeof(tiny_bits_arena));
+    if (!arena) return NULL;
+    arena->allocator.alloc = _tb_arena_alloc;
+    arena->allocator.realloc = _tb_arena_realloc;
+    arena->allocator.free = _tb_arena_free;
+    arena->allocator.context = arena;
+    arena->blocks = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size ? block_size : TB_ARENA_BLOCK_SIZE;
+    arena->allocated = 0;
+    return arena;
+}
+
+/**
+ * @brief Releases everything allocated from the arena at once
+ *
+ * @param arena The arena instance
+ *
+ * @note Packers and unpackers created with the arena must not be used afterwards (there is no need to destroy
+ * them). Blocks of the default size are kept for reuse, larger ones are freed.
+ */
+static inline void tiny_bits_arena_reset(tiny_bits_arena *arena) {
+    if (!arena) return;
+    while (arena->blocks) {
+        tiny_bits_arena_block *block = arena->blocks;
+        arena->blocks = block->next;
+        if (block->size > arena->block_size) {
+            free(block);
+        } else {
+            block->next = arena->spare;
+            arena->spare = block;
+        }
+    }
+    arena->allocated = 0;
+}
+
+/**
+ * @brief Deallocate the arena object and everything allocated from it
+ *
+ * @param arena The arena instance
+ */
+static inline void tiny_bits_arena_destroy(tiny_bits_arena *arena) {
+    if (!arena) return;
+    tiny_bits_arena_reset(arena);
+    while (arena->spare) {
+        tiny_bits_arena_block *next = arena->spare->next;
+        free(arena->spare);
+        arena->spare = next;
+    }
+    free(arena);
+}
+
+/* End allocator.h */
+
 /* Begin common.h */
 
 #include <stdint.h>
@@ -14,11 +211,42 @@
 #include <stddef.h> // for size_t
 #include <math.h>
 #include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Keeps rarely taken paths (allocation, uncommon values) out of the functions they are called from
+#if defined(__GNUC__)
+#define TB_NOINLINE __attribute__((noinline))
+#else
+#define TB_NOINLINE
+#endif
 
-#define TB_HASH_SIZE 128
-#define TB_HASH_CACHE_SIZE 256
+// Branch hint for the same uncommon values
+#if defined(__GNUC__)
+#define TB_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define TB_UNLIKELY(x) (x)
+#endif
+
+// Walks specialized for a visitor known at compile time (see TINY_BITS_WALKER()) need the loop inlined
+#if defined(__GNUC__)
+#define TB_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define TB_ALWAYS_INLINE inline
+#endif
+
+#define TB_HASH_SIZE 128        // initial number of bins, always a power of two
+#define TB_HASH_CACHE_SIZE 256  // initial number of entries, also the default dedupe limit
 #define MAX_BYTES 9
 #define TB_DDP_STR_LEN_MAX 128
+#define TB_DICT_MAX_SIZE 65536
+#define TB_DEFERRED_HEADER_SIZE 6      // container header reserved by pack_arr_begin()/pack_map_begin()
+#define TB_DEFERRED_SHIFT_LIMIT 65536  // longest body moved back to shrink that header on end
+#define TB_REF_MIN_SIZE 256            // shorter payloads given to pack_blob_ref()/pack_str_ref() are copied
+#ifndef TB_MAX_DEPTH
+#define TB_MAX_DEPTH 64                // deepest nesting tracked by tiny_bits_read_value() and tiny_bits_skip_value()
+#endif
 
 // main tags
 #define TB_INT_TAG 0x80     // +/- integer
@@ -50,11 +278,31 @@
 #define TB_MAP_LEN 0x0F     // max embedded map length
 #define TB_ARR_LEN 0x07     // max embedded array length
 
-// native extensions TR_NXT_TAG
+// native extensions TR_NXT_TAG (second byte after TB_NXT_TAG)
+#define TB_NXT_RST 0x00     // reset deduplicated strings, following strings are numbered from scratch
+#define TB_NXT_PKI 0x01     // packed integer array (frame of reference + bit packing)
+#define TB_NXT_PKD 0x02     // packed double array (decimal scale or raw bits, then as TB_NXT_PKI)
+
+#define TB_PACKED_RAW 0xFF  // packed double array scale for values stored as their IEEE 754 bits
 
 // Feature flags (from encoder)
 #define TB_FEATURE_STRING_DEDUPE    0x01
 #define TB_FEATURE_COMPRESS_FLOATS  0x02
+#define TB_FEATURE_NARROW_FLOATS    0x04
+
+// String hash functions for the dedupe tables, select one by defining TB_HASH_ALGO
+// before including tinybits. The hash never goes on the wire, so it is safe to change.
+#define TB_HASH_ALGO_FAST           0 // length, first two and last bytes, collides a lot on real keys
+#define TB_HASH_ALGO_WY             1 // wyhash style multiply-mix of the whole string
+#define TB_HASH_ALGO_CRC32C         2 // SSE4.2 crc32 instruction, falls back to TB_HASH_ALGO_WY without it
+
+#ifndef TB_HASH_ALGO
+#define TB_HASH_ALGO TB_HASH_ALGO_WY
+#endif
+
+// Dedupe table replacement policies, once the table reaches its limit
+#define TB_DEDUPE_POLICY_STOP       0x00 // stop registering new strings
+#define TB_DEDUPE_POLICY_LRU        0x01 // evict the least recently used string (clock approximation)
 
 static double powers[] = {
     1.0, 
@@ -73,18 +321,26 @@ static double powers[] = {
 };
 
 typedef struct HashEntry {
-    uint32_t hash;          // 32-bit hash from fast_hash_32
+    uint32_t hash;          // 32-bit hash from string_hash_32
     uint32_t length;
     uint32_t offset;
-    uint32_t next_index;
+    uint32_t next_index;    // 1-based index of the next entry in the same bin, 0 ends the chain
+    uint32_t id;            // reference id of the string
+    uint32_t referenced;    // set on every hit, cleared by the clock hand (TB_DEDUPE_POLICY_LRU)
 } HashEntry;
 
 typedef struct HashTable {
-    HashEntry* cache; // HASH_SIZE is 2048, use directly or define HASH_SIZE in header
-    uint32_t next_id;
-    uint32_t cache_size;
-    uint32_t cache_pos;
-    uint8_t bins[TB_HASH_SIZE];
+    HashEntry* cache;       // entries, grown up to cache_limit
+    uint32_t next_id;       // id of the next registered string
+    uint32_t cache_size;    // allocated entries
+    uint32_t cache_pos;     // used entries
+    uint32_t cache_limit;   // maximum number of entries
+    uint32_t *bins;         // 1-based entry indexes, bin_mask + 1 of them
+    uint32_t bin_mask;
+    uint32_t bin_shift;     // 32 - log2(number of bins)
+    uint32_t clock_hand;    // next eviction candidate
+    uint8_t policy;         // TB_DEDUPE_POLICY_*
+    const tiny_bits_allocator *allocator; // NULL for malloc()
 } HashTable;
 
 static inline uint32_t fast_hash_32(const char* str, uint16_t len) {
@@ -97,83 +353,235 @@ static inline uint32_t fast_hash_32(const char* str, uint16_t len) {
     return hash;
 }
 
+static inline uint64_t _read_u64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t _read_u32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 64x64 -> 128 bit multiply, folded
+static inline uint64_t _mum(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    // from 32 bit halves, for compilers without a 128 bit type (same result)
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    uint64_t lo = (cross << 32) | (uint32_t)lo_lo;
+    return lo ^ hi;
+#endif
+}
+
+static inline uint32_t wy_hash_32(const char* str, uint32_t len) {
+    const uint64_t s0 = 0xa0761d6478bd642full;
+    const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    uint64_t seed = s0 ^ len;
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two (possibly overlapping) pairs of 4 byte reads cover the whole string
+            uint32_t mid = (len >> 3) << 2;
+            a = (_read_u32(str) << 32) | _read_u32(str + mid);
+            b = (_read_u32(str + len - 4) << 32) | _read_u32(str + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)(unsigned char)str[0] << 16) | ((uint64_t)(unsigned char)str[len >> 1] << 8) 
+                | (unsigned char)str[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        uint32_t i = len;
+        const char *p = str;
+        while (i > 16) {
+            seed = _mum(_read_u64(p) ^ s1, _read_u64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = _read_u64(str + len - 16);
+        b = _read_u64(str + len - 8);
+    }
+    return (uint32_t)_mum(s1 ^ len, _mum(a ^ s1, b ^ seed));
+}
+
+#if defined(__SSE4_2__)
+static inline uint32_t crc32c_hash_32(const char* str, uint32_t len) {
+    uint64_t crc = 0xFFFFFFFFu ^ len;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) crc = _mm_crc32_u64(crc, _read_u64(str + i));
+    if (i + 4 <= len) {
+        crc = _mm_crc32_u32((uint32_t)crc, (uint32_t)_read_u32(str + i));
+        i += 4;
+    }
+    for (; i < len; i++) crc = _mm_crc32_u8((uint32_t)crc, (unsigned char)str[i]);
+    return (uint32_t)crc;
+}
+#else
+static inline uint32_t crc32c_hash_32(const char* str, uint32_t len) {
+    return wy_hash_32(str, len);
+}
+#endif
+
+// The hash used by all the dedupe tables (packer, dictionary)
+static inline uint32_t string_hash_32(const char* str, uint32_t len) {
+#if TB_HASH_ALGO == TB_HASH_ALGO_FAST
+    return fast_hash_32(str, len);
+#elif TB_HASH_ALGO == TB_HASH_ALGO_CRC32C
+    return crc32c_hash_32(str, len);
+#else
+    return wy_hash_32(str, len);
+#endif
+}
+
+// Byte swaps, leading and trailing zeros (of a value other than 0) and set bits, with shifts where the compiler
+// has no builtin
+static inline uint32_t _tb_bswap32(uint32_t v) {
+#if defined(__GNUC__)
+    return __builtin_bswap32(v);
+#else
+    v = ((v & 0x00FF00FFu) << 8) | ((v >> 8) & 0x00FF00FFu);
+    return (v << 16) | (v >> 16);
+#endif
+}
+
+static inline uint64_t _tb_bswap64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_bswap64(v);
+#else
+    v = ((v & 0x00FF00FF00FF00FFull) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFull);
+    v = ((v & 0x0000FFFF0000FFFFull) << 16) | ((v >> 16) & 0x0000FFFF0000FFFFull);
+    return (v << 32) | (v >> 32);
+#endif
+}
+
+static inline int _tb_clz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+    if (!(v >> 32)) { n += 32; v <<= 32; }
+    if (!(v >> 48)) { n += 16; v <<= 16; }
+    if (!(v >> 56)) { n += 8; v <<= 8; }
+    if (!(v >> 60)) { n += 4; v <<= 4; }
+    if (!(v >> 62)) { n += 2; v <<= 2; }
+    return n + !(v >> 63);
+#endif
+}
+
+static inline int _tb_ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    if (!(v & 0xFFFFFFFFull)) { n += 32; v >>= 32; }
+    if (!(v & 0xFFFFull)) { n += 16; v >>= 16; }
+    if (!(v & 0xFFull)) { n += 8; v >>= 8; }
+    if (!(v & 0xFull)) { n += 4; v >>= 4; }
+    if (!(v & 0x3ull)) { n += 2; v >>= 2; }
+    return n + !(v & 1);
+#endif
+}
+
+static inline int _tb_popcount64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    v -= (v >> 1) & 0x5555555555555555ull;
+    v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (int)((v * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Big endian loads and stores, one unaligned access and a byte swap
+static inline uint64_t _load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void _store_be64(uint8_t *p, uint64_t v) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
+
+static inline void _store_be32(uint8_t *p, uint32_t v) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap32(v);
+#endif
+    memcpy(p, &v, 4);
+}
+
+/*
+ * Varints: a prefix byte, then
+ *   0-240    the value itself
+ *   241-248  one byte, value 240 + 256 * (prefix - 241) + byte
+ *   249      two bytes, value 2288 + big endian bytes
+ *   250-255  prefix - 247 (3 to 8) big endian bytes
+ */
+
+// Bytes (3 to 8) following prefixes 250-255 for a value over 67823
+static inline int _varint_long_bytes(uint64_t value) {
+    return (71 - _tb_clz64(value)) >> 3;
+}
+
 static inline int encode_varint(uint64_t value, uint8_t* buffer) {
     if (value <= 240) {
-        buffer[0] = (uint8_t)value;  // 1 byte
+        buffer[0] = (uint8_t)value;
         return 1;
-    } else if (value < 2288) {  // 241 to 248
+    }
+    if (value < 2288) {
         value -= 240;
-        int prefix = 241 + (value / 256);
-        buffer[0] = (uint8_t)prefix;  // A0
-        buffer[1] = (uint8_t)(value % 256);  // A1
+        buffer[0] = (uint8_t)(241 + (value >> 8));
+        buffer[1] = (uint8_t)value;
         return 2;
-    } else if (value <= 67823) {  // Up to 249
+    }
+    if (value <= 67823) {
         value -= 2288;
-        buffer[0] = 249;  // A0
-        buffer[1] = (uint8_t)(value / 256);  // A1
-        buffer[2] = (uint8_t)(value % 256);  // A2
+        buffer[0] = 249;
+        buffer[1] = (uint8_t)(value >> 8);
+        buffer[2] = (uint8_t)value;
         return 3;
-    } else if (value < (1ULL << 24)) {  // 250: 3-byte big-endian
-        buffer[0] = 250;  // A0
-        buffer[1] = (uint8_t)(value >> 16);  // A1 (most significant)
-        buffer[2] = (uint8_t)(value >> 8);   // A2
-        buffer[3] = (uint8_t)value;          // A3 (least significant)
-        return 4;
-    } else if (value < (1ULL << 32)) {  // 251: 4-byte big-endian
-        buffer[0] = 251;  // A0
-        buffer[1] = (uint8_t)(value >> 24);
-        buffer[2] = (uint8_t)(value >> 16);
-        buffer[3] = (uint8_t)(value >> 8);
-        buffer[4] = (uint8_t)value;
-        return 5;
-    } else if (value < (1ULL << 40)) {  // 252: 5-byte big-endian
-        buffer[0] = 252;  // A0
-        buffer[1] = (uint8_t)(value >> 32);
-        buffer[2] = (uint8_t)(value >> 24);
-        buffer[3] = (uint8_t)(value >> 16);
-        buffer[4] = (uint8_t)(value >> 8);
-        buffer[5] = (uint8_t)value;
-        return 6;
-    } else if (value < (1ULL << 48)) {  // 253: 6-byte big-endian
-        buffer[0] = 253;  // A0
-        buffer[1] = (uint8_t)(value >> 40);
-        buffer[2] = (uint8_t)(value >> 32);
-        buffer[3] = (uint8_t)(value >> 24);
-        buffer[4] = (uint8_t)(value >> 16);
-        buffer[5] = (uint8_t)(value >> 8);
-        buffer[6] = (uint8_t)value;
-        return 7;
-    } else if (value < (1ULL << 56)) {  // 254: 7-byte big-endian
-        buffer[0] = 254;  // A0
-        buffer[1] = (uint8_t)(value >> 48);
-        buffer[2] = (uint8_t)(value >> 40);
-        buffer[3] = (uint8_t)(value >> 32);
-        buffer[4] = (uint8_t)(value >> 24);
-        buffer[5] = (uint8_t)(value >> 16);
-        buffer[6] = (uint8_t)(value >> 8);
-        buffer[7] = (uint8_t)value;
-        return 8;
-    } else {  // 255: 8-byte big-endian
-        buffer[0] = 255;  // A0
-        buffer[1] = (uint8_t)(value >> 56);
-        buffer[2] = (uint8_t)(value >> 48);
-        buffer[3] = (uint8_t)(value >> 40);
-        buffer[4] = (uint8_t)(value >> 32);
-        buffer[5] = (uint8_t)(value >> 24);
-        buffer[6] = (uint8_t)(value >> 16);
-        buffer[7] = (uint8_t)(value >> 8);
-        buffer[8] = (uint8_t)value;
-        return 9;
     }
+    int bytes = _varint_long_bytes(value);
+    buffer[0] = (uint8_t)(247 + bytes);
+    if (bytes >= 4) {
+        // two overlapping 4 byte stores cover 4 to 8 bytes without writing past them
+        _store_be32(buffer + 1, (uint32_t)(value >> (8 * bytes - 32)));
+        _store_be32(buffer + bytes - 3, (uint32_t)value);
+    } else {
+        buffer[1] = (uint8_t)(value >> 16);
+        buffer[2] = (uint8_t)(value >> 8);
+        buffer[3] = (uint8_t)value;
+    }
+    return bytes + 1;
 }
 
+// Number of bytes encode_varint() writes for value
 static inline int varint_size(uint64_t value){
-    if (value < (1ULL << 48)) {  // 253: 6-byte big-endian
-        return 7;
-    } else if(value  < (1ULL << 52)){
-        return 8;
-    }
-    return 9;
+    if (value <= 240) return 1;
+    if (value < 2288) return 2;
+    if (value <= 67823) return 3;
+    return 1 + _varint_long_bytes(value);
+}
+
+// Number of bytes of a varint, prefix included
+static inline uint8_t varint_length(uint8_t prefix){
+    return prefix <= 240 ? 1 : prefix <= 248 ? 2 : (uint8_t)(prefix - 246);
 }
 
 static inline int8_t decode_varint(const uint8_t* buffer, size_t size, size_t pos, uint64_t *value) {
@@ -182,125 +590,76 @@ static inline int8_t decode_varint(const uint8_t* buffer, size_t size, size_t po
     if (prefix <= 240) {
         *value = prefix;
         return 1;
-    } else if (prefix >= 241 && prefix <= 248) {
-        if (pos + 1 >= size) return 0; // Not enough bytes
-        *value = 240 + 256 * (prefix - 241) + buffer[pos+1];
-        return 2;
-    } else if (prefix == 249){
-        if (pos + 2 >= size) return 0; // Not enough bytes
-        *value = 2288 + 256 * buffer[pos+1] + buffer[pos+2];
-        return 3;
-    } else if (prefix == 250){
-        if (pos + 3 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 16) | ((uint64_t)buffer[pos+2] << 8) | buffer[pos+3];
-        return 4;
-    } else if (prefix == 251){
-        if (pos + 4 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 24) | ((uint64_t)buffer[pos+2] << 16) |
-               ((uint64_t)buffer[pos+3] << 8) | buffer[pos+4];
-        return 5;    
-    } else if (prefix == 252){
-        if (pos + 5 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 32) | ((uint64_t)buffer[pos+2] << 24) |
-               ((uint64_t)buffer[pos+3] << 16) | ((uint64_t)buffer[pos+4] << 8) | buffer[pos+5];
-        return 6;        
-    } else if (prefix == 253){
-        if (pos + 6 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 40) | ((uint64_t)buffer[pos+2] << 32) |
-               ((uint64_t)buffer[pos+3] << 24) | ((uint64_t)buffer[pos+4] << 16) |
-               ((uint64_t)buffer[pos+5] << 8) | buffer[pos+6];
-        return 7;            
-    } else if (prefix == 254){
-        if (pos + 7 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 48) | ((uint64_t)buffer[pos+2] << 40) |
-               ((uint64_t)buffer[pos+3] << 32) | ((uint64_t)buffer[pos+4] << 24) |
-               ((uint64_t)buffer[pos+5] << 16) | ((uint64_t)buffer[pos+6] << 8) | buffer[pos+7];
-        return 8;            
-    } else if (prefix == 255){
-        if (pos + 8 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 56) | ((uint64_t)buffer[pos+2] << 48) |
-               ((uint64_t)buffer[pos+3] << 40) | ((uint64_t)buffer[pos+4] << 32) |
-               ((uint64_t)buffer[pos+5] << 24) | ((uint64_t)buffer[pos+6] << 16) |
-               ((uint64_t)buffer[pos+7] << 8) | buffer[pos+8];
-        return 9;            
-    } else {
-        return 0;
     }
-
-}
-
-static inline uint64_t decode_varint_old(const uint8_t* buffer, size_t size, size_t *pos) {
-    if (*pos >= size) {
-        return 0; // not enough buffer
+    if (prefix <= 248) {
+        // lengths and ids are often just over 240, one more byte is cheaper than a word load and a swap
+        if (size - pos < 2) return 0;
+        *value = 240 + ((uint64_t)(prefix - 241) << 8) + buffer[pos + 1];
+        return 2;
     }
-
-    uint8_t prefix = buffer[*pos];
-    if (prefix <= 240) {
-        *pos += 1;
-        return prefix;
-    } else if (prefix >= 241 && prefix <= 248) {
-        if (*pos + 1 >= size) return 0; // Not enough bytes
-        uint64_t value = 240 + 256 * (prefix - 241) + buffer[*pos+1];
-        *pos += 2;
-        return value;
-    } else if (prefix == 249) {
-        if (*pos + 2 >= size) return 0; // Not enough bytes
-        uint64_t value = 2288 + 256 * buffer[*pos+1] + buffer[*pos+2];
-        *pos += 3;
-        return value;
-    } else if (prefix == 250) {
-        if (*pos + 3 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 16) | ((uint64_t)buffer[*pos+2] << 8) | buffer[*pos+3];
-        *pos += 4;
-        return value;
-    } else if (prefix == 251) {
-        if (*pos + 4 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 24) | ((uint64_t)buffer[*pos+2] << 16) |
-               ((uint64_t)buffer[*pos+3] << 8) | buffer[*pos+4];
-        *pos += 5;
-        return value;
-    } else if (prefix == 252) {
-        if (*pos + 5 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 32) | ((uint64_t)buffer[*pos+2] << 24) |
-               ((uint64_t)buffer[*pos+3] << 16) | ((uint64_t)buffer[*pos+4] << 8) | buffer[*pos+5];
-        *pos += 6;
-        return value;
-    } else if (prefix == 253) {
-        if (*pos + 6 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 40) | ((uint64_t)buffer[*pos+2] << 32) |
-               ((uint64_t)buffer[*pos+3] << 24) | ((uint64_t)buffer[*pos+4] << 16) |
-               ((uint64_t)buffer[*pos+5] << 8) | buffer[*pos+6];
-        *pos += 7;
-        return value;       
-    } else if (prefix == 254) {
-        if (*pos + 7 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 48) | ((uint64_t)buffer[*pos+2] << 40) |
-               ((uint64_t)buffer[*pos+3] << 32) | ((uint64_t)buffer[*pos+4] << 24) |
-               ((uint64_t)buffer[*pos+5] << 16) | ((uint64_t)buffer[*pos+6] << 8) | buffer[*pos+7];
-        *pos += 8;
-        return value;       
-    } else if (prefix == 255) {
-        if (*pos + 8 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 56) | ((uint64_t)buffer[*pos+2] << 48) |
-               ((uint64_t)buffer[*pos+3] << 40) | ((uint64_t)buffer[*pos+4] << 32) |
-               ((uint64_t)buffer[*pos+5] << 24) | ((uint64_t)buffer[*pos+6] << 16) |
-               ((uint64_t)buffer[*pos+7] << 8) | buffer[*pos+8];
-        *pos += 9;
-        return value;
+    uint64_t word; // the bytes following the prefix, first one in the top byte
+    if (size - pos >= 9) {
+        word = _load_be64(buffer + pos + 1);
     } else {
-        return 0;  // Error case
+        // near the end of the buffer, never load past it
+        uint8_t length = varint_length(prefix);
+        if (size - pos < length) return 0; // Not enough bytes
+        uint8_t tail[8] = {0};
+        memcpy(tail, buffer + pos + 1, length - 1);
+        word = _load_be64(tail);
+    }
+    if (prefix == 249) {
+        *value = 2288 + (word >> 48);
+        return 3;
     }
+    *value = word >> (8 * (255 - prefix)); // prefix - 247 bytes
+    return (int8_t)(prefix - 246);
 }
 
+// Equality test (0 when equal), compares with the widest loads available instead of byte by byte.
+// Short lengths use two overlapping loads of the largest word that fits, so no byte is read twice
+// past the end and no loop is needed.
 static inline int fast_memcmp(const void *ptr1, const void *ptr2, size_t num) {
-    if(num < 32){
-        const unsigned char *p1 = (const unsigned char*)ptr1;
-        const unsigned char *p2 = (const unsigned char*)ptr2;
-        for(size_t i = 0; i < num; i++){
-            if(p1[i] != p2[i]) return 1; 
+    const char *p1 = (const char*)ptr1;
+    const char *p2 = (const char*)ptr2;
+    if (num >= 16) {
+#if defined(__AVX2__)
+        for (; num >= 32; num -= 32, p1 += 32, p2 += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)p1);
+            __m256i b = _mm256_loadu_si256((const __m256i *)p2);
+            if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xFFFFFFFFu) return 1;
+        }
+        if (num == 0) return 0;
+        if (num < 16) {
+            // step back so the last 16 bytes are compared, overlapping the ones already done
+            p1 -= 16 - num;
+            p2 -= 16 - num;
+            num = 16;
         }
-    }else{
-        return memcmp(ptr1, ptr2, num); 
+#endif
+#if defined(__SSE2__)
+        const char *end1 = p1 + num - 16;
+        const char *end2 = p2 + num - 16;
+        for (; num > 16; num -= 16, p1 += 16, p2 += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)p1);
+            __m128i b = _mm_loadu_si128((const __m128i *)p2);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) return 1;
+        }
+        __m128i a = _mm_loadu_si128((const __m128i *)end1);
+        __m128i b = _mm_loadu_si128((const __m128i *)end2);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF;
+#else
+        return memcmp(p1, p2, num) != 0;
+#endif
+    }
+    if (num >= 8) {
+        return ((_read_u64(p1) ^ _read_u64(p2)) | (_read_u64(p1 + num - 8) ^ _read_u64(p2 + num - 8))) != 0;
+    }
+    if (num >= 4) {
+        return ((_read_u32(p1) ^ _read_u32(p2)) | (_read_u32(p1 + num - 4) ^ _read_u32(p2 + num - 4))) != 0;
+    }
+    for (size_t i = 0; i < num; i++) {
+        if (p1[i] != p2[i]) return 1;
     }
     return 0;
 }
@@ -312,9 +671,174 @@ static inline void *fast_memcpy(unsigned char *ptr1, const char *ptr2, size_t nu
     return ptr1;
 }
 
-#include <immintrin.h>
-#include <stddef.h>
-#include <stdint.h>
+static inline uint32_t hash_table_bin(const HashTable *table, uint32_t hash_code) {
+    // fibonacci hashing, spreads all the hash bits over the power of two bins
+    return (hash_code * 0x9E3779B1u) >> table->bin_shift;
+}
+
+static inline int _hash_table_alloc_bins(HashTable *table, uint32_t bin_count) {
+    uint32_t *bins = (uint32_t *)_tb_calloc(table->allocator, bin_count, sizeof(uint32_t));
+    if (!bins) return 0;
+    uint32_t shift = 32;
+    for (uint32_t n = bin_count; n > 1; n >>= 1) shift--;
+    _tb_free(table->allocator, table->bins);
+    table->bins = bins;
+    table->bin_mask = bin_count - 1;
+    table->bin_shift = shift;
+    return 1;
+}
+
+/**
+ * @brief Initializes an empty hash table
+ *
+ * @param table The hash table
+ * @param cache_size Initial number of entries (also the number of bins, rounded up to a power of two)
+ * @param cache_limit Maximum number of entries the table may grow to
+ * @param policy What to do once the limit is reached, one of TB_DEDUPE_POLICY_*
+ * @param allocator Where the table memory comes from, NULL for malloc()
+ * @return 1 on success, 0 on allocation failure
+ */
+static inline int hash_table_init_with(HashTable *table, uint32_t cache_size, uint32_t cache_limit, uint8_t policy,
+                                       const tiny_bits_allocator *allocator) {
+    memset(table, 0, sizeof(HashTable));
+    table->allocator = allocator;
+    if (cache_limit < 1) cache_limit = 1;
+    if (cache_size > cache_limit) cache_size = cache_limit;
+    if (cache_size < 1) cache_size = 1;
+    uint32_t bin_count = TB_HASH_SIZE;
+    while (bin_count < cache_size) bin_count <<= 1;
+    table->cache = (HashEntry*)_tb_alloc(allocator, sizeof(HashEntry) * cache_size);
+    if (!table->cache) return 0;
+    if (!_hash_table_alloc_bins(table, bin_count)) {
+        _tb_free(allocator, table->cache);
+        table->cache = NULL;
+        return 0;
+    }
+    table->cache_size = cache_size;
+    table->cache_limit = cache_limit;
+    table->policy = policy;
+    return 1;
+}
+
+// hash_table_init_with() using malloc()
+static inline int hash_table_init(HashTable *table, uint32_t cache_size, uint32_t cache_limit, uint8_t policy) {
+    return hash_table_init_with(table, cache_size, cache_limit, policy, NULL);
+}
+
+static inline void hash_table_free(HashTable *table) {
+    _tb_free(table->allocator, table->cache);
+    _tb_free(table->allocator, table->bins);
+    table->cache = NULL;
+    table->bins = NULL;
+}
+
+/**
+ * @brief Removes all entries, keeping the allocated memory
+ */
+static inline void hash_table_clear(HashTable *table) {
+    if (!table->bins) return;
+    // a table that grew for one large message should not cost a full memset per small one
+    if (table->cache_pos < (table->bin_mask + 1) / 4) {
+        for (uint32_t i = 0; i < table->cache_pos; i++) {
+            table->bins[hash_table_bin(table, table->cache[i].hash)] = 0;
+        }
+    } else {
+        memset(table->bins, 0, (table->bin_mask + 1) * sizeof(uint32_t));
+    }
+    table->cache_pos = 0;
+    table->next_id = 0;
+    table->clock_hand = 0;
+}
+
+// Walks the chain of the string's bin, returns the matching entry or NULL
+static inline HashEntry *hash_table_lookup(HashTable *table, const unsigned char *base, 
+                                           const char *str, uint32_t len, uint32_t hash_code) {
+    uint32_t index = table->bins[hash_table_bin(table, hash_code)];
+    while (index > 0) {
+        HashEntry *entry = &table->cache[index - 1];
+        if (hash_code == entry->hash 
+            && len == entry->length
+            && fast_memcmp(str, base + entry->offset, len) == 0 ) {
+            if (table->policy == TB_DEDUPE_POLICY_LRU) entry->referenced = 1;
+            return entry;
+        }
+        index = entry->next_index;
+    }
+    return NULL;
+}
+
+static inline int _hash_table_grow(HashTable *table) {
+    uint32_t new_size = table->cache_size * 2;
+    if (new_size > table->cache_limit || new_size < table->cache_size) new_size = table->cache_limit;
+    HashEntry *new_cache = (HashEntry*)_tb_realloc(table->allocator, table->cache, sizeof(HashEntry) * new_size);
+    if (!new_cache) return 0;
+    table->cache = new_cache;
+    table->cache_size = new_size;
+    if (new_size > table->bin_mask + 1) {
+        // keep chains short, one bin per entry, rehashing from the stored hashes
+        uint32_t bin_count = table->bin_mask + 1;
+        while (bin_count < new_size) bin_count <<= 1;
+        if (!_hash_table_alloc_bins(table, bin_count)) return 1; // longer chains, but still correct
+        for (uint32_t i = 0; i < table->cache_pos; i++) {
+            uint32_t bin = hash_table_bin(table, table->cache[i].hash);
+            table->cache[i].next_index = table->bins[bin];
+            table->bins[bin] = i + 1;
+        }
+    }
+    return 1;
+}
+
+// Picks the entry to replace, skipping (and clearing) the recently referenced ones
+static inline uint32_t _hash_table_evict(HashTable *table) {
+    uint32_t victim;
+    while (1) {
+        victim = table->clock_hand;
+        table->clock_hand = (table->clock_hand + 1) % table->cache_pos;
+        if (!table->cache[victim].referenced) break;
+        table->cache[victim].referenced = 0;
+    }
+    // unlink it from its chain
+    HashEntry *entry = &table->cache[victim];
+    uint32_t *link = &table->bins[hash_table_bin(table, entry->hash)];
+    while (*link != victim + 1) link = &table->cache[*link - 1].next_index;
+    *link = entry->next_index;
+    return victim;
+}
+
+/**
+ * @brief Registers a string, assigning it the next id
+ *
+ * @param table The hash table
+ * @param hash_code The string hash
+ * @param length The string length
+ * @param offset Where the string bytes are, relative to the base used for lookups
+ * @return 1 if the string was registered, 0 if the table is full (TB_DEDUPE_POLICY_STOP)
+ *
+ * @note Ids must stay in sync with the unpacker, which numbers every deduplicatable string it sees.
+ * So a table that stops registering (when full or out of memory) never starts again until cleared.
+ */
+static inline int hash_table_insert(HashTable *table, uint32_t hash_code, uint32_t length, uint32_t offset) {
+    uint32_t slot;
+    if (table->cache_pos < table->cache_size) {
+        slot = table->cache_pos++;
+    } else if (table->cache_size < table->cache_limit && _hash_table_grow(table)) {
+        slot = table->cache_pos++;
+    } else {
+        table->cache_limit = table->cache_size; // never grow again, see the note above
+        if (table->policy != TB_DEDUPE_POLICY_LRU) return 0;
+        slot = _hash_table_evict(table);
+    }
+    HashEntry* new_entry = &table->cache[slot];
+    uint32_t bin = hash_table_bin(table, hash_code);
+    new_entry->hash = hash_code; 
+    new_entry->length = length;
+    new_entry->offset = offset;
+    new_entry->id = table->next_id++;
+    new_entry->referenced = 0;
+    new_entry->next_index = table->bins[bin];
+    table->bins[bin] = slot + 1;
+    return 1;
+}
 
 static inline uint64_t dtoi_bits(double d) {
     union {
@@ -334,165 +858,793 @@ static inline double itod_bits(uint64_t u) {
     return converter.d;
 }
 
+// Narrows a finite double to a float, returns 0 unless the float holds the exact same value
+static inline int double_to_float_exact(double d, float *f) {
+    if (fabs(d) > 3.4028234663852886e38) return 0; // FLT_MAX
+    *f = (float)d;
+    return (double)*f == d;
+}
+
+// Narrows a float to IEEE 754 half precision bits, returns 0 unless the half holds the exact same value
+static inline int float_to_half_exact(float f, uint16_t *half) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xFF) - 127;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if ((bits & 0x7FFFFFFF) == 0) { // +/- zero
+        *half = sign;
+        return 1;
+    }
+    if (exponent >= -14 && exponent <= 15) { // normal half, 10 mantissa bits
+        if (mantissa & 0x1FFF) return 0;
+        *half = sign | (uint16_t)((exponent + 15) << 10) | (uint16_t)(mantissa >> 13);
+        return 1;
+    }
+    if (exponent >= -24 && exponent < -14) { // subnormal half, multiples of 2^-24
+        uint32_t full = mantissa | 0x800000;
+        int shift = -(exponent + 1);
+        if (full & ((1u << shift) - 1)) return 0;
+        *half = sign | (uint16_t)(full >> shift);
+        return 1;
+    }
+    return 0;
+}
+
+static inline double half_to_double(uint16_t half) {
+    int exponent = (half >> 10) & 0x1F;
+    double magnitude;
+    if (exponent == 0) {
+        magnitude = ldexp((double)(half & 0x3FF), -24);
+    } else if (exponent == 31) {
+        magnitude = (half & 0x3FF) ? NAN : INFINITY;
+    } else {
+        magnitude = ldexp((double)((half & 0x3FF) | 0x400), exponent - 25);
+    }
+    return (half & 0x8000) ? -magnitude : magnitude;
+}
+
 static inline void encode_uint64( uint64_t value, uint8_t *buffer) {
-    buffer[0] = (value >> 56) & 0xFF;
-    buffer[1] = (value >> 48) & 0xFF;
-    buffer[2] = (value >> 40) & 0xFF;
-    buffer[3] = (value >> 32) & 0xFF;
-    buffer[4] = (value >> 24) & 0xFF;
-    buffer[5] = (value >> 16) & 0xFF;
-    buffer[6] = (value >> 8) & 0xFF;
-    buffer[7] = value & 0xFF;
+    _store_be64(buffer, value);
 }
 
 static inline uint64_t decode_uint64(const uint8_t *buffer) {
-    return ((uint64_t)buffer[0] << 56) |
-           ((uint64_t)buffer[1] << 48) |
-           ((uint64_t)buffer[2] << 40) |
-           ((uint64_t)buffer[3] << 32) |
-           ((uint64_t)buffer[4] << 24) |
-           ((uint64_t)buffer[5] << 16) |
-           ((uint64_t)buffer[6] << 8) |
-            (uint64_t)buffer[7];
+    return _load_be64(buffer);
 }
 
-static inline int decimal_places_count(double abs_val, double *scaled) {
-    //double abs_val = fabs(val);
-    *scaled = abs_val;
-    double temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 0;}
-
-    *scaled = abs_val * 10000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 10;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 1;}
-        *scaled = abs_val * 100;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 2;}
-        *scaled = abs_val * 1000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 3;}
-        *scaled = temp;
-        return 4;
-    }
-
-    *scaled = abs_val * 100000000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 100000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 5;}
-        *scaled = abs_val * 1000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 6;}
-        *scaled = abs_val * 10000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 7;}
-        *scaled = temp;
-        return 8;
-    }
-
-    *scaled = abs_val * 1000000000000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 1000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 9;}
-        *scaled = abs_val * 10000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 10;}
-        *scaled = abs_val * 100000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 11;}
-        *scaled = temp;
-        return 12;
-    }
-    return -1;
+// Packed arrays store their bit stream little endian
+static inline uint64_t _load_le64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    return v;
 }
 
-/* End common.h */
+static inline void _store_le64(uint8_t *p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
 
-/* Begin packer.h */
+// Number of bits needed to hold value, 0 for 0
+static inline uint8_t bit_width_64(uint64_t value) {
+    return value ? (uint8_t)(64 - _tb_clz64(value)) : 0;
+}
 
+static inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
 
-typedef struct tiny_bits_packer {
-    unsigned char *buffer;      // Pointer to the allocated buffer
-    size_t capacity;         // Total allocated size of the buffer
-    size_t current_pos;      // Current position in the buffer (write position)
-    HashTable encode_table; // Add the hash table here
-    HashTable dictionary;
-    uint8_t features;
-    // Add any other encoder-specific state here if needed (e.g., string deduplication table later)
-} tiny_bits_packer;
+static inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
 
-static inline unsigned char *tiny_bits_packer_ensure_capacity(tiny_bits_packer *encoder, size_t needed_size) {
-    if (!encoder) return NULL;
+// 2^48 / 10^k, the largest values scaling by 10^k to an integer a compressed double can hold
+static const double scale_limits[] = {
+    281474976710656.0,
+    281474976710656.0 / 1e1,
+    281474976710656.0 / 1e2,
+    281474976710656.0 / 1e3,
+    281474976710656.0 / 1e4,
+    281474976710656.0 / 1e5,
+    281474976710656.0 / 1e6,
+    281474976710656.0 / 1e7,
+    281474976710656.0 / 1e8,
+    281474976710656.0 / 1e9,
+    281474976710656.0 / 1e10,
+    281474976710656.0 / 1e11,
+    281474976710656.0 / 1e12
+};
 
-    size_t available_space = encoder->capacity - encoder->current_pos;
-    if (needed_size > available_space) {
-        size_t new_capacity = encoder->capacity + needed_size + (encoder->capacity);
-        unsigned char *new_buffer = (unsigned char *)realloc(encoder->buffer, new_capacity);
-        if (!new_buffer) return NULL;
-        encoder->buffer = new_buffer;
-        encoder->capacity = new_capacity;
-    }
-    return encoder->buffer + encoder->current_pos;
+// Largest power of 10 that keeps a value below 2^48, from its binary exponent (abs_val < 2^48)
+static inline int _decimal_scale(double abs_val) {
+    // floor((47 - e) * log10(2)) for e = exponent of abs_val, one more when the value is small enough for it
+    uint64_t bits = dtoi_bits(abs_val);
+    int e = (int)(bits >> 52) - 1023;
+    int top = ((47 - e) * 1233) >> 12;
+    if (top >= 12) return 12;
+    return top + (abs_val < scale_limits[top + 1]);
 }
 
 /**
- * @brief allocates and initializes a new packer
- * 
- * @return pointer to new packer instance
- * 
- * @note the returned packer object must be freed using tiny_bits_packer_destroy()
+ * @brief Finds the fewest decimal places (0-12) of a non negative double
+ *
+ * @param abs_val The value, a positive double or 0
+ * @param scaled Set to abs_val * 10^places, an integer below 2^48 unless abs_val itself is a larger integer
+ * @return The number of decimal places, or -1 if there is none
+ *
+ * Scaled by the largest power of 10 that keeps it below 2^48 (picked from its binary exponent), a
+ * decimal with its fewest places p rounds to exactly its digits followed by top - p zeros, and most
+ * other values are rejected because they do not land near an integer. The places are what remains
+ * once those zeros are stripped, and a count is only returned when scaled / 10^places (what the
+ * unpacker computes) gives back abs_val exactly.
  */
-tiny_bits_packer *tiny_bits_packer_create(size_t initial_capacity, uint8_t features) {
-    tiny_bits_packer *encoder = (tiny_bits_packer *)malloc(sizeof(tiny_bits_packer));
-    if (!encoder) return NULL;
-
-    encoder->buffer = (unsigned char *)malloc(initial_capacity);
-    if (!encoder->buffer) {
-        free(encoder);
-        return NULL;
+static inline int decimal_places_count(double abs_val, double *scaled) {
+    *scaled = abs_val;
+    if (TB_UNLIKELY(!(abs_val < scale_limits[0]))) { // also rejects NaN
+        // too large to scale, only integers qualify
+        return (abs_val < 18446744073709551616.0 && abs_val == (double)(uint64_t)abs_val) ? 0 : -1;
     }
-    encoder->capacity = initial_capacity;
-    encoder->current_pos = 0;
-    encoder->features = features;
+    int k = _decimal_scale(abs_val);
+    double x = abs_val * powers[k];
+    uint64_t digits = (uint64_t)(x + 0.5);
+    if (fabs(x - (double)digits) > 0.0625) return -1;
+    // strip min(trailing zeros, k) zeros, 8, 4, 2 and 1 at a time (k <= 12)
+    if (k >= 8 && digits % 100000000 == 0) { digits /= 100000000; k -= 8; }
+    if (k >= 4 && digits % 10000 == 0) { digits /= 10000; k -= 4; }
+    if (k >= 2 && digits % 100 == 0) { digits /= 100; k -= 2; }
+    if (k >= 1 && digits % 10 == 0) { digits /= 10; k -= 1; }
+    double integer = (double)digits;
+    if (integer / powers[k] != abs_val) return -1;
+    *scaled = integer;
+    return k;
+}
 
-    // Only allocate hash table if deduplication is enabled
-    if (features & TB_FEATURE_STRING_DEDUPE) {
-        encoder->encode_table.cache = (HashEntry*)malloc(sizeof(HashEntry) * TB_HASH_CACHE_SIZE);
-        if (!encoder->encode_table.cache) {
-            //free(encoder->encode_table.buckets);
-            free(encoder->buffer);
-            free(encoder);
-            return NULL;
+/**
+ * @brief decimal_places_count() trying the decimal places of a neighbouring value first
+ *
+ * @param abs_val The value, a positive double or 0 (NaN and infinities get -1)
+ * @param guess Decimal places to try first, or -1
+ * @param scaled Set to abs_val scaled by 10^places
+ * @return The number of decimal places, or -1 if there is none
+ *
+ * Neighbouring values of a series tend to have the same number of decimals, and checking a guess
+ * is a single scale and test.
+ */
+static inline int decimal_places_count_near(double abs_val, int guess, double *scaled) {
+    if (guess >= 0 && abs_val < scale_limits[guess]) {
+        double x = abs_val * powers[guess];
+        int64_t integer = (int64_t)(x + 0.5);
+        // exact and not a multiple of 10 (then fewer places would do)
+        if ((double)integer / powers[guess] == abs_val
+            && (guess == 0 || integer % 10 != 0)) {
+            *scaled = (double)integer;
+            return guess;
         }
-        encoder->encode_table.cache_size = TB_HASH_CACHE_SIZE;
-        encoder->encode_table.cache_pos = 0;
-        encoder->encode_table.next_id = 0;
-    } else {
-        encoder->encode_table.cache = NULL;
-        encoder->encode_table.cache_size = 0;
-        encoder->encode_table.cache_pos = 0;
-        encoder->encode_table.next_id = 0;
     }
-
-    return encoder;
+    return decimal_places_count(abs_val, scaled);
 }
 
 /**
- * @brief Resets internal data structure of the packer object
- * 
- * @param encoder The packer instance
+ * @brief decimal_places_count() over an array
  *
- * @note This function allows for more efficient packing by reusing the same packer object
+ * @param abs_vals The values, positive doubles or 0 (NaN and infinities get -1)
+ * @param count Number of values
+ * @param places Set to the decimal places of each value, or -1
+ * @param scaled Set to each value scaled by 10^places
+ *
+ * Each value is first checked against the decimal places of the one before it, see
+ * decimal_places_count_near().
  */
-inline void tiny_bits_packer_reset(tiny_bits_packer *encoder) {
-    if (!encoder) return;
-    encoder->current_pos = 0;  
-    if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
-        encoder->encode_table.next_id = 0;
-        encoder->encode_table.cache_pos = 0;
-        memset(encoder->encode_table.bins, 0, TB_HASH_SIZE * sizeof(uint8_t));
+static inline void decimal_places_count_batch(const double *abs_vals, size_t count, int8_t *places, double *scaled) {
+    int guess = -1;
+    for (size_t i = 0; i < count; i++) {
+        guess = decimal_places_count_near(abs_vals[i], guess, &scaled[i]);
+        places[i] = (int8_t)guess;
     }
-    
 }
 
-/**
+/* End common.h */
+
+/* Begin pool.h */
+
+// The pool locks with pthreads, so it is only there when TB_WITH_POOL is defined before including tinybits
+#if defined(TB_WITH_POOL)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define TB_POOL_MIN_SHIFT 10     // smallest size class, 1KB
+#define TB_POOL_MAX_SHIFT 26     // largest size class, 64MB, larger buffers are never cached
+#define TB_POOL_CLASSES (TB_POOL_MAX_SHIFT - TB_POOL_MIN_SHIFT + 1)
+
+typedef struct tiny_bits_pool_stats {
+    uint64_t acquired;      // buffers handed out
+    uint64_t reused;        // of which came from the cache
+    uint64_t released;      // buffers given back
+    uint64_t dropped;       // of which were freed instead of cached (over the limit or too large)
+    size_t cached_bytes;    // bytes sitting in the cache
+    size_t borrowed_bytes;  // bytes currently handed out
+    size_t peak_borrowed_bytes;
+} tiny_bits_pool_stats;
+
+/**
+ * A thread safe cache of buffers in power of two size classes, shared by packers (see tiny_bits_packer_set_pool())
+ * so that large buffers forced by an occasional large message go back to the pool when the packer is reset,
+ * instead of staying with it. The cache holds at most max_cached_bytes, buffers released beyond it are freed.
+ */
+typedef struct tiny_bits_buffer_pool {
+    pthread_mutex_t lock;
+    void *free_lists[TB_POOL_CLASSES]; // cached buffers, each holding the pointer to the next one
+    size_t max_cached_bytes;
+    tiny_bits_pool_stats stats;
+} tiny_bits_buffer_pool;
+
+// Size class of a buffer of at least size bytes, TB_POOL_CLASSES when it is too large to cache
+static inline int _tb_pool_class(size_t size) {
+    if (size <= ((size_t)1 << TB_POOL_MIN_SHIFT)) return 0;
+    int shift = 64 - _tb_clz64(size - 1);
+    return shift > TB_POOL_MAX_SHIFT ? TB_POOL_CLASSES : shift - TB_POOL_MIN_SHIFT;
+}
+
+/**
+ * @brief allocates and initializes a new buffer pool
+ *
+ * @param max_cached_bytes Most bytes kept in the cache, released buffers beyond it are freed
+ * @return pointer to new pool instance
+ *
+ * @note the returned pool object must be freed using tiny_bits_pool_destroy(), once no packer uses it
+ */
+static inline tiny_bits_buffer_pool *tiny_bits_pool_create(size_t max_cached_bytes) {
+    tiny_bits_buffer_pool *pool = (tiny_bits_buffer_pool *)malloc(sizeof(tiny_bits_buffer_pool));
+    if (!pool) return NULL;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+    memset(&pool->stats, 0, sizeof(pool->stats));
+    pool->max_cached_bytes = max_cached_bytes;
+    return pool;
+}
+
+/**
+ * @brief Borrows a buffer of at least size bytes
+ *
+ * @param pool The pool instance
+ * @param size Bytes needed
+ * @param capacity Set to the actual size of the buffer (its size class)
+ * @return The buffer, or NULL on allocation failure
+ *
+ * @note Give it back with tiny_bits_pool_release() and the same capacity
+ */
+static inline void *tiny_bits_pool_acquire(tiny_bits_buffer_pool *pool, size_t size, size_t *capacity) {
+    int size_class = _tb_pool_class(size);
+    size_t class_size = size_class < TB_POOL_CLASSES ? (size_t)1 << (size_class + TB_POOL_MIN_SHIFT) : size;
+    void *buffer = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (size_class < TB_POOL_CLASSES && pool->free_lists[size_class]) {
+        buffer = pool->free_lists[size_class];
+        memcpy(&pool->free_lists[size_class], buffer, sizeof(void *));
+        pool->stats.cached_bytes -= class_size;
+        pool->stats.reused++;
+    }
+    pool->stats.acquired++;
+    pool->stats.borrowed_bytes += class_size;
+    if (pool->stats.borrowed_bytes > pool->stats.peak_borrowed_bytes) {
+        pool->stats.peak_borrowed_bytes = pool->stats.borrowed_bytes;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!buffer) {
+        buffer = malloc(class_size);
+        if (!buffer) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.acquired--;
+            pool->stats.borrowed_bytes -= class_size;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+    }
+    *capacity = class_size;
+    return buffer;
+}
+
+/**
+ * @brief Gives back a buffer borrowed with tiny_bits_pool_acquire()
+ *
+ * @param pool The pool instance
+ * @param buffer The buffer
+ * @param capacity Its size, as set by tiny_bits_pool_acquire()
+ */
+static inline void tiny_bits_pool_release(tiny_bits_buffer_pool *pool, void *buffer, size_t capacity) {
+    if (!buffer) return;
+    int size_class = _tb_pool_class(capacity);
+    int cache = 0;
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.released++;
+    pool->stats.borrowed_bytes -= capacity;
+    if (size_class < TB_POOL_CLASSES && ((size_t)1 << (size_class + TB_POOL_MIN_SHIFT)) == capacity
+        && pool->stats.cached_bytes + capacity <= pool->max_cached_bytes) {
+        memcpy(buffer, &pool->free_lists[size_class], sizeof(void *));
+        pool->free_lists[size_class] = buffer;
+        pool->stats.cached_bytes += capacity;
+        cache = 1;
+    } else {
+        pool->stats.dropped++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!cache) free(buffer);
+}
+
+/**
+ * @brief Frees cached buffers, largest first, until the cache holds at most max_bytes
+ *
+ * @param pool The pool instance
+ * @param max_bytes Bytes the cache may keep, 0 empties it
+ * @return Number of bytes freed
+ */
+static inline size_t tiny_bits_pool_trim(tiny_bits_buffer_pool *pool, size_t max_bytes) {
+    void *to_free = NULL;
+    size_t freed = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int size_class = TB_POOL_CLASSES - 1; size_class >= 0 && pool->stats.cached_bytes > max_bytes; size_class--) {
+        size_t class_size = (size_t)1 << (size_class + TB_POOL_MIN_SHIFT);
+        while (pool->free_lists[size_class] && pool->stats.cached_bytes > max_bytes) {
+            void *buffer = pool->free_lists[size_class];
+            memcpy(&pool->free_lists[size_class], buffer, sizeof(void *));
+            pool->stats.cached_bytes -= class_size;
+            freed += class_size;
+            // free outside of the lock
+            memcpy(buffer, &to_free, sizeof(void *));
+            to_free = buffer;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    while (to_free) {
+        void *next;
+        memcpy(&next, to_free, sizeof(void *));
+        free(to_free);
+        to_free = next;
+    }
+    return freed;
+}
+
+/**
+ * @brief Sets the most bytes the cache keeps, trimming it if needed
+ *
+ * @param pool The pool instance
+ * @param max_cached_bytes Most bytes kept in the cache
+ */
+static inline void tiny_bits_pool_set_limit(tiny_bits_buffer_pool *pool, size_t max_cached_bytes) {
+    pthread_mutex_lock(&pool->lock);
+    pool->max_cached_bytes = max_cached_bytes;
+    pthread_mutex_unlock(&pool->lock);
+    tiny_bits_pool_trim(pool, max_cached_bytes);
+}
+
+/**
+ * @brief Copies the pool counters
+ *
+ * @param pool The pool instance
+ * @param stats Set to the current counters
+ */
+static inline void tiny_bits_pool_get_stats(tiny_bits_buffer_pool *pool, tiny_bits_pool_stats *stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Deallocate the pool object and the buffers it caches
+ *
+ * @param pool The pool instance
+ *
+ * @note Borrowed buffers are not tracked, packers using the pool must be destroyed first
+ */
+static inline void tiny_bits_pool_destroy(tiny_bits_buffer_pool *pool) {
+    if (!pool) return;
+    tiny_bits_pool_trim(pool, 0);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+#endif // TB_WITH_POOL
+
+/* End pool.h */
+
+/* Begin packer.h */
+
+
+// Called by a streaming packer with the bytes to write out, returns 0 on error
+typedef int (*tiny_bits_flush_fn)(void *context, const uint8_t *data, size_t size);
+
+// A payload packed by reference, it follows the buffer bytes before pos, see pack_blob_ref()
+typedef struct tiny_bits_ref {
+    size_t pos;             // buffer position of the payload (right after its header)
+    const void *data;       // the caller's bytes
+    size_t size;
+} tiny_bits_ref;
+
+typedef struct tiny_bits_packer {
+    unsigned char *buffer;      // Pointer to the allocated buffer
+    size_t capacity;         // Total allocated size of the buffer
+    size_t current_pos;      // Current position in the buffer (write position)
+    HashTable encode_table; // Add the hash table here
+    HashTable dictionary;   // Pre-shared strings (ids 0..next_id-1), see tiny_bits_packer_set_dictionary()
+    const char *dictionary_data; // Storage the dictionary entry offsets point into
+    unsigned char *strings;      // When set, registered strings are copied here and encode_table offsets point into it
+    size_t strings_size;         // Bytes used in strings
+    size_t strings_capacity;     // Bytes allocated for strings
+    uint32_t session_window;     // Ids kept across messages before a reset, 0 when not in a session
+    tiny_bits_flush_fn flush;    // Set on a streaming packer, see tiny_bits_packer_set_flush()
+    void *flush_context;         // Passed to flush
+    size_t flushed;              // Bytes handed to flush so far
+    uint32_t deferred_open;      // Containers started by pack_arr_begin()/pack_map_begin() and not ended yet
+    const tiny_bits_allocator *allocator; // Where the buffer, dedupe table and strings come from, NULL for malloc()
+    struct tiny_bits_buffer_pool *pool; // When set the buffer is borrowed from it, see tiny_bits_packer_set_pool()
+    size_t pool_keep;            // Largest buffer kept across resets, larger ones go back to the pool
+    tiny_bits_ref *refs;         // Payloads packed by reference, in buffer order
+    uint32_t refs_count;
+    uint32_t refs_capacity;
+    size_t refs_size;            // Bytes they add to the message
+    uint8_t measuring;           // Only counts the bytes, see tiny_bits_packer_set_measure()
+    size_t measured_peak;        // Most bytes held at once while measuring, before deferred headers shrank
+    uint8_t features;
+    int8_t float_places;         // Decimal places of the last double packed, tried first on the next one (-1 for none)
+    // Add any other encoder-specific state here if needed (e.g., string deduplication table later)
+} tiny_bits_packer;
+
+static inline int tiny_bits_packer_flush(tiny_bits_packer *encoder);
+
+static inline unsigned char *tiny_bits_packer_ensure_capacity(tiny_bits_packer *encoder, size_t needed_size) {
+    if (!encoder) return NULL;
+
+    size_t available_space = encoder->capacity - encoder->current_pos;
+    if (needed_size > available_space && encoder->flush && !encoder->deferred_open && encoder->current_pos) {
+        // streaming: write out what is packed so far, this is always called before a value is written
+        if (!tiny_bits_packer_flush(encoder)) return NULL;
+        available_space = encoder->capacity;
+    }
+#if defined(TB_WITH_POOL)
+    if (needed_size > available_space && encoder->pool) {
+        // the next size class up, what was packed so far moves over
+        size_t new_capacity;
+        unsigned char *new_buffer = (unsigned char *)tiny_bits_pool_acquire(encoder->pool, encoder->current_pos + needed_size, &new_capacity);
+        if (!new_buffer) return NULL;
+        memcpy(new_buffer, encoder->buffer, encoder->current_pos);
+        tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+        encoder->buffer = new_buffer;
+        encoder->capacity = new_capacity;
+        available_space = new_capacity - encoder->current_pos;
+    }
+#endif
+    if (needed_size > available_space) {
+        size_t new_capacity = encoder->capacity + needed_size + (encoder->capacity);
+        unsigned char *new_buffer = (unsigned char *)_tb_realloc(encoder->allocator, encoder->buffer, new_capacity);
+        if (!new_buffer) return NULL;
+        encoder->buffer = new_buffer;
+        encoder->capacity = new_capacity;
+    }
+    return encoder->buffer + encoder->current_pos;
+}
+
+/**
+ * @brief allocates and initializes a new packer, taking all its memory from an allocator
+ * 
+ * @param initial_capacity Initial buffer size
+ * @param features TB_FEATURE_* flags
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
+ * @return pointer to new packer instance
+ * 
+ * @note the returned packer object must be freed using tiny_bits_packer_destroy(), unless it comes from an
+ * arena that is reset or destroyed as a whole. The allocator must outlive the packer.
+ */
+tiny_bits_packer *tiny_bits_packer_create_with(size_t initial_capacity, uint8_t features, const tiny_bits_allocator *allocator) {
+    tiny_bits_packer *encoder = (tiny_bits_packer *)_tb_alloc(allocator, sizeof(tiny_bits_packer));
+    if (!encoder) return NULL;
+
+    encoder->buffer = (unsigned char *)_tb_alloc(allocator, initial_capacity);
+    if (!encoder->buffer) {
+        _tb_free(allocator, encoder);
+        return NULL;
+    }
+    encoder->capacity = initial_capacity;
+    encoder->current_pos = 0;
+    encoder->features = features;
+    memset(&encoder->dictionary, 0, sizeof(HashTable));
+    encoder->dictionary_data = NULL;
+    encoder->strings = NULL;
+    encoder->strings_size = 0;
+    encoder->strings_capacity = 0;
+    encoder->session_window = 0;
+    encoder->flush = NULL;
+    encoder->flush_context = NULL;
+    encoder->flushed = 0;
+    encoder->deferred_open = 0;
+    encoder->allocator = allocator;
+    encoder->pool = NULL;
+    encoder->pool_keep = 0;
+    encoder->refs = NULL;
+    encoder->refs_count = 0;
+    encoder->refs_capacity = 0;
+    encoder->refs_size = 0;
+    encoder->measuring = 0;
+    encoder->measured_peak = 0;
+    encoder->float_places = -1;
+
+    // Only allocate hash table if deduplication is enabled
+    if (features & TB_FEATURE_STRING_DEDUPE) {
+        if (!hash_table_init_with(&encoder->encode_table, TB_HASH_CACHE_SIZE, TB_HASH_CACHE_SIZE, TB_DEDUPE_POLICY_STOP, allocator)) {
+            _tb_free(allocator, encoder->buffer);
+            _tb_free(allocator, encoder);
+            return NULL;
+        }
+    } else {
+        memset(&encoder->encode_table, 0, sizeof(HashTable));
+    }
+
+    return encoder;
+}
+
+/**
+ * @brief allocates and initializes a new packer
+ * 
+ * @return pointer to new packer instance
+ * 
+ * @note the returned packer object must be freed using tiny_bits_packer_destroy()
+ */
+tiny_bits_packer *tiny_bits_packer_create(size_t initial_capacity, uint8_t features) {
+    return tiny_bits_packer_create_with(initial_capacity, features, NULL);
+}
+
+static inline void _packer_clear_strings(tiny_bits_packer *encoder) {
+    if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
+        hash_table_clear(&encoder->encode_table);
+    }
+    encoder->strings_size = 0;
+}
+
+/**
+ * @brief Packs a marker telling the unpacker to forget all deduplicated strings
+ * 
+ * @param encoder Pointer to the packer instance
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note Strings packed after the marker are numbered from scratch (after the dictionary, if any)
+ */
+static inline int pack_strings_reset(tiny_bits_packer *encoder){
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 2);
+    if (!buffer) return 0; // Handle error
+    buffer[0] = TB_NXT_TAG;
+    buffer[1] = TB_NXT_RST;
+    encoder->current_pos += 2;
+    _packer_clear_strings(encoder);
+    return 2;
+}
+
+/**
+ * @brief Resets internal data structure of the packer object
+ * 
+ * @param encoder The packer instance
+ *
+ * @note This function allows for more efficient packing by reusing the same packer object
+ * @note In a session, deduplicated strings are kept for the next message, unless the session
+ * window is exhausted. Then they are dropped and the next message starts with a reset marker.
+ */
+static inline void tiny_bits_packer_reset(tiny_bits_packer *encoder) {
+    if (!encoder) return;
+    encoder->current_pos = 0;  
+    encoder->deferred_open = 0;
+    encoder->refs_count = 0;
+    encoder->refs_size = 0;
+    if (encoder->measuring) {
+        encoder->flushed = 0;
+        encoder->measured_peak = 0;
+    }
+#if defined(TB_WITH_POOL)
+    if (encoder->pool && encoder->capacity > encoder->pool_keep) {
+        // give an outgrown buffer back, keep working with a typical one
+        size_t capacity;
+        unsigned char *buffer = (unsigned char *)tiny_bits_pool_acquire(encoder->pool, encoder->pool_keep, &capacity);
+        if (buffer) {
+            tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+            encoder->buffer = buffer;
+            encoder->capacity = capacity;
+        }
+    }
+#endif
+    if (encoder->session_window) {
+        HashTable *table = &encoder->encode_table;
+        // a full table that stopped registering would never reach the window
+        if (table->next_id >= encoder->session_window
+            || (table->policy == TB_DEDUPE_POLICY_STOP && table->cache_pos >= table->cache_limit)) {
+            pack_strings_reset(encoder);
+        }
+        return;
+    }
+    _packer_clear_strings(encoder);
+}
+
+/**
+ * @brief Starts a session, where deduplicated strings persist across messages
+ * 
+ * @param encoder The packer instance, it must have TB_FEATURE_STRING_DEDUPE
+ * @param window Number of string ids the session may accumulate, once exceeded the strings
+ *               are reset at the start of the next message (see tiny_bits_packer_reset())
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer at the start of a stream, the unpacker on the other end must be in
+ * a session as well (see tiny_bits_unpacker_begin_session()). Registered strings are copied aside since the
+ * buffer is reused between messages.
+ */
+static inline int tiny_bits_packer_begin_session(tiny_bits_packer *encoder, uint32_t window) {
+    if (!encoder || !(encoder->features & TB_FEATURE_STRING_DEDUPE) || window < 1) return 0;
+    if (!encoder->strings) {
+        encoder->strings_capacity = 1024;
+        encoder->strings = (unsigned char *)_tb_alloc(encoder->allocator, encoder->strings_capacity);
+        if (!encoder->strings) return 0;
+    }
+    _packer_clear_strings(encoder);
+    encoder->session_window = window;
+    return 1;
+}
+
+/**
+ * @brief Makes the packer stream its output through a callback instead of growing its buffer
+ * 
+ * @param encoder The packer instance
+ * @param flush Called with the packed bytes whenever the buffer is full (and by tiny_bits_packer_flush()),
+ *              NULL turns streaming off
+ * @param context Passed to flush
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer. The buffer keeps the capacity the packer was created with and is
+ * only written out between values, so output of any size is packed in constant memory, except for single values
+ * (or containers started by pack_arr_begin()/pack_map_begin(), which stay in the buffer until ended) larger than
+ * the buffer. Deduplicated strings are copied aside as in a session. Call tiny_bits_packer_flush() once done.
+ */
+static inline int tiny_bits_packer_set_flush(tiny_bits_packer *encoder, tiny_bits_flush_fn flush, void *context) {
+    if (!encoder) return 0;
+    if (flush && (encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->strings) {
+        encoder->strings_capacity = 1024;
+        encoder->strings = (unsigned char *)_tb_alloc(encoder->allocator, encoder->strings_capacity);
+        if (!encoder->strings) return 0;
+        _packer_clear_strings(encoder);
+    }
+    encoder->flush = flush;
+    encoder->flush_context = context;
+    encoder->flushed = 0;
+    return 1;
+}
+
+/**
+ * @brief Hands the packed bytes to the flush callback and empties the buffer
+ * 
+ * @param encoder The packer instance, with a flush callback set
+ * @return 1 on success, 0 on error (no callback, the callback failed, or a container started by
+ *         pack_arr_begin()/pack_map_begin() is still open)
+ *
+ * @note Deduplicated strings stay registered, later strings may reference the flushed ones. Payloads packed by
+ * reference (see pack_blob_ref()) are passed to the callback as they are, between the buffer bytes around them.
+ */
+static inline int tiny_bits_packer_flush(tiny_bits_packer *encoder) {
+    if (!encoder || !encoder->flush || encoder->deferred_open) return 0;
+    // payloads packed by reference go out between the buffer bytes around them
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        if (ref->pos > start && !encoder->flush(encoder->flush_context, encoder->buffer + start, ref->pos - start)) return 0;
+        if (!encoder->flush(encoder->flush_context, (const uint8_t *)ref->data, ref->size)) return 0;
+        encoder->flushed += ref->pos - start + ref->size;
+        start = ref->pos;
+    }
+    if (encoder->current_pos > start) {
+        if (!encoder->flush(encoder->flush_context, encoder->buffer + start, encoder->current_pos - start)) return 0;
+        encoder->flushed += encoder->current_pos - start;
+    }
+    encoder->current_pos = 0;
+    encoder->refs_count = 0;
+    encoder->refs_size = 0;
+    return 1;
+}
+
+static inline int _packer_discard(void *context, const uint8_t *data, size_t size) {
+    (void)context;
+    (void)data;
+    (void)size;
+    return 1;
+}
+
+/**
+ * @brief Makes the packer measure messages instead of keeping them
+ * 
+ * @param encoder The packer instance, created with the features of the packer the message is meant for
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh packer. The same encoding runs (float compression, deduplication), but the bytes
+ * are dropped as the buffer fills and large payloads are never copied, tiny_bits_packer_measured() then gives
+ * the size of the buffer the message needs. A packer created with that capacity packs the message without
+ * growing its buffer.
+ * tiny_bits_packer_reset() starts the next measure.
+ */
+static inline int tiny_bits_packer_set_measure(tiny_bits_packer *encoder) {
+    if (!encoder || encoder->flush || encoder->current_pos) return 0;
+    if (!tiny_bits_packer_set_flush(encoder, _packer_discard, NULL)) return 0;
+    encoder->measuring = 1;
+    return 1;
+}
+
+/**
+ * @brief Size of the message packed since the last reset by a measuring packer
+ * 
+ * @param encoder The packer instance, see tiny_bits_packer_set_measure()
+ * @return Number of bytes
+ *
+ * @note Containers started with pack_arr_begin() or pack_map_begin() hold a 6 byte header until they end, and
+ * only then shrink it. The buffer has to hold it meanwhile, so up to 5 bytes more than the message are counted
+ * for each of those.
+ */
+static inline size_t tiny_bits_packer_measured(tiny_bits_packer *encoder) {
+    if (!encoder) return 0;
+    size_t size = encoder->flushed + encoder->current_pos + encoder->refs_size;
+    return size > encoder->measured_peak ? size : encoder->measured_peak;
+}
+
+#if defined(TB_WITH_POOL)
+/**
+ * @brief Makes the packer borrow its buffer from a shared pool
+ * 
+ * @param encoder The packer instance
+ * @param pool The pool, shared by any number of packers and threads
+ * @param keep_capacity Buffer size the packer keeps across resets, a buffer grown beyond it for a large
+ *                      message goes back to the pool on tiny_bits_packer_reset() (and on destroy)
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer. Buffers come in power of two size classes, so growing
+ * doubles the buffer. The pool must outlive the packer. Only there when TB_WITH_POOL is defined.
+ */
+static inline int tiny_bits_packer_set_pool(tiny_bits_packer *encoder, tiny_bits_buffer_pool *pool, size_t keep_capacity) {
+    if (!encoder || !pool || encoder->pool || encoder->current_pos) return 0;
+    size_t capacity;
+    unsigned char *buffer = (unsigned char *)tiny_bits_pool_acquire(pool, keep_capacity, &capacity);
+    if (!buffer) return 0;
+    _tb_free(encoder->allocator, encoder->buffer);
+    encoder->buffer = buffer;
+    encoder->capacity = capacity;
+    encoder->pool = pool;
+    encoder->pool_keep = capacity;
+    return 1;
+}
+#endif // TB_WITH_POOL
+
+/**
+ * @brief Sets how many distinct strings the packer deduplicates per message
+ * 
+ * @param encoder The packer instance
+ * @param max_entries Maximum number of strings in the dedupe table, the table grows up to it as needed
+ * @param policy What happens once the table is full, TB_DEDUPE_POLICY_STOP (send new strings inline
+ *               without registering them) or TB_DEDUPE_POLICY_LRU (forget the least recently used ones)
+ * @return 1 on success, 0 on error
+ *
+ * @note The default is TB_HASH_CACHE_SIZE (256) entries with TB_DEDUPE_POLICY_STOP, the only setting older
+ * unpackers (limited to 256 strings) can decode. This clears the table, call it between messages.
+ */
+static inline int tiny_bits_packer_set_dedupe_limit(tiny_bits_packer *encoder, uint32_t max_entries, uint8_t policy) {
+    if (!encoder || !(encoder->features & TB_FEATURE_STRING_DEDUPE) || max_entries < 1) return 0;
+    HashTable table;
+    uint32_t initial = max_entries < TB_HASH_CACHE_SIZE ? max_entries : TB_HASH_CACHE_SIZE;
+    if (!hash_table_init_with(&table, initial, max_entries, policy, encoder->allocator)) return 0;
+    hash_table_free(&encoder->encode_table);
+    encoder->encode_table = table;
+    return 1;
+}
+
+/**
  * @brief Deallocate the packer object and its internal data structures
  * 
  * @param encoder The unpacker instance
@@ -502,10 +1654,18 @@ void tiny_bits_packer_destroy(tiny_bits_packer *encoder) {
     if (!encoder) return;
     
     if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
-        free(encoder->encode_table.cache);
+        hash_table_free(&encoder->encode_table);
     }
-    free(encoder->buffer);
-    free(encoder);
+    _tb_free(encoder->allocator, encoder->strings);
+    _tb_free(encoder->allocator, encoder->refs);
+#if defined(TB_WITH_POOL)
+    if (encoder->pool) {
+        tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+        encoder->buffer = NULL;
+    }
+#endif
+    _tb_free(encoder->allocator, encoder->buffer);
+    _tb_free(encoder->allocator, encoder);
 }
 
 /**
@@ -576,41 +1736,168 @@ static inline int pack_map(tiny_bits_packer *encoder, int map_len){
     return written;
 }
 
+// Reserves a container header with a 4 byte count (tag, varint prefix 251 and 4 bytes), see pack_arr_begin()
+static inline int _pack_deferred_begin(tiny_bits_packer *encoder, uint8_t tag, size_t *mark){
+    if (encoder && encoder->flush && !encoder->deferred_open && encoder->current_pos > encoder->capacity / 2) {
+        // the container stays in the buffer until ended, give it room
+        if (!tiny_bits_packer_flush(encoder)) return 0;
+    }
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, TB_DEFERRED_HEADER_SIZE);
+    if (!buffer || !mark) return 0;
+    *mark = encoder->current_pos;
+    buffer[0] = tag;
+    buffer[1] = 251;
+    encoder->current_pos += TB_DEFERRED_HEADER_SIZE;
+    encoder->deferred_open++;
+    return TB_DEFERRED_HEADER_SIZE;
+}
+
+// Patches the header reserved at mark with the count, shrinking it to its smallest form when the body is short
+static inline int _pack_deferred_end(tiny_bits_packer *encoder, uint8_t tag, uint8_t embedded_len, size_t mark, uint32_t count){
+    if (!encoder || mark + TB_DEFERRED_HEADER_SIZE > encoder->current_pos) return 0;
+    uint8_t *header = encoder->buffer + mark;
+    if (header[0] != (tag | embedded_len) || header[1] != 251 || !encoder->deferred_open) return 0; // not a reserved header
+    encoder->deferred_open--;
+    if (encoder->measuring) {
+        // the real buffer holds the whole header until here
+        size_t held = encoder->flushed + encoder->current_pos + encoder->refs_size;
+        if (held > encoder->measured_peak) encoder->measured_peak = held;
+    }
+    size_t body = mark + TB_DEFERRED_HEADER_SIZE;
+    size_t body_size = encoder->current_pos - body;
+    if (body_size > TB_DEFERRED_SHIFT_LIMIT && count >= embedded_len) {
+        // too long to move, keep the 4 byte count (a longer varint than needed decodes all the same)
+        uint32_t value = count - embedded_len;
+        header[2] = (uint8_t)(value >> 24);
+        header[3] = (uint8_t)(value >> 16);
+        header[4] = (uint8_t)(value >> 8);
+        header[5] = (uint8_t)value;
+        return TB_DEFERRED_HEADER_SIZE;
+    }
+    uint8_t compact[TB_DEFERRED_HEADER_SIZE];
+    int header_size = 1;
+    if (count < embedded_len) {
+        compact[0] = tag | (uint8_t)count;
+    } else {
+        compact[0] = tag | embedded_len;
+        header_size += encode_varint((uint64_t)(count - embedded_len), compact + 1);
+    }
+    size_t shift = TB_DEFERRED_HEADER_SIZE - header_size;
+    memcpy(header, compact, header_size);
+    if (shift) {
+        memmove(header + header_size, header + TB_DEFERRED_HEADER_SIZE, body_size);
+        encoder->current_pos -= shift;
+        // deduplicated strings in the body moved with it
+        if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->strings) {
+            HashTable *table = &encoder->encode_table;
+            for (uint32_t i = 0; i < table->cache_pos; i++) {
+                if (table->cache[i].offset >= body) table->cache[i].offset -= (uint32_t)shift;
+            }
+        }
+        for (uint32_t i = encoder->refs_count; i > 0 && encoder->refs[i - 1].pos >= body; i--) {
+            encoder->refs[i - 1].pos -= shift;
+        }
+    }
+    return header_size;
+}
+
 /**
- * @brief Packs an integer value into the buffer
- * 
+ * @brief Starts an array whose length is only known once its elements are packed
+ *
  * @param encoder Pointer to the packer instance
- * @param value The integer value to pack
+ * @param mark Set to the position of the header, to pass to pack_arr_end()
  * @return Number of bytes written, or 0 on error
- * 
- * @note Uses a compact representation for small values and SQLite4 like integer encoding for larger values
+ *
+ * @note A 6 byte header is reserved, pack_arr_end() writes the length into it. Containers started this way
+ * must be ended in reverse order, an inner one before the one holding it.
  */
-static inline int pack_int(tiny_bits_packer *encoder, int64_t value){
-    int written = 0;
-    int needed_size = 10;
-    uint8_t *buffer;
-    buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
-    if (!buffer) return 0; // Handle error
-    //printf("value is %ld\n", value);
+static inline int pack_arr_begin(tiny_bits_packer *encoder, size_t *mark){
+    return _pack_deferred_begin(encoder, TB_ARR_TAG | TB_ARR_LEN, mark);
+}
 
-    if (value >= 0 && value < 120) {
-        buffer[0] = (uint8_t)(TB_INT_TAG | value);  // No continuation
-        //printf("value is %ld, wrote to buffer %x\n", value, buffer[0]);
-        encoder->current_pos += 1;
-        return 1;
-    } else if (value >= 120) {
+/**
+ * @brief Ends an array started with pack_arr_begin()
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark The position set by pack_arr_begin()
+ * @param arr_len Number of elements packed since
+ * @return Size of the header as finally written, or 0 on error
+ *
+ * @note Unless the elements take more than TB_DEFERRED_SHIFT_LIMIT bytes, they are moved back so the header
+ * takes the same bytes as with pack_arr(). Longer arrays keep the reserved header.
+ */
+static inline int pack_arr_end(tiny_bits_packer *encoder, size_t mark, uint32_t arr_len){
+    return _pack_deferred_end(encoder, TB_ARR_TAG, TB_ARR_LEN, mark, arr_len);
+}
+
+/**
+ * @brief Starts a map whose length is only known once its key-value pairs are packed
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark Set to the position of the header, to pass to pack_map_end()
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note See pack_arr_begin()
+ */
+static inline int pack_map_begin(tiny_bits_packer *encoder, size_t *mark){
+    return _pack_deferred_begin(encoder, TB_MAP_TAG | TB_MAP_LEN, mark);
+}
+
+/**
+ * @brief Ends a map started with pack_map_begin()
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark The position set by pack_map_begin()
+ * @param map_len Number of key-value pairs packed since
+ * @return Size of the header as finally written, or 0 on error
+ *
+ * @note See pack_arr_end()
+ */
+static inline int pack_map_end(tiny_bits_packer *encoder, size_t mark, uint32_t map_len){
+    return _pack_deferred_end(encoder, TB_MAP_TAG, TB_MAP_LEN, mark, map_len);
+}
+
+static inline int _encode_int(uint8_t *buffer, int64_t value){
+    if (value >= 0 && value < 120) {
+        buffer[0] = (uint8_t)(TB_INT_TAG | value);  // No continuation
+        return 1;
+    } else if (value >= 120) {
         buffer[0] = 248;  // Tag for positive with continuation
         value -= 120;
     } else if (value > -7) {
         buffer[0] = (uint8_t)(248 + (-value));  // No continuation
-        encoder->current_pos += 1;
         return 1;
     } else {
         buffer[0] = 255;  // Tag for negative with continuation
         value = -(value + 7);  // Store positive magnitude
     }
     // Encode continuation bytes in BER format (7 bits per byte)
-    written += encode_varint(value, buffer + 1) + 1 ;
+    return encode_varint(value, buffer + 1) + 1;
+}
+
+// Number of bytes _encode_int() writes for value
+static inline int _int_size(int64_t value){
+    if (value >= 0 && value < 120) return 1;
+    if (value >= 120) return 1 + varint_size((uint64_t)value - 120);
+    if (value > -7) return 1;
+    return 1 + varint_size((uint64_t)-(value + 7));
+}
+
+/**
+ * @brief Packs an integer value into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param value The integer value to pack
+ * @return Number of bytes written, or 0 on error
+ * 
+ * @note Uses a compact representation for small values and SQLite4 like integer encoding for larger values
+ */
+static inline int pack_int(tiny_bits_packer *encoder, int64_t value){
+    int written = 0;
+    uint8_t *buffer;
+    buffer = tiny_bits_packer_ensure_capacity(encoder, _int_size(value));
+    if (!buffer) return 0; // Handle error
+    written = _encode_int(buffer, value);
     encoder->current_pos += written;
     return written;
 }
@@ -694,6 +1981,107 @@ static inline int pack_negative_infinity(tiny_bits_packer *encoder){
     return _pack_tag_only(encoder, (uint8_t)TB_NNF_TAG);
 }
 
+// Writes the header of a payload packed by reference and records where the caller's bytes go
+static inline int _pack_ref(tiny_bits_packer *encoder, uint8_t tag, uint8_t embedded_len, const void *data, size_t size){
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 1 + varint_size((uint64_t)(size - embedded_len)));
+    if (!buffer) return 0;
+    if (!encoder->measuring && encoder->refs_count == encoder->refs_capacity) {
+        uint32_t new_capacity = encoder->refs_capacity ? encoder->refs_capacity * 2 : 16;
+        tiny_bits_ref *new_refs = (tiny_bits_ref *)_tb_realloc(encoder->allocator, encoder->refs, new_capacity * sizeof(tiny_bits_ref));
+        if (!new_refs) return 0;
+        encoder->refs = new_refs;
+        encoder->refs_capacity = new_capacity;
+    }
+    buffer[0] = tag | embedded_len;
+    int written = 1 + encode_varint((uint64_t)(size - embedded_len), buffer + 1);
+    encoder->current_pos += written;
+    if (encoder->measuring) {
+        encoder->flushed += size; // counted, never copied
+        return written + (int)size;
+    }
+    tiny_bits_ref *ref = &encoder->refs[encoder->refs_count++];
+    ref->pos = encoder->current_pos;
+    ref->data = data;
+    ref->size = size;
+    encoder->refs_size += size;
+    return written + (int)size;
+}
+
+/**
+ * @brief Number of bytes pack_str() writes for a string of str_len bytes sent inline
+ *
+ * @note A deduplicated string takes less, measure the message (see tiny_bits_packer_set_measure()) to account
+ * for deduplication
+ */
+static inline size_t tiny_bits_size_of_str(uint32_t str_len){
+    return (str_len < TB_STR_LEN ? 1 : 1 + varint_size(str_len - TB_STR_LEN)) + (size_t)str_len;
+}
+
+// Looks a string up in the dictionary, then in the dedupe table. Returns 1 and sets id when found, the hash code
+// is set whenever the string may be registered.
+static inline int _packer_find_str(tiny_bits_packer *encoder, const char *str, uint32_t str_len, uint32_t *id, uint32_t *hash_code) {
+    uint32_t dictionary_size = encoder->dictionary.next_id;
+    if (((encoder->features & TB_FEATURE_STRING_DEDUPE) || dictionary_size) && str_len >= 2 && str_len <= 128) {
+        *hash_code = string_hash_32(str, str_len);
+        HashEntry *entry = NULL;
+        if (dictionary_size) {
+            entry = hash_table_lookup(&encoder->dictionary, (const unsigned char *)encoder->dictionary_data, 
+                                      str, str_len, *hash_code);
+            if (entry) {
+                *id = entry->id;
+                return 1;
+            }
+        }
+        if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
+            const unsigned char *base = encoder->strings ? encoder->strings : encoder->buffer;
+            entry = hash_table_lookup(&encoder->encode_table, base, str, str_len, *hash_code);
+            if (entry) {
+                // message strings are numbered after the dictionary ones
+                *id = dictionary_size + entry->id;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Writes the id of a deduplicated string
+static inline int _encode_str_id(uint8_t *buffer, uint32_t id) {
+    if (id < TB_REF_LEN) {
+        buffer[0] = TB_REF_TAG | id;
+        return 1;
+    }
+    buffer[0] = TB_REF_TAG | TB_REF_LEN;
+    return 1 + encode_varint(id - TB_REF_LEN, buffer + 1);
+}
+
+// Writes a string inline, header and bytes
+static inline int _encode_str(uint8_t *buffer, const char *str, uint32_t str_len) {
+    if (str_len < TB_STR_LEN) {
+        buffer[0] = TB_STR_TAG | str_len;
+        fast_memcpy(buffer + 1, str, str_len);
+        return 1 + str_len;
+    }
+    buffer[0] = TB_STR_TAG | TB_STR_LEN;
+    int written = 1 + encode_varint(str_len - TB_STR_LEN, buffer + 1);
+    memcpy(buffer + written, str, str_len);
+    return written + str_len;
+}
+
+// Registers a string just written inline at buffer position pos, copying it aside when strings is set (the caller
+// makes room for it there)
+static inline void _packer_keep_str(tiny_bits_packer *encoder, uint32_t hash_code, const char *str, uint32_t str_len, size_t pos) {
+    if (encoder->strings) {
+        uint32_t offset = encoder->strings_size;
+        if (hash_table_insert(&encoder->encode_table, hash_code, str_len, offset)) {
+            memcpy(encoder->strings + offset, str, str_len);
+            encoder->strings_size += str_len;
+        }
+    } else {
+        hash_table_insert(&encoder->encode_table, hash_code, str_len, (uint32_t)pos);
+    }
+}
+
 /**
  * @brief Packs a string into the buffer
  * 
@@ -706,114 +2094,73 @@ static inline int pack_negative_infinity(tiny_bits_packer *encoder){
  */
 static inline int pack_str(tiny_bits_packer *encoder, char* str, uint32_t str_len) {
     uint32_t id = 0;
-    int found = 0;
+    uint32_t hash_code = 0;
     int written = 0;
-    int needed_size = 0;
+    int written_reset = 0;
     uint8_t *buffer;
-    uint32_t hash_code = 0;
-    uint32_t hash = 0;
-    if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128) {
-        hash_code = fast_hash_32(str, str_len);
-        hash = hash_code % TB_HASH_SIZE;
-        uint8_t index = encoder->encode_table.bins[hash];
-        while (index > 0) {
-            HashEntry entry = encoder->encode_table.cache[index - 1];
-            if (hash_code == entry.hash 
-                && str_len == entry.length
-                && fast_memcmp(str, encoder->buffer + entry.offset, str_len) == 0 ) {
-                id = index - 1;
-                found = 1;
-                break;
-            }
-            index = entry.next_index;
-        }
-    }
 
-    if (found) {
+    if (_packer_find_str(encoder, str, str_len, &id, &hash_code)) {
         // Encode existing string ID
-        if (id < 31) {
-            needed_size = 1;
-        } else {
-            needed_size = 1 + varint_size(id - 31);
-        }
-        buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
+        buffer = tiny_bits_packer_ensure_capacity(encoder, id < TB_REF_LEN ? 1 : 1 + varint_size(id - TB_REF_LEN));
         if (!buffer) return 0;
-
-        if (id < TB_REF_LEN) {
-            buffer[0] = TB_REF_TAG | id;
-            written = 1;
-        } else {
-            buffer[0] = TB_REF_TAG | TB_REF_LEN;
-            written = 1;
-            written += encode_varint(id - TB_REF_LEN, buffer + written);
-        }
+        written = _encode_str_id(buffer, id);
     } else {
-       needed_size = 10 + str_len;
-        buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
-        if (!buffer) return 0;
-
-        if (str_len < TB_STR_LEN) {
-            buffer[0] = TB_STR_TAG | str_len;
-            written = 1;
-            fast_memcpy(buffer + written, str, str_len);
-            written += str_len;
-        } else {
-            buffer[0] = TB_STR_TAG | TB_STR_LEN;
-            written = 1;
-            written += encode_varint(str_len - TB_STR_LEN, buffer + written);
-            memcpy(buffer + written, str, str_len);
-            written += str_len;
+        int keep = (encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128;
+        if (keep && encoder->strings) {
+            HashTable *table = &encoder->encode_table;
+            if (encoder->flush && !encoder->measuring && encoder->strings_size + str_len > encoder->strings_capacity
+                && table->policy == TB_DEDUPE_POLICY_LRU && table->cache_pos >= table->cache_limit) {
+                // a streaming packer never resets on its own, start over instead of keeping evicted strings
+                if (!pack_strings_reset(encoder)) return 0;
+                written_reset = 2;
+            }
+            // copy aside first, failing here leaves the packer untouched
+            if (encoder->strings_size + str_len > encoder->strings_capacity) {
+                size_t new_capacity = encoder->strings_capacity + str_len + encoder->strings_capacity;
+                unsigned char *new_strings = (unsigned char *)_tb_realloc(encoder->allocator, encoder->strings, new_capacity);
+                if (!new_strings) return 0;
+                encoder->strings = new_strings;
+                encoder->strings_capacity = new_capacity;
+            }
         }
-        
-        if ((encoder->features & TB_FEATURE_STRING_DEDUPE) 
-            && encoder->encode_table.cache_pos < TB_HASH_CACHE_SIZE
-            && str_len >= 2 && str_len <= 128){ 
-            HashEntry* new_entry = &encoder->encode_table.cache[encoder->encode_table.cache_pos++];
-            new_entry->hash = hash_code; 
-            new_entry->length = str_len;
-            new_entry->offset = encoder->current_pos + written - str_len;
-            new_entry->next_index = encoder->encode_table.bins[hash];
-            encoder->encode_table.bins[hash] = encoder->encode_table.cache_pos;
+        if (!keep && encoder->measuring && !encoder->deferred_open && str_len >= TB_REF_MIN_SIZE) {
+            return _pack_ref(encoder, TB_STR_TAG, TB_STR_LEN, str, str_len); // only counted
         }
-
+        buffer = tiny_bits_packer_ensure_capacity(encoder, tiny_bits_size_of_str(str_len));
+        if (!buffer) return 0;
+        written = _encode_str(buffer, str, str_len);
+        if (keep) _packer_keep_str(encoder, hash_code, str, str_len, encoder->current_pos + written - str_len);
     }
 
     encoder->current_pos += written;
-    return written;
+    return written + written_reset;
 }
 
-/**
- * @brief Packs a double-precision floating point value into the buffer
- * 
- * @param encoder Pointer to the packer instance
- * @param val The double value to pack
- * @return Number of bytes written, or 0 on error
- * 
- * @note If TB_FEATURE_COMPRESS_FLOATS is enabled, this will use a more compact representation for some values
- */
-static inline int pack_double(tiny_bits_packer *encoder, double val) {
+// Same as _encode_double() given the decimal places of the value, see decimal_places_count()
+static inline int _encode_double_places(uint8_t *buffer, double val, uint8_t features, int multiplies, double scaled) {
     int written = 0;
-    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 10);
-    if (!buffer) return 0;
     if(isnan(val)){
-      return pack_nan(encoder);
+      buffer[0] = TB_NAN_TAG;
+      return 1;
     } 
     if(isinf(val)){
-      if(val > 0){
-        return pack_infinity(encoder);
-      } else {
-        return pack_negative_infinity(encoder);
-      }
+      buffer[0] = val > 0 ? TB_INF_TAG : TB_NNF_TAG;
+      return 1;
+    }
+    // narrower IEEE 754 formats, only when they hold the exact same value
+    int narrow_size = 9;
+    float narrow_float = 0;
+    uint16_t narrow_half = 0;
+    if (features & TB_FEATURE_NARROW_FLOATS) {
+        if (double_to_float_exact(val, &narrow_float)) {
+            narrow_size = float_to_half_exact(narrow_float, &narrow_half) ? 3 : 5;
+        }
     }
     // scaled varint encoding
-    if (encoder->features & TB_FEATURE_COMPRESS_FLOATS) {
-        double abs_val = fabs(val); ///val >= 0 ? val : -val;
-        double scaled; //= abs_val;
-        int multiplies = decimal_places_count(abs_val, &scaled);
+    if (features & TB_FEATURE_COMPRESS_FLOATS) {
         if(multiplies >= 0){
             uint64_t integer = (uint64_t)scaled;
             if(integer < (1ULL << 48)) {
-                if (!buffer) return 0;
                 if(val >= 0){
                     buffer[0] = TB_PFP_TAG | (multiplies);
                 } else {
@@ -821,21 +2168,229 @@ static inline int pack_double(tiny_bits_packer *encoder, double val) {
                 }
                 written++;
                 written += encode_varint(integer, buffer + written);
-                encoder->current_pos += written;
-                return written;
+                if (written <= narrow_size) return written;
             }
         }
 
     }
+    if (narrow_size == 3) {
+        buffer[0] = TB_F16_TAG;
+        buffer[1] = (uint8_t)(narrow_half >> 8);
+        buffer[2] = (uint8_t)narrow_half;
+        return 3;
+    }
+    if (narrow_size == 5) {
+        uint32_t bits;
+        memcpy(&bits, &narrow_float, 4);
+        buffer[0] = TB_F32_TAG;
+        buffer[1] = (uint8_t)(bits >> 24);
+        buffer[2] = (uint8_t)(bits >> 16);
+        buffer[3] = (uint8_t)(bits >> 8);
+        buffer[4] = (uint8_t)bits;
+        return 5;
+    }
     // Fallback to raw double
     buffer[0] = TB_F64_TAG;
-    written++;
+    written = 1;
     encode_uint64(dtoi_bits(val), buffer + written);
     written += 8;
+    return written;
+}
+
+// Same as _encode_double(), trying the decimal places in *places first and leaving those of val there
+static inline int _encode_double_near(uint8_t *buffer, double val, uint8_t features, int8_t *places) {
+    double scaled = 0;
+    int multiplies = -1;
+    if ((features & TB_FEATURE_COMPRESS_FLOATS) && isfinite(val)) {
+        multiplies = decimal_places_count_near(fabs(val), *places, &scaled);
+        *places = (int8_t)multiplies;
+    }
+    return _encode_double_places(buffer, val, features, multiplies, scaled);
+}
+
+// Writes a double (tag and payload), the caller reserves 10 bytes
+static inline int _encode_double(uint8_t *buffer, double val, uint8_t features) {
+    int8_t places = -1;
+    return _encode_double_near(buffer, val, features, &places);
+}
+
+/**
+ * @brief Packs a double-precision floating point value into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param val The double value to pack
+ * @return Number of bytes written, or 0 on error
+ * 
+ * @note If TB_FEATURE_COMPRESS_FLOATS is enabled, this will use a more compact representation for some values
+ * @note If TB_FEATURE_NARROW_FLOATS is enabled, values a float (or a half) holds exactly are packed as such,
+ * in 5 (or 3) bytes instead of 9. The smallest lossless form is used when both features are enabled.
+ */
+static inline int pack_double(tiny_bits_packer *encoder, double val) {
+    int written = 0;
+    uint8_t scratch[10];
+    if (!encoder) return 0;
+    if (encoder->capacity - encoder->current_pos < 10) {
+        // near the end of the buffer reserve only what the value takes, a buffer sized by measuring never grows
+        written = _encode_double_near(scratch, val, encoder->features, &encoder->float_places);
+        uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, written);
+        if (!buffer) return 0;
+        memcpy(buffer, scratch, written);
+    } else {
+        written = _encode_double_near(encoder->buffer + encoder->current_pos, val, encoder->features,
+                                      &encoder->float_places);
+    }
     encoder->current_pos += written;
     return written;
 }
 
+// Writes an array header, the caller reserves 10 bytes
+static inline int _encode_arr_header(uint8_t *buffer, size_t arr_len){
+    if(arr_len < TB_ARR_LEN){
+      buffer[0] = TB_ARR_TAG | arr_len;
+      return 1;
+    }
+    buffer[0] = TB_ARR_TAG | TB_ARR_LEN;
+    return 1 + encode_varint((uint64_t)(arr_len - TB_ARR_LEN), buffer + 1);
+}
+
+// Writes integers as pack_int() does, the caller reserves 10 bytes per value
+static inline size_t _encode_int_values(uint8_t *buffer, const int64_t *values, size_t count){
+    size_t written = 0;
+    size_t blocks = count & ~(size_t)7;
+    size_t i = 0;
+    for (; i < blocks; i += 8) {
+        const int64_t *v = values + i;
+        // branchless check, compiles to a vector compare
+        int small = ((uint64_t)v[0] < 120) & ((uint64_t)v[1] < 120) & ((uint64_t)v[2] < 120) & ((uint64_t)v[3] < 120)
+                  & ((uint64_t)v[4] < 120) & ((uint64_t)v[5] < 120) & ((uint64_t)v[6] < 120) & ((uint64_t)v[7] < 120);
+        if (small) {
+            for (int j = 0; j < 8; j++) buffer[written + j] = (uint8_t)(TB_INT_TAG | v[j]);
+            written += 8;
+        } else {
+            for (int j = 0; j < 8; j++) written += _encode_int(buffer + written, v[j]);
+        }
+    }
+    for (; i < count; i++) {
+        written += _encode_int(buffer + written, values[i]);
+    }
+    return written;
+}
+
+// Writes doubles as pack_double() does, the caller reserves 10 bytes per value
+static inline size_t _encode_double_values(uint8_t *buffer, const double *values, size_t count, uint8_t features){
+    size_t written = 0;
+    if (!(features & TB_FEATURE_COMPRESS_FLOATS)) {
+        for (size_t i = 0; i < count; i++) {
+            written += _encode_double(buffer + written, values[i], features);
+        }
+        return written;
+    }
+    // decimal places are found a chunk at a time
+    double abs_vals[64], scaled[64];
+    int8_t places[64];
+    for (size_t start = 0; start < count; start += 64) {
+        size_t n = count - start < 64 ? count - start : 64;
+        for (size_t i = 0; i < n; i++) abs_vals[i] = fabs(values[start + i]);
+        decimal_places_count_batch(abs_vals, n, places, scaled);
+        for (size_t i = 0; i < n; i++) {
+            written += _encode_double_places(buffer + written, values[start + i], features, places[i], scaled[i]);
+        }
+    }
+    return written;
+}
+
+// Number of bytes _encode_int_values() writes
+static inline size_t _int_values_size(const int64_t *values, size_t count){
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) size += _int_size(values[i]);
+    return size;
+}
+
+// Number of bytes _encode_double_values() writes, found by encoding a chunk at a time
+static inline size_t _double_values_size(const double *values, size_t count, uint8_t features){
+    uint8_t scratch[64 * 10];
+    size_t size = 0;
+    for (size_t start = 0; start < count; start += 64) {
+        size += _encode_double_values(scratch, values + start, count - start < 64 ? count - start : 64, features);
+    }
+    return size;
+}
+
+// Number of array elements reserved at once: all of them, unless a streaming packer's buffer can't hold them
+static inline size_t _packer_slice(tiny_bits_packer *encoder, size_t count){
+    if (!encoder->flush || 10 + count * 10 <= encoder->capacity) return count;
+    size_t slice = encoder->capacity > 20 ? (encoder->capacity - 10) / 10 : 1;
+    return slice < count ? slice : count;
+}
+
+static inline size_t tiny_bits_size_of_arr(size_t arr_len);
+
+// Shared by pack_int_array() and pack_double_array(), one of ints or doubles is set
+static inline int _pack_array_values(tiny_bits_packer *encoder, const int64_t *ints, const double *doubles, size_t count){
+    if (!encoder || (!ints && !doubles && count)) return 0;
+    if (count > (INT32_MAX - 10) / 10) return 0; // the byte count must fit the return value
+    uint8_t features = encoder->features;
+    size_t slice = _packer_slice(encoder, count);
+    size_t reserved = 10 + slice * 10;
+    size_t available = encoder->capacity - encoder->current_pos;
+    size_t header_size = tiny_bits_size_of_arr(count);
+    if (slice == count && reserved > available && header_size + count <= available) {
+        // the values may still fit, reserve what they take so that a buffer sized by measuring never grows
+        reserved = header_size + (ints ? _int_values_size(ints, count) : _double_values_size(doubles, count, features));
+    }
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, reserved);
+    if (!buffer) return 0; // Handle error
+
+    size_t header = _encode_arr_header(buffer, count);
+    encoder->current_pos += header;
+    size_t written = header;
+    for (size_t start = 0; start < count; start += slice) {
+        size_t n = count - start < slice ? count - start : slice;
+        if (start) {
+            // later slices of a streamed array, the buffer may be flushed in between
+            buffer = tiny_bits_packer_ensure_capacity(encoder, n * 10);
+            if (!buffer) return 0;
+        } else {
+            buffer += header;
+        }
+        size_t part = ints ? _encode_int_values(buffer, ints + start, n)
+                           : _encode_double_values(buffer, doubles + start, n, features);
+        encoder->current_pos += part;
+        written += part;
+    }
+    return (int)written;
+}
+
+/**
+ * @brief Packs an array of integers, same as pack_arr() followed by pack_int() for each element
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the integers
+ * @param count Number of integers
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note Space is reserved once for the whole array and runs of small positive integers
+ * (0-119, one byte each) are written eight at a time. A streaming packer reserves space for
+ * as many elements as its buffer holds at a time.
+ */
+static inline int pack_int_array(tiny_bits_packer *encoder, const int64_t *values, size_t count){
+    if (!values && count) return 0;
+    return _pack_array_values(encoder, values, NULL, count);
+}
+
+/**
+ * @brief Packs an array of doubles, same as pack_arr() followed by pack_double() for each element
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the doubles
+ * @param count Number of doubles
+ * @return Number of bytes written, or 0 on error
+ */
+static inline int pack_double_array(tiny_bits_packer *encoder, const double *values, size_t count){
+    if (!values && count) return 0;
+    return _pack_array_values(encoder, NULL, values, count);
+}
+
 /**
  * @brief Packs a unixtime double-precision floating point value, along with a time zone offset into the buffer
  * 
@@ -847,7 +2402,7 @@ static inline int pack_double(tiny_bits_packer *encoder, double val) {
  */
 static inline int pack_datetime(tiny_bits_packer *encoder, double val, int16_t offset) {
     int written = 0;
-    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 11);
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 10);
     if (!buffer) return 0;
     buffer[0] = TB_DTM_TAG;
     buffer[1] = (int8_t) ((offset % 86400) / (60*15)); // convert seconds to multiples of 15 minutes
@@ -872,6 +2427,9 @@ static inline int pack_blob(tiny_bits_packer *encoder, const char* blob, int blo
     int needed_size;
     uint8_t *buffer;
 
+    if (encoder && encoder->measuring && !encoder->deferred_open && blob_size >= TB_REF_MIN_SIZE) {
+        return _pack_ref(encoder, TB_BLB_TAG, 0, blob, (size_t)blob_size); // only counted
+    }
     needed_size = 1 + varint_size((uint64_t)blob_size) + blob_size;
     buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
     if (!buffer) return 0; // Handle error
@@ -885,50 +2443,507 @@ static inline int pack_blob(tiny_bits_packer *encoder, const char* blob, int blo
     return written;
 }
 
-/* End packer.h */
+/**
+ * @brief Packs a binary blob without copying it, only its header goes into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param blob Pointer to the binary data, it must stay valid and unchanged until the message is written out
+ * @param blob_size Size of the binary data in bytes
+ * @return Number of bytes the blob adds to the message, or 0 on error
+ *
+ * @note The message is then no longer the buffer alone, write it out with tiny_bits_packer_iovec() (or copy it
+ * with tiny_bits_packer_gather()). A streaming packer hands the blob to its flush callback as is. Blobs shorter
+ * than TB_REF_MIN_SIZE are copied, as by pack_blob().
+ */
+static inline int pack_blob_ref(tiny_bits_packer *encoder, const char* blob, int blob_size){
+    if (!encoder || blob_size < 0) return 0;
+    if (blob_size < TB_REF_MIN_SIZE) return pack_blob(encoder, blob, blob_size);
+    return _pack_ref(encoder, TB_BLB_TAG, 0, blob, (size_t)blob_size);
+}
 
-/* Begin unpacker.h */
+/**
+ * @brief Packs a string without copying it, only its header goes into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param str Pointer to the string data, it must stay valid and unchanged until the message is written out
+ * @param str_len Length of the string in bytes
+ * @return Number of bytes the string adds to the message, or 0 on error
+ *
+ * @note Same as pack_blob_ref(). Strings shorter than TB_REF_MIN_SIZE are copied by pack_str(), longer ones are
+ * never deduplicated anyway.
+ */
+static inline int pack_str_ref(tiny_bits_packer *encoder, const char* str, uint32_t str_len){
+    if (!encoder) return 0;
+    if (str_len < TB_REF_MIN_SIZE) return pack_str(encoder, (char *)str, str_len);
+    return _pack_ref(encoder, TB_STR_TAG, TB_STR_LEN, str, str_len);
+}
 
+/**
+ * @brief Size of the packed message, including the payloads packed by reference
+ * 
+ * @param encoder The packer instance
+ * @return Number of bytes
+ */
+static inline size_t tiny_bits_packer_size(tiny_bits_packer *encoder) {
+    return encoder ? encoder->current_pos + encoder->refs_size : 0;
+}
 
+/**
+ * @brief Number of entries tiny_bits_packer_iovec() fills for the packed message
+ * 
+ * @param encoder The packer instance
+ * @return Number of entries, at most twice the number of payloads packed by reference plus one
+ */
+static inline int tiny_bits_packer_iovec_count(tiny_bits_packer *encoder) {
+    if (!encoder) return 0;
+    size_t last = encoder->refs_count ? encoder->refs[encoder->refs_count - 1].pos : 0;
+    return (int)encoder->refs_count * 2 + (encoder->current_pos > last);
+}
 
-// Decoder return types
-enum tiny_bits_type {
-    TINY_BITS_ARRAY,    // length: number of elements
-    TINY_BITS_MAP,      // length: number of key-value pairs
-    TINY_BITS_INT,      // int_val: integer value
-    TINY_BITS_DOUBLE,   // double_val: double value
-    TINY_BITS_STR,      // str_blob_val.length: byte length of string, str_blob_val.data: pointer to string
-    TINY_BITS_BLOB,     // str_blob_val.length: byte length of blob, str_blob_val.data: pointer to blob
-    TINY_BITS_TRUE,     // No value
-    TINY_BITS_FALSE,    // No value
-    TINY_BITS_NULL,     // No value
-    TINY_BITS_NAN,      // No value
-    TINY_BITS_INF,      // No value
-    TINY_BITS_N_INF,    // No value
-    TINY_BITS_EXT,      // No value
-    TINY_BITS_SEP,      // No balue
-    TINY_BITS_FINISHED, // End of buffer
-    TINY_BITS_ERROR,     // Parsing error
-    TINY_BITS_DATETIME   // double_val: double value
-};
+// struct iovec comes from <sys/uio.h>, so tiny_bits_packer_iovec() is only there when TB_WITH_IOVEC is defined
+#if defined(TB_WITH_IOVEC)
+#include <sys/uio.h>
 
-// value union
-typedef union tiny_bits_value {
-    int64_t int_val;    // TINY_BITS_INT
-    double double_val;  // TINY_BITS_DOUBLE
-    size_t length;      // TINY_BITS_ARRAY, TINY_BITS_MAP,
-    struct {            // TINY_BITS_STR, TINY_BITS_BLOB
-        const char *data; 
-        size_t length;
-        int32_t id;
-    } str_blob_val;
-    struct {            // TINY_BITS_STR, TINY_BITS_BLOB
-        double unixtime;
-        size_t offset;
-    } datetime_val;   
-} tiny_bits_value;
+/**
+ * @brief Describes the packed message as a list of segments for writev()/sendmsg()
+ * 
+ * @param encoder The packer instance
+ * @param iov Filled with the buffer slices and, between them, the payloads packed by reference
+ * @param iov_max Number of entries in iov, see tiny_bits_packer_iovec_count()
+ * @return Number of entries filled, or 0 on error (iov too small) or when nothing is packed
+ *
+ * @note The segments point into the buffer and the caller's data, they are valid until the packer is reset or
+ * packs again. writev() takes at most IOV_MAX (usually 1024) entries per call.
+ */
+static inline int tiny_bits_packer_iovec(tiny_bits_packer *encoder, struct iovec *iov, int iov_max) {
+    if (!encoder || !iov || tiny_bits_packer_iovec_count(encoder) > iov_max) return 0;
+    int count = 0;
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        // every payload follows its header, so no buffer slice is empty
+        iov[count].iov_base = encoder->buffer + start;
+        iov[count].iov_len = ref->pos - start;
+        iov[count + 1].iov_base = (void *)ref->data;
+        iov[count + 1].iov_len = ref->size;
+        count += 2;
+        start = ref->pos;
+    }
+    if (encoder->current_pos > start) {
+        iov[count].iov_base = encoder->buffer + start;
+        iov[count].iov_len = encoder->current_pos - start;
+        count++;
+    }
+    return count;
+}
+#endif // TB_WITH_IOVEC
 
-// The unpacker data structure
+/**
+ * @brief Copies the packed message, including the payloads packed by reference, into one contiguous block
+ * 
+ * @param encoder The packer instance
+ * @param dest Destination, at least tiny_bits_packer_size() bytes
+ * @param dest_size Size of dest
+ * @return Number of bytes copied, or 0 on error (dest too small)
+ */
+static inline size_t tiny_bits_packer_gather(tiny_bits_packer *encoder, void *dest, size_t dest_size) {
+    size_t size = tiny_bits_packer_size(encoder);
+    if (!encoder || !dest || size > dest_size) return 0;
+    uint8_t *out = (uint8_t *)dest;
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        memcpy(out, encoder->buffer + start, ref->pos - start);
+        out += ref->pos - start;
+        memcpy(out, ref->data, ref->size);
+        out += ref->size;
+        start = ref->pos;
+    }
+    memcpy(out, encoder->buffer + start, encoder->current_pos - start);
+    return size;
+}
+
+// Integer stored by a packed double array for value, see pack_packed_doubles()
+static inline int64_t _packed_double_to_int(double value, uint8_t scale) {
+    if (scale == TB_PACKED_RAW) return (int64_t)dtoi_bits(value);
+    double scaled = value * powers[scale];
+    return (int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// Writes a packed array: tag, subtag, count, [scale,] width, base, then each value minus base on width bits.
+// Either ints or doubles (converted with scale) are given.
+static inline int _pack_packed(tiny_bits_packer *encoder, uint8_t subtag, const int64_t *ints, const double *doubles,
+                               uint8_t scale, size_t count, int64_t base, uint8_t width){
+    size_t bits_size = (count * width + 7) / 8;
+    size_t header_size = 3 + (subtag == TB_NXT_PKD) + varint_size((uint64_t)count) + varint_size(zigzag_encode(base));
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, header_size + bits_size);
+    if (!buffer) return 0; // Handle error
+    // bits are OR-ed 8 bytes at a time, which takes 9 bytes of slack after them, else a byte at a time
+    int slack = encoder->capacity - encoder->current_pos >= header_size + bits_size + 9;
+
+    size_t written = 0;
+    buffer[written++] = TB_NXT_TAG;
+    buffer[written++] = subtag;
+    written += encode_varint((uint64_t)count, buffer + written);
+    if (subtag == TB_NXT_PKD) buffer[written++] = scale;
+    buffer[written++] = width;
+    written += encode_varint(zigzag_encode(base), buffer + written);
+
+    uint8_t *bits = buffer + written;
+    memset(bits, 0, bits_size + (slack ? 9 : 0));
+    if (width) {
+        size_t bit = 0;
+        for (size_t i = 0; i < count; i++, bit += width) {
+            int64_t value = ints ? ints[i] : _packed_double_to_int(doubles[i], scale);
+            uint64_t delta = (uint64_t)value - (uint64_t)base;
+            size_t pos = bit >> 3;
+            unsigned shift = bit & 7;
+            if (slack) {
+                _store_le64(bits + pos, _load_le64(bits + pos) | (delta << shift));
+                if (shift + width > 64) bits[pos + 8] |= (uint8_t)(delta >> (64 - shift));
+            } else {
+                unsigned bytes = (shift + width + 7) / 8;
+                uint64_t low = delta << shift;
+                for (unsigned k = 0; k < bytes && k < 8; k++) bits[pos + k] |= (uint8_t)(low >> (8 * k));
+                if (bytes > 8) bits[pos + 8] |= (uint8_t)(delta >> (64 - shift));
+            }
+        }
+    }
+    written += bits_size;
+    encoder->current_pos += written;
+    return (int)written;
+}
+
+/**
+ * @brief Packs an array of integers as a packed array: the smallest value followed by the
+ * difference of every value to it, all stored on the same (minimal) number of bits
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the integers
+ * @param count Number of integers
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note The result is a single TINY_BITS_PACKED_INT value, not an array, unpackers must support
+ * packed arrays (see unpack_packed_ints() and unpack_int_array())
+ */
+static inline int pack_packed_ints(tiny_bits_packer *encoder, const int64_t *values, size_t count){
+    if (!encoder || (!values && count)) return 0;
+    if (count > (INT32_MAX - 64) / 8) return 0; // the byte count must fit the return value
+    int64_t min = count ? values[0] : 0;
+    int64_t max = min;
+    for (size_t i = 1; i < count; i++) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    uint8_t width = bit_width_64((uint64_t)max - (uint64_t)min);
+    return _pack_packed(encoder, TB_NXT_PKI, values, NULL, 0, count, min, width);
+}
+
+/**
+ * @brief Packs an array of doubles as a packed array
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the doubles
+ * @param count Number of doubles
+ * @return Number of bytes written, or 0 on error
+ *
+ * When every value has at most 12 decimal places, the values are scaled to integers by the same
+ * power of 10 and packed as in pack_packed_ints(). Otherwise their IEEE 754 bits are packed instead,
+ * which still saves the high bits shared by values of similar magnitude.
+ * Values always unpack to the exact same doubles.
+ *
+ * @note The result is a single TINY_BITS_PACKED_DOUBLE value, not an array, unpackers must support
+ * packed arrays (see unpack_packed_doubles() and unpack_double_array())
+ */
+static inline int pack_packed_doubles(tiny_bits_packer *encoder, const double *values, size_t count){
+    if (!encoder || (!values && count)) return 0;
+    if (count > (INT32_MAX - 64) / 8) return 0; // the byte count must fit the return value
+    // smallest power of 10 turning every value into an integer the unpacker divides back exactly
+    int scale = 0;
+    int64_t min = 0, max = 0;
+    for (size_t i = 0; i < count && scale >= 0; i++) {
+        if (!isfinite(values[i]) || (values[i] == 0 && signbit(values[i]))) { scale = -1; break; }
+        while (fabs(values[i] * powers[scale]) >= 9007199254740992.0 // 2^53
+               || (double)_packed_double_to_int(values[i], (uint8_t)scale) / powers[scale] != values[i]) {
+            if (++scale > 12) { scale = -1; break; }
+        }
+    }
+    // a larger scale is not always exact for the values checked before it was raised
+    for (size_t i = 0; i < count && scale >= 0; i++) {
+        if (fabs(values[i] * powers[scale]) >= 9007199254740992.0) { scale = -1; break; }
+        int64_t integer = _packed_double_to_int(values[i], (uint8_t)scale);
+        if ((double)integer / powers[scale] != values[i]) { scale = -1; break; }
+        if (i == 0 || integer < min) min = integer;
+        if (i == 0 || integer > max) max = integer;
+    }
+    if (scale < 0) {
+        scale = TB_PACKED_RAW;
+        for (size_t i = 0; i < count; i++) {
+            int64_t integer = _packed_double_to_int(values[i], TB_PACKED_RAW);
+            if (i == 0 || integer < min) min = integer;
+            if (i == 0 || integer > max) max = integer;
+        }
+    }
+    uint8_t width = bit_width_64((uint64_t)max - (uint64_t)min);
+    return _pack_packed(encoder, TB_NXT_PKD, NULL, values, (uint8_t)scale, count, min, width);
+}
+
+/**
+ * @brief Reserves room for values written with the put_*() functions, which don't check the room left
+ * 
+ * @param encoder The packer instance
+ * @param size Bytes reserved, at least what the values take (see tiny_bits_size_of_*()) or a bound of 10 bytes
+ *             per number or header, plus the length of strings and blobs
+ * @return Cursor to write at, pass it to the put_*() functions then to tiny_bits_packer_commit(), or NULL on error
+ *
+ * @note Nothing else may be packed until the cursor is committed. With deduplicated strings copied aside (in a
+ * session or when streaming) room is made for them as well, so put_str() never allocates.
+ */
+static inline uint8_t *tiny_bits_packer_reserve(tiny_bits_packer *encoder, size_t size) {
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, size);
+    if (!buffer) return NULL;
+    if (encoder->strings && encoder->strings_size + size > encoder->strings_capacity) {
+        size_t new_capacity = encoder->strings_capacity + size + encoder->strings_capacity;
+        unsigned char *new_strings = (unsigned char *)_tb_realloc(encoder->allocator, encoder->strings, new_capacity);
+        if (!new_strings) return NULL;
+        encoder->strings = new_strings;
+        encoder->strings_capacity = new_capacity;
+    }
+    return buffer;
+}
+
+/**
+ * @brief Ends writing with a cursor returned by tiny_bits_packer_reserve()
+ * 
+ * @param encoder The packer instance
+ * @param cursor The cursor, as advanced by the put_*() functions
+ * @return Number of bytes written since the reserve, or 0 on error (not a cursor into the reserved room)
+ */
+static inline int tiny_bits_packer_commit(tiny_bits_packer *encoder, uint8_t *cursor) {
+    if (!encoder || !cursor) return 0;
+    uint8_t *start = encoder->buffer + encoder->current_pos;
+    if (cursor < start || cursor > encoder->buffer + encoder->capacity) return 0;
+    encoder->current_pos += (size_t)(cursor - start);
+    return (int)(cursor - start);
+}
+
+/**
+ * @brief Writes an integer at cursor, as pack_int() does
+ * 
+ * @return The cursor past the integer
+ */
+static inline uint8_t *put_int(uint8_t *cursor, int64_t value){
+    return cursor + _encode_int(cursor, value);
+}
+
+/**
+ * @brief Writes a double at cursor, as pack_double() does with the given TB_FEATURE_* flags
+ * 
+ * @return The cursor past the double
+ */
+static inline uint8_t *put_double(uint8_t *cursor, double val, uint8_t features){
+    return cursor + _encode_double(cursor, val, features);
+}
+
+/**
+ * @brief Writes an array header at cursor, as pack_arr() does
+ * 
+ * @return The cursor past the header
+ */
+static inline uint8_t *put_arr(uint8_t *cursor, size_t arr_len){
+    return cursor + _encode_arr_header(cursor, arr_len);
+}
+
+/**
+ * @brief Writes a map header at cursor, as pack_map() does
+ * 
+ * @return The cursor past the header
+ */
+static inline uint8_t *put_map(uint8_t *cursor, size_t map_len){
+    if (map_len < TB_MAP_LEN) {
+        *cursor = TB_MAP_TAG | (uint8_t)map_len;
+        return cursor + 1;
+    }
+    *cursor = TB_MAP_TAG | TB_MAP_LEN;
+    return cursor + 1 + encode_varint((uint64_t)(map_len - TB_MAP_LEN), cursor + 1);
+}
+
+/**
+ * @brief Writes a null, true or false value at cursor
+ * 
+ * @return The cursor past the value
+ */
+static inline uint8_t *put_null(uint8_t *cursor){
+    *cursor = TB_NIL_TAG;
+    return cursor + 1;
+}
+
+static inline uint8_t *put_true(uint8_t *cursor){
+    *cursor = TB_TRU_TAG;
+    return cursor + 1;
+}
+
+static inline uint8_t *put_false(uint8_t *cursor){
+    *cursor = TB_FLS_TAG;
+    return cursor + 1;
+}
+
+/**
+ * @brief Writes a binary blob at cursor, as pack_blob() does
+ * 
+ * @return The cursor past the blob
+ */
+static inline uint8_t *put_blob(uint8_t *cursor, const char *blob, size_t blob_size){
+    *cursor = TB_BLB_TAG;
+    cursor += 1 + encode_varint((uint64_t)blob_size, cursor + 1);
+    memcpy(cursor, blob, blob_size);
+    return cursor + blob_size;
+}
+
+/**
+ * @brief Writes a string at cursor, as pack_str() does (deduplicated strings included)
+ * 
+ * @param encoder The packer the cursor was reserved from
+ * @return The cursor past the string
+ */
+static inline uint8_t *put_str(tiny_bits_packer *encoder, uint8_t *cursor, const char *str, uint32_t str_len){
+    uint32_t id = 0;
+    uint32_t hash_code = 0;
+    if (_packer_find_str(encoder, str, str_len, &id, &hash_code)) {
+        return cursor + _encode_str_id(cursor, id);
+    }
+    int written = _encode_str(cursor, str, str_len);
+    if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128) {
+        _packer_keep_str(encoder, hash_code, str, str_len, (size_t)(cursor - encoder->buffer) + written - str_len);
+    }
+    return cursor + written;
+}
+
+/**
+ * @brief Number of bytes pack_int() writes for value
+ */
+static inline size_t tiny_bits_size_of_int(int64_t value){
+    return _int_size(value);
+}
+
+/**
+ * @brief Number of bytes pack_double() writes for val, with the given TB_FEATURE_* flags
+ *
+ * @note With TB_FEATURE_COMPRESS_FLOATS this runs the same decimal places search as packing
+ */
+static inline size_t tiny_bits_size_of_double(double val, uint8_t features){
+    uint8_t scratch[10];
+    return _encode_double(scratch, val, features);
+}
+
+/**
+ * @brief Number of bytes pack_blob() (or pack_blob_ref()) adds for a blob of blob_size bytes
+ */
+static inline size_t tiny_bits_size_of_blob(size_t blob_size){
+    return 1 + varint_size(blob_size) + blob_size;
+}
+
+/**
+ * @brief Number of bytes pack_arr() writes for an array header
+ */
+static inline size_t tiny_bits_size_of_arr(size_t arr_len){
+    return arr_len < TB_ARR_LEN ? 1 : 1 + varint_size(arr_len - TB_ARR_LEN);
+}
+
+/**
+ * @brief Number of bytes pack_map() writes for a map header
+ */
+static inline size_t tiny_bits_size_of_map(size_t map_len){
+    return map_len < TB_MAP_LEN ? 1 : 1 + varint_size(map_len - TB_MAP_LEN);
+}
+
+/**
+ * @brief Number of bytes pack_datetime() writes
+ */
+static inline size_t tiny_bits_size_of_datetime(void){
+    return 10;
+}
+
+/**
+ * @brief Number of bytes pack_int_array() writes
+ */
+static inline size_t tiny_bits_size_of_int_array(const int64_t *values, size_t count){
+    return tiny_bits_size_of_arr(count) + _int_values_size(values, count);
+}
+
+/**
+ * @brief Number of bytes pack_double_array() writes, with the given TB_FEATURE_* flags
+ */
+static inline size_t tiny_bits_size_of_double_array(const double *values, size_t count, uint8_t features){
+    return tiny_bits_size_of_arr(count) + _double_values_size(values, count, features);
+}
+
+/* End packer.h */
+
+/* Begin unpacker.h */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Decoder return types
+enum tiny_bits_type {
+    TINY_BITS_ARRAY,    // length: number of elements
+    TINY_BITS_MAP,      // length: number of key-value pairs
+    TINY_BITS_INT,      // int_val: integer value
+    TINY_BITS_DOUBLE,   // double_val: double value
+    TINY_BITS_STR,      // str_blob_val.length: byte length of string, str_blob_val.data: pointer to string
+    TINY_BITS_BLOB,     // str_blob_val.length: byte length of blob, str_blob_val.data: pointer to blob
+    TINY_BITS_TRUE,     // No value
+    TINY_BITS_FALSE,    // No value
+    TINY_BITS_NULL,     // No value
+    TINY_BITS_NAN,      // No value
+    TINY_BITS_INF,      // No value
+    TINY_BITS_N_INF,    // No value
+    TINY_BITS_EXT,      // No value
+    TINY_BITS_SEP,      // No balue
+    TINY_BITS_FINISHED, // End of buffer
+    TINY_BITS_ERROR,     // Parsing error
+    TINY_BITS_DATETIME,  // double_val: double value
+    TINY_BITS_PACKED_INT,   // packed_val.count: number of integers, decode with unpack_packed_ints()
+    TINY_BITS_PACKED_DOUBLE, // packed_val.count: number of doubles, decode with unpack_packed_doubles()
+    TINY_BITS_NOT_FOUND,    // No value at the path given to tiny_bits_query()
+    TINY_BITS_NEED_MORE     // The value goes on past the input of an incremental unpacker, see tiny_bits_unpacker_append()
+};
+
+// value union
+typedef union tiny_bits_value {
+    int64_t int_val;    // TINY_BITS_INT
+    double double_val;  // TINY_BITS_DOUBLE
+    size_t length;      // TINY_BITS_ARRAY, TINY_BITS_MAP,
+    struct {            // TINY_BITS_STR, TINY_BITS_BLOB
+        const char *data; 
+        size_t length;
+        int32_t id;
+    } str_blob_val;
+    struct {            // TINY_BITS_STR, TINY_BITS_BLOB
+        double unixtime;
+        size_t offset;
+    } datetime_val;   
+    struct {            // TINY_BITS_PACKED_INT, TINY_BITS_PACKED_DOUBLE
+        const uint8_t *data; // packed array layout, following the element count
+        size_t count;
+        uint8_t kind;        // TB_NXT_PKI or TB_NXT_PKD
+    } packed_val;
+} tiny_bits_value;
+
+// Storage for strings that must outlive the buffer they came from, blocks never move
+typedef struct tiny_bits_string_block {
+    struct tiny_bits_string_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} tiny_bits_string_block;
+
+#define TB_STRING_BLOCK_SIZE 4096
+
+// The unpacker data structure
 typedef struct tiny_bits_unpacker {
     const unsigned char *buffer;  // Input buffer (read-only)
     size_t size;                  // Total size of buffer
@@ -939,31 +2954,109 @@ typedef struct tiny_bits_unpacker {
     } *strings;           // Array of decoded strings
     size_t strings_size;  // Capacity of strings array
     size_t strings_count; // Number of strings stored
-    HashTable dictionary;
+    HashTable dictionary; // Pre-shared strings occupying strings[0..next_id-1], see tiny_bits_unpacker_set_dictionary()
+    tiny_bits_string_block *string_blocks; // Copies of the strings kept across buffers, newest block first
+    uint8_t session;      // Strings persist across buffers, see tiny_bits_unpacker_begin_session() (2 when only for incremental input)
+    uint32_t resets;      // Times the strings were forgotten, see _unpacker_rewind()
+    const tiny_bits_allocator *allocator; // Where the strings array and blocks come from, NULL for malloc()
+    size_t frames[TB_MAX_DEPTH]; // Values left in each open container, see tiny_bits_read_value()
+    uint32_t depth;       // Number of open containers
+    uint8_t stream;       // Incremental, buffer is input and grows with tiny_bits_unpacker_append()
+    unsigned char *input; // Bytes appended to an incremental unpacker, the consumed ones are dropped on the next append
+    size_t input_capacity;
 } tiny_bits_unpacker;
 
 /**
- * @brief allocates and initializes a new unpacker
+ * @brief allocates and initializes a new unpacker, taking all its memory from an allocator
  * 
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
  * @return pointer to new unpacker instance
  * 
- * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy()
+ * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy(), unless it comes from an
+ * arena that is reset or destroyed as a whole. The allocator must outlive the unpacker.
  */
-tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
+tiny_bits_unpacker *tiny_bits_unpacker_create_with(const tiny_bits_allocator *allocator) {
 
-    tiny_bits_unpacker *decoder = (tiny_bits_unpacker *)malloc(sizeof(tiny_bits_unpacker));
+    tiny_bits_unpacker *decoder = (tiny_bits_unpacker *)_tb_alloc(allocator, sizeof(tiny_bits_unpacker));
     if (!decoder) return NULL;
     // String array setup
     decoder->strings_size = 8; // Initial capacity
-    decoder->strings = (void *)malloc(decoder->strings_size * sizeof(*decoder->strings));
+    decoder->strings = (void *)_tb_alloc(allocator, decoder->strings_size * sizeof(*decoder->strings));
     if (!decoder->strings) {
-        free(decoder);
+        _tb_free(allocator, decoder);
         return NULL;
     }
     decoder->strings_count = 0;
+    memset(&decoder->dictionary, 0, sizeof(HashTable));
+    decoder->string_blocks = NULL;
+    decoder->session = 0;
+    decoder->resets = 0;
+    decoder->allocator = allocator;
+    decoder->depth = 0;
+    decoder->stream = 0;
+    decoder->input = NULL;
+    decoder->input_capacity = 0;
     return decoder;
 }
 
+/**
+ * @brief allocates and initializes a new unpacker
+ * 
+ * @return pointer to new unpacker instance
+ * 
+ * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy()
+ */
+tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
+    return tiny_bits_unpacker_create_with(NULL);
+}
+
+// Forgets all deduplicated strings, keeping only the dictionary ones
+static inline void _unpacker_clear_strings(tiny_bits_unpacker *decoder) {
+    decoder->strings_count = decoder->dictionary.next_id;
+    decoder->resets++;
+    tiny_bits_string_block *block = decoder->string_blocks;
+    if (!block) return;
+    while (block->next) {
+        tiny_bits_string_block *next = block->next->next;
+        _tb_free(decoder->allocator, block->next);
+        block->next = next;
+    }
+    block->used = 0;
+}
+
+// Copies a string to storage owned by the unpacker, returns NULL on allocation failure
+static TB_NOINLINE char *_unpacker_keep_string(tiny_bits_unpacker *decoder, const char *str, size_t len) {
+    tiny_bits_string_block *block = decoder->string_blocks;
+    if (!block || block->used + len > block->size) {
+        size_t size = len > TB_STRING_BLOCK_SIZE ? len : TB_STRING_BLOCK_SIZE;
+        block = (tiny_bits_string_block *)_tb_alloc(decoder->allocator, sizeof(tiny_bits_string_block) + size);
+        if (!block) return NULL;
+        block->next = decoder->string_blocks;
+        block->used = 0;
+        block->size = size;
+        decoder->string_blocks = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, str, len);
+    block->used += len;
+    return copy;
+}
+
+/**
+ * @brief Starts a session, where deduplicated strings persist across buffers
+ * 
+ * @param decoder The unpacker instance
+ *
+ * @note The packer on the other end must be in a session as well (see tiny_bits_packer_begin_session()).
+ * Deduplicatable strings are copied aside so the buffers can be released once unpacked, strings returned
+ * by unpack_value() remain valid until the packer resets the strings or tiny_bits_unpacker_reset() is called.
+ */
+static inline void tiny_bits_unpacker_begin_session(tiny_bits_unpacker *decoder) {
+    if (!decoder) return;
+    _unpacker_clear_strings(decoder);
+    decoder->session = 1;
+}
+
 /**
  * @breif Provides a buffer to the unpacker for unpacking
  * 
@@ -974,6 +3067,8 @@ tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
  * @param size Size of the region to be unpacked
  *
  * @note This function implicitly resets the unpacker object so no need to call tiny_bits_unpacker_reset()
+ * @note An incremental unpacker (see tiny_bits_unpacker_append()) drops what is left of its input, and the
+ * strings it kept unless a session was begun
  */
 static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, const unsigned char *buffer, size_t size) {
     if (!decoder) return;
@@ -981,7 +3076,14 @@ static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, co
     decoder->buffer = buffer;
     decoder->size = size;
     decoder->current_pos = 0;
-    decoder->strings_count = 0;
+    decoder->depth = 0;
+    decoder->stream = 0;
+    if (decoder->session == 2) {
+        // the session only came with the incremental input, a plain buffer starts from scratch
+        decoder->session = 0;
+        _unpacker_clear_strings(decoder);
+    }
+    if (!decoder->session) decoder->strings_count = decoder->dictionary.next_id;
 }
 
 /**
@@ -990,11 +3092,89 @@ static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, co
  * @param decoder The unpacker instance
  *
  * @note This function is useful if you want to operate on the same buffer again for some reason
+ * @note In a session this forgets the strings of previous buffers as well
+ * @note An incremental unpacker drops its input instead, to start over with a new stream
  */
 static inline void tiny_bits_unpacker_reset(tiny_bits_unpacker *decoder) {
     if (!decoder) return;
     decoder->current_pos = 0;
-    decoder->strings_count = 0;
+    decoder->depth = 0;
+    if (decoder->stream) decoder->size = 0;
+    _unpacker_clear_strings(decoder);
+}
+
+/**
+ * @brief Makes room for more input of an incremental unpacker, to be read into directly (from a socket for
+ * instance) and then added with tiny_bits_unpacker_commit()
+ *
+ * @param decoder The unpacker instance
+ * @param size Bytes to make room for
+ * @return Where to write them, NULL on allocation failure
+ *
+ * @note The first call turns the unpacker incremental, see tiny_bits_unpacker_append()
+ */
+static inline unsigned char *tiny_bits_unpacker_reserve(tiny_bits_unpacker *decoder, size_t size) {
+    if (!decoder) return NULL;
+    if (!decoder->stream) {
+        // strings are copied aside as in a session, the input they come from moves or goes away
+        _unpacker_clear_strings(decoder);
+        if (!decoder->session) decoder->session = 2;
+        decoder->stream = 1;
+        decoder->size = 0;
+        decoder->current_pos = 0;
+        decoder->depth = 0;
+    }
+    // slide what is not consumed yet to the front, it is at most the value in progress
+    size_t pending = decoder->size - decoder->current_pos;
+    if (decoder->current_pos) {
+        memmove(decoder->input, decoder->input + decoder->current_pos, pending);
+        decoder->size = pending;
+        decoder->current_pos = 0;
+    }
+    if (size > decoder->input_capacity - pending) {
+        if (size > SIZE_MAX / 2 - pending) return NULL;
+        size_t capacity = decoder->input_capacity ? decoder->input_capacity : 1024;
+        while (capacity < pending + size) capacity *= 2;
+        unsigned char *input = (unsigned char *)_tb_realloc(decoder->allocator, decoder->input, capacity);
+        if (!input) return NULL;
+        decoder->input = input;
+        decoder->input_capacity = capacity;
+    }
+    decoder->buffer = decoder->input;
+    return decoder->input + decoder->size;
+}
+
+/**
+ * @brief Adds bytes written where tiny_bits_unpacker_reserve() pointed to the input
+ *
+ * @param decoder The unpacker instance
+ * @param size Bytes written, at most the size reserved
+ */
+static inline void tiny_bits_unpacker_commit(tiny_bits_unpacker *decoder, size_t size) {
+    if (!decoder || !decoder->stream || size > decoder->input_capacity - decoder->size) return;
+    decoder->size += size;
+}
+
+/**
+ * @brief Appends bytes to the input of an incremental unpacker, for decoding as they arrive
+ *
+ * @param decoder The unpacker instance
+ * @param data The bytes
+ * @param size Their number
+ * @return 1 on success, 0 on allocation failure
+ *
+ * @note The first call turns the unpacker incremental: it owns its input, and unpack_value() returns
+ * TINY_BITS_NEED_MORE for a value cut short by the end of it, leaving the unpacker as it was before the value.
+ * Consumed bytes are dropped on the next append, so the input holds little more than the value in progress.
+ * Strings and blobs returned point into the input and are valid until then (deduplicated strings are copied
+ * aside and remain valid as in a session). tiny_bits_unpacker_set_buffer() makes it a plain unpacker again.
+ */
+static inline int tiny_bits_unpacker_append(tiny_bits_unpacker *decoder, const void *data, size_t size) {
+    unsigned char *input = tiny_bits_unpacker_reserve(decoder, size);
+    if (!input) return 0;
+    if (size) memcpy(input, data, size);
+    decoder->size += size;
+    return 1;
 }
 
 
@@ -1007,92 +3187,335 @@ static inline void tiny_bits_unpacker_reset(tiny_bits_unpacker *decoder) {
 void tiny_bits_unpacker_destroy(tiny_bits_unpacker *decoder) {
     if (!decoder) return;
     if (decoder->strings) {
-        free(decoder->strings);
+        _tb_free(decoder->allocator, decoder->strings);
     }
-    free(decoder);
+    while (decoder->string_blocks) {
+        tiny_bits_string_block *next = decoder->string_blocks->next;
+        _tb_free(decoder->allocator, decoder->string_blocks);
+        decoder->string_blocks = next;
+    }
+    _tb_free(decoder->allocator, decoder->input);
+    _tb_free(decoder->allocator, decoder);
 }
 
-static inline enum tiny_bits_type _unpack_int(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 248) { // Small positive (128-247)
-            value->int_val = tag - 128;
-            return TINY_BITS_INT;
-        } else if (tag == 248) { // Positive with continuation
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->int_val = val + 120;
-            decoder->current_pos += read;
-            return TINY_BITS_INT;
-        } else if (tag > 248 && tag < 255) { // Small negative (248-254)
-            value->int_val = -(tag - 248);
-            return TINY_BITS_INT;
-        } else { // 255: Negative with continuation
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->int_val = -(val + 7);
-            decoder->current_pos += read;
-            return TINY_BITS_INT;
-        }
-}
-
-static inline enum tiny_bits_type _unpack_arr(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 0b00001111) { // Small array (0-30)
-            value->length = tag & 0b00000111;
-        } else { // Large array
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->length = val + 7;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_ARRAY;
-}
+// How unpack_value() reads what follows a tag, see tag_table
+enum tiny_bits_tag_op {
+    TB_OP_INLINE,       // nothing follows, the value is tag & mask, negated when sign is set (0 for valueless types)
+    TB_OP_VARINT,       // integer or array/map length, varint + bias, negated when sign is set
+    TB_OP_STR,          // string, its length in the tag (tag & mask)
+    TB_OP_STR_VARINT,   // string, its length varint + bias
+    TB_OP_REF,          // deduplicated string, its id in the tag (tag & mask)
+    TB_OP_REF_VARINT,   // deduplicated string, its id varint + bias
+    TB_OP_FP,           // compressed double, decimal places in the tag (tag & mask), sign in bit 0x10
+    TB_OP_F16,
+    TB_OP_F32,
+    TB_OP_F64,
+    TB_OP_BLOB,
+    TB_OP_DATETIME,
+    TB_OP_NXT
+};
 
-static inline enum tiny_bits_type _unpack_map(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 0x1F) { // Small map (0-14)
-            value->length = tag & 0x0F;
-        } else { // Large map
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->length = val + 15;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_MAP;
+typedef struct tiny_bits_tag_info {
+    uint8_t type;   // enum tiny_bits_type of the value
+    uint8_t op;     // enum tiny_bits_tag_op
+    uint8_t mask;   // tag bits holding a small value, length or id
+    uint8_t bias;   // added to the varint following the tag
+    int8_t sign;    // -1 for negative integers, 0 otherwise
+} tiny_bits_tag_info;
+
+// Every tag, so that unpack_value() dispatches with a single lookup (written out in full, ranges are a GNU extension)
+static const tiny_bits_tag_info tag_table[256] = {
+    // 0x00: constants, blob, extensions and datetime
+    { TINY_BITS_FALSE, TB_OP_INLINE, 0, 0, 0 }, // 0x00 TB_FLS_TAG
+    { TINY_BITS_TRUE, TB_OP_INLINE, 0, 0, 0 }, // 0x01 TB_TRU_TAG
+    { TINY_BITS_NULL, TB_OP_INLINE, 0, 0, 0 }, // 0x02 TB_NIL_TAG
+    { TINY_BITS_BLOB, TB_OP_BLOB, 0, 0, 0 }, // 0x03 TB_BLB_TAG
+    { TINY_BITS_EXT, TB_OP_INLINE, 0, 0, 0 }, // 0x04 TB_EXT_TAG
+    { TINY_BITS_SEP, TB_OP_INLINE, 0, 0, 0 }, // 0x05 TB_SEP_TAG
+    { TINY_BITS_ERROR, TB_OP_NXT, 0, 0, 0 }, // 0x06 TB_NXT_TAG
+    { TINY_BITS_DATETIME, TB_OP_DATETIME, 0, 0, 0 }, // 0x07 TB_DTM_TAG
+    // 0x08: arrays, length in the tag
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x08
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x09
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0A
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0B
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0C
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0D
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0E
+    // 0x0F: array, length varint
+    { TINY_BITS_ARRAY, TB_OP_VARINT, 0, TB_ARR_LEN, 0 }, // 0x0F
+    // 0x10: maps, length in the tag
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x10
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x11
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x12
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x13
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x14
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x15
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x16
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x17
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x18
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x19
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1A
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1B
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1C
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1D
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1E
+    // 0x1F: map, length varint
+    { TINY_BITS_MAP, TB_OP_VARINT, 0, TB_MAP_LEN, 0 }, // 0x1F
+    // 0x20: positive compressed doubles, decimal places in the tag
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x20
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x21
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x22
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x23
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x24
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x25
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x26
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x27
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x28
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x29
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2A
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2B
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2C
+    // 0x2D: NaN, -Infinity, float
+    { TINY_BITS_NAN, TB_OP_INLINE, 0, 0, 0 }, // 0x2D TB_NAN_TAG
+    { TINY_BITS_N_INF, TB_OP_INLINE, 0, 0, 0 }, // 0x2E TB_NNF_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F32, 0, 0, 0 }, // 0x2F TB_F32_TAG
+    // 0x30: negative compressed doubles
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x30
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x31
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x32
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x33
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x34
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x35
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x36
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x37
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x38
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x39
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3A
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3B
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3C
+    // 0x3D: Infinity, f16, double
+    { TINY_BITS_INF, TB_OP_INLINE, 0, 0, 0 }, // 0x3D TB_INF_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F16, 0, 0, 0 }, // 0x3E TB_F16_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F64, 0, 0, 0 }, // 0x3F TB_F64_TAG
+    // 0x40: strings, length in the tag
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x40
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x41
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x42
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x43
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x44
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x45
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x46
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x47
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x48
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x49
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4A
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4B
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4C
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4D
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4E
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4F
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x50
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x51
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x52
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x53
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x54
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x55
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x56
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x57
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x58
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x59
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5A
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5B
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5C
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5D
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5E
+    // 0x5F: string, length varint
+    { TINY_BITS_STR, TB_OP_STR_VARINT, 0, TB_STR_LEN, 0 }, // 0x5F
+    // 0x60: references, id in the tag
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x60
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x61
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x62
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x63
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x64
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x65
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x66
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x67
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x68
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x69
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6A
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6B
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6C
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6D
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6E
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6F
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x70
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x71
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x72
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x73
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x74
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x75
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x76
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x77
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x78
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x79
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7A
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7B
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7C
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7D
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7E
+    // 0x7F: reference, id varint
+    { TINY_BITS_STR, TB_OP_REF_VARINT, 0, TB_REF_LEN, 0 }, // 0x7F
+    // 0x80: integers 0 to 119
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x80
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x81
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x82
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x83
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x84
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x85
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x86
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x87
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x88
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x89
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8A
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8B
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8C
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8D
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8E
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8F
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x90
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x91
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x92
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x93
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x94
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x95
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x96
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x97
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x98
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x99
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9A
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9B
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9C
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9D
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9E
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9F
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xED
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF7
+    // 0xF8: integer 120 and up, varint
+    { TINY_BITS_INT, TB_OP_VARINT, 0, 120, 0 }, // 0xF8
+    // 0xF9: integers -1 to -6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xF9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFE
+    // 0xFF: integer -7 and down, varint
+    { TINY_BITS_INT, TB_OP_VARINT, 0, 7, -1 }, // 0xFF
+};
+
+// magnitude, negated when sign is -1, without a branch (in unsigned arithmetic, it may wrap)
+static inline int64_t _tb_signed(uint64_t magnitude, int8_t sign){
+    uint64_t mask = (uint64_t)(int64_t)sign;
+    return (int64_t)((magnitude ^ mask) - mask);
 }
 
-static inline enum tiny_bits_type _unpack_double(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag == TB_F64_TAG) { // Raw double
-            if(pos + 8 > decoder->size) return TINY_BITS_ERROR;
-            uint64_t number = decode_uint64(decoder->buffer + pos);
-            value->double_val = itod_bits(number);
-            decoder->current_pos += 8;
-        } else { // Compressed double
-            uint8_t read;
-            uint64_t number;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &number);
-            if(read == 0) return TINY_BITS_ERROR;
-            int order = (tag & 0x0F); 
-            double fractional = (double)number / powers[order];
-            if(tag & 0x10) fractional = -fractional;        
-            value->double_val = fractional;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_DOUBLE;
+// Reads the varint following a tag, returns its size (0 on error)
+static inline uint8_t _unpack_varint(tiny_bits_unpacker *decoder, uint64_t *number){
+    uint8_t read = decode_varint(decoder->buffer, decoder->size, decoder->current_pos, number);
+    decoder->current_pos += read;
+    return read;
 }
 
 static inline enum tiny_bits_type _unpack_datetime(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
     size_t pos = decoder->current_pos;
-    if(pos + 8 > decoder->size) return TINY_BITS_ERROR;
+    if(pos + 9 > decoder->size) return TINY_BITS_ERROR;
     value->datetime_val.offset = decoder->buffer[pos] * (60*15); // convert offset back to seconds (from multiples of 15 minutes)
     uint64_t unixtime = decode_uint64(decoder->buffer + pos + 1);
     value->datetime_val.unixtime = itod_bits(unixtime);
@@ -1106,68 +3529,330 @@ static inline enum tiny_bits_type _unpack_blob(tiny_bits_unpacker *decoder, uint
         size_t read; 
         read = decode_varint(decoder->buffer, decoder->size, pos, &len);
         if(read == 0) return TINY_BITS_ERROR;
-        if((pos + read + len) > decoder->size) return TINY_BITS_ERROR; 
-        value->str_blob_val.data =  (const char *)decoder->buffer + pos;
+        if(len > decoder->size - pos - read) return TINY_BITS_ERROR; 
+        value->str_blob_val.data =  (const char *)decoder->buffer + pos + read;
         value->str_blob_val.length = len; 
         decoder->current_pos = pos + read + len;
         return TINY_BITS_BLOB;
 }
 
-static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        size_t len;
-        if (tag < 0x5F) { // Small string (0-30)
-            len = tag & 0x1F;
-            if(pos + len > decoder->size) return TINY_BITS_ERROR;
-            value->str_blob_val.data =  (const char *)decoder->buffer + pos;
-            value->str_blob_val.length = len; 
-            decoder->current_pos += len;
-        } else if (tag == 0x5F) { // Large string
-            size_t read;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &len);
-            if(read == 0) return TINY_BITS_ERROR;
-            len += 31;
-            if(pos + read + len > decoder->size) return TINY_BITS_ERROR;
-            value->str_blob_val.data =  (const char *)decoder->buffer + pos;
-            value->str_blob_val.length = len; 
-            decoder->current_pos += (read + len);
-        } else { // Deduplicated (small: < 0x7F, large: 0x7F)
-            size_t id;
-            size_t read;
-            if(tag < 0x7F){
-                id = tag & 0x1F;
-            }else {
-                read = decode_varint(decoder->buffer, decoder->size, pos, &id);
-                if(read == 0) return TINY_BITS_ERROR;
-                id += 31; 
-                decoder->current_pos += read; // Update pos after varint
-            } 
-            if (id >= decoder->strings_count) return TINY_BITS_ERROR;
-            len = decoder->strings[id].length;
-            value->str_blob_val.data = decoder->strings[id].str;
-            value->str_blob_val.length = len;
-            value->str_blob_val.id = id + 1;
-            return TINY_BITS_STR;
-        }
-        value->str_blob_val.id = 0;
-        // Handle new string (not deduplicated)
-        if(decoder->strings_count < TB_HASH_CACHE_SIZE && len >= 2 && len <= 128){
-            if (decoder->strings_count >= decoder->strings_size) {
-                size_t new_size = decoder->strings_size * 2;
-                void *new_strings = realloc(decoder->strings, new_size * sizeof(*decoder->strings));
-                if (!new_strings) return TINY_BITS_ERROR;
-                decoder->strings = new_strings;
-                decoder->strings_size = new_size;
-            }
-            
-            decoder->strings[decoder->strings_count].str =  (char *)decoder->buffer + pos;
-            decoder->strings[decoder->strings_count].length = len;
-            decoder->strings_count++;
-            value->str_blob_val.id = -1 * decoder->strings_count;
+// Doubles the room for numbered strings, kept out of the decoding paths
+static TB_NOINLINE int _unpacker_grow_strings(tiny_bits_unpacker *decoder){
+        size_t new_size = decoder->strings_size * 2;
+        void *new_strings = _tb_realloc(decoder->allocator, decoder->strings, new_size * sizeof(*decoder->strings));
+        if (!new_strings) return 0;
+        decoder->strings = new_strings;
+        decoder->strings_size = new_size;
+        return 1;
+}
+
+// Numbers a string that may be referenced later, returns its id (negative) or 0 on allocation failure
+static inline int32_t _unpacker_number_string(tiny_bits_unpacker *decoder, const char *str, size_t len){
+        if (decoder->strings_count >= decoder->strings_size && !_unpacker_grow_strings(decoder)) return 0;
+        if (decoder->session) {
+            char *copy = _unpacker_keep_string(decoder, str, len);
+            if (!copy) return 0;
+            decoder->strings[decoder->strings_count].str = copy;
+        } else {
+            decoder->strings[decoder->strings_count].str = (char *)str;
+        }
+        decoder->strings[decoder->strings_count].length = len;
+        decoder->strings_count++;
+        return -1 * (int32_t)decoder->strings_count;
+}
+
+// Where the token at pos ends, 0 when it goes on past the end of the buffer and SIZE_MAX when it is malformed
+static inline size_t _unpacker_token_end(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    uint64_t length;
+    uint8_t read;
+    if (pos >= size) return 0;
+    uint8_t tag = buffer[pos++];
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    if (info->op == TB_OP_INLINE || info->op == TB_OP_REF) return pos;
+    if (pos >= size) return 0;
+    switch (info->op) {
+    case TB_OP_VARINT:
+    case TB_OP_REF_VARINT:
+    case TB_OP_FP:
+        length = varint_length(buffer[pos]);
+        break;
+    case TB_OP_STR:
+        length = tag & info->mask;
+        break;
+    case TB_OP_STR_VARINT:
+    case TB_OP_BLOB:
+        if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+        pos += read;
+        if (info->op == TB_OP_STR_VARINT) {
+            if (length > SIZE_MAX - info->bias) return SIZE_MAX;
+            length += info->bias;
+        }
+        break;
+    case TB_OP_F16: length = 2; break;
+    case TB_OP_F32: length = 4; break;
+    case TB_OP_F64: length = 8; break;
+    case TB_OP_DATETIME: length = 9; break;
+    case TB_OP_NXT: {
+        // packed array: count, scale for doubles, width, base, then the bits
+        uint8_t kind = buffer[pos++];
+        if (kind == TB_NXT_RST) return pos;
+        if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) return SIZE_MAX;
+        if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+        pos += read;
+        size_t header = kind == TB_NXT_PKD ? 2 : 1;
+        if (header > size - pos) return 0;
+        uint8_t width = buffer[pos + header - 1];
+        pos += header;
+        if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+        pos += varint_length(buffer[pos]);
+        if (width > 64 || length > (1ULL << 56)) return SIZE_MAX;
+        length = (length * width + 7) / 8;
+        break;
+    }
+    default:
+        return SIZE_MAX;
+    }
+    return length > size - pos ? 0 : pos + length;
+}
+
+// Whether the value at pos goes on past the end of the buffer, rather than being malformed
+static inline int _unpacker_incomplete(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) pos += 2;
+    return _unpacker_token_end(decoder, pos) == 0;
+}
+
+// Same for the value at pos with everything it contains, without numbering or forgetting strings on the way:
+// an incremental unpacker checks it before decoding a whole value, so that it never stops halfway through one
+static TB_NOINLINE int _unpacker_incomplete_value(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    size_t count = 1;
+    while (count) {
+        size_t end = _unpacker_token_end(decoder, pos);
+        if (end == 0) return 1;
+        if (end == SIZE_MAX) return 0;
+        uint8_t tag = buffer[pos];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length = tag & info->mask;
+        if (info->op == TB_OP_NXT && buffer[pos + 1] == TB_NXT_RST) {
+            pos = end; // not a value
+            continue;
+        }
+        count--;
+        if (info->type <= TINY_BITS_MAP && info->op == TB_OP_VARINT) {
+            if (!decode_varint(buffer, size, pos + 1, &length)) return 0;
+            if (length > size) return 1;
+            length += info->bias;
         }
+        pos = end;
+        if (info->type > TINY_BITS_MAP || (info->op != TB_OP_INLINE && info->op != TB_OP_VARINT)) continue;
+        // every value takes a byte at least, more of them than bytes left cannot all be there yet
+        if (length > size - pos) return 1;
+        count += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (count > size - pos) return 1;
+    }
+    return 0;
+}
+
+// Whether an incremental unpacker has only part of the next value, for those decoding values as a whole
+static inline int _unpacker_awaits(const tiny_bits_unpacker *decoder){
+    return decoder->stream && decoder->current_pos < decoder->size && _unpacker_incomplete_value(decoder, decoder->current_pos);
+}
+
+// A value that failed at start: when an incremental unpacker has only part of it, it is read again once more input came
+static TB_NOINLINE enum tiny_bits_type _unpacker_cut_short(tiny_bits_unpacker *decoder, size_t start){
+    if (!decoder->stream || !_unpacker_incomplete(decoder, start)) return TINY_BITS_ERROR;
+    decoder->current_pos = start;
+    return TINY_BITS_NEED_MORE;
+}
+
+// A string of len bytes sent inline (its tag at start), numbered when it may be referenced later
+static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint64_t len, tiny_bits_value *value, size_t start){
+        size_t pos = decoder->current_pos;
+        if(len > decoder->size - pos) return _unpacker_cut_short(decoder, start);
+        value->str_blob_val.data =  (const char *)decoder->buffer + pos;
+        value->str_blob_val.length = len; 
+        value->str_blob_val.id = 0;
+        decoder->current_pos += len;
+        // every deduplicatable string gets an id since the packer may be configured to deduplicate
+        // any number of them (see tiny_bits_packer_set_dedupe_limit())
+        if(len >= 2 && len <= 128){
+            value->str_blob_val.id = _unpacker_number_string(decoder, (const char *)decoder->buffer + pos, len);
+            if (!value->str_blob_val.id) return TINY_BITS_ERROR;
+        }
+        return TINY_BITS_STR;
+}
+
+// A deduplicated string, the id-th one numbered so far
+static inline enum tiny_bits_type _unpack_ref(tiny_bits_unpacker *decoder, uint64_t id, tiny_bits_value *value){
+        if (id >= decoder->strings_count) return TINY_BITS_ERROR;
+        value->str_blob_val.data = decoder->strings[id].str;
+        value->str_blob_val.length = decoder->strings[id].length;
+        value->str_blob_val.id = id + 1;
         return TINY_BITS_STR;
 }
 
+static inline enum tiny_bits_type unpack_value(tiny_bits_unpacker *decoder, tiny_bits_value *value);
+
+// Where a value starts, to go back to it with _unpacker_rewind()
+typedef struct tiny_bits_unpacker_mark {
+    size_t start;
+    size_t strings_count;
+    tiny_bits_string_block *block; // the newest block of string copies and how much of it was used
+    size_t used;
+    uint32_t resets;
+} tiny_bits_unpacker_mark;
+
+static inline void _unpacker_mark(const tiny_bits_unpacker *decoder, tiny_bits_unpacker_mark *mark){
+    mark->start = decoder->current_pos;
+    mark->strings_count = decoder->strings_count;
+    mark->block = decoder->string_blocks;
+    mark->used = mark->block ? mark->block->used : 0;
+    mark->resets = decoder->resets;
+}
+
+// Back to a mark, forgetting the strings numbered since and their copies. When the strings were reset in
+// between only the position goes back: those before the reset are gone, and reading it again resets them again
+static TB_NOINLINE void _unpacker_restore(tiny_bits_unpacker *decoder, const tiny_bits_unpacker_mark *mark){
+    decoder->current_pos = mark->start;
+    if (decoder->resets != mark->resets) return;
+    decoder->strings_count = mark->strings_count;
+    while (decoder->string_blocks != mark->block) {
+        tiny_bits_string_block *next = decoder->string_blocks->next;
+        _tb_free(decoder->allocator, decoder->string_blocks);
+        decoder->string_blocks = next;
+    }
+    if (mark->block) mark->block->used = mark->used;
+}
+
+// Gives up on a value of an incremental unpacker that went on past the input: back to its mark, to read it
+// again once more input came. TINY_BITS_ERROR otherwise, or when the strings were reset within the value
+static TB_NOINLINE enum tiny_bits_type _unpacker_rewind(tiny_bits_unpacker *decoder, const tiny_bits_unpacker_mark *mark){
+    if (!decoder->stream || decoder->resets != mark->resets) return TINY_BITS_ERROR;
+    _unpacker_restore(decoder, mark);
+    return TINY_BITS_NEED_MORE;
+}
+
+static inline enum tiny_bits_type _unpack_packed(tiny_bits_unpacker *decoder, uint8_t kind, tiny_bits_value *value){
+        size_t pos = decoder->current_pos;
+        uint64_t count, base;
+        uint8_t read = decode_varint(decoder->buffer, decoder->size, pos, &count);
+        if(read == 0) return TINY_BITS_ERROR;
+        pos += read;
+        const uint8_t *data = decoder->buffer + pos;
+        if (kind == TB_NXT_PKD) {
+            if(pos >= decoder->size) return TINY_BITS_ERROR;
+            uint8_t scale = decoder->buffer[pos++];
+            if(scale > 12 && scale != TB_PACKED_RAW) return TINY_BITS_ERROR;
+        }
+        if(pos >= decoder->size) return TINY_BITS_ERROR;
+        uint8_t width = decoder->buffer[pos++];
+        if(width > 64) return TINY_BITS_ERROR;
+        read = decode_varint(decoder->buffer, decoder->size, pos, &base);
+        if(read == 0) return TINY_BITS_ERROR;
+        pos += read;
+        if(count > (1ULL << 56)) return TINY_BITS_ERROR;
+        uint64_t bits_size = (count * width + 7) / 8;
+        if(bits_size > decoder->size - pos) return TINY_BITS_ERROR;
+        value->packed_val.data = data;
+        value->packed_val.count = count;
+        value->packed_val.kind = kind;
+        decoder->current_pos = pos + bits_size;
+        return kind == TB_NXT_PKI ? TINY_BITS_PACKED_INT : TINY_BITS_PACKED_DOUBLE;
+}
+
+static inline enum tiny_bits_type _unpack_nxt(tiny_bits_unpacker *decoder, tiny_bits_value *value){
+        if(decoder->current_pos >= decoder->size) return TINY_BITS_ERROR;
+        uint8_t ext = decoder->buffer[decoder->current_pos++];
+        if (ext == TB_NXT_RST) { // not a value, forget the strings and go on with the next one
+            _unpacker_clear_strings(decoder);
+            // a run of markers is consumed here, the value after it is not one (no recursion for each)
+            const uint8_t *buffer = decoder->buffer;
+            size_t pos = decoder->current_pos;
+            while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) pos += 2;
+            decoder->current_pos = pos;
+            return unpack_value(decoder, value);
+        }
+        if (ext == TB_NXT_PKI || ext == TB_NXT_PKD) {
+            return _unpack_packed(decoder, ext, value);
+        }
+        return TINY_BITS_ERROR; // Unknown native extension
+}
+
+// Unpacks the value following a tag (already read), dispatching on tag_table
+static inline enum tiny_bits_type _unpack_tag(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    size_t pos = decoder->current_pos;
+    const uint8_t *p = decoder->buffer + pos;
+    uint64_t number;
+    enum tiny_bits_type type;
+    switch (info->op) {
+    case TB_OP_INLINE:
+        value->int_val = _tb_signed(tag & info->mask, info->sign);
+        return (enum tiny_bits_type)info->type;
+    case TB_OP_VARINT:
+        if (!_unpack_varint(decoder, &number)) goto fail;
+        // lengths share the storage of int_val
+        value->int_val = _tb_signed(number + info->bias, info->sign);
+        return (enum tiny_bits_type)info->type;
+    case TB_OP_STR:
+        return _unpack_str(decoder, tag & info->mask, value, pos - 1);
+    case TB_OP_STR_VARINT:
+        if (!_unpack_varint(decoder, &number) || number > SIZE_MAX - info->bias) goto fail;
+        return _unpack_str(decoder, number + info->bias, value, pos - 1);
+    case TB_OP_REF:
+        type = _unpack_ref(decoder, tag & info->mask, value);
+        break;
+    case TB_OP_REF_VARINT:
+        if (!_unpack_varint(decoder, &number) || number > SIZE_MAX - info->bias) goto fail;
+        type = _unpack_ref(decoder, number + info->bias, value);
+        break;
+    case TB_OP_FP: {
+        if (!_unpack_varint(decoder, &number)) goto fail;
+        double fractional = (double)number / powers[tag & info->mask];
+        value->double_val = (tag & 0x10) ? -fractional : fractional;
+        return TINY_BITS_DOUBLE;
+    }
+    case TB_OP_F16:
+        if (pos + 2 > decoder->size) goto fail;
+        value->double_val = half_to_double((uint16_t)((p[0] << 8) | p[1]));
+        decoder->current_pos += 2;
+        return TINY_BITS_DOUBLE;
+    case TB_OP_F32: {
+        if (pos + 4 > decoder->size) goto fail;
+        uint32_t bits = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        float number32;
+        memcpy(&number32, &bits, 4);
+        value->double_val = number32;
+        decoder->current_pos += 4;
+        return TINY_BITS_DOUBLE;
+    }
+    case TB_OP_F64:
+        if (pos + 8 > decoder->size) goto fail;
+        value->double_val = itod_bits(decode_uint64(p));
+        decoder->current_pos += 8;
+        return TINY_BITS_DOUBLE;
+    case TB_OP_BLOB:
+        type = _unpack_blob(decoder, tag, value);
+        break;
+    case TB_OP_DATETIME:
+        type = _unpack_datetime(decoder, tag, value);
+        break;
+    case TB_OP_NXT:
+        type = _unpack_nxt(decoder, value);
+        break;
+    default:
+        goto fail; // Unknown tag
+    }
+    if (type != TINY_BITS_ERROR) return type;
+fail:
+    // malformed, or cut short by the end of the input of an incremental unpacker
+    return _unpacker_cut_short(decoder, pos - 1);
+}
+
 /**
  * @brief Unpacks a value and returns its type while setting its value
  *
@@ -1183,6 +3868,9 @@ static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint8
  * TINY_BITS_SEP means the current object was fully unpacked, and that there is potentially another one
  * this is specifically for stream unpacking multiple objects one after the other as they are being recieved 
  *
+ * TINY_BITS_NEED_MORE means an incremental unpacker (see tiny_bits_unpacker_append()) has only the start of
+ * the next value, it is left before it and unpacks it once the rest is appended
+ *
  * The location of the value you need in the value union will depend on the returned type as follows
  * 
  * TINY_BITS_TRUE, TINY_BITS_FALSE, TINY_BITS_NULL, TINY_BITS_NAN, TINY_BITS_INF & TINY_BITS_N_INF all
@@ -1211,44 +3899,1877 @@ static inline enum tiny_bits_type unpack_value(tiny_bits_unpacker *decoder, tiny
     if (!decoder || !value || decoder->current_pos >= decoder->size) {
         return (decoder && decoder->current_pos >= decoder->size) ? TINY_BITS_FINISHED : TINY_BITS_ERROR;
     }
-
+    size_t start = decoder->current_pos;
     uint8_t tag = decoder->buffer[decoder->current_pos++];
-    // Dispatch based on tag
-    if ((tag & TB_INT_TAG) == TB_INT_TAG) { // Integers
-        return _unpack_int(decoder, tag, value);
-    } else if ((tag & TB_STR_TAG) == TB_STR_TAG) { // Strings
-        return _unpack_str(decoder, tag, value);
-    } else if (tag == TB_NIL_TAG) {
-        return TINY_BITS_NULL;
-    } else if (tag == TB_NAN_TAG) {
-        return TINY_BITS_NAN;
-    } else if (tag == TB_INF_TAG) {
-        return TINY_BITS_INF;
-    } else if (tag == TB_NNF_TAG) {
-        return TINY_BITS_N_INF;
-    } else if ((tag & TB_DBL_TAG) == TB_DBL_TAG) { // Doubles
-        return _unpack_double(decoder, tag, value);
-    } else if ((tag & TB_MAP_TAG) == TB_MAP_TAG) { // Maps
-        return _unpack_map(decoder, tag, value);
-    } else if ((tag & TB_ARR_TAG) == TB_ARR_TAG) { // Arrays
-        return _unpack_arr(decoder, tag, value);
-    } else if (tag == TB_BLB_TAG) { // Blob
-        return _unpack_blob(decoder, tag, value);
-    } else if (tag == TB_DTM_TAG) {
-        return _unpack_datetime(decoder, tag, value);
-    } else if (tag == TB_SEP_TAG) {
-        return TINY_BITS_SEP;
-    } else if (tag == TB_EXT_TAG) {
-        return TINY_BITS_EXT;
-    } else if (tag == TB_TRU_TAG) {
-        return TINY_BITS_TRUE;
-    } else if (tag == TB_FLS_TAG) {
-        return TINY_BITS_FALSE;
-    }
-    return TINY_BITS_ERROR; // Unknown tag
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    if (info->op == TB_OP_INLINE) {
+        // the most common values (small integers, short array and map headers, constants) without a branch
+        value->int_val = _tb_signed(tag & info->mask, info->sign);
+        return (enum tiny_bits_type)info->type;
+    }
+    // short strings and references come next, the rest goes through the full dispatch
+    if (info->op == TB_OP_STR) return _unpack_str(decoder, tag & info->mask, value, start);
+    if (info->op == TB_OP_REF) return _unpack_ref(decoder, tag & info->mask, value);
+    return _unpack_tag(decoder, tag, value);
+}
+
+// Skips count values and everything they contain, returns 0 on malformed input
+static inline int _skip_values(tiny_bits_unpacker *decoder, size_t count){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    size_t pos = decoder->current_pos;
+    tiny_bits_value scratch;
+    while (count) {
+        if (pos >= size) return 0;
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length;
+        uint8_t read;
+        count--;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) continue;
+            length = tag & info->mask;
+            break;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) continue;
+            length += info->bias;
+            break;
+        case TB_OP_STR:
+            length = tag & info->mask;
+            if (length > size - pos) return 0;
+            // strings are jumped over but still numbered, for later references to them
+            if (length >= 2 && !_unpacker_number_string(decoder, (const char *)buffer + pos, length)) return 0;
+            pos += length;
+            continue;
+        case TB_OP_REF:
+            if ((size_t)(tag & info->mask) >= decoder->strings_count) return 0;
+            continue;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+            pos += varint_length(buffer[pos]);
+            continue;
+        case TB_OP_F64:
+            if (8 > size - pos) return 0;
+            pos += 8;
+            continue;
+        case TB_OP_NXT:
+            if (pos < size && buffer[pos] == TB_NXT_RST) {
+                // not a value
+                _unpacker_clear_strings(decoder);
+                pos++;
+                count++;
+                continue;
+            }
+            // fall through
+        default:
+            decoder->current_pos = pos;
+            enum tiny_bits_type type = _unpack_tag(decoder, tag, &scratch);
+            if (type == TINY_BITS_ERROR || type == TINY_BITS_NEED_MORE) return 0;
+            pos = decoder->current_pos;
+            continue;
+        }
+        // every value takes a byte at least, larger counts can only be malformed
+        if (length > size) return 0;
+        count += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (count > size - pos) return 0;
+    }
+    decoder->current_pos = pos;
+    return 1;
+}
+
+// Accounts for a value read at the current depth, opening its container if it has values
+static inline int _unpacker_track(tiny_bits_unpacker *decoder, enum tiny_bits_type type, size_t length){
+    if (decoder->depth) decoder->frames[decoder->depth - 1]--;
+    if ((type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) && length) {
+        if (decoder->depth == TB_MAX_DEPTH || length > SIZE_MAX / 2) return 0;
+        decoder->frames[decoder->depth++] = type == TINY_BITS_MAP ? 2 * length : length;
+    }
+    while (decoder->depth && decoder->frames[decoder->depth - 1] == 0) decoder->depth--;
+    return 1;
+}
+
+/**
+ * @brief Unpacks a value like unpack_value(), keeping track of the containers it is in
+ *
+ * @param decoder The unpacker instance
+ * @param[out] value A supplied tiny_bits_value instance
+ * @return enum tiny_bits_type, TINY_BITS_ERROR as well when containers nest deeper than TB_MAX_DEPTH
+ *
+ * @note Use it instead of unpack_value() along with tiny_bits_skip_value() and tiny_bits_leave_container(),
+ * so that tiny_bits_unpacker_depth() stays accurate
+ */
+static inline enum tiny_bits_type tiny_bits_read_value(tiny_bits_unpacker *decoder, tiny_bits_value *value){
+    enum tiny_bits_type type = unpack_value(decoder, value);
+    if (type == TINY_BITS_ERROR || type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) return type;
+    size_t length = (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) ? value->length : 0;
+    return _unpacker_track(decoder, type, length) ? type : TINY_BITS_ERROR;
+}
+
+/**
+ * @brief Skips the next value, with everything it contains when it is an array or a map
+ *
+ * @param decoder The unpacker instance
+ * @return The type of the skipped value, TINY_BITS_FINISHED at the end of the buffer or TINY_BITS_ERROR
+ * on malformed input. An incremental unpacker returns TINY_BITS_NEED_MORE, skipping nothing, until all of the
+ * value is there.
+ *
+ * @note Nothing is materialized, but skipped strings are still numbered so that later references to
+ * them resolve. Costs about a tag lookup per value, strings and blobs are jumped over.
+ */
+static inline enum tiny_bits_type tiny_bits_skip_value(tiny_bits_unpacker *decoder){
+    if (!decoder) return TINY_BITS_ERROR;
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    const uint8_t *buffer = decoder->buffer;
+    size_t pos = decoder->current_pos;
+    while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) {
+        _unpacker_clear_strings(decoder);
+        pos += 2;
+    }
+    decoder->current_pos = pos;
+    if (pos >= decoder->size) return TINY_BITS_FINISHED;
+    enum tiny_bits_type type = (enum tiny_bits_type)tag_table[buffer[pos]].type;
+    if (buffer[pos] == TB_NXT_TAG && pos + 1 < decoder->size) {
+        type = buffer[pos + 1] == TB_NXT_PKI ? TINY_BITS_PACKED_INT : TINY_BITS_PACKED_DOUBLE;
+    }
+    if (!_skip_values(decoder, 1)) return TINY_BITS_ERROR;
+    _unpacker_track(decoder, type, 0);
+    return type;
+}
+
+/**
+ * @brief Skips what is left of the innermost container opened by tiny_bits_read_value()
+ *
+ * @param decoder The unpacker instance
+ * @return 1 on success, the next value read is the one following the container, 0 on malformed input
+ * or when no container is open
+ */
+static inline int tiny_bits_leave_container(tiny_bits_unpacker *decoder){
+    if (!decoder || !decoder->depth) return 0;
+    if (!_skip_values(decoder, decoder->frames[decoder->depth - 1])) return 0;
+    decoder->frames[decoder->depth - 1] = 0;
+    while (decoder->depth && decoder->frames[decoder->depth - 1] == 0) decoder->depth--;
+    return 1;
+}
+
+/**
+ * @brief Number of containers tiny_bits_read_value() is in, 0 at the top level
+ *
+ * @param decoder The unpacker instance
+ */
+static inline uint32_t tiny_bits_unpacker_depth(const tiny_bits_unpacker *decoder){
+    return decoder ? decoder->depth : 0;
+}
+
+// Decodes a packed array (validated by unpack_value()) into either ints or doubles
+static inline void _unpack_packed_values(const tiny_bits_value *value, int64_t *ints, double *doubles){
+    const uint8_t *data = value->packed_val.data;
+    size_t count = value->packed_val.count;
+    uint8_t scale = 0;
+    uint64_t base;
+    if (value->packed_val.kind == TB_NXT_PKD) scale = *data++;
+    uint8_t width = *data++;
+    data += decode_varint(data, varint_length(*data), 0, &base); // validated by _unpack_packed()
+    int64_t first = zigzag_decode(base);
+
+    size_t bits_size = (count * width + 7) / 8;
+    uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    size_t bit = 0;
+    for (size_t i = 0; i < count; i++, bit += width) {
+        size_t pos = bit >> 3;
+        unsigned shift = bit & 7;
+        uint64_t word = 0;
+        if (pos + 8 <= bits_size) {
+            word = _load_le64(data + pos) >> shift;
+            // a value may spill into a ninth byte
+            if (shift + width > 64) word |= (uint64_t)data[pos + 8] << (64 - shift);
+        } else {
+            for (size_t b = pos; b < bits_size; b++) word |= (uint64_t)data[b] << (8 * (b - pos));
+            word >>= shift;
+        }
+        int64_t integer = (int64_t)((uint64_t)first + (word & mask));
+        if (ints) {
+            ints[i] = integer;
+        } else if (scale == TB_PACKED_RAW) {
+            doubles[i] = itod_bits((uint64_t)integer);
+        } else {
+            doubles[i] = (double)integer / powers[scale];
+        }
+    }
+}
+
+/**
+ * @brief Decodes a packed integer array
+ * 
+ * @param value A value of type TINY_BITS_PACKED_INT returned by unpack_value()
+ * @param values Where to store the integers, room for value->packed_val.count of them
+ * @return 1 on success, 0 if value is not a packed integer array
+ *
+ * @note The packed data is read from the unpacker buffer, which must still be around
+ */
+static inline int unpack_packed_ints(const tiny_bits_value *value, int64_t *values){
+    if (!value || value->packed_val.kind != TB_NXT_PKI) return 0;
+    _unpack_packed_values(value, values, NULL);
+    return 1;
+}
+
+/**
+ * @brief Decodes a packed double (or integer) array
+ * 
+ * @param value A value of type TINY_BITS_PACKED_DOUBLE or TINY_BITS_PACKED_INT returned by unpack_value()
+ * @param values Where to store the doubles, room for value->packed_val.count of them
+ * @return 1 on success, 0 if value is not a packed array
+ *
+ * @note The packed data is read from the unpacker buffer, which must still be around
+ */
+static inline int unpack_packed_doubles(const tiny_bits_value *value, double *values){
+    if (!value || (value->packed_val.kind != TB_NXT_PKD && value->packed_val.kind != TB_NXT_PKI)) return 0;
+    _unpack_packed_values(value, NULL, values);
+    return 1;
+}
+
+/**
+ * @brief Unpacks an array of integers, as packed by pack_int_array() (or pack_arr() and pack_int() calls)
+ * or pack_packed_ints()
+ * 
+ * @param decoder The unpacker instance
+ * @param values Where to store the integers
+ * @param max_count Capacity of values
+ * @param count Set to the number of integers in the array
+ * @return TINY_BITS_ARRAY on success, TINY_BITS_ERROR if the next value is not an array of integers
+ * or it has more than max_count elements (TINY_BITS_NEED_MORE if it goes on past the input of an incremental
+ * unpacker), the unpacker (position and numbered strings) is left as it was in that case
+ *
+ * @note Runs of small positive integers (one byte each) are decoded eight at a time
+ */
+static inline enum tiny_bits_type unpack_int_array(tiny_bits_unpacker *decoder, int64_t *values, size_t max_count, size_t *count){
+    if (!decoder || !count) return TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark start; // a string read first was numbered, going back forgets it
+    _unpacker_mark(decoder, &start);
+    size_t at = start.start; // the value being read, to tell a short input from a malformed one
+    tiny_bits_value value;
+    enum tiny_bits_type type = unpack_value(decoder, &value);
+    if (type == TINY_BITS_PACKED_INT) {
+        if (value.packed_val.count > max_count) goto fail;
+        unpack_packed_ints(&value, values);
+        *count = value.packed_val.count;
+        return TINY_BITS_ARRAY;
+    }
+    if (type != TINY_BITS_ARRAY || value.length > max_count) goto fail;
+    size_t length = value.length;
+    const uint8_t *buffer = decoder->buffer;
+    for (size_t i = 0; i < length; i++) {
+        at = decoder->current_pos;
+        if (decoder->current_pos >= decoder->size) goto fail;
+        uint8_t tag = buffer[decoder->current_pos];
+        if (tag >= 128 && tag < 248 && i + 8 <= length && decoder->current_pos + 8 <= decoder->size) {
+            uint64_t word;
+            memcpy(&word, buffer + decoder->current_pos, 8);
+            // are all eight bytes small positive int tags? 0x80 to 0xF7: high bit set and not 0xF8 or above
+            uint64_t big = (word & 0xF8F8F8F8F8F8F8F8ULL) ^ 0xF8F8F8F8F8F8F8F8ULL; // zero bytes mark 0xF8 or above
+            uint64_t has_big = (big - 0x0101010101010101ULL) & ~big & 0x8080808080808080ULL;
+            if ((word & 0x8080808080808080ULL) == 0x8080808080808080ULL && !has_big) {
+                const uint8_t *tags = buffer + decoder->current_pos;
+                for (int j = 0; j < 8; j++) values[i + j] = tags[j] - 128;
+                decoder->current_pos += 8;
+                i += 7;
+                continue;
+            }
+        }
+        decoder->current_pos++;
+        if (tag_table[tag].type != TINY_BITS_INT || _unpack_tag(decoder, tag, &value) != TINY_BITS_INT) goto fail;
+        values[i] = value.int_val;
+    }
+    *count = length;
+    return TINY_BITS_ARRAY;
+fail:
+    _unpacker_restore(decoder, &start);
+    // an incremental unpacker may only be missing the rest of the array
+    return decoder->stream && _unpacker_incomplete(decoder, at) ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;
+}
+
+/**
+ * @brief Unpacks an array of doubles, as packed by pack_double_array() (or pack_arr() and pack_double() calls)
+ * or pack_packed_doubles()
+ * 
+ * @param decoder The unpacker instance
+ * @param values Where to store the doubles
+ * @param max_count Capacity of values
+ * @param count Set to the number of doubles in the array
+ * @return TINY_BITS_ARRAY on success, TINY_BITS_ERROR if the next value is not an array of numbers
+ * or it has more than max_count elements (TINY_BITS_NEED_MORE if it goes on past the input of an incremental
+ * unpacker), the unpacker (position and numbered strings) is left as it was in that case
+ *
+ * @note NaN and infinities are returned as such, integer elements are converted to double
+ */
+static inline enum tiny_bits_type unpack_double_array(tiny_bits_unpacker *decoder, double *values, size_t max_count, size_t *count){
+    if (!decoder || !count) return TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark start; // a string read first was numbered, going back forgets it
+    _unpacker_mark(decoder, &start);
+    size_t at = start.start; // the value being read, to tell a short input from a malformed one
+    tiny_bits_value value;
+    enum tiny_bits_type type = unpack_value(decoder, &value);
+    if (type == TINY_BITS_PACKED_DOUBLE || type == TINY_BITS_PACKED_INT) {
+        if (value.packed_val.count > max_count) goto fail;
+        unpack_packed_doubles(&value, values);
+        *count = value.packed_val.count;
+        return TINY_BITS_ARRAY;
+    }
+    if (type != TINY_BITS_ARRAY || value.length > max_count) goto fail;
+    size_t length = value.length;
+    for (size_t i = 0; i < length; i++) {
+        at = decoder->current_pos;
+        if (decoder->current_pos >= decoder->size) goto fail;
+        uint8_t tag = decoder->buffer[decoder->current_pos++];
+        switch (tag_table[tag].type) {
+        case TINY_BITS_INT:
+            if (_unpack_tag(decoder, tag, &value) != TINY_BITS_INT) goto fail;
+            values[i] = (double)value.int_val;
+            break;
+        case TINY_BITS_DOUBLE:
+            if (_unpack_tag(decoder, tag, &value) != TINY_BITS_DOUBLE) goto fail;
+            values[i] = value.double_val;
+            break;
+        case TINY_BITS_NAN:
+            values[i] = NAN;
+            break;
+        case TINY_BITS_INF:
+            values[i] = INFINITY;
+            break;
+        case TINY_BITS_N_INF:
+            values[i] = -INFINITY;
+            break;
+        default:
+            goto fail;
+        }
+    }
+    *count = length;
+    return TINY_BITS_ARRAY;
+fail:
+    _unpacker_restore(decoder, &start);
+    // an incremental unpacker may only be missing the rest of the array
+    return decoder->stream && _unpacker_incomplete(decoder, at) ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;
 }
 
 
 /* End unpacker.h */
 
+/* Begin dictionary.h */
+
+
+// A versioned, read-only set of common strings shared by both ends of a connection.
+// Once loaded into a packer and an unpacker, dictionary entries take the reference
+// ids 0..count-1 and the strings of each message are numbered after them, so a
+// dictionary string is sent as a reference from its very first occurrence.
+typedef struct tiny_bits_dictionary {
+    uint32_t version;       // Application defined, both sides must use the same version
+    char *data;             // Dictionary strings, stored back to back
+    size_t data_size;       // Bytes used in data
+    size_t data_capacity;   // Bytes allocated for data
+    HashTable table;        // Entry offsets are relative to data, next_id is the entry count
+} tiny_bits_dictionary;
+
+// Training candidate, a string seen while scanning the corpus
+typedef struct tiny_bits_dictionary_candidate {
+    const char *str;
+    uint32_t length;
+    uint32_t hash;
+    uint32_t count;   // Number of messages in which the string was sent inline
+} tiny_bits_dictionary_candidate;
+
+/**
+ * @brief allocates and initializes a new, empty dictionary
+ *
+ * @param version Application defined version number, stored with the dictionary
+ * @return pointer to new dictionary instance
+ *
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_create(uint32_t version) {
+    tiny_bits_dictionary *dict = (tiny_bits_dictionary *)malloc(sizeof(tiny_bits_dictionary));
+    if (!dict) return NULL;
+    memset(dict, 0, sizeof(tiny_bits_dictionary));
+    if (!hash_table_init(&dict->table, TB_HASH_CACHE_SIZE, TB_DICT_MAX_SIZE, TB_DEDUPE_POLICY_STOP)) {
+        free(dict);
+        return NULL;
+    }
+    dict->version = version;
+    return dict;
+}
+
+/**
+ * @brief Deallocate the dictionary object and its internal data structures
+ *
+ * @param dict The dictionary instance
+ *
+ * @note Packers and unpackers using the dictionary must be destroyed (or have their dictionary unset) first
+ */
+void tiny_bits_dictionary_destroy(tiny_bits_dictionary *dict) {
+    if (!dict) return;
+    hash_table_free(&dict->table);
+    free(dict->data);
+    free(dict);
+}
+
+/**
+ * @brief Adds a string to the dictionary
+ *
+ * @param dict The dictionary instance
+ * @param str Pointer to the string data (copied into the dictionary)
+ * @param str_len Length of the string in bytes
+ * @return The id of the string in the dictionary, or -1 on error
+ *
+ * @note Only deduplicatable strings (2-128 bytes) are accepted and at most TB_DICT_MAX_SIZE of them.
+ * Adding an existing string returns its id. Strings must not be added once the dictionary was set on
+ * a packer or an unpacker.
+ */
+static inline int32_t tiny_bits_dictionary_add(tiny_bits_dictionary *dict, const char *str, uint32_t str_len) {
+    if (!dict || !str || str_len < 2 || str_len > 128) return -1;
+    uint32_t hash_code = string_hash_32(str, str_len);
+    HashEntry *entry = hash_table_lookup(&dict->table, (const unsigned char *)dict->data, str, str_len, hash_code);
+    if (entry) return entry->id;
+    if (dict->table.cache_pos >= TB_DICT_MAX_SIZE) return -1;
+
+    if (dict->data_size + str_len > dict->data_capacity) {
+        size_t new_capacity = dict->data_capacity + str_len + dict->data_capacity;
+        char *new_data = (char *)realloc(dict->data, new_capacity);
+        if (!new_data) return -1;
+        dict->data = new_data;
+        dict->data_capacity = new_capacity;
+    }
+    if (!hash_table_insert(&dict->table, hash_code, str_len, dict->data_size)) return -1;
+    memcpy(dict->data + dict->data_size, str, str_len);
+    dict->data_size += str_len;
+    return dict->table.next_id - 1;
+}
+
+/**
+ * @brief Serializes the dictionary as a tinybits message: [version, [string, string, ...]]
+ *
+ * @param dict The dictionary instance
+ * @param encoder The packer to write to, it must not have a dictionary set
+ * @return Number of bytes written, or 0 on error
+ */
+static inline int tiny_bits_dictionary_save(const tiny_bits_dictionary *dict, tiny_bits_packer *encoder) {
+    if (!dict || !encoder || encoder->dictionary.next_id) return 0;
+    size_t start = encoder->current_pos;
+    if (!pack_arr(encoder, 2)) return 0;
+    if (!pack_int(encoder, dict->version)) return 0;
+    if (!pack_arr(encoder, dict->table.cache_pos)) return 0;
+    for (uint32_t i = 0; i < dict->table.cache_pos; i++) {
+        HashEntry entry = dict->table.cache[i];
+        if (!pack_str(encoder, dict->data + entry.offset, entry.length)) return 0;
+    }
+    return encoder->current_pos - start;
+}
+
+/**
+ * @brief Creates a dictionary from a buffer produced by tiny_bits_dictionary_save()
+ *
+ * @param buffer A pointer to the serialized dictionary
+ * @param size Size of the serialized dictionary
+ * @return pointer to new dictionary instance, or NULL if the buffer is malformed
+ *
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_load(const unsigned char *buffer, size_t size) {
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder) return NULL;
+    tiny_bits_dictionary *dict = NULL;
+    tiny_bits_value value;
+    tiny_bits_unpacker_set_buffer(decoder, buffer, size);
+
+    if (unpack_value(decoder, &value) != TINY_BITS_ARRAY || value.length != 2) goto done;
+    if (unpack_value(decoder, &value) != TINY_BITS_INT
+        || value.int_val < 0 || value.int_val > UINT32_MAX) goto done;
+    dict = tiny_bits_dictionary_create((uint32_t)value.int_val);
+    if (!dict) goto done;
+    if (unpack_value(decoder, &value) != TINY_BITS_ARRAY || value.length > TB_DICT_MAX_SIZE) goto fail;
+    size_t count = value.length;
+    for (size_t i = 0; i < count; i++) {
+        if (unpack_value(decoder, &value) != TINY_BITS_STR) goto fail;
+        // ids are positional, so every entry must land in its own slot
+        if (tiny_bits_dictionary_add(dict, value.str_blob_val.data, value.str_blob_val.length) != (int32_t)i) goto fail;
+    }
+    goto done;
+fail:
+    tiny_bits_dictionary_destroy(dict);
+    dict = NULL;
+done:
+    tiny_bits_unpacker_destroy(decoder);
+    return dict;
+}
+
+static inline int _dictionary_candidate_compare(const void *a, const void *b) {
+    const tiny_bits_dictionary_candidate *x = (const tiny_bits_dictionary_candidate *)a;
+    const tiny_bits_dictionary_candidate *y = (const tiny_bits_dictionary_candidate *)b;
+    // bytes saved over the corpus, roughly one string body per message it appears in
+    uint64_t x_score = (uint64_t)x->count * x->length;
+    uint64_t y_score = (uint64_t)y->count * y->length;
+    if (x_score != y_score) return x_score > y_score ? -1 : 1;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return memcmp(x->str, y->str, x->length);
+}
+
+/**
+ * @brief Builds a dictionary from a corpus of captured messages
+ *
+ * @param messages Array of pointers to packed messages
+ * @param sizes Size of each message
+ * @param count Number of messages in the corpus
+ * @param max_entries Maximum number of strings in the dictionary (capped at TB_DICT_MAX_SIZE)
+ * @param version Version number stored in the resulting dictionary
+ * @return pointer to new dictionary instance, or NULL on error
+ *
+ * Every deduplicatable string is scored by the number of messages that send it inline
+ * times its length, strings sent inline by fewer than two messages are never selected.
+ * The best candidates get the lowest ids, so they are referenced with a single byte.
+ *
+ * @note The corpus must be packed without a dictionary
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_train(const unsigned char **messages, const size_t *sizes, size_t count,
+                                                 uint32_t max_entries, uint32_t version) {
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder) return NULL;
+    tiny_bits_dictionary *dict = NULL;
+    size_t slots = 1024;  // open addressing, kept at most half full
+    size_t used = 0;
+    tiny_bits_dictionary_candidate *candidates = (tiny_bits_dictionary_candidate *)calloc(slots, sizeof(*candidates));
+    if (!candidates) goto done;
+
+    for (size_t m = 0; m < count; m++) {
+        tiny_bits_value value;
+        enum tiny_bits_type type;
+        if (!messages[m] || sizes[m] == 0) continue;
+        tiny_bits_unpacker_set_buffer(decoder, messages[m], sizes[m]);
+        while ((type = unpack_value(decoder, &value)) != TINY_BITS_FINISHED && type != TINY_BITS_ERROR) {
+            // references (positive ids) are already cheap, only inline strings count
+            if (type != TINY_BITS_STR || value.str_blob_val.id > 0) continue;
+            uint32_t len = value.str_blob_val.length;
+            if (len < 2 || len > 128) continue;
+            if ((used + 1) * 2 > slots) {
+                size_t new_slots = slots * 2;
+                tiny_bits_dictionary_candidate *grown = (tiny_bits_dictionary_candidate *)calloc(new_slots, sizeof(*grown));
+                if (!grown) goto done;
+                for (size_t i = 0; i < slots; i++) {
+                    if (!candidates[i].str) continue;
+                    size_t j = candidates[i].hash & (new_slots - 1);
+                    while (grown[j].str) j = (j + 1) & (new_slots - 1);
+                    grown[j] = candidates[i];
+                }
+                free(candidates);
+                candidates = grown;
+                slots = new_slots;
+            }
+            uint32_t hash_code = string_hash_32(value.str_blob_val.data, len);
+            size_t i = hash_code & (slots - 1);
+            while (candidates[i].str) {
+                if (candidates[i].hash == hash_code && candidates[i].length == len
+                    && memcmp(candidates[i].str, value.str_blob_val.data, len) == 0) break;
+                i = (i + 1) & (slots - 1);
+            }
+            if (!candidates[i].str) {
+                candidates[i].str = value.str_blob_val.data;
+                candidates[i].length = len;
+                candidates[i].hash = hash_code;
+                used++;
+            }
+            candidates[i].count++;
+        }
+    }
+
+    // compact the table, dropping strings that would never pay off
+    size_t selected = 0;
+    for (size_t i = 0; i < slots; i++) {
+        if (candidates[i].str && candidates[i].count >= 2) candidates[selected++] = candidates[i];
+    }
+    qsort(candidates, selected, sizeof(*candidates), _dictionary_candidate_compare);
+
+    dict = tiny_bits_dictionary_create(version);
+    if (!dict) goto done;
+    if (max_entries > TB_DICT_MAX_SIZE) max_entries = TB_DICT_MAX_SIZE;
+    for (size_t i = 0; i < selected && i < max_entries; i++) {
+        if (tiny_bits_dictionary_add(dict, candidates[i].str, candidates[i].length) < 0) {
+            tiny_bits_dictionary_destroy(dict);
+            dict = NULL;
+            break;
+        }
+    }
+done:
+    free(candidates);
+    tiny_bits_unpacker_destroy(decoder);
+    return dict;
+}
+
+/**
+ * @brief Sets (or clears) the pre-shared dictionary used by the packer
+ *
+ * @param encoder The packer instance
+ * @param dict The dictionary, or NULL to stop using one
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this between messages, right after creating or resetting the packer.
+ * The dictionary must outlive its use by the packer.
+ */
+static inline int tiny_bits_packer_set_dictionary(tiny_bits_packer *encoder, const tiny_bits_dictionary *dict) {
+    if (!encoder) return 0;
+    if (!dict) {
+        memset(&encoder->dictionary, 0, sizeof(HashTable));
+        encoder->dictionary_data = NULL;
+        return 1;
+    }
+    encoder->dictionary = dict->table;
+    encoder->dictionary_data = dict->data;
+    return 1;
+}
+
+/**
+ * @brief Sets (or clears) the pre-shared dictionary used by the unpacker
+ *
+ * @param decoder The unpacker instance
+ * @param dict The dictionary, or NULL to stop using one
+ * @return 1 on success, 0 on error
+ *
+ * @note This resets the string table of the unpacker, call it before tiny_bits_unpacker_set_buffer().
+ * The dictionary must outlive its use by the unpacker.
+ */
+static inline int tiny_bits_unpacker_set_dictionary(tiny_bits_unpacker *decoder, const tiny_bits_dictionary *dict) {
+    if (!decoder) return 0;
+    if (!dict) {
+        memset(&decoder->dictionary, 0, sizeof(HashTable));
+        decoder->strings_count = 0;
+        return 1;
+    }
+    size_t count = dict->table.cache_pos;
+    if (count >= decoder->strings_size) {
+        size_t new_size = count + decoder->strings_size;
+        void *new_strings = _tb_realloc(decoder->allocator, decoder->strings, new_size * sizeof(*decoder->strings));
+        if (!new_strings) return 0;
+        decoder->strings = new_strings;
+        decoder->strings_size = new_size;
+    }
+    for (size_t i = 0; i < count; i++) {
+        decoder->strings[i].str = dict->data + dict->table.cache[i].offset;
+        decoder->strings[i].length = dict->table.cache[i].length;
+    }
+    decoder->dictionary = dict->table;
+    decoder->strings_count = count;
+    return 1;
+}
+
+/* End dictionary.h */
+
+/* Begin query.h */
+
+
+#define TB_QUERY_MAX_PATHS 64 // most paths tiny_bits_query_many() looks up in one pass
+
+// One step of a path, a map key or an array index
+typedef struct tiny_bits_path_step {
+    const char *key;    // NULL for an array index
+    uint32_t key_len;
+    uint32_t index;
+} tiny_bits_path_step;
+
+/**
+ * A compiled path expression, such as user.children[2].first_name. Keys are matched against the string keys
+ * of maps, [n] picks the nth element of an array. The steps and their keys are stored in the same allocation.
+ */
+typedef struct tiny_bits_path {
+    uint32_t count;
+    tiny_bits_path_step steps[];
+} tiny_bits_path;
+
+/**
+ * @brief Compiles a path expression
+ *
+ * @param expression Keys separated by dots and array indexes in brackets: a.b[2][0].c, an empty expression
+ * is the value itself. A backslash makes the next character part of the key (a\.b is the key "a.b")
+ * @return The compiled path, NULL on a syntax error or allocation failure
+ *
+ * @note the returned path must be freed using tiny_bits_path_destroy()
+ */
+static inline tiny_bits_path *tiny_bits_path_compile(const char *expression) {
+    if (!expression) return NULL;
+    size_t expression_len = strlen(expression);
+    // every step takes one character at least, keys are never longer than the expression
+    size_t max_steps = expression_len + 1;
+    tiny_bits_path *path = (tiny_bits_path *)malloc(sizeof(tiny_bits_path) + max_steps * sizeof(tiny_bits_path_step) + expression_len);
+    if (!path) return NULL;
+    char *keys = (char *)(path->steps + max_steps);
+    const char *p = expression;
+    path->count = 0;
+    while (*p) {
+        tiny_bits_path_step *step = &path->steps[path->count];
+        if (*p == '[') {
+            uint64_t index = 0;
+            p++;
+            if (*p < '0' || *p > '9') goto fail;
+            while (*p >= '0' && *p <= '9') {
+                index = index * 10 + (uint64_t)(*p++ - '0');
+                if (index > UINT32_MAX) goto fail;
+            }
+            if (*p++ != ']') goto fail;
+            step->key = NULL;
+            step->key_len = 0;
+            step->index = (uint32_t)index;
+        } else {
+            if (*p == '.') {
+                if (path->count == 0) goto fail;
+                p++;
+            } else if (path->count > 0) {
+                goto fail; // a key follows a dot
+            }
+            step->key = keys;
+            while (*p && *p != '.' && *p != '[') {
+                if (*p == ']') goto fail;
+                if (*p == '\\' && p[1]) p++;
+                *keys++ = *p++;
+            }
+            step->key_len = (uint32_t)(keys - step->key);
+            step->index = 0;
+            if (step->key_len == 0) goto fail;
+        }
+        path->count++;
+    }
+    return path;
+fail:
+    free(path);
+    return NULL;
+}
+
+/**
+ * @brief Deallocate a compiled path
+ *
+ * @param path The path instance
+ */
+static inline void tiny_bits_path_destroy(tiny_bits_path *path) {
+    free(path);
+}
+
+// Skips what is left of the container opened at level, unless reading its last value closed it already
+static inline int _query_leave(tiny_bits_unpacker *decoder, uint32_t level) {
+    return decoder->depth == level ? tiny_bits_leave_container(decoder) : 1;
+}
+
+// Skips a value nothing is looked for in, as _query_walk() returns
+static inline int _query_skip(tiny_bits_unpacker *decoder) {
+    enum tiny_bits_type type = tiny_bits_skip_value(decoder);
+    return type == TINY_BITS_ERROR ? 0 : type == TINY_BITS_NEED_MORE ? -1 : 1;
+}
+
+// Reads the next value, the active paths have matched it with their first depth steps. Returns 1 when done,
+// 0 on malformed input and -1 when an incremental unpacker has only part of the value
+static inline int _query_walk(tiny_bits_unpacker *decoder, const tiny_bits_path **paths, uint32_t depth, uint64_t active,
+                                     uint64_t *pending, tiny_bits_value *values, enum tiny_bits_type *types) {
+    tiny_bits_value value;
+    enum tiny_bits_type type = tiny_bits_read_value(decoder, &value);
+    if (type == TINY_BITS_ERROR) return 0;
+    if (type == TINY_BITS_NEED_MORE) return -1;
+    if (type == TINY_BITS_FINISHED) return 1;
+    uint64_t deeper = 0; // paths going on into this value
+    for (uint64_t rest = active; rest; rest &= rest - 1) {
+        int p = _tb_ctz64(rest);
+        if (paths[p]->count == depth) {
+            values[p] = value;
+            types[p] = type;
+            *pending &= ~(1ULL << p);
+        } else {
+            deeper |= 1ULL << p;
+        }
+    }
+    // once everything is found the rest is left unread
+    if (!*pending) return 1;
+    if (type != TINY_BITS_ARRAY && type != TINY_BITS_MAP) return 1;
+    uint32_t level = decoder->depth;
+    if (!value.length) return 1;
+    if (!deeper) return tiny_bits_leave_container(decoder);
+    size_t length = value.length;
+    if (type == TINY_BITS_ARRAY) {
+        int64_t last = -1; // highest index looked for
+        for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+            const tiny_bits_path_step *step = &paths[_tb_ctz64(rest)]->steps[depth];
+            if (!step->key && (int64_t)step->index > last) last = step->index;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if ((int64_t)i > last) return _query_leave(decoder, level);
+            uint64_t child = 0;
+            for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+                int p = _tb_ctz64(rest);
+                if (!paths[p]->steps[depth].key && paths[p]->steps[depth].index == i) child |= 1ULL << p;
+            }
+            int done = child ? _query_walk(decoder, paths, depth + 1, child, pending, values, types) : _query_skip(decoder);
+            if (done <= 0) return done;
+            if (!*pending) return 1;
+        }
+        return 1;
+    }
+    uint64_t unmatched = 0; // paths still looking for their key in this map
+    for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+        int p = _tb_ctz64(rest);
+        if (paths[p]->steps[depth].key) unmatched |= 1ULL << p;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!unmatched) return _query_leave(decoder, level);
+        tiny_bits_value key;
+        enum tiny_bits_type key_type = tiny_bits_read_value(decoder, &key);
+        if (key_type == TINY_BITS_NEED_MORE) return -1;
+        if (key_type == TINY_BITS_ERROR || key_type == TINY_BITS_FINISHED) return 0;
+        uint64_t child = 0;
+        if (key_type == TINY_BITS_STR) {
+            for (uint64_t rest = unmatched; rest; rest &= rest - 1) {
+                int p = _tb_ctz64(rest);
+                const tiny_bits_path_step *step = &paths[p]->steps[depth];
+                if (step->key_len == key.str_blob_val.length && memcmp(step->key, key.str_blob_val.data, step->key_len) == 0) {
+                    child |= 1ULL << p;
+                }
+            }
+        }
+        unmatched &= ~child;
+        int done = child ? _query_walk(decoder, paths, depth + 1, child, pending, values, types) : _query_skip(decoder);
+        if (done <= 0) return done;
+        if (!*pending) return 1;
+    }
+    return 1;
+}
+
+// Nothing found yet, the value is not all there
+static inline int _query_need_more(enum tiny_bits_type *types, size_t count) {
+    for (size_t i = 0; i < count; i++) types[i] = TINY_BITS_NEED_MORE;
+    return 0;
+}
+
+/**
+ * @brief Looks up several paths in the next value, in a single pass
+ *
+ * @param decoder The unpacker instance
+ * @param paths Compiled paths, at most TB_QUERY_MAX_PATHS
+ * @param count Number of paths
+ * @param[out] values Set to the value found at each path
+ * @param[out] types Set to the type of the value found at each path, TINY_BITS_NOT_FOUND if there is none
+ * @return Number of paths found, -1 on malformed input or too many paths. An incremental unpacker returns 0,
+ * with every type set to TINY_BITS_NEED_MORE and the unpacker left as it was, until all of the value is there
+ *
+ * @note Values that no path leads into are skipped without being decoded, and reading stops as soon as every
+ * path is found. The unpacker is then left right after the last value found (inside its container when it is
+ * an array or a map, whose elements can be read next). The containers around it are tracked as with
+ * tiny_bits_read_value(), tiny_bits_leave_container() moves on past them.
+ */
+static inline int tiny_bits_query_many(tiny_bits_unpacker *decoder, const tiny_bits_path **paths, size_t count,
+                                       tiny_bits_value *values, enum tiny_bits_type *types) {
+    if (!decoder || !paths || !values || !types || count > TB_QUERY_MAX_PATHS) return -1;
+    if (count == 0) return 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!paths[i]) return -1;
+        types[i] = TINY_BITS_NOT_FOUND;
+    }
+    tiny_bits_unpacker_mark mark;
+    if (_unpacker_awaits(decoder)) return _query_need_more(types, count);
+    _unpacker_mark(decoder, &mark);
+    // reading the value counts it off the container it is in, going back counts it again
+    uint32_t depth = decoder->depth;
+    size_t left = depth ? decoder->frames[depth - 1] : 0;
+    uint64_t active = count == 64 ? ~0ULL : (1ULL << count) - 1;
+    uint64_t pending = active;
+    int done = _query_walk(decoder, paths, 0, active, &pending, values, types);
+    if (done == 0) return -1;
+    if (done < 0) {
+        if (_unpacker_rewind(decoder, &mark) != TINY_BITS_NEED_MORE) return -1;
+        decoder->depth = depth;
+        if (depth) decoder->frames[depth - 1] = left;
+        return _query_need_more(types, count);
+    }
+    return (int)(count - (size_t)_tb_popcount64(pending));
+}
+
+/**
+ * @brief Looks up a path in the next value
+ *
+ * @param decoder The unpacker instance
+ * @param path A compiled path
+ * @param[out] value Set to the value found
+ * @return The type of the value found, TINY_BITS_NOT_FOUND if there is none, TINY_BITS_ERROR on malformed input.
+ * An incremental unpacker returns TINY_BITS_NEED_MORE, reading nothing, until all of the value is there.
+ *
+ * @note Leaves the unpacker as tiny_bits_query_many() does
+ */
+static inline enum tiny_bits_type tiny_bits_query(tiny_bits_unpacker *decoder, const tiny_bits_path *path,
+                                                  tiny_bits_value *value) {
+    enum tiny_bits_type type;
+    if (tiny_bits_query_many(decoder, &path, 1, value, &type) < 0) return TINY_BITS_ERROR;
+    return type;
+}
+
+/* End query.h */
+
+/* Begin document.h */
+
+
+#define TB_DOC_LINEAR_MAP 8 // maps with more pairs get a hash index of their keys
+
+/**
+ * A decoded value, in document order: arrays and maps are followed by their elements (for maps, each key
+ * then its value), next skips the node and everything it contains. Strings, blobs and packed arrays point
+ * into the unpacker buffer (or its session copies).
+ */
+typedef struct tiny_bits_node {
+    tiny_bits_value value;  // as unpack_value() set it, value.length for the elements (pairs) of containers
+    uint32_t next;          // index of the node following this one and everything it contains
+    uint32_t elements;      // containers: where the node indexes of the elements (keys for maps) start in document->elements
+    uint8_t type;           // enum tiny_bits_type
+} tiny_bits_node;
+
+/**
+ * A whole value decoded at once into a flat array of nodes, for random access afterwards: array elements by
+ * position and map values by key in constant time. Nodes and indexes are kept across parses, so a reused
+ * document stops allocating once it has seen its largest message.
+ */
+typedef struct tiny_bits_document {
+    tiny_bits_node *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *elements;         // per container, the node index of each element (of each key for maps),
+                                // then for larger maps a hash table of key node index + 1, 0 for empty slots
+    uint32_t elements_count;
+    uint32_t elements_capacity;
+    const tiny_bits_allocator *allocator;
+} tiny_bits_document;
+
+/**
+ * @brief allocates and initializes a new document, taking all its memory from an allocator
+ *
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
+ * @return pointer to new document instance
+ *
+ * @note the returned document object must be freed using tiny_bits_document_destroy(), unless it comes from
+ * an arena that is reset or destroyed as a whole
+ */
+static inline tiny_bits_document *tiny_bits_document_create_with(const tiny_bits_allocator *allocator) {
+    tiny_bits_document *doc = (tiny_bits_document *)_tb_alloc(allocator, sizeof(tiny_bits_document));
+    if (!doc) return NULL;
+    memset(doc, 0, sizeof(tiny_bits_document));
+    doc->allocator = allocator;
+    return doc;
+}
+
+/**
+ * @brief allocates and initializes a new document
+ *
+ * @return pointer to new document instance
+ *
+ * @note the returned document object must be freed using tiny_bits_document_destroy()
+ */
+static inline tiny_bits_document *tiny_bits_document_create(void) {
+    return tiny_bits_document_create_with(NULL);
+}
+
+/**
+ * @brief Deallocate the document object and its nodes
+ *
+ * @param doc The document instance
+ */
+static inline void tiny_bits_document_destroy(tiny_bits_document *doc) {
+    if (!doc) return;
+    _tb_free(doc->allocator, doc->nodes);
+    _tb_free(doc->allocator, doc->elements);
+    _tb_free(doc->allocator, doc);
+}
+
+// Room for needed more nodes, kept out of the parsing loop
+static TB_NOINLINE int _document_grow_nodes(tiny_bits_document *doc, size_t needed) {
+    size_t capacity = doc->capacity ? doc->capacity : 64;
+    while (capacity < (size_t)doc->count + needed) capacity *= 2;
+    if (capacity > UINT32_MAX) return 0;
+    tiny_bits_node *nodes = (tiny_bits_node *)_tb_realloc(doc->allocator, doc->nodes, capacity * sizeof(tiny_bits_node));
+    if (!nodes) return 0;
+    doc->nodes = nodes;
+    doc->capacity = (uint32_t)capacity;
+    return 1;
+}
+
+// Reserves count entries of the element index, returns where they start or UINT32_MAX on failure
+static inline uint32_t _document_reserve_elements(tiny_bits_document *doc, size_t count) {
+    if ((size_t)doc->elements_count + count > doc->elements_capacity) {
+        size_t capacity = doc->elements_capacity ? doc->elements_capacity : 64;
+        while (capacity < (size_t)doc->elements_count + count) capacity *= 2;
+        if (capacity >= UINT32_MAX) return UINT32_MAX;
+        uint32_t *elements = (uint32_t *)_tb_realloc(doc->allocator, doc->elements, capacity * sizeof(uint32_t));
+        if (!elements) return UINT32_MAX;
+        doc->elements = elements;
+        doc->elements_capacity = (uint32_t)capacity;
+    }
+    uint32_t start = doc->elements_count;
+    doc->elements_count += (uint32_t)count;
+    return start;
+}
+
+// Slots of the key hash index of a map, 0 when it is looked up linearly
+static inline uint32_t _document_map_slots(uint32_t length) {
+    if (length <= TB_DOC_LINEAR_MAP) return 0;
+    uint32_t slots = 16;
+    while (slots < 2 * length) slots *= 2;
+    return slots;
+}
+
+// Hashes the string keys of a linked map into the slots following its key index
+static inline void _document_index_map(tiny_bits_document *doc, const tiny_bits_node *map) {
+    uint32_t length = (uint32_t)map->value.length;
+    uint32_t slots = _document_map_slots(length);
+    const uint32_t *keys = doc->elements + map->elements;
+    uint32_t *table = doc->elements + map->elements + length;
+    memset(table, 0, slots * sizeof(uint32_t));
+    for (uint32_t i = 0; i < length; i++) {
+        const tiny_bits_node *key = &doc->nodes[keys[i]];
+        if (key->type != TINY_BITS_STR) continue;
+        uint32_t slot = string_hash_32(key->value.str_blob_val.data, (uint32_t)key->value.str_blob_val.length) & (slots - 1);
+        while (table[slot]) slot = (slot + 1) & (slots - 1);
+        table[slot] = keys[i] + 1;
+    }
+}
+
+// Sets next and fills the element index of every node, last to first: the nodes following a container are
+// linked by the time it is reached, so its elements are found by hopping from one to the next
+static inline void _document_link(tiny_bits_document *doc) {
+    tiny_bits_node *nodes = doc->nodes;
+    for (uint32_t i = doc->count; i-- > 0;) {
+        tiny_bits_node *node = &nodes[i];
+        uint32_t next = i + 1;
+        if (node->type == TINY_BITS_ARRAY) {
+            uint32_t *elements = doc->elements + node->elements;
+            for (size_t k = 0; k < node->value.length; k++) {
+                elements[k] = next;
+                next = nodes[next].next;
+            }
+        } else if (node->type == TINY_BITS_MAP) {
+            uint32_t *keys = doc->elements + node->elements;
+            for (size_t k = 0; k < node->value.length; k++) {
+                keys[k] = next;
+                next = nodes[nodes[next].next].next; // past the key and its value
+            }
+            if (node->value.length > TB_DOC_LINEAR_MAP) _document_index_map(doc, node);
+        }
+        node->next = next;
+    }
+}
+
+/**
+ * @brief Decodes the next value of an unpacker, with everything it contains, into the document
+ *
+ * @param doc The document instance, its previous content is discarded
+ * @param decoder The unpacker, left after the value
+ * @return The type of the value (the root node), TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_ERROR
+ * on malformed input or allocation failure. An incremental unpacker returns TINY_BITS_NEED_MORE, and is left
+ * before the value, until all of it has been appended.
+ *
+ * @note Nodes point into the unpacker buffer, which must outlive them. Values are unpacked straight into their
+ * nodes, then containers are linked and indexed in a second pass over the nodes, maps of more than
+ * TB_DOC_LINEAR_MAP pairs get a hash index of their keys.
+ */
+static inline enum tiny_bits_type tiny_bits_document_parse(tiny_bits_document *doc, tiny_bits_unpacker *decoder) {
+    if (!doc || !decoder) return TINY_BITS_ERROR;
+    size_t left = 1; // values still to come, containers add their elements
+    tiny_bits_unpacker_mark mark;
+    doc->count = 0;
+    doc->elements_count = 0;
+    // an incremental unpacker waits for all of the value rather than parsing it again with every append
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    _unpacker_mark(decoder, &mark);
+    while (left) {
+        if (doc->count == doc->capacity && !_document_grow_nodes(doc, 1)) goto fail;
+        tiny_bits_node *node = &doc->nodes[doc->count];
+        enum tiny_bits_type type = unpack_value(decoder, &node->value);
+        if (type == TINY_BITS_FINISHED && doc->count == 0) return TINY_BITS_FINISHED;
+        if (type == TINY_BITS_ERROR) goto fail;
+        if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) goto cut_short;
+        node->type = (uint8_t)type;
+        doc->count++;
+        left--;
+        if (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) {
+            size_t length = node->value.length;
+            size_t values = type == TINY_BITS_MAP ? 2 * length : length;
+            // every value takes a byte at least, which also bounds the element index by the buffer size
+            if (length > decoder->size - decoder->current_pos || values > decoder->size - decoder->current_pos - left) goto cut_short;
+            uint32_t elements = _document_reserve_elements(doc, length + (type == TINY_BITS_MAP ? _document_map_slots((uint32_t)length) : 0));
+            if (elements == UINT32_MAX) goto fail;
+            node->elements = elements;
+            left += values;
+        }
+    }
+    _document_link(doc);
+    return (enum tiny_bits_type)doc->nodes[0].type;
+cut_short:
+    // malformed, or an incremental unpacker that has not got all of the value yet
+    doc->count = 0;
+    return _unpacker_rewind(decoder, &mark);
+fail:
+    doc->count = 0;
+    return TINY_BITS_ERROR;
+}
+
+/**
+ * @brief The value parsed last
+ *
+ * @param doc The document instance
+ * @return The root node, NULL if the document is empty
+ */
+static inline const tiny_bits_node *tiny_bits_document_root(const tiny_bits_document *doc) {
+    return doc && doc->count ? &doc->nodes[0] : NULL;
+}
+
+/**
+ * @brief An element of an array
+ *
+ * @param doc The document instance
+ * @param array An array node of the document
+ * @param index Position of the element
+ * @return The element node, NULL if array is not an array or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_at(const tiny_bits_document *doc, const tiny_bits_node *array, size_t index) {
+    if (!array || array->type != TINY_BITS_ARRAY || index >= array->value.length) return NULL;
+    return &doc->nodes[doc->elements[array->elements + index]];
+}
+
+/**
+ * @brief A key of a map, in the order they were packed
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param index Position of the pair
+ * @return The key node (its value is the node right after it), NULL if map is not a map or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_key_at(const tiny_bits_document *doc, const tiny_bits_node *map, size_t index) {
+    if (!map || map->type != TINY_BITS_MAP || index >= map->value.length) return NULL;
+    return &doc->nodes[doc->elements[map->elements + index]];
+}
+
+/**
+ * @brief The value of a pair of a map, in the order they were packed
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param index Position of the pair
+ * @return The value node, NULL if map is not a map or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_value_at(const tiny_bits_document *doc, const tiny_bits_node *map, size_t index) {
+    const tiny_bits_node *key = tiny_bits_node_key_at(doc, map, index);
+    return key ? &doc->nodes[key->next] : NULL;
+}
+
+/**
+ * @brief Looks a string key up in a map
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param key The key
+ * @param key_len Its length in bytes
+ * @return The value node, NULL if map is not a map or has no such key
+ */
+static inline const tiny_bits_node *tiny_bits_node_get(const tiny_bits_document *doc, const tiny_bits_node *map,
+                                                       const char *key, size_t key_len) {
+    if (!map || map->type != TINY_BITS_MAP) return NULL;
+    uint32_t length = (uint32_t)map->value.length;
+    const uint32_t *keys = doc->elements + map->elements;
+    if (length <= TB_DOC_LINEAR_MAP) {
+        for (uint32_t i = 0; i < length; i++) {
+            const tiny_bits_node *node = &doc->nodes[keys[i]];
+            if (node->type == TINY_BITS_STR && node->value.str_blob_val.length == key_len
+                && memcmp(node->value.str_blob_val.data, key, key_len) == 0) {
+                return &doc->nodes[node->next];
+            }
+        }
+        return NULL;
+    }
+    if (key_len > UINT32_MAX) return NULL;
+    uint32_t slots = _document_map_slots(length);
+    const uint32_t *table = keys + length;
+    uint32_t slot = string_hash_32(key, (uint32_t)key_len) & (slots - 1);
+    while (table[slot]) {
+        const tiny_bits_node *node = &doc->nodes[table[slot] - 1];
+        if (node->value.str_blob_val.length == key_len && memcmp(node->value.str_blob_val.data, key, key_len) == 0) {
+            return &doc->nodes[node->next];
+        }
+        slot = (slot + 1) & (slots - 1);
+    }
+    return NULL;
+}
+
+/* End document.h */
+
+/* Begin walker.h */
+
+
+/**
+ * Callbacks for tiny_bits_walk(), each returns 1 to go on and 0 to stop the walk. NULL callbacks are skipped,
+ * the values they would have been given go to on_value when it is set. Map elements come as key, value,
+ * key, value... between on_map_begin and on_map_end.
+ */
+typedef struct tiny_bits_visitor {
+    int (*on_int)(void *context, int64_t value);
+    int (*on_double)(void *context, double value);      // NaN and infinities too
+    int (*on_str)(void *context, const char *data, size_t length);
+    int (*on_blob)(void *context, const char *data, size_t length);
+    int (*on_bool)(void *context, int value);
+    int (*on_null)(void *context);
+    int (*on_datetime)(void *context, double unixtime, size_t offset);
+    int (*on_array_begin)(void *context, size_t length);
+    int (*on_array_end)(void *context);
+    int (*on_map_begin)(void *context, size_t length);  // number of key-value pairs
+    int (*on_map_end)(void *context);
+    // any other value (packed arrays, separators), and the ones above whose callback is NULL
+    int (*on_value)(void *context, enum tiny_bits_type type, const tiny_bits_value *value);
+} tiny_bits_visitor;
+
+// One open container while walking
+typedef struct tiny_bits_walk_frame {
+    size_t left;    // values still to come, keys and values for maps
+    uint8_t map;
+} tiny_bits_walk_frame;
+
+// Calls the visitor for one value, 0 when it stops the walk
+static TB_ALWAYS_INLINE int _walk_visit(const tiny_bits_visitor *visitor, void *context, enum tiny_bits_type type,
+                                        const tiny_bits_value *value) {
+    switch (type) {
+    case TINY_BITS_INT:
+        if (visitor->on_int) return visitor->on_int(context, value->int_val);
+        break;
+    case TINY_BITS_DOUBLE:
+        if (visitor->on_double) return visitor->on_double(context, value->double_val);
+        break;
+    case TINY_BITS_NAN:
+        if (visitor->on_double) return visitor->on_double(context, NAN);
+        break;
+    case TINY_BITS_INF:
+        if (visitor->on_double) return visitor->on_double(context, INFINITY);
+        break;
+    case TINY_BITS_N_INF:
+        if (visitor->on_double) return visitor->on_double(context, -INFINITY);
+        break;
+    case TINY_BITS_STR:
+        if (visitor->on_str) return visitor->on_str(context, value->str_blob_val.data, value->str_blob_val.length);
+        break;
+    case TINY_BITS_BLOB:
+        if (visitor->on_blob) return visitor->on_blob(context, value->str_blob_val.data, value->str_blob_val.length);
+        break;
+    case TINY_BITS_TRUE:
+    case TINY_BITS_FALSE:
+        if (visitor->on_bool) return visitor->on_bool(context, type == TINY_BITS_TRUE);
+        break;
+    case TINY_BITS_NULL:
+        if (visitor->on_null) return visitor->on_null(context);
+        break;
+    case TINY_BITS_DATETIME:
+        if (visitor->on_datetime) return visitor->on_datetime(context, value->datetime_val.unixtime, value->datetime_val.offset);
+        break;
+    case TINY_BITS_ARRAY:
+        if (visitor->on_array_begin) return visitor->on_array_begin(context, value->length);
+        break;
+    case TINY_BITS_MAP:
+        if (visitor->on_map_begin) return visitor->on_map_begin(context, value->length);
+        break;
+    default:
+        break;
+    }
+    return visitor->on_value ? visitor->on_value(context, type, value) : 1;
+}
+
+// The walk itself, always inlined so that a constant visitor turns into direct (and inlinable) calls
+static TB_ALWAYS_INLINE enum tiny_bits_type _tiny_bits_walk(tiny_bits_unpacker *decoder, const tiny_bits_visitor *visitor,
+                                                            void *context) {
+    tiny_bits_walk_frame stack[TB_MAX_DEPTH]; // the containers around the current one
+    tiny_bits_walk_frame current = { 1, 0 };  // kept out of the stack, it changes with every value
+    uint32_t depth = 0;
+    enum tiny_bits_type root = TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark mark;
+    // an incremental unpacker waits for all of the value, the callbacks never see part of one
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    _unpacker_mark(decoder, &mark);
+    for (;;) {
+        tiny_bits_value value;
+        enum tiny_bits_type type = unpack_value(decoder, &value);
+        if (type == TINY_BITS_FINISHED && root == TINY_BITS_ERROR) return TINY_BITS_FINISHED;
+        if (type == TINY_BITS_ERROR) return TINY_BITS_ERROR;
+        if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) return _unpacker_rewind(decoder, &mark);
+        if (root == TINY_BITS_ERROR) root = type;
+        current.left--;
+        if (!_walk_visit(visitor, context, type, &value)) return TINY_BITS_ERROR;
+        if (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) {
+            // every value takes a byte at least, larger counts are malformed (or not all there yet)
+            if (value.length > decoder->size - decoder->current_pos) return _unpacker_rewind(decoder, &mark);
+            if (depth == TB_MAX_DEPTH) return TINY_BITS_ERROR;
+            stack[depth++] = current;
+            current.left = type == TINY_BITS_MAP ? 2 * value.length : value.length;
+            current.map = type == TINY_BITS_MAP;
+        }
+        // close the containers this value completed
+        while (current.left == 0) {
+            if (depth == 0) return root;
+            if (current.map ? visitor->on_map_end && !visitor->on_map_end(context)
+                            : visitor->on_array_end && !visitor->on_array_end(context)) {
+                return TINY_BITS_ERROR;
+            }
+            current = stack[--depth];
+        }
+    }
+}
+
+/**
+ * @brief Walks the next value of an unpacker, with everything it contains, calling the visitor for each value
+ * and for the end of each container
+ *
+ * @param decoder The unpacker, left after the value
+ * @param visitor The callbacks
+ * @param context Passed to every callback
+ * @return The type of the value walked, TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_ERROR on malformed
+ * input, nesting deeper than TB_MAX_DEPTH or when a callback returned 0 (the unpacker is then left after
+ * the value it was given). An incremental unpacker returns TINY_BITS_NEED_MORE, without calling any callback,
+ * until all of the value has been appended.
+ *
+ * @note Strings and blobs point into the buffer (or session copies) and are only valid as long as it is.
+ * When the visitor is known at compile time, TINY_BITS_WALKER() defines a walk specialized for it.
+ */
+static inline enum tiny_bits_type tiny_bits_walk(tiny_bits_unpacker *decoder, const tiny_bits_visitor *visitor, void *context) {
+    if (!decoder || !visitor) return TINY_BITS_ERROR;
+    return _tiny_bits_walk(decoder, visitor, context);
+}
+
+/**
+ * Defines name(decoder, context), a tiny_bits_walk() with visitor (a static const tiny_bits_visitor) built in:
+ * the unused callbacks disappear and static callbacks can be inlined into the loop.
+ *
+ *     static const tiny_bits_visitor sum_visitor = { .on_int = add_int };
+ *     TINY_BITS_WALKER(sum_walk, sum_visitor)
+ *     ...
+ *     sum_walk(unpacker, &total);
+ */
+#define TINY_BITS_WALKER(name, visitor)                                                      \
+    static inline enum tiny_bits_type name(tiny_bits_unpacker *decoder, void *context) {    \
+        if (!decoder) return TINY_BITS_ERROR;                                                \
+        return _tiny_bits_walk(decoder, &(visitor), context);                                \
+    }
+
+/* End walker.h */
+
+/* Begin parallel.h */
+
+
+// A run of bytes that decodes on its own, without the separator that ends it
+typedef struct tiny_bits_frame {
+    size_t offset;
+    size_t size;
+} tiny_bits_frame;
+
+/**
+ * Where the messages of a buffer of messages joined by pack_separator() start, so that they can be decoded
+ * out of order. A message using deduplicated strings of the messages before it is put in the same frame as
+ * them, each frame numbers its strings from scratch (after the dictionary, if any).
+ */
+typedef struct tiny_bits_frame_index {
+    tiny_bits_frame *frames;
+    size_t count;
+    size_t capacity;
+    size_t messages;    // messages indexed, more than count when some could not be framed on their own
+    const tiny_bits_allocator *allocator;
+} tiny_bits_frame_index;
+
+/**
+ * @brief allocates and initializes a new frame index, taking all its memory from an allocator
+ *
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
+ * @return pointer to new frame index instance
+ *
+ * @note the returned frame index object must be freed using tiny_bits_frame_index_destroy(), unless it comes
+ * from an arena that is reset or destroyed as a whole
+ */
+static inline tiny_bits_frame_index *tiny_bits_frame_index_create_with(const tiny_bits_allocator *allocator) {
+    tiny_bits_frame_index *index = (tiny_bits_frame_index *)_tb_alloc(allocator, sizeof(tiny_bits_frame_index));
+    if (!index) return NULL;
+    memset(index, 0, sizeof(tiny_bits_frame_index));
+    index->allocator = allocator;
+    return index;
+}
+
+/**
+ * @brief allocates and initializes a new frame index
+ *
+ * @return pointer to new frame index instance
+ *
+ * @note the returned frame index object must be freed using tiny_bits_frame_index_destroy()
+ */
+static inline tiny_bits_frame_index *tiny_bits_frame_index_create(void) {
+    return tiny_bits_frame_index_create_with(NULL);
+}
+
+/**
+ * @brief Deallocate the frame index object and its frames
+ *
+ * @param index The frame index instance
+ */
+static inline void tiny_bits_frame_index_destroy(tiny_bits_frame_index *index) {
+    if (!index) return;
+    _tb_free(index->allocator, index->frames);
+    _tb_free(index->allocator, index);
+}
+
+// Records the message from offset to end: a frame of its own, or the end of the frames it depends on
+static inline int _frame_index_add(tiny_bits_frame_index *index, size_t offset, size_t end, int dependent, size_t clean) {
+    index->messages++;
+    if (dependent && index->count) {
+        // back to the last frame that started with the strings of the unpacker, all the frames after it
+        // number their strings from the wrong id as well
+        index->count = clean + 1;
+        index->frames[clean].size = end - index->frames[clean].offset;
+        return 1;
+    }
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        tiny_bits_frame *frames = (tiny_bits_frame *)_tb_realloc(index->allocator, index->frames, capacity * sizeof(tiny_bits_frame));
+        if (!frames) return 0;
+        index->frames = frames;
+        index->capacity = capacity;
+    }
+    index->frames[index->count].offset = offset;
+    index->frames[index->count].size = end - offset;
+    index->count++;
+    return 1;
+}
+
+/**
+ * @brief Finds the messages of a buffer of messages joined by pack_separator()
+ *
+ * @param index The frame index instance, its previous frames are dropped
+ * @param buffer The messages
+ * @param size Size of the buffer
+ * @param dict The dictionary the messages were packed with, NULL for none
+ * @return 1 on success, 0 on malformed input or allocation failure
+ *
+ * @note Values are jumped over without being decoded, at the cost of a tag lookup each, so separator bytes
+ * inside strings or numbers are never taken for boundaries. Messages without values get no frame. A message that
+ * refers to strings numbered before it, without a reset marker first, stays in the frame of the messages
+ * it depends on: calling pack_strings_reset() after each pack_separator() gives every message its own frame.
+ */
+static inline int tiny_bits_frame_index_build(tiny_bits_frame_index *index, const unsigned char *buffer, size_t size,
+                                              const tiny_bits_dictionary *dict) {
+    if (!index || (!buffer && size)) return 0;
+    size_t base = dict ? dict->table.next_id : 0; // ids taken by the dictionary
+    size_t strings = base;          // strings numbered so far, as the unpacker numbers them
+    size_t message_strings = base;  // the same at the start of the current message
+    size_t pending = 0;             // values left in the open containers
+    size_t start = 0, clean = 0, pos = 0;
+    int reset = 0, dependent = 0, empty = 1;
+    index->count = 0;
+    index->messages = 0;
+    while (pos < size) {
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length, id;
+        uint8_t read;
+        if (tag == TB_SEP_TAG && !pending) {
+            if (!empty) {
+                if (!dependent && message_strings == base) clean = index->count;
+                if (!_frame_index_add(index, start, pos - 1, dependent, clean)) return 0;
+            }
+            start = pos;
+            message_strings = strings;
+            reset = dependent = 0;
+            empty = 1;
+            continue;
+        }
+        if (tag == TB_NXT_TAG && pos < size && buffer[pos] == TB_NXT_RST) {
+            // not a value, strings are numbered from scratch again
+            strings = base;
+            if (pos - 1 == start) message_strings = base; // as if the message had started clean
+            reset = 1;
+            pos++;
+            continue;
+        }
+        empty = 0;
+        if (pending) pending--;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) continue;
+            length = tag & info->mask;
+            break;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) continue;
+            length += info->bias;
+            break;
+        case TB_OP_STR:
+        case TB_OP_STR_VARINT:
+            length = tag & info->mask;
+            if (info->op == TB_OP_STR_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &length)) || length > SIZE_MAX - info->bias) return 0;
+                pos += read;
+                length += info->bias;
+            }
+            if (length > size - pos) return 0;
+            if (length >= 2 && length <= TB_DDP_STR_LEN_MAX) strings++;
+            pos += length;
+            continue;
+        case TB_OP_REF:
+        case TB_OP_REF_VARINT:
+            id = tag & info->mask;
+            if (info->op == TB_OP_REF_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &id)) || id > SIZE_MAX - info->bias) return 0;
+                pos += read;
+                id += info->bias;
+            }
+            if (id >= strings) return 0;
+            // ids of the strings of this message are shifted too when it starts with those of others
+            if (id >= base && !reset && message_strings != base) dependent = 1;
+            continue;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+            pos += varint_length(buffer[pos]);
+            continue;
+        case TB_OP_F16: length = 2; goto jump;
+        case TB_OP_F32: length = 4; goto jump;
+        case TB_OP_F64: length = 8; goto jump;
+        case TB_OP_DATETIME: length = 9; goto jump;
+        case TB_OP_BLOB:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            goto jump;
+        case TB_OP_NXT: {
+            if (pos >= size) return 0;
+            uint8_t kind = buffer[pos++];
+            uint64_t count, width;
+            if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) return 0;
+            if (!(read = decode_varint(buffer, size, pos, &count))) return 0;
+            pos += read;
+            if (kind == TB_NXT_PKD) pos++; // scale
+            if (pos >= size) return 0;
+            width = buffer[pos++];
+            if (width > 64 || count > (1ULL << 56)) return 0;
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0; // base
+            pos += read;
+            length = (count * width + 7) / 8;
+            goto jump;
+        }
+        default:
+            return 0;
+        }
+        // every value takes a byte at least, larger counts can only be malformed
+        if (length > size) return 0;
+        pending += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (pending > size - pos) return 0;
+        continue;
+    jump:
+        if (length > size - pos) return 0;
+        pos += length;
+    }
+    if (pending) return 0; // the last message is cut short
+    if (!empty) {
+        if (!dependent && message_strings == base) clean = index->count;
+        if (!_frame_index_add(index, start, size, dependent, clean)) return 0;
+    }
+    return 1;
+}
+
+// Decoding on several threads uses pthreads, it is only there when TB_WITH_THREADS is defined before including tinybits
+#if defined(TB_WITH_THREADS)
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define TB_FRAMES_PER_CLAIM 8 // frames a worker takes per thread and round, see tiny_bits_decode_frames()
+
+/**
+ * Called by tiny_bits_decode_frames() for each frame, with an unpacker set to it. Returns 1 to go on and 0 to
+ * stop decoding.
+ */
+typedef int (*tiny_bits_frame_fn)(void *context, tiny_bits_unpacker *decoder, size_t frame);
+
+// What the workers of tiny_bits_decode_frames() share
+typedef struct tiny_bits_frames_job {
+    pthread_mutex_t lock;
+    const tiny_bits_frame_index *index;
+    const unsigned char *buffer;
+    const tiny_bits_dictionary *dict;
+    tiny_bits_frame_fn fn;
+    void *context;
+    size_t next;    // first frame not taken yet
+    size_t claim;   // frames taken at once
+    int failed;
+} tiny_bits_frames_job;
+
+// A worker, decoding frames with an unpacker of its own until none are left
+static inline void *_tb_frames_worker(void *argument) {
+    tiny_bits_frames_job *job = (tiny_bits_frames_job *)argument;
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder || (job->dict && !tiny_bits_unpacker_set_dictionary(decoder, job->dict))) {
+        pthread_mutex_lock(&job->lock);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->lock);
+        tiny_bits_unpacker_destroy(decoder);
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t first = job->next;
+        size_t last = job->failed || first >= job->index->count ? first : first + job->claim;
+        if (last > job->index->count) last = job->index->count;
+        job->next = last;
+        pthread_mutex_unlock(&job->lock);
+        if (first == last) break;
+        for (size_t i = first; i < last; i++) {
+            const tiny_bits_frame *frame = &job->index->frames[i];
+            tiny_bits_unpacker_set_buffer(decoder, job->buffer + frame->offset, frame->size);
+            if (!job->fn(job->context, decoder, i)) {
+                pthread_mutex_lock(&job->lock);
+                job->failed = 1;
+                pthread_mutex_unlock(&job->lock);
+                break;
+            }
+        }
+    }
+    tiny_bits_unpacker_destroy(decoder);
+    return NULL;
+}
+
+/**
+ * @brief Decodes the frames of an index on several threads, each with an unpacker of its own
+ *
+ * @param index The frame index, built from buffer
+ * @param buffer The messages
+ * @param dict The dictionary the messages were packed with, NULL for none
+ * @param threads Threads to decode on, the calling one included, 0 for one per online core
+ * @param fn Called for each frame with an unpacker set to it (and to dict), on any of the threads
+ * @param context Passed to fn
+ * @return 1 once all the frames were decoded, 0 when fn returned 0 or on allocation failure
+ *
+ * @note Frames are taken a few at a time in index order, but fn runs concurrently and in no particular order:
+ * it should only write to what belongs to its frame (results indexed by frame for instance), or lock.
+ * Strings point into buffer. When threads can not be started, the remaining ones decode all the frames.
+ * Only there when TB_WITH_THREADS is defined.
+ */
+static inline int tiny_bits_decode_frames(const tiny_bits_frame_index *index, const unsigned char *buffer,
+                                          const tiny_bits_dictionary *dict, unsigned int threads,
+                                          tiny_bits_frame_fn fn, void *context) {
+    if (!index || !fn || (!buffer && index->count)) return 0;
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if (threads > index->count) threads = index->count ? (unsigned int)index->count : 1;
+    tiny_bits_frames_job job;
+    if (pthread_mutex_init(&job.lock, NULL) != 0) return 0;
+    job.index = index;
+    job.buffer = buffer;
+    job.dict = dict;
+    job.fn = fn;
+    job.context = context;
+    job.next = 0;
+    // small claims balance frames of uneven sizes, larger ones take the lock less often
+    job.claim = index->count / ((size_t)threads * TB_FRAMES_PER_CLAIM);
+    if (job.claim < 1) job.claim = 1;
+    job.failed = 0;
+    pthread_t *workers = threads > 1 ? (pthread_t *)malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    unsigned int started = 0;
+    while (workers && started < threads - 1 && pthread_create(&workers[started], NULL, _tb_frames_worker, &job) == 0) {
+        started++;
+    }
+    _tb_frames_worker(&job);
+    for (unsigned int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+    return !job.failed && job.next == index->count;
+}
+
+#endif // TB_WITH_THREADS
+
+/* End parallel.h */
+
+/* Begin validator.h */
+
+
+// What tiny_bits_validate() found wrong first
+enum tiny_bits_validity {
+    TINY_BITS_VALID,
+    TINY_BITS_INVALID_TAG,      // a separator inside a container, or an unknown native extension or packed scale
+    TINY_BITS_TRUNCATED,        // a value, or the elements of a container, go on past the buffer
+    TINY_BITS_INVALID_REF,      // a reference to a string not numbered yet
+    TINY_BITS_INVALID_COUNT,    // an array or map with more elements than bytes left to hold them
+    TINY_BITS_TOO_DEEP,         // containers nested deeper than the limit
+    TINY_BITS_TOO_LARGE         // over the size, length or value limit
+};
+
+// Budget for tiny_bits_validate(), 0 leaves a limit out
+typedef struct tiny_bits_limits {
+    uint32_t max_depth;     // deepest nesting of arrays and maps, at most (and 0 for) TB_MAX_DEPTH
+    size_t max_size;        // largest buffer
+    size_t max_values;      // most values in all, elements of containers included
+    size_t max_length;      // longest string or blob, most elements in an array, map (pairs) or packed array
+} tiny_bits_limits;
+
+/**
+ * @brief Checks that a buffer is well formed before decoding it, in a single pass without decoding values
+ *
+ * @param buffer The buffer, values (and messages, separated by pack_separator()) back to back
+ * @param size Size of the buffer
+ * @param dict The dictionary the buffer was packed with, NULL for none
+ * @param limits The budget, NULL for no other limit than TB_MAX_DEPTH
+ * @param offset Set to where the first problem is (to size when the buffer ends too early), NULL if not needed
+ * @return TINY_BITS_VALID, or what is wrong with the buffer
+ *
+ * @note Beyond what unpack_value() checks, arrays and maps must hold as many values as they declare, and
+ * separators may only come between values. A valid buffer decodes without TINY_BITS_ERROR, with
+ * tiny_bits_read_value() as well. References to strings of previous buffers of a session are invalid.
+ */
+static inline enum tiny_bits_validity tiny_bits_validate(const unsigned char *buffer, size_t size, const tiny_bits_dictionary *dict,
+                                                         const tiny_bits_limits *limits, size_t *offset) {
+    size_t frames[TB_MAX_DEPTH];    // values left in the containers around the innermost one
+    size_t left = SIZE_MAX;         // values left in the innermost container, never running out at the top
+    uint32_t depth = 0;
+    uint32_t max_depth = limits && limits->max_depth && limits->max_depth < TB_MAX_DEPTH ? limits->max_depth : TB_MAX_DEPTH;
+    size_t max_values = limits && limits->max_values ? limits->max_values : SIZE_MAX;
+    size_t max_length = limits && limits->max_length ? limits->max_length : SIZE_MAX;
+    size_t base = dict ? dict->table.next_id : 0;
+    size_t strings = base;  // strings numbered so far, as the unpacker numbers them
+    size_t values = 0;
+    size_t pos = 0, at = 0;
+    enum tiny_bits_validity result = TINY_BITS_VALID;
+    if (!buffer && size) {
+        result = TINY_BITS_TRUNCATED;
+        goto done;
+    }
+    if (limits && limits->max_size && size > limits->max_size) {
+        result = TINY_BITS_TOO_LARGE;
+        goto done;
+    }
+    while (pos < size) {
+        at = pos;
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length, id;
+        uint8_t read;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) {
+                if (tag != TB_SEP_TAG) goto value;
+                // between messages, not a value
+                if (depth) { result = TINY_BITS_INVALID_TAG; goto done; }
+                continue;
+            }
+            length = tag & info->mask;
+            goto container;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) goto value;
+            if (length > SIZE_MAX - info->bias) goto too_large;
+            length += info->bias;
+            goto container;
+        case TB_OP_STR:
+        case TB_OP_STR_VARINT:
+            length = tag & info->mask;
+            if (info->op == TB_OP_STR_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+                pos += read;
+                if (length > SIZE_MAX - info->bias) goto truncated;
+                length += info->bias;
+            }
+            if (length > max_length) goto too_large;
+            if (length > size - pos) goto truncated;
+            if (length >= 2 && length <= TB_DDP_STR_LEN_MAX) strings++;
+            pos += length;
+            goto value;
+        case TB_OP_REF:
+        case TB_OP_REF_VARINT:
+            id = tag & info->mask;
+            if (info->op == TB_OP_REF_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &id))) goto truncated;
+                pos += read;
+                if (id > SIZE_MAX - info->bias) { result = TINY_BITS_INVALID_REF; goto done; }
+                id += info->bias;
+            }
+            if (id >= strings) { result = TINY_BITS_INVALID_REF; goto done; }
+            goto value;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) goto truncated;
+            pos += varint_length(buffer[pos]);
+            goto value;
+        case TB_OP_F16: length = 2; goto jump;
+        case TB_OP_F32: length = 4; goto jump;
+        case TB_OP_F64: length = 8; goto jump;
+        case TB_OP_DATETIME: length = 9; goto jump;
+        case TB_OP_BLOB:
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+            pos += read;
+            if (length > max_length) goto too_large;
+            goto jump;
+        case TB_OP_NXT: {
+            if (pos >= size) goto truncated;
+            uint8_t kind = buffer[pos++];
+            uint64_t count, width;
+            if (kind == TB_NXT_RST) {
+                // not a value, strings are numbered from scratch again
+                strings = base;
+                continue;
+            }
+            if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) { result = TINY_BITS_INVALID_TAG; goto done; }
+            if (!(read = decode_varint(buffer, size, pos, &count))) goto truncated;
+            pos += read;
+            if (count > max_length) goto too_large;
+            if (kind == TB_NXT_PKD) {
+                if (pos >= size) goto truncated;
+                uint8_t scale = buffer[pos++];
+                if (scale > 12 && scale != TB_PACKED_RAW) { result = TINY_BITS_INVALID_TAG; goto done; }
+            }
+            if (pos >= size) goto truncated;
+            width = buffer[pos++];
+            if (width > 64) { result = TINY_BITS_INVALID_TAG; goto done; }
+            if (count > (1ULL << 56)) goto too_large;
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated; // base
+            pos += read;
+            length = (count * width + 7) / 8;
+            goto jump;
+        }
+        default:
+            result = TINY_BITS_INVALID_TAG;
+            goto done;
+        }
+    container:
+        // an array or a map of length elements (pairs)
+        if (length > max_length || ++values > max_values) goto too_large;
+        if (!length) goto counted;
+        if (depth == max_depth) { result = TINY_BITS_TOO_DEEP; goto done; }
+        // every value takes a byte at least
+        if (length > size || (info->type == TINY_BITS_MAP ? 2 * length : length) > size - pos) {
+            result = TINY_BITS_INVALID_COUNT;
+            goto done;
+        }
+        frames[depth++] = left - 1;
+        left = info->type == TINY_BITS_MAP ? 2 * length : length;
+        continue;
+    jump:
+        if (length > size - pos) goto truncated;
+        pos += length;
+    value:
+        if (++values > max_values) goto too_large;
+    counted:
+        // close the containers this value completed
+        if (--left == 0) {
+            do left = frames[--depth]; while (left == 0);
+        }
+    }
+    at = size;
+    if (depth) goto truncated;
+    goto done;
+truncated:
+    result = TINY_BITS_TRUNCATED;
+    goto done;
+too_large:
+    result = TINY_BITS_TOO_LARGE;
+done:
+    if (offset) *offset = result == TINY_BITS_VALID ? size : at;
+    return result;
+}
+
+/* End validator.h */
+
 #endif /* TINY_BIS_H */
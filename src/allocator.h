@@ -0,0 +1,197 @@
+#ifndef TINY_BITS_ALLOCATOR_H
+#define TINY_BITS_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TB_ARENA_BLOCK_SIZE 65536 // default size of the blocks an arena carves allocations from
+#define TB_ARENA_ALIGN 16
+
+/**
+ * Memory functions used by a packer or unpacker for everything it allocates (buffers, dedupe tables, strings).
+ * They follow malloc(), realloc() and free(), with the context passed first. A NULL allocator means the
+ * standard ones.
+ */
+typedef struct tiny_bits_allocator {
+    void *(*alloc)(void *context, size_t size);
+    void *(*realloc)(void *context, void *ptr, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+} tiny_bits_allocator;
+
+static inline void *_tb_alloc(const tiny_bits_allocator *allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->context, size) : malloc(size);
+}
+
+static inline void *_tb_calloc(const tiny_bits_allocator *allocator, size_t count, size_t size) {
+    if (!allocator) return calloc(count, size);
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = allocator->alloc(allocator->context, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+static inline void *_tb_realloc(const tiny_bits_allocator *allocator, void *ptr, size_t size) {
+    return allocator ? allocator->realloc(allocator->context, ptr, size) : realloc(ptr, size);
+}
+
+static inline void _tb_free(const tiny_bits_allocator *allocator, void *ptr) {
+    if (allocator) {
+        if (ptr) allocator->free(allocator->context, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+typedef struct tiny_bits_arena_block {
+    struct tiny_bits_arena_block *next;
+    size_t used;
+    size_t size;
+    size_t padding;         // keeps data 16 byte aligned
+    unsigned char data[];
+} tiny_bits_arena_block;
+
+/**
+ * A region allocator: allocations are carved from large blocks and only released all at once, by
+ * tiny_bits_arena_reset() or tiny_bits_arena_destroy(). Use its allocator member with
+ * tiny_bits_packer_create_with() and tiny_bits_unpacker_create_with(). Not thread safe.
+ */
+typedef struct tiny_bits_arena {
+    tiny_bits_allocator allocator; // allocates from this arena
+    tiny_bits_arena_block *blocks; // newest first, allocations come from the first one
+    tiny_bits_arena_block *spare;  // blocks emptied by tiny_bits_arena_reset(), reused before allocating new ones
+    size_t block_size;
+    size_t allocated;              // bytes handed out since the last reset
+} tiny_bits_arena;
+
+// Each allocation is preceded by its size, realloc() needs it to copy
+typedef struct tiny_bits_arena_header {
+    size_t size;
+    size_t padding;
+} tiny_bits_arena_header;
+
+static inline void *_tb_arena_alloc(void *context, size_t size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)context;
+    size_t needed = sizeof(tiny_bits_arena_header) + ((size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+    if (needed < size) return NULL; // overflow
+    tiny_bits_arena_block *block = arena->blocks;
+    if (!block || block->used + needed > block->size) {
+        // a block emptied by a reset comes first, otherwise a new one (larger for large allocations)
+        tiny_bits_arena_block *fresh = arena->spare;
+        if (fresh && needed <= fresh->size) {
+            arena->spare = fresh->next;
+        } else {
+            size_t block_size = needed > arena->block_size ? needed : arena->block_size;
+            fresh = (tiny_bits_arena_block *)malloc(sizeof(tiny_bits_arena_block) + block_size);
+            if (!fresh) return NULL;
+            fresh->size = block_size;
+        }
+        fresh->next = block;
+        fresh->used = 0;
+        block = fresh;
+        arena->blocks = block;
+    }
+    tiny_bits_arena_header *header = (tiny_bits_arena_header *)(block->data + block->used);
+    header->size = size;
+    block->used += needed;
+    arena->allocated += size;
+    return header + 1;
+}
+
+static inline void *_tb_arena_realloc(void *context, void *ptr, size_t size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)context;
+    if (!ptr) return _tb_arena_alloc(context, size);
+    tiny_bits_arena_header *header = (tiny_bits_arena_header *)ptr - 1;
+    size_t old_size = header->size;
+    if (size <= old_size) {
+        header->size = size;
+        return ptr;
+    }
+    tiny_bits_arena_block *block = arena->blocks;
+    unsigned char *start = (unsigned char *)ptr;
+    if (start > block->data && start < block->data + block->used) {
+        size_t offset = (size_t)(start - block->data);
+        size_t old_end = offset + ((old_size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+        size_t new_end = offset + ((size + TB_ARENA_ALIGN - 1) & ~(size_t)(TB_ARENA_ALIGN - 1));
+        if (old_end == block->used && new_end <= block->size && new_end > offset) {
+            // the latest allocation grows in place
+            block->used = new_end;
+            arena->allocated += size - old_size;
+            header->size = size;
+            return ptr;
+        }
+    }
+    void *copy = _tb_arena_alloc(context, size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, old_size);
+    return copy;
+}
+
+static inline void _tb_arena_free(void *context, void *ptr) {
+    (void)context;
+    (void)ptr; // released with the whole arena
+}
+
+/**
+ * @brief allocates and initializes a new arena
+ *
+ * @param block_size Size of the blocks allocations are carved from, 0 for TB_ARENA_BLOCK_SIZE
+ * @return pointer to new arena instance
+ *
+ * @note the returned arena object must be freed using tiny_bits_arena_destroy()
+ */
+static inline tiny_bits_arena *tiny_bits_arena_create(size_t block_size) {
+    tiny_bits_arena *arena = (tiny_bits_arena *)malloc(sizeof(tiny_bits_arena));
+    if (!arena) return NULL;
+    arena->allocator.alloc = _tb_arena_alloc;
+    arena->allocator.realloc = _tb_arena_realloc;
+    arena->allocator.free = _tb_arena_free;
+    arena->allocator.context = arena;
+    arena->blocks = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size ? block_size : TB_ARENA_BLOCK_SIZE;
+    arena->allocated = 0;
+    return arena;
+}
+
+/**
+ * @brief Releases everything allocated from the arena at once
+ *
+ * @param arena The arena instance
+ *
+ * @note Packers and unpackers created with the arena must not be used afterwards (there is no need to destroy
+ * them). Blocks of the default size are kept for reuse, larger ones are freed.
+ */
+static inline void tiny_bits_arena_reset(tiny_bits_arena *arena) {
+    if (!arena) return;
+    while (arena->blocks) {
+        tiny_bits_arena_block *block = arena->blocks;
+        arena->blocks = block->next;
+        if (block->size > arena->block_size) {
+            free(block);
+        } else {
+            block->next = arena->spare;
+            arena->spare = block;
+        }
+    }
+    arena->allocated = 0;
+}
+
+/**
+ * @brief Deallocate the arena object and everything allocated from it
+ *
+ * @param arena The arena instance
+ */
+static inline void tiny_bits_arena_destroy(tiny_bits_arena *arena) {
+    if (!arena) return;
+    tiny_bits_arena_reset(arena);
+    while (arena->spare) {
+        tiny_bits_arena_block *next = arena->spare->next;
+        free(arena->spare);
+        arena->spare = next;
+    }
+    free(arena);
+}
+
+#endif // TINY_BITS_ALLOCATOR_H
@@ -7,11 +7,43 @@
 #include <stddef.h> // for size_t
 #include <math.h>
 #include <stdio.h>
+#include "allocator.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Keeps rarely taken paths (allocation, uncommon values) out of the functions they are called from
+#if defined(__GNUC__)
+#define TB_NOINLINE __attribute__((noinline))
+#else
+#define TB_NOINLINE
+#endif
+
+// Branch hint for the same uncommon values
+#if defined(__GNUC__)
+#define TB_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define TB_UNLIKELY(x) (x)
+#endif
+
+// Walks specialized for a visitor known at compile time (see TINY_BITS_WALKER()) need the loop inlined
+#if defined(__GNUC__)
+#define TB_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define TB_ALWAYS_INLINE inline
+#endif
 
-#define TB_HASH_SIZE 128
-#define TB_HASH_CACHE_SIZE 256
+#define TB_HASH_SIZE 128        // initial number of bins, always a power of two
+#define TB_HASH_CACHE_SIZE 256  // initial number of entries, also the default dedupe limit
 #define MAX_BYTES 9
 #define TB_DDP_STR_LEN_MAX 128
+#define TB_DICT_MAX_SIZE 65536
+#define TB_DEFERRED_HEADER_SIZE 6      // container header reserved by pack_arr_begin()/pack_map_begin()
+#define TB_DEFERRED_SHIFT_LIMIT 65536  // longest body moved back to shrink that header on end
+#define TB_REF_MIN_SIZE 256            // shorter payloads given to pack_blob_ref()/pack_str_ref() are copied
+#ifndef TB_MAX_DEPTH
+#define TB_MAX_DEPTH 64                // deepest nesting tracked by tiny_bits_read_value() and tiny_bits_skip_value()
+#endif
 
 // main tags
 #define TB_INT_TAG 0x80     // +/- integer
@@ -43,11 +75,31 @@
 #define TB_MAP_LEN 0x0F     // max embedded map length
 #define TB_ARR_LEN 0x07     // max embedded array length
 
-// native extensions TR_NXT_TAG
+// native extensions TR_NXT_TAG (second byte after TB_NXT_TAG)
+#define TB_NXT_RST 0x00     // reset deduplicated strings, following strings are numbered from scratch
+#define TB_NXT_PKI 0x01     // packed integer array (frame of reference + bit packing)
+#define TB_NXT_PKD 0x02     // packed double array (decimal scale or raw bits, then as TB_NXT_PKI)
+
+#define TB_PACKED_RAW 0xFF  // packed double array scale for values stored as their IEEE 754 bits
 
 // Feature flags (from encoder)
 #define TB_FEATURE_STRING_DEDUPE    0x01
 #define TB_FEATURE_COMPRESS_FLOATS  0x02
+#define TB_FEATURE_NARROW_FLOATS    0x04
+
+// String hash functions for the dedupe tables, select one by defining TB_HASH_ALGO
+// before including tinybits. The hash never goes on the wire, so it is safe to change.
+#define TB_HASH_ALGO_FAST           0 // length, first two and last bytes, collides a lot on real keys
+#define TB_HASH_ALGO_WY             1 // wyhash style multiply-mix of the whole string
+#define TB_HASH_ALGO_CRC32C         2 // SSE4.2 crc32 instruction, falls back to TB_HASH_ALGO_WY without it
+
+#ifndef TB_HASH_ALGO
+#define TB_HASH_ALGO TB_HASH_ALGO_WY
+#endif
+
+// Dedupe table replacement policies, once the table reaches its limit
+#define TB_DEDUPE_POLICY_STOP       0x00 // stop registering new strings
+#define TB_DEDUPE_POLICY_LRU        0x01 // evict the least recently used string (clock approximation)
 
 static double powers[] = {
     1.0, 
@@ -66,18 +118,26 @@ static double powers[] = {
 };
 
 typedef struct HashEntry {
-    uint32_t hash;          // 32-bit hash from fast_hash_32
+    uint32_t hash;          // 32-bit hash from string_hash_32
     uint32_t length;
     uint32_t offset;
-    uint32_t next_index;
+    uint32_t next_index;    // 1-based index of the next entry in the same bin, 0 ends the chain
+    uint32_t id;            // reference id of the string
+    uint32_t referenced;    // set on every hit, cleared by the clock hand (TB_DEDUPE_POLICY_LRU)
 } HashEntry;
 
 typedef struct HashTable {
-    HashEntry* cache; // HASH_SIZE is 2048, use directly or define HASH_SIZE in header
-    uint32_t next_id;
-    uint32_t cache_size;
-    uint32_t cache_pos;
-    uint8_t bins[TB_HASH_SIZE];
+    HashEntry* cache;       // entries, grown up to cache_limit
+    uint32_t next_id;       // id of the next registered string
+    uint32_t cache_size;    // allocated entries
+    uint32_t cache_pos;     // used entries
+    uint32_t cache_limit;   // maximum number of entries
+    uint32_t *bins;         // 1-based entry indexes, bin_mask + 1 of them
+    uint32_t bin_mask;
+    uint32_t bin_shift;     // 32 - log2(number of bins)
+    uint32_t clock_hand;    // next eviction candidate
+    uint8_t policy;         // TB_DEDUPE_POLICY_*
+    const tiny_bits_allocator *allocator; // NULL for malloc()
 } HashTable;
 
 static inline uint32_t fast_hash_32(const char* str, uint16_t len) {
@@ -90,83 +150,235 @@ static inline uint32_t fast_hash_32(const char* str, uint16_t len) {
     return hash;
 }
 
+static inline uint64_t _read_u64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t _read_u32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 64x64 -> 128 bit multiply, folded
+static inline uint64_t _mum(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    // from 32 bit halves, for compilers without a 128 bit type (same result)
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    uint64_t lo = (cross << 32) | (uint32_t)lo_lo;
+    return lo ^ hi;
+#endif
+}
+
+static inline uint32_t wy_hash_32(const char* str, uint32_t len) {
+    const uint64_t s0 = 0xa0761d6478bd642full;
+    const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    uint64_t seed = s0 ^ len;
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two (possibly overlapping) pairs of 4 byte reads cover the whole string
+            uint32_t mid = (len >> 3) << 2;
+            a = (_read_u32(str) << 32) | _read_u32(str + mid);
+            b = (_read_u32(str + len - 4) << 32) | _read_u32(str + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)(unsigned char)str[0] << 16) | ((uint64_t)(unsigned char)str[len >> 1] << 8) 
+                | (unsigned char)str[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        uint32_t i = len;
+        const char *p = str;
+        while (i > 16) {
+            seed = _mum(_read_u64(p) ^ s1, _read_u64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = _read_u64(str + len - 16);
+        b = _read_u64(str + len - 8);
+    }
+    return (uint32_t)_mum(s1 ^ len, _mum(a ^ s1, b ^ seed));
+}
+
+#if defined(__SSE4_2__)
+static inline uint32_t crc32c_hash_32(const char* str, uint32_t len) {
+    uint64_t crc = 0xFFFFFFFFu ^ len;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) crc = _mm_crc32_u64(crc, _read_u64(str + i));
+    if (i + 4 <= len) {
+        crc = _mm_crc32_u32((uint32_t)crc, (uint32_t)_read_u32(str + i));
+        i += 4;
+    }
+    for (; i < len; i++) crc = _mm_crc32_u8((uint32_t)crc, (unsigned char)str[i]);
+    return (uint32_t)crc;
+}
+#else
+static inline uint32_t crc32c_hash_32(const char* str, uint32_t len) {
+    return wy_hash_32(str, len);
+}
+#endif
+
+// The hash used by all the dedupe tables (packer, dictionary)
+static inline uint32_t string_hash_32(const char* str, uint32_t len) {
+#if TB_HASH_ALGO == TB_HASH_ALGO_FAST
+    return fast_hash_32(str, len);
+#elif TB_HASH_ALGO == TB_HASH_ALGO_CRC32C
+    return crc32c_hash_32(str, len);
+#else
+    return wy_hash_32(str, len);
+#endif
+}
+
+// Byte swaps, leading and trailing zeros (of a value other than 0) and set bits, with shifts where the compiler
+// has no builtin
+static inline uint32_t _tb_bswap32(uint32_t v) {
+#if defined(__GNUC__)
+    return __builtin_bswap32(v);
+#else
+    v = ((v & 0x00FF00FFu) << 8) | ((v >> 8) & 0x00FF00FFu);
+    return (v << 16) | (v >> 16);
+#endif
+}
+
+static inline uint64_t _tb_bswap64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_bswap64(v);
+#else
+    v = ((v & 0x00FF00FF00FF00FFull) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFull);
+    v = ((v & 0x0000FFFF0000FFFFull) << 16) | ((v >> 16) & 0x0000FFFF0000FFFFull);
+    return (v << 32) | (v >> 32);
+#endif
+}
+
+static inline int _tb_clz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+    if (!(v >> 32)) { n += 32; v <<= 32; }
+    if (!(v >> 48)) { n += 16; v <<= 16; }
+    if (!(v >> 56)) { n += 8; v <<= 8; }
+    if (!(v >> 60)) { n += 4; v <<= 4; }
+    if (!(v >> 62)) { n += 2; v <<= 2; }
+    return n + !(v >> 63);
+#endif
+}
+
+static inline int _tb_ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    if (!(v & 0xFFFFFFFFull)) { n += 32; v >>= 32; }
+    if (!(v & 0xFFFFull)) { n += 16; v >>= 16; }
+    if (!(v & 0xFFull)) { n += 8; v >>= 8; }
+    if (!(v & 0xFull)) { n += 4; v >>= 4; }
+    if (!(v & 0x3ull)) { n += 2; v >>= 2; }
+    return n + !(v & 1);
+#endif
+}
+
+static inline int _tb_popcount64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    v -= (v >> 1) & 0x5555555555555555ull;
+    v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (int)((v * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Big endian loads and stores, one unaligned access and a byte swap
+static inline uint64_t _load_be64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void _store_be64(uint8_t *p, uint64_t v) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
+
+static inline void _store_be32(uint8_t *p, uint32_t v) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = _tb_bswap32(v);
+#endif
+    memcpy(p, &v, 4);
+}
+
+/*
+ * Varints: a prefix byte, then
+ *   0-240    the value itself
+ *   241-248  one byte, value 240 + 256 * (prefix - 241) + byte
+ *   249      two bytes, value 2288 + big endian bytes
+ *   250-255  prefix - 247 (3 to 8) big endian bytes
+ */
+
+// Bytes (3 to 8) following prefixes 250-255 for a value over 67823
+static inline int _varint_long_bytes(uint64_t value) {
+    return (71 - _tb_clz64(value)) >> 3;
+}
+
 static inline int encode_varint(uint64_t value, uint8_t* buffer) {
     if (value <= 240) {
-        buffer[0] = (uint8_t)value;  // 1 byte
+        buffer[0] = (uint8_t)value;
         return 1;
-    } else if (value < 2288) {  // 241 to 248
+    }
+    if (value < 2288) {
         value -= 240;
-        int prefix = 241 + (value / 256);
-        buffer[0] = (uint8_t)prefix;  // A0
-        buffer[1] = (uint8_t)(value % 256);  // A1
+        buffer[0] = (uint8_t)(241 + (value >> 8));
+        buffer[1] = (uint8_t)value;
         return 2;
-    } else if (value <= 67823) {  // Up to 249
+    }
+    if (value <= 67823) {
         value -= 2288;
-        buffer[0] = 249;  // A0
-        buffer[1] = (uint8_t)(value / 256);  // A1
-        buffer[2] = (uint8_t)(value % 256);  // A2
+        buffer[0] = 249;
+        buffer[1] = (uint8_t)(value >> 8);
+        buffer[2] = (uint8_t)value;
         return 3;
-    } else if (value < (1ULL << 24)) {  // 250: 3-byte big-endian
-        buffer[0] = 250;  // A0
-        buffer[1] = (uint8_t)(value >> 16);  // A1 (most significant)
-        buffer[2] = (uint8_t)(value >> 8);   // A2
-        buffer[3] = (uint8_t)value;          // A3 (least significant)
-        return 4;
-    } else if (value < (1ULL << 32)) {  // 251: 4-byte big-endian
-        buffer[0] = 251;  // A0
-        buffer[1] = (uint8_t)(value >> 24);
-        buffer[2] = (uint8_t)(value >> 16);
-        buffer[3] = (uint8_t)(value >> 8);
-        buffer[4] = (uint8_t)value;
-        return 5;
-    } else if (value < (1ULL << 40)) {  // 252: 5-byte big-endian
-        buffer[0] = 252;  // A0
-        buffer[1] = (uint8_t)(value >> 32);
-        buffer[2] = (uint8_t)(value >> 24);
-        buffer[3] = (uint8_t)(value >> 16);
-        buffer[4] = (uint8_t)(value >> 8);
-        buffer[5] = (uint8_t)value;
-        return 6;
-    } else if (value < (1ULL << 48)) {  // 253: 6-byte big-endian
-        buffer[0] = 253;  // A0
-        buffer[1] = (uint8_t)(value >> 40);
-        buffer[2] = (uint8_t)(value >> 32);
-        buffer[3] = (uint8_t)(value >> 24);
-        buffer[4] = (uint8_t)(value >> 16);
-        buffer[5] = (uint8_t)(value >> 8);
-        buffer[6] = (uint8_t)value;
-        return 7;
-    } else if (value < (1ULL << 56)) {  // 254: 7-byte big-endian
-        buffer[0] = 254;  // A0
-        buffer[1] = (uint8_t)(value >> 48);
-        buffer[2] = (uint8_t)(value >> 40);
-        buffer[3] = (uint8_t)(value >> 32);
-        buffer[4] = (uint8_t)(value >> 24);
-        buffer[5] = (uint8_t)(value >> 16);
-        buffer[6] = (uint8_t)(value >> 8);
-        buffer[7] = (uint8_t)value;
-        return 8;
-    } else {  // 255: 8-byte big-endian
-        buffer[0] = 255;  // A0
-        buffer[1] = (uint8_t)(value >> 56);
-        buffer[2] = (uint8_t)(value >> 48);
-        buffer[3] = (uint8_t)(value >> 40);
-        buffer[4] = (uint8_t)(value >> 32);
-        buffer[5] = (uint8_t)(value >> 24);
-        buffer[6] = (uint8_t)(value >> 16);
-        buffer[7] = (uint8_t)(value >> 8);
-        buffer[8] = (uint8_t)value;
-        return 9;
     }
+    int bytes = _varint_long_bytes(value);
+    buffer[0] = (uint8_t)(247 + bytes);
+    if (bytes >= 4) {
+        // two overlapping 4 byte stores cover 4 to 8 bytes without writing past them
+        _store_be32(buffer + 1, (uint32_t)(value >> (8 * bytes - 32)));
+        _store_be32(buffer + bytes - 3, (uint32_t)value);
+    } else {
+        buffer[1] = (uint8_t)(value >> 16);
+        buffer[2] = (uint8_t)(value >> 8);
+        buffer[3] = (uint8_t)value;
+    }
+    return bytes + 1;
 }
 
+// Number of bytes encode_varint() writes for value
 static inline int varint_size(uint64_t value){
-    if (value < (1ULL << 48)) {  // 253: 6-byte big-endian
-        return 7;
-    } else if(value  < (1ULL << 52)){
-        return 8;
-    }
-    return 9;
+    if (value <= 240) return 1;
+    if (value < 2288) return 2;
+    if (value <= 67823) return 3;
+    return 1 + _varint_long_bytes(value);
+}
+
+// Number of bytes of a varint, prefix included
+static inline uint8_t varint_length(uint8_t prefix){
+    return prefix <= 240 ? 1 : prefix <= 248 ? 2 : (uint8_t)(prefix - 246);
 }
 
 static inline int8_t decode_varint(const uint8_t* buffer, size_t size, size_t pos, uint64_t *value) {
@@ -175,125 +387,76 @@ static inline int8_t decode_varint(const uint8_t* buffer, size_t size, size_t po
     if (prefix <= 240) {
         *value = prefix;
         return 1;
-    } else if (prefix >= 241 && prefix <= 248) {
-        if (pos + 1 >= size) return 0; // Not enough bytes
-        *value = 240 + 256 * (prefix - 241) + buffer[pos+1];
-        return 2;
-    } else if (prefix == 249){
-        if (pos + 2 >= size) return 0; // Not enough bytes
-        *value = 2288 + 256 * buffer[pos+1] + buffer[pos+2];
-        return 3;
-    } else if (prefix == 250){
-        if (pos + 3 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 16) | ((uint64_t)buffer[pos+2] << 8) | buffer[pos+3];
-        return 4;
-    } else if (prefix == 251){
-        if (pos + 4 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 24) | ((uint64_t)buffer[pos+2] << 16) |
-               ((uint64_t)buffer[pos+3] << 8) | buffer[pos+4];
-        return 5;    
-    } else if (prefix == 252){
-        if (pos + 5 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 32) | ((uint64_t)buffer[pos+2] << 24) |
-               ((uint64_t)buffer[pos+3] << 16) | ((uint64_t)buffer[pos+4] << 8) | buffer[pos+5];
-        return 6;        
-    } else if (prefix == 253){
-        if (pos + 6 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 40) | ((uint64_t)buffer[pos+2] << 32) |
-               ((uint64_t)buffer[pos+3] << 24) | ((uint64_t)buffer[pos+4] << 16) |
-               ((uint64_t)buffer[pos+5] << 8) | buffer[pos+6];
-        return 7;            
-    } else if (prefix == 254){
-        if (pos + 7 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 48) | ((uint64_t)buffer[pos+2] << 40) |
-               ((uint64_t)buffer[pos+3] << 32) | ((uint64_t)buffer[pos+4] << 24) |
-               ((uint64_t)buffer[pos+5] << 16) | ((uint64_t)buffer[pos+6] << 8) | buffer[pos+7];
-        return 8;            
-    } else if (prefix == 255){
-        if (pos + 8 >= size) return 0; // Not enough bytes
-        *value = ((uint64_t)buffer[pos+1] << 56) | ((uint64_t)buffer[pos+2] << 48) |
-               ((uint64_t)buffer[pos+3] << 40) | ((uint64_t)buffer[pos+4] << 32) |
-               ((uint64_t)buffer[pos+5] << 24) | ((uint64_t)buffer[pos+6] << 16) |
-               ((uint64_t)buffer[pos+7] << 8) | buffer[pos+8];
-        return 9;            
-    } else {
-        return 0;
     }
-
-}
-
-static inline uint64_t decode_varint_old(const uint8_t* buffer, size_t size, size_t *pos) {
-    if (*pos >= size) {
-        return 0; // not enough buffer
+    if (prefix <= 248) {
+        // lengths and ids are often just over 240, one more byte is cheaper than a word load and a swap
+        if (size - pos < 2) return 0;
+        *value = 240 + ((uint64_t)(prefix - 241) << 8) + buffer[pos + 1];
+        return 2;
     }
-
-    uint8_t prefix = buffer[*pos];
-    if (prefix <= 240) {
-        *pos += 1;
-        return prefix;
-    } else if (prefix >= 241 && prefix <= 248) {
-        if (*pos + 1 >= size) return 0; // Not enough bytes
-        uint64_t value = 240 + 256 * (prefix - 241) + buffer[*pos+1];
-        *pos += 2;
-        return value;
-    } else if (prefix == 249) {
-        if (*pos + 2 >= size) return 0; // Not enough bytes
-        uint64_t value = 2288 + 256 * buffer[*pos+1] + buffer[*pos+2];
-        *pos += 3;
-        return value;
-    } else if (prefix == 250) {
-        if (*pos + 3 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 16) | ((uint64_t)buffer[*pos+2] << 8) | buffer[*pos+3];
-        *pos += 4;
-        return value;
-    } else if (prefix == 251) {
-        if (*pos + 4 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 24) | ((uint64_t)buffer[*pos+2] << 16) |
-               ((uint64_t)buffer[*pos+3] << 8) | buffer[*pos+4];
-        *pos += 5;
-        return value;
-    } else if (prefix == 252) {
-        if (*pos + 5 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 32) | ((uint64_t)buffer[*pos+2] << 24) |
-               ((uint64_t)buffer[*pos+3] << 16) | ((uint64_t)buffer[*pos+4] << 8) | buffer[*pos+5];
-        *pos += 6;
-        return value;
-    } else if (prefix == 253) {
-        if (*pos + 6 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 40) | ((uint64_t)buffer[*pos+2] << 32) |
-               ((uint64_t)buffer[*pos+3] << 24) | ((uint64_t)buffer[*pos+4] << 16) |
-               ((uint64_t)buffer[*pos+5] << 8) | buffer[*pos+6];
-        *pos += 7;
-        return value;       
-    } else if (prefix == 254) {
-        if (*pos + 7 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 48) | ((uint64_t)buffer[*pos+2] << 40) |
-               ((uint64_t)buffer[*pos+3] << 32) | ((uint64_t)buffer[*pos+4] << 24) |
-               ((uint64_t)buffer[*pos+5] << 16) | ((uint64_t)buffer[*pos+6] << 8) | buffer[*pos+7];
-        *pos += 8;
-        return value;       
-    } else if (prefix == 255) {
-        if (*pos + 8 >= size) return 0; // Not enough bytes
-        uint64_t value = ((uint64_t)buffer[*pos+1] << 56) | ((uint64_t)buffer[*pos+2] << 48) |
-               ((uint64_t)buffer[*pos+3] << 40) | ((uint64_t)buffer[*pos+4] << 32) |
-               ((uint64_t)buffer[*pos+5] << 24) | ((uint64_t)buffer[*pos+6] << 16) |
-               ((uint64_t)buffer[*pos+7] << 8) | buffer[*pos+8];
-        *pos += 9;
-        return value;
+    uint64_t word; // the bytes following the prefix, first one in the top byte
+    if (size - pos >= 9) {
+        word = _load_be64(buffer + pos + 1);
     } else {
-        return 0;  // Error case
+        // near the end of the buffer, never load past it
+        uint8_t length = varint_length(prefix);
+        if (size - pos < length) return 0; // Not enough bytes
+        uint8_t tail[8] = {0};
+        memcpy(tail, buffer + pos + 1, length - 1);
+        word = _load_be64(tail);
+    }
+    if (prefix == 249) {
+        *value = 2288 + (word >> 48);
+        return 3;
     }
+    *value = word >> (8 * (255 - prefix)); // prefix - 247 bytes
+    return (int8_t)(prefix - 246);
 }
 
+// Equality test (0 when equal), compares with the widest loads available instead of byte by byte.
+// Short lengths use two overlapping loads of the largest word that fits, so no byte is read twice
+// past the end and no loop is needed.
 static inline int fast_memcmp(const void *ptr1, const void *ptr2, size_t num) {
-    if(num < 32){
-        const unsigned char *p1 = (const unsigned char*)ptr1;
-        const unsigned char *p2 = (const unsigned char*)ptr2;
-        for(size_t i = 0; i < num; i++){
-            if(p1[i] != p2[i]) return 1; 
+    const char *p1 = (const char*)ptr1;
+    const char *p2 = (const char*)ptr2;
+    if (num >= 16) {
+#if defined(__AVX2__)
+        for (; num >= 32; num -= 32, p1 += 32, p2 += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)p1);
+            __m256i b = _mm256_loadu_si256((const __m256i *)p2);
+            if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xFFFFFFFFu) return 1;
+        }
+        if (num == 0) return 0;
+        if (num < 16) {
+            // step back so the last 16 bytes are compared, overlapping the ones already done
+            p1 -= 16 - num;
+            p2 -= 16 - num;
+            num = 16;
+        }
+#endif
+#if defined(__SSE2__)
+        const char *end1 = p1 + num - 16;
+        const char *end2 = p2 + num - 16;
+        for (; num > 16; num -= 16, p1 += 16, p2 += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)p1);
+            __m128i b = _mm_loadu_si128((const __m128i *)p2);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) return 1;
         }
-    }else{
-        return memcmp(ptr1, ptr2, num); 
+        __m128i a = _mm_loadu_si128((const __m128i *)end1);
+        __m128i b = _mm_loadu_si128((const __m128i *)end2);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF;
+#else
+        return memcmp(p1, p2, num) != 0;
+#endif
+    }
+    if (num >= 8) {
+        return ((_read_u64(p1) ^ _read_u64(p2)) | (_read_u64(p1 + num - 8) ^ _read_u64(p2 + num - 8))) != 0;
+    }
+    if (num >= 4) {
+        return ((_read_u32(p1) ^ _read_u32(p2)) | (_read_u32(p1 + num - 4) ^ _read_u32(p2 + num - 4))) != 0;
+    }
+    for (size_t i = 0; i < num; i++) {
+        if (p1[i] != p2[i]) return 1;
     }
     return 0;
 }
@@ -305,9 +468,174 @@ static inline void *fast_memcpy(unsigned char *ptr1, const char *ptr2, size_t nu
     return ptr1;
 }
 
-#include <immintrin.h>
-#include <stddef.h>
-#include <stdint.h>
+static inline uint32_t hash_table_bin(const HashTable *table, uint32_t hash_code) {
+    // fibonacci hashing, spreads all the hash bits over the power of two bins
+    return (hash_code * 0x9E3779B1u) >> table->bin_shift;
+}
+
+static inline int _hash_table_alloc_bins(HashTable *table, uint32_t bin_count) {
+    uint32_t *bins = (uint32_t *)_tb_calloc(table->allocator, bin_count, sizeof(uint32_t));
+    if (!bins) return 0;
+    uint32_t shift = 32;
+    for (uint32_t n = bin_count; n > 1; n >>= 1) shift--;
+    _tb_free(table->allocator, table->bins);
+    table->bins = bins;
+    table->bin_mask = bin_count - 1;
+    table->bin_shift = shift;
+    return 1;
+}
+
+/**
+ * @brief Initializes an empty hash table
+ *
+ * @param table The hash table
+ * @param cache_size Initial number of entries (also the number of bins, rounded up to a power of two)
+ * @param cache_limit Maximum number of entries the table may grow to
+ * @param policy What to do once the limit is reached, one of TB_DEDUPE_POLICY_*
+ * @param allocator Where the table memory comes from, NULL for malloc()
+ * @return 1 on success, 0 on allocation failure
+ */
+static inline int hash_table_init_with(HashTable *table, uint32_t cache_size, uint32_t cache_limit, uint8_t policy,
+                                       const tiny_bits_allocator *allocator) {
+    memset(table, 0, sizeof(HashTable));
+    table->allocator = allocator;
+    if (cache_limit < 1) cache_limit = 1;
+    if (cache_size > cache_limit) cache_size = cache_limit;
+    if (cache_size < 1) cache_size = 1;
+    uint32_t bin_count = TB_HASH_SIZE;
+    while (bin_count < cache_size) bin_count <<= 1;
+    table->cache = (HashEntry*)_tb_alloc(allocator, sizeof(HashEntry) * cache_size);
+    if (!table->cache) return 0;
+    if (!_hash_table_alloc_bins(table, bin_count)) {
+        _tb_free(allocator, table->cache);
+        table->cache = NULL;
+        return 0;
+    }
+    table->cache_size = cache_size;
+    table->cache_limit = cache_limit;
+    table->policy = policy;
+    return 1;
+}
+
+// hash_table_init_with() using malloc()
+static inline int hash_table_init(HashTable *table, uint32_t cache_size, uint32_t cache_limit, uint8_t policy) {
+    return hash_table_init_with(table, cache_size, cache_limit, policy, NULL);
+}
+
+static inline void hash_table_free(HashTable *table) {
+    _tb_free(table->allocator, table->cache);
+    _tb_free(table->allocator, table->bins);
+    table->cache = NULL;
+    table->bins = NULL;
+}
+
+/**
+ * @brief Removes all entries, keeping the allocated memory
+ */
+static inline void hash_table_clear(HashTable *table) {
+    if (!table->bins) return;
+    // a table that grew for one large message should not cost a full memset per small one
+    if (table->cache_pos < (table->bin_mask + 1) / 4) {
+        for (uint32_t i = 0; i < table->cache_pos; i++) {
+            table->bins[hash_table_bin(table, table->cache[i].hash)] = 0;
+        }
+    } else {
+        memset(table->bins, 0, (table->bin_mask + 1) * sizeof(uint32_t));
+    }
+    table->cache_pos = 0;
+    table->next_id = 0;
+    table->clock_hand = 0;
+}
+
+// Walks the chain of the string's bin, returns the matching entry or NULL
+static inline HashEntry *hash_table_lookup(HashTable *table, const unsigned char *base, 
+                                           const char *str, uint32_t len, uint32_t hash_code) {
+    uint32_t index = table->bins[hash_table_bin(table, hash_code)];
+    while (index > 0) {
+        HashEntry *entry = &table->cache[index - 1];
+        if (hash_code == entry->hash 
+            && len == entry->length
+            && fast_memcmp(str, base + entry->offset, len) == 0 ) {
+            if (table->policy == TB_DEDUPE_POLICY_LRU) entry->referenced = 1;
+            return entry;
+        }
+        index = entry->next_index;
+    }
+    return NULL;
+}
+
+static inline int _hash_table_grow(HashTable *table) {
+    uint32_t new_size = table->cache_size * 2;
+    if (new_size > table->cache_limit || new_size < table->cache_size) new_size = table->cache_limit;
+    HashEntry *new_cache = (HashEntry*)_tb_realloc(table->allocator, table->cache, sizeof(HashEntry) * new_size);
+    if (!new_cache) return 0;
+    table->cache = new_cache;
+    table->cache_size = new_size;
+    if (new_size > table->bin_mask + 1) {
+        // keep chains short, one bin per entry, rehashing from the stored hashes
+        uint32_t bin_count = table->bin_mask + 1;
+        while (bin_count < new_size) bin_count <<= 1;
+        if (!_hash_table_alloc_bins(table, bin_count)) return 1; // longer chains, but still correct
+        for (uint32_t i = 0; i < table->cache_pos; i++) {
+            uint32_t bin = hash_table_bin(table, table->cache[i].hash);
+            table->cache[i].next_index = table->bins[bin];
+            table->bins[bin] = i + 1;
+        }
+    }
+    return 1;
+}
+
+// Picks the entry to replace, skipping (and clearing) the recently referenced ones
+static inline uint32_t _hash_table_evict(HashTable *table) {
+    uint32_t victim;
+    while (1) {
+        victim = table->clock_hand;
+        table->clock_hand = (table->clock_hand + 1) % table->cache_pos;
+        if (!table->cache[victim].referenced) break;
+        table->cache[victim].referenced = 0;
+    }
+    // unlink it from its chain
+    HashEntry *entry = &table->cache[victim];
+    uint32_t *link = &table->bins[hash_table_bin(table, entry->hash)];
+    while (*link != victim + 1) link = &table->cache[*link - 1].next_index;
+    *link = entry->next_index;
+    return victim;
+}
+
+/**
+ * @brief Registers a string, assigning it the next id
+ *
+ * @param table The hash table
+ * @param hash_code The string hash
+ * @param length The string length
+ * @param offset Where the string bytes are, relative to the base used for lookups
+ * @return 1 if the string was registered, 0 if the table is full (TB_DEDUPE_POLICY_STOP)
+ *
+ * @note Ids must stay in sync with the unpacker, which numbers every deduplicatable string it sees.
+ * So a table that stops registering (when full or out of memory) never starts again until cleared.
+ */
+static inline int hash_table_insert(HashTable *table, uint32_t hash_code, uint32_t length, uint32_t offset) {
+    uint32_t slot;
+    if (table->cache_pos < table->cache_size) {
+        slot = table->cache_pos++;
+    } else if (table->cache_size < table->cache_limit && _hash_table_grow(table)) {
+        slot = table->cache_pos++;
+    } else {
+        table->cache_limit = table->cache_size; // never grow again, see the note above
+        if (table->policy != TB_DEDUPE_POLICY_LRU) return 0;
+        slot = _hash_table_evict(table);
+    }
+    HashEntry* new_entry = &table->cache[slot];
+    uint32_t bin = hash_table_bin(table, hash_code);
+    new_entry->hash = hash_code; 
+    new_entry->length = length;
+    new_entry->offset = offset;
+    new_entry->id = table->next_id++;
+    new_entry->referenced = 0;
+    new_entry->next_index = table->bins[bin];
+    table->bins[bin] = slot + 1;
+    return 1;
+}
 
 static inline uint64_t dtoi_bits(double d) {
     union {
@@ -327,73 +655,193 @@ static inline double itod_bits(uint64_t u) {
     return converter.d;
 }
 
+// Narrows a finite double to a float, returns 0 unless the float holds the exact same value
+static inline int double_to_float_exact(double d, float *f) {
+    if (fabs(d) > 3.4028234663852886e38) return 0; // FLT_MAX
+    *f = (float)d;
+    return (double)*f == d;
+}
+
+// Narrows a float to IEEE 754 half precision bits, returns 0 unless the half holds the exact same value
+static inline int float_to_half_exact(float f, uint16_t *half) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xFF) - 127;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if ((bits & 0x7FFFFFFF) == 0) { // +/- zero
+        *half = sign;
+        return 1;
+    }
+    if (exponent >= -14 && exponent <= 15) { // normal half, 10 mantissa bits
+        if (mantissa & 0x1FFF) return 0;
+        *half = sign | (uint16_t)((exponent + 15) << 10) | (uint16_t)(mantissa >> 13);
+        return 1;
+    }
+    if (exponent >= -24 && exponent < -14) { // subnormal half, multiples of 2^-24
+        uint32_t full = mantissa | 0x800000;
+        int shift = -(exponent + 1);
+        if (full & ((1u << shift) - 1)) return 0;
+        *half = sign | (uint16_t)(full >> shift);
+        return 1;
+    }
+    return 0;
+}
+
+static inline double half_to_double(uint16_t half) {
+    int exponent = (half >> 10) & 0x1F;
+    double magnitude;
+    if (exponent == 0) {
+        magnitude = ldexp((double)(half & 0x3FF), -24);
+    } else if (exponent == 31) {
+        magnitude = (half & 0x3FF) ? NAN : INFINITY;
+    } else {
+        magnitude = ldexp((double)((half & 0x3FF) | 0x400), exponent - 25);
+    }
+    return (half & 0x8000) ? -magnitude : magnitude;
+}
+
 static inline void encode_uint64( uint64_t value, uint8_t *buffer) {
-    buffer[0] = (value >> 56) & 0xFF;
-    buffer[1] = (value >> 48) & 0xFF;
-    buffer[2] = (value >> 40) & 0xFF;
-    buffer[3] = (value >> 32) & 0xFF;
-    buffer[4] = (value >> 24) & 0xFF;
-    buffer[5] = (value >> 16) & 0xFF;
-    buffer[6] = (value >> 8) & 0xFF;
-    buffer[7] = value & 0xFF;
+    _store_be64(buffer, value);
 }
 
 static inline uint64_t decode_uint64(const uint8_t *buffer) {
-    return ((uint64_t)buffer[0] << 56) |
-           ((uint64_t)buffer[1] << 48) |
-           ((uint64_t)buffer[2] << 40) |
-           ((uint64_t)buffer[3] << 32) |
-           ((uint64_t)buffer[4] << 24) |
-           ((uint64_t)buffer[5] << 16) |
-           ((uint64_t)buffer[6] << 8) |
-            (uint64_t)buffer[7];
+    return _load_be64(buffer);
 }
 
+// Packed arrays store their bit stream little endian
+static inline uint64_t _load_le64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void _store_le64(uint8_t *p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = _tb_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
+
+// Number of bits needed to hold value, 0 for 0
+static inline uint8_t bit_width_64(uint64_t value) {
+    return value ? (uint8_t)(64 - _tb_clz64(value)) : 0;
+}
+
+static inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// 2^48 / 10^k, the largest values scaling by 10^k to an integer a compressed double can hold
+static const double scale_limits[] = {
+    281474976710656.0,
+    281474976710656.0 / 1e1,
+    281474976710656.0 / 1e2,
+    281474976710656.0 / 1e3,
+    281474976710656.0 / 1e4,
+    281474976710656.0 / 1e5,
+    281474976710656.0 / 1e6,
+    281474976710656.0 / 1e7,
+    281474976710656.0 / 1e8,
+    281474976710656.0 / 1e9,
+    281474976710656.0 / 1e10,
+    281474976710656.0 / 1e11,
+    281474976710656.0 / 1e12
+};
+
+// Largest power of 10 that keeps a value below 2^48, from its binary exponent (abs_val < 2^48)
+static inline int _decimal_scale(double abs_val) {
+    // floor((47 - e) * log10(2)) for e = exponent of abs_val, one more when the value is small enough for it
+    uint64_t bits = dtoi_bits(abs_val);
+    int e = (int)(bits >> 52) - 1023;
+    int top = ((47 - e) * 1233) >> 12;
+    if (top >= 12) return 12;
+    return top + (abs_val < scale_limits[top + 1]);
+}
+
+/**
+ * @brief Finds the fewest decimal places (0-12) of a non negative double
+ *
+ * @param abs_val The value, a positive double or 0
+ * @param scaled Set to abs_val * 10^places, an integer below 2^48 unless abs_val itself is a larger integer
+ * @return The number of decimal places, or -1 if there is none
+ *
+ * Scaled by the largest power of 10 that keeps it below 2^48 (picked from its binary exponent), a
+ * decimal with its fewest places p rounds to exactly its digits followed by top - p zeros, and most
+ * other values are rejected because they do not land near an integer. The places are what remains
+ * once those zeros are stripped, and a count is only returned when scaled / 10^places (what the
+ * unpacker computes) gives back abs_val exactly.
+ */
 static inline int decimal_places_count(double abs_val, double *scaled) {
-    //double abs_val = fabs(val);
     *scaled = abs_val;
-    double temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 0;}
-
-    *scaled = abs_val * 10000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 10;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 1;}
-        *scaled = abs_val * 100;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 2;}
-        *scaled = abs_val * 1000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 3;}
-        *scaled = temp;
-        return 4;
+    if (TB_UNLIKELY(!(abs_val < scale_limits[0]))) { // also rejects NaN
+        // too large to scale, only integers qualify
+        return (abs_val < 18446744073709551616.0 && abs_val == (double)(uint64_t)abs_val) ? 0 : -1;
     }
+    int k = _decimal_scale(abs_val);
+    double x = abs_val * powers[k];
+    uint64_t digits = (uint64_t)(x + 0.5);
+    if (fabs(x - (double)digits) > 0.0625) return -1;
+    // strip min(trailing zeros, k) zeros, 8, 4, 2 and 1 at a time (k <= 12)
+    if (k >= 8 && digits % 100000000 == 0) { digits /= 100000000; k -= 8; }
+    if (k >= 4 && digits % 10000 == 0) { digits /= 10000; k -= 4; }
+    if (k >= 2 && digits % 100 == 0) { digits /= 100; k -= 2; }
+    if (k >= 1 && digits % 10 == 0) { digits /= 10; k -= 1; }
+    double integer = (double)digits;
+    if (integer / powers[k] != abs_val) return -1;
+    *scaled = integer;
+    return k;
+}
 
-    *scaled = abs_val * 100000000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 100000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 5;}
-        *scaled = abs_val * 1000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 6;}
-        *scaled = abs_val * 10000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 7;}
-        *scaled = temp;
-        return 8;
+/**
+ * @brief decimal_places_count() trying the decimal places of a neighbouring value first
+ *
+ * @param abs_val The value, a positive double or 0 (NaN and infinities get -1)
+ * @param guess Decimal places to try first, or -1
+ * @param scaled Set to abs_val scaled by 10^places
+ * @return The number of decimal places, or -1 if there is none
+ *
+ * Neighbouring values of a series tend to have the same number of decimals, and checking a guess
+ * is a single scale and test.
+ */
+static inline int decimal_places_count_near(double abs_val, int guess, double *scaled) {
+    if (guess >= 0 && abs_val < scale_limits[guess]) {
+        double x = abs_val * powers[guess];
+        int64_t integer = (int64_t)(x + 0.5);
+        // exact and not a multiple of 10 (then fewer places would do)
+        if ((double)integer / powers[guess] == abs_val
+            && (guess == 0 || integer % 10 != 0)) {
+            *scaled = (double)integer;
+            return guess;
+        }
     }
+    return decimal_places_count(abs_val, scaled);
+}
 
-    *scaled = abs_val * 1000000000000;
-    temp = *scaled;
-    if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { 
-        *scaled = abs_val * 1000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 9;}
-        *scaled = abs_val * 10000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 10;}
-        *scaled = abs_val * 100000000000;
-        if(*scaled == (uint64_t)(*scaled) && *scaled >= abs_val) { return 11;}
-        *scaled = temp;
-        return 12;
+/**
+ * @brief decimal_places_count() over an array
+ *
+ * @param abs_vals The values, positive doubles or 0 (NaN and infinities get -1)
+ * @param count Number of values
+ * @param places Set to the decimal places of each value, or -1
+ * @param scaled Set to each value scaled by 10^places
+ *
+ * Each value is first checked against the decimal places of the one before it, see
+ * decimal_places_count_near().
+ */
+static inline void decimal_places_count_batch(const double *abs_vals, size_t count, int8_t *places, double *scaled) {
+    int guess = -1;
+    for (size_t i = 0; i < count; i++) {
+        guess = decimal_places_count_near(abs_vals[i], guess, &scaled[i]);
+        places[i] = (int8_t)guess;
     }
-    return -1;
 }
 
-#endif
+#endif // TINY_BITS_COMMON_H
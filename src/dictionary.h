@@ -0,0 +1,308 @@
+#ifndef TINY_BITS_DICTIONARY_H
+#define TINY_BITS_DICTIONARY_H
+
+#include "packer.h"
+#include "unpacker.h"
+
+// A versioned, read-only set of common strings shared by both ends of a connection.
+// Once loaded into a packer and an unpacker, dictionary entries take the reference
+// ids 0..count-1 and the strings of each message are numbered after them, so a
+// dictionary string is sent as a reference from its very first occurrence.
+typedef struct tiny_bits_dictionary {
+    uint32_t version;       // Application defined, both sides must use the same version
+    char *data;             // Dictionary strings, stored back to back
+    size_t data_size;       // Bytes used in data
+    size_t data_capacity;   // Bytes allocated for data
+    HashTable table;        // Entry offsets are relative to data, next_id is the entry count
+} tiny_bits_dictionary;
+
+// Training candidate, a string seen while scanning the corpus
+typedef struct tiny_bits_dictionary_candidate {
+    const char *str;
+    uint32_t length;
+    uint32_t hash;
+    uint32_t count;   // Number of messages in which the string was sent inline
+} tiny_bits_dictionary_candidate;
+
+/**
+ * @brief allocates and initializes a new, empty dictionary
+ *
+ * @param version Application defined version number, stored with the dictionary
+ * @return pointer to new dictionary instance
+ *
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_create(uint32_t version) {
+    tiny_bits_dictionary *dict = (tiny_bits_dictionary *)malloc(sizeof(tiny_bits_dictionary));
+    if (!dict) return NULL;
+    memset(dict, 0, sizeof(tiny_bits_dictionary));
+    if (!hash_table_init(&dict->table, TB_HASH_CACHE_SIZE, TB_DICT_MAX_SIZE, TB_DEDUPE_POLICY_STOP)) {
+        free(dict);
+        return NULL;
+    }
+    dict->version = version;
+    return dict;
+}
+
+/**
+ * @brief Deallocate the dictionary object and its internal data structures
+ *
+ * @param dict The dictionary instance
+ *
+ * @note Packers and unpackers using the dictionary must be destroyed (or have their dictionary unset) first
+ */
+void tiny_bits_dictionary_destroy(tiny_bits_dictionary *dict) {
+    if (!dict) return;
+    hash_table_free(&dict->table);
+    free(dict->data);
+    free(dict);
+}
+
+/**
+ * @brief Adds a string to the dictionary
+ *
+ * @param dict The dictionary instance
+ * @param str Pointer to the string data (copied into the dictionary)
+ * @param str_len Length of the string in bytes
+ * @return The id of the string in the dictionary, or -1 on error
+ *
+ * @note Only deduplicatable strings (2-128 bytes) are accepted and at most TB_DICT_MAX_SIZE of them.
+ * Adding an existing string returns its id. Strings must not be added once the dictionary was set on
+ * a packer or an unpacker.
+ */
+static inline int32_t tiny_bits_dictionary_add(tiny_bits_dictionary *dict, const char *str, uint32_t str_len) {
+    if (!dict || !str || str_len < 2 || str_len > 128) return -1;
+    uint32_t hash_code = string_hash_32(str, str_len);
+    HashEntry *entry = hash_table_lookup(&dict->table, (const unsigned char *)dict->data, str, str_len, hash_code);
+    if (entry) return entry->id;
+    if (dict->table.cache_pos >= TB_DICT_MAX_SIZE) return -1;
+
+    if (dict->data_size + str_len > dict->data_capacity) {
+        size_t new_capacity = dict->data_capacity + str_len + dict->data_capacity;
+        char *new_data = (char *)realloc(dict->data, new_capacity);
+        if (!new_data) return -1;
+        dict->data = new_data;
+        dict->data_capacity = new_capacity;
+    }
+    if (!hash_table_insert(&dict->table, hash_code, str_len, dict->data_size)) return -1;
+    memcpy(dict->data + dict->data_size, str, str_len);
+    dict->data_size += str_len;
+    return dict->table.next_id - 1;
+}
+
+/**
+ * @brief Serializes the dictionary as a tinybits message: [version, [string, string, ...]]
+ *
+ * @param dict The dictionary instance
+ * @param encoder The packer to write to, it must not have a dictionary set
+ * @return Number of bytes written, or 0 on error
+ */
+static inline int tiny_bits_dictionary_save(const tiny_bits_dictionary *dict, tiny_bits_packer *encoder) {
+    if (!dict || !encoder || encoder->dictionary.next_id) return 0;
+    size_t start = encoder->current_pos;
+    if (!pack_arr(encoder, 2)) return 0;
+    if (!pack_int(encoder, dict->version)) return 0;
+    if (!pack_arr(encoder, dict->table.cache_pos)) return 0;
+    for (uint32_t i = 0; i < dict->table.cache_pos; i++) {
+        HashEntry entry = dict->table.cache[i];
+        if (!pack_str(encoder, dict->data + entry.offset, entry.length)) return 0;
+    }
+    return encoder->current_pos - start;
+}
+
+/**
+ * @brief Creates a dictionary from a buffer produced by tiny_bits_dictionary_save()
+ *
+ * @param buffer A pointer to the serialized dictionary
+ * @param size Size of the serialized dictionary
+ * @return pointer to new dictionary instance, or NULL if the buffer is malformed
+ *
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_load(const unsigned char *buffer, size_t size) {
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder) return NULL;
+    tiny_bits_dictionary *dict = NULL;
+    tiny_bits_value value;
+    tiny_bits_unpacker_set_buffer(decoder, buffer, size);
+
+    if (unpack_value(decoder, &value) != TINY_BITS_ARRAY || value.length != 2) goto done;
+    if (unpack_value(decoder, &value) != TINY_BITS_INT
+        || value.int_val < 0 || value.int_val > UINT32_MAX) goto done;
+    dict = tiny_bits_dictionary_create((uint32_t)value.int_val);
+    if (!dict) goto done;
+    if (unpack_value(decoder, &value) != TINY_BITS_ARRAY || value.length > TB_DICT_MAX_SIZE) goto fail;
+    size_t count = value.length;
+    for (size_t i = 0; i < count; i++) {
+        if (unpack_value(decoder, &value) != TINY_BITS_STR) goto fail;
+        // ids are positional, so every entry must land in its own slot
+        if (tiny_bits_dictionary_add(dict, value.str_blob_val.data, value.str_blob_val.length) != (int32_t)i) goto fail;
+    }
+    goto done;
+fail:
+    tiny_bits_dictionary_destroy(dict);
+    dict = NULL;
+done:
+    tiny_bits_unpacker_destroy(decoder);
+    return dict;
+}
+
+static inline int _dictionary_candidate_compare(const void *a, const void *b) {
+    const tiny_bits_dictionary_candidate *x = (const tiny_bits_dictionary_candidate *)a;
+    const tiny_bits_dictionary_candidate *y = (const tiny_bits_dictionary_candidate *)b;
+    // bytes saved over the corpus, roughly one string body per message it appears in
+    uint64_t x_score = (uint64_t)x->count * x->length;
+    uint64_t y_score = (uint64_t)y->count * y->length;
+    if (x_score != y_score) return x_score > y_score ? -1 : 1;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return memcmp(x->str, y->str, x->length);
+}
+
+/**
+ * @brief Builds a dictionary from a corpus of captured messages
+ *
+ * @param messages Array of pointers to packed messages
+ * @param sizes Size of each message
+ * @param count Number of messages in the corpus
+ * @param max_entries Maximum number of strings in the dictionary (capped at TB_DICT_MAX_SIZE)
+ * @param version Version number stored in the resulting dictionary
+ * @return pointer to new dictionary instance, or NULL on error
+ *
+ * Every deduplicatable string is scored by the number of messages that send it inline
+ * times its length, strings sent inline by fewer than two messages are never selected.
+ * The best candidates get the lowest ids, so they are referenced with a single byte.
+ *
+ * @note The corpus must be packed without a dictionary
+ * @note the returned dictionary object must be freed using tiny_bits_dictionary_destroy()
+ */
+tiny_bits_dictionary *tiny_bits_dictionary_train(const unsigned char **messages, const size_t *sizes, size_t count,
+                                                 uint32_t max_entries, uint32_t version) {
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder) return NULL;
+    tiny_bits_dictionary *dict = NULL;
+    size_t slots = 1024;  // open addressing, kept at most half full
+    size_t used = 0;
+    tiny_bits_dictionary_candidate *candidates = (tiny_bits_dictionary_candidate *)calloc(slots, sizeof(*candidates));
+    if (!candidates) goto done;
+
+    for (size_t m = 0; m < count; m++) {
+        tiny_bits_value value;
+        enum tiny_bits_type type;
+        if (!messages[m] || sizes[m] == 0) continue;
+        tiny_bits_unpacker_set_buffer(decoder, messages[m], sizes[m]);
+        while ((type = unpack_value(decoder, &value)) != TINY_BITS_FINISHED && type != TINY_BITS_ERROR) {
+            // references (positive ids) are already cheap, only inline strings count
+            if (type != TINY_BITS_STR || value.str_blob_val.id > 0) continue;
+            uint32_t len = value.str_blob_val.length;
+            if (len < 2 || len > 128) continue;
+            if ((used + 1) * 2 > slots) {
+                size_t new_slots = slots * 2;
+                tiny_bits_dictionary_candidate *grown = (tiny_bits_dictionary_candidate *)calloc(new_slots, sizeof(*grown));
+                if (!grown) goto done;
+                for (size_t i = 0; i < slots; i++) {
+                    if (!candidates[i].str) continue;
+                    size_t j = candidates[i].hash & (new_slots - 1);
+                    while (grown[j].str) j = (j + 1) & (new_slots - 1);
+                    grown[j] = candidates[i];
+                }
+                free(candidates);
+                candidates = grown;
+                slots = new_slots;
+            }
+            uint32_t hash_code = string_hash_32(value.str_blob_val.data, len);
+            size_t i = hash_code & (slots - 1);
+            while (candidates[i].str) {
+                if (candidates[i].hash == hash_code && candidates[i].length == len
+                    && memcmp(candidates[i].str, value.str_blob_val.data, len) == 0) break;
+                i = (i + 1) & (slots - 1);
+            }
+            if (!candidates[i].str) {
+                candidates[i].str = value.str_blob_val.data;
+                candidates[i].length = len;
+                candidates[i].hash = hash_code;
+                used++;
+            }
+            candidates[i].count++;
+        }
+    }
+
+    // compact the table, dropping strings that would never pay off
+    size_t selected = 0;
+    for (size_t i = 0; i < slots; i++) {
+        if (candidates[i].str && candidates[i].count >= 2) candidates[selected++] = candidates[i];
+    }
+    qsort(candidates, selected, sizeof(*candidates), _dictionary_candidate_compare);
+
+    dict = tiny_bits_dictionary_create(version);
+    if (!dict) goto done;
+    if (max_entries > TB_DICT_MAX_SIZE) max_entries = TB_DICT_MAX_SIZE;
+    for (size_t i = 0; i < selected && i < max_entries; i++) {
+        if (tiny_bits_dictionary_add(dict, candidates[i].str, candidates[i].length) < 0) {
+            tiny_bits_dictionary_destroy(dict);
+            dict = NULL;
+            break;
+        }
+    }
+done:
+    free(candidates);
+    tiny_bits_unpacker_destroy(decoder);
+    return dict;
+}
+
+/**
+ * @brief Sets (or clears) the pre-shared dictionary used by the packer
+ *
+ * @param encoder The packer instance
+ * @param dict The dictionary, or NULL to stop using one
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this between messages, right after creating or resetting the packer.
+ * The dictionary must outlive its use by the packer.
+ */
+static inline int tiny_bits_packer_set_dictionary(tiny_bits_packer *encoder, const tiny_bits_dictionary *dict) {
+    if (!encoder) return 0;
+    if (!dict) {
+        memset(&encoder->dictionary, 0, sizeof(HashTable));
+        encoder->dictionary_data = NULL;
+        return 1;
+    }
+    encoder->dictionary = dict->table;
+    encoder->dictionary_data = dict->data;
+    return 1;
+}
+
+/**
+ * @brief Sets (or clears) the pre-shared dictionary used by the unpacker
+ *
+ * @param decoder The unpacker instance
+ * @param dict The dictionary, or NULL to stop using one
+ * @return 1 on success, 0 on error
+ *
+ * @note This resets the string table of the unpacker, call it before tiny_bits_unpacker_set_buffer().
+ * The dictionary must outlive its use by the unpacker.
+ */
+static inline int tiny_bits_unpacker_set_dictionary(tiny_bits_unpacker *decoder, const tiny_bits_dictionary *dict) {
+    if (!decoder) return 0;
+    if (!dict) {
+        memset(&decoder->dictionary, 0, sizeof(HashTable));
+        decoder->strings_count = 0;
+        return 1;
+    }
+    size_t count = dict->table.cache_pos;
+    if (count >= decoder->strings_size) {
+        size_t new_size = count + decoder->strings_size;
+        void *new_strings = _tb_realloc(decoder->allocator, decoder->strings, new_size * sizeof(*decoder->strings));
+        if (!new_strings) return 0;
+        decoder->strings = new_strings;
+        decoder->strings_size = new_size;
+    }
+    for (size_t i = 0; i < count; i++) {
+        decoder->strings[i].str = dict->data + dict->table.cache[i].offset;
+        decoder->strings[i].length = dict->table.cache[i].length;
+    }
+    decoder->dictionary = dict->table;
+    decoder->strings_count = count;
+    return 1;
+}
+
+#endif // TINY_BITS_DICTIONARY_H
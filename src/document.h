@@ -0,0 +1,294 @@
+#ifndef TINY_BITS_DOCUMENT_H
+#define TINY_BITS_DOCUMENT_H
+
+#include "unpacker.h"
+
+#define TB_DOC_LINEAR_MAP 8 // maps with more pairs get a hash index of their keys
+
+/**
+ * A decoded value, in document order: arrays and maps are followed by their elements (for maps, each key
+ * then its value), next skips the node and everything it contains. Strings, blobs and packed arrays point
+ * into the unpacker buffer (or its session copies).
+ */
+typedef struct tiny_bits_node {
+    tiny_bits_value value;  // as unpack_value() set it, value.length for the elements (pairs) of containers
+    uint32_t next;          // index of the node following this one and everything it contains
+    uint32_t elements;      // containers: where the node indexes of the elements (keys for maps) start in document->elements
+    uint8_t type;           // enum tiny_bits_type
+} tiny_bits_node;
+
+/**
+ * A whole value decoded at once into a flat array of nodes, for random access afterwards: array elements by
+ * position and map values by key in constant time. Nodes and indexes are kept across parses, so a reused
+ * document stops allocating once it has seen its largest message.
+ */
+typedef struct tiny_bits_document {
+    tiny_bits_node *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *elements;         // per container, the node index of each element (of each key for maps),
+                                // then for larger maps a hash table of key node index + 1, 0 for empty slots
+    uint32_t elements_count;
+    uint32_t elements_capacity;
+    const tiny_bits_allocator *allocator;
+} tiny_bits_document;
+
+/**
+ * @brief allocates and initializes a new document, taking all its memory from an allocator
+ *
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
+ * @return pointer to new document instance
+ *
+ * @note the returned document object must be freed using tiny_bits_document_destroy(), unless it comes from
+ * an arena that is reset or destroyed as a whole
+ */
+static inline tiny_bits_document *tiny_bits_document_create_with(const tiny_bits_allocator *allocator) {
+    tiny_bits_document *doc = (tiny_bits_document *)_tb_alloc(allocator, sizeof(tiny_bits_document));
+    if (!doc) return NULL;
+    memset(doc, 0, sizeof(tiny_bits_document));
+    doc->allocator = allocator;
+    return doc;
+}
+
+/**
+ * @brief allocates and initializes a new document
+ *
+ * @return pointer to new document instance
+ *
+ * @note the returned document object must be freed using tiny_bits_document_destroy()
+ */
+static inline tiny_bits_document *tiny_bits_document_create(void) {
+    return tiny_bits_document_create_with(NULL);
+}
+
+/**
+ * @brief Deallocate the document object and its nodes
+ *
+ * @param doc The document instance
+ */
+static inline void tiny_bits_document_destroy(tiny_bits_document *doc) {
+    if (!doc) return;
+    _tb_free(doc->allocator, doc->nodes);
+    _tb_free(doc->allocator, doc->elements);
+    _tb_free(doc->allocator, doc);
+}
+
+// Room for needed more nodes, kept out of the parsing loop
+static TB_NOINLINE int _document_grow_nodes(tiny_bits_document *doc, size_t needed) {
+    size_t capacity = doc->capacity ? doc->capacity : 64;
+    while (capacity < (size_t)doc->count + needed) capacity *= 2;
+    if (capacity > UINT32_MAX) return 0;
+    tiny_bits_node *nodes = (tiny_bits_node *)_tb_realloc(doc->allocator, doc->nodes, capacity * sizeof(tiny_bits_node));
+    if (!nodes) return 0;
+    doc->nodes = nodes;
+    doc->capacity = (uint32_t)capacity;
+    return 1;
+}
+
+// Reserves count entries of the element index, returns where they start or UINT32_MAX on failure
+static inline uint32_t _document_reserve_elements(tiny_bits_document *doc, size_t count) {
+    if ((size_t)doc->elements_count + count > doc->elements_capacity) {
+        size_t capacity = doc->elements_capacity ? doc->elements_capacity : 64;
+        while (capacity < (size_t)doc->elements_count + count) capacity *= 2;
+        if (capacity >= UINT32_MAX) return UINT32_MAX;
+        uint32_t *elements = (uint32_t *)_tb_realloc(doc->allocator, doc->elements, capacity * sizeof(uint32_t));
+        if (!elements) return UINT32_MAX;
+        doc->elements = elements;
+        doc->elements_capacity = (uint32_t)capacity;
+    }
+    uint32_t start = doc->elements_count;
+    doc->elements_count += (uint32_t)count;
+    return start;
+}
+
+// Slots of the key hash index of a map, 0 when it is looked up linearly
+static inline uint32_t _document_map_slots(uint32_t length) {
+    if (length <= TB_DOC_LINEAR_MAP) return 0;
+    uint32_t slots = 16;
+    while (slots < 2 * length) slots *= 2;
+    return slots;
+}
+
+// Hashes the string keys of a linked map into the slots following its key index
+static inline void _document_index_map(tiny_bits_document *doc, const tiny_bits_node *map) {
+    uint32_t length = (uint32_t)map->value.length;
+    uint32_t slots = _document_map_slots(length);
+    const uint32_t *keys = doc->elements + map->elements;
+    uint32_t *table = doc->elements + map->elements + length;
+    memset(table, 0, slots * sizeof(uint32_t));
+    for (uint32_t i = 0; i < length; i++) {
+        const tiny_bits_node *key = &doc->nodes[keys[i]];
+        if (key->type != TINY_BITS_STR) continue;
+        uint32_t slot = string_hash_32(key->value.str_blob_val.data, (uint32_t)key->value.str_blob_val.length) & (slots - 1);
+        while (table[slot]) slot = (slot + 1) & (slots - 1);
+        table[slot] = keys[i] + 1;
+    }
+}
+
+// Sets next and fills the element index of every node, last to first: the nodes following a container are
+// linked by the time it is reached, so its elements are found by hopping from one to the next
+static inline void _document_link(tiny_bits_document *doc) {
+    tiny_bits_node *nodes = doc->nodes;
+    for (uint32_t i = doc->count; i-- > 0;) {
+        tiny_bits_node *node = &nodes[i];
+        uint32_t next = i + 1;
+        if (node->type == TINY_BITS_ARRAY) {
+            uint32_t *elements = doc->elements + node->elements;
+            for (size_t k = 0; k < node->value.length; k++) {
+                elements[k] = next;
+                next = nodes[next].next;
+            }
+        } else if (node->type == TINY_BITS_MAP) {
+            uint32_t *keys = doc->elements + node->elements;
+            for (size_t k = 0; k < node->value.length; k++) {
+                keys[k] = next;
+                next = nodes[nodes[next].next].next; // past the key and its value
+            }
+            if (node->value.length > TB_DOC_LINEAR_MAP) _document_index_map(doc, node);
+        }
+        node->next = next;
+    }
+}
+
+/**
+ * @brief Decodes the next value of an unpacker, with everything it contains, into the document
+ *
+ * @param doc The document instance, its previous content is discarded
+ * @param decoder The unpacker, left after the value
+ * @return The type of the value (the root node), TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_ERROR
+ * on malformed input or allocation failure. An incremental unpacker returns TINY_BITS_NEED_MORE, and is left
+ * before the value, until all of it has been appended.
+ *
+ * @note Nodes point into the unpacker buffer, which must outlive them. Values are unpacked straight into their
+ * nodes, then containers are linked and indexed in a second pass over the nodes, maps of more than
+ * TB_DOC_LINEAR_MAP pairs get a hash index of their keys.
+ */
+static inline enum tiny_bits_type tiny_bits_document_parse(tiny_bits_document *doc, tiny_bits_unpacker *decoder) {
+    if (!doc || !decoder) return TINY_BITS_ERROR;
+    size_t left = 1; // values still to come, containers add their elements
+    tiny_bits_unpacker_mark mark;
+    doc->count = 0;
+    doc->elements_count = 0;
+    // an incremental unpacker waits for all of the value rather than parsing it again with every append
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    _unpacker_mark(decoder, &mark);
+    while (left) {
+        if (doc->count == doc->capacity && !_document_grow_nodes(doc, 1)) goto fail;
+        tiny_bits_node *node = &doc->nodes[doc->count];
+        enum tiny_bits_type type = unpack_value(decoder, &node->value);
+        if (type == TINY_BITS_FINISHED && doc->count == 0) return TINY_BITS_FINISHED;
+        if (type == TINY_BITS_ERROR) goto fail;
+        if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) goto cut_short;
+        node->type = (uint8_t)type;
+        doc->count++;
+        left--;
+        if (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) {
+            size_t length = node->value.length;
+            size_t values = type == TINY_BITS_MAP ? 2 * length : length;
+            // every value takes a byte at least, which also bounds the element index by the buffer size
+            if (length > decoder->size - decoder->current_pos || values > decoder->size - decoder->current_pos - left) goto cut_short;
+            uint32_t elements = _document_reserve_elements(doc, length + (type == TINY_BITS_MAP ? _document_map_slots((uint32_t)length) : 0));
+            if (elements == UINT32_MAX) goto fail;
+            node->elements = elements;
+            left += values;
+        }
+    }
+    _document_link(doc);
+    return (enum tiny_bits_type)doc->nodes[0].type;
+cut_short:
+    // malformed, or an incremental unpacker that has not got all of the value yet
+    doc->count = 0;
+    return _unpacker_rewind(decoder, &mark);
+fail:
+    doc->count = 0;
+    return TINY_BITS_ERROR;
+}
+
+/**
+ * @brief The value parsed last
+ *
+ * @param doc The document instance
+ * @return The root node, NULL if the document is empty
+ */
+static inline const tiny_bits_node *tiny_bits_document_root(const tiny_bits_document *doc) {
+    return doc && doc->count ? &doc->nodes[0] : NULL;
+}
+
+/**
+ * @brief An element of an array
+ *
+ * @param doc The document instance
+ * @param array An array node of the document
+ * @param index Position of the element
+ * @return The element node, NULL if array is not an array or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_at(const tiny_bits_document *doc, const tiny_bits_node *array, size_t index) {
+    if (!array || array->type != TINY_BITS_ARRAY || index >= array->value.length) return NULL;
+    return &doc->nodes[doc->elements[array->elements + index]];
+}
+
+/**
+ * @brief A key of a map, in the order they were packed
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param index Position of the pair
+ * @return The key node (its value is the node right after it), NULL if map is not a map or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_key_at(const tiny_bits_document *doc, const tiny_bits_node *map, size_t index) {
+    if (!map || map->type != TINY_BITS_MAP || index >= map->value.length) return NULL;
+    return &doc->nodes[doc->elements[map->elements + index]];
+}
+
+/**
+ * @brief The value of a pair of a map, in the order they were packed
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param index Position of the pair
+ * @return The value node, NULL if map is not a map or index is out of range
+ */
+static inline const tiny_bits_node *tiny_bits_node_value_at(const tiny_bits_document *doc, const tiny_bits_node *map, size_t index) {
+    const tiny_bits_node *key = tiny_bits_node_key_at(doc, map, index);
+    return key ? &doc->nodes[key->next] : NULL;
+}
+
+/**
+ * @brief Looks a string key up in a map
+ *
+ * @param doc The document instance
+ * @param map A map node of the document
+ * @param key The key
+ * @param key_len Its length in bytes
+ * @return The value node, NULL if map is not a map or has no such key
+ */
+static inline const tiny_bits_node *tiny_bits_node_get(const tiny_bits_document *doc, const tiny_bits_node *map,
+                                                       const char *key, size_t key_len) {
+    if (!map || map->type != TINY_BITS_MAP) return NULL;
+    uint32_t length = (uint32_t)map->value.length;
+    const uint32_t *keys = doc->elements + map->elements;
+    if (length <= TB_DOC_LINEAR_MAP) {
+        for (uint32_t i = 0; i < length; i++) {
+            const tiny_bits_node *node = &doc->nodes[keys[i]];
+            if (node->type == TINY_BITS_STR && node->value.str_blob_val.length == key_len
+                && memcmp(node->value.str_blob_val.data, key, key_len) == 0) {
+                return &doc->nodes[node->next];
+            }
+        }
+        return NULL;
+    }
+    if (key_len > UINT32_MAX) return NULL;
+    uint32_t slots = _document_map_slots(length);
+    const uint32_t *table = keys + length;
+    uint32_t slot = string_hash_32(key, (uint32_t)key_len) & (slots - 1);
+    while (table[slot]) {
+        const tiny_bits_node *node = &doc->nodes[table[slot] - 1];
+        if (node->value.str_blob_val.length == key_len && memcmp(node->value.str_blob_val.data, key, key_len) == 0) {
+            return &doc->nodes[node->next];
+        }
+        slot = (slot + 1) & (slots - 1);
+    }
+    return NULL;
+}
+
+#endif // TINY_BITS_DOCUMENT_H
@@ -2,24 +2,74 @@
 #define TINY_BITS_PACKER_H
 
 #include "common.h"
+#include "pool.h"
+
+// Called by a streaming packer with the bytes to write out, returns 0 on error
+typedef int (*tiny_bits_flush_fn)(void *context, const uint8_t *data, size_t size);
+
+// A payload packed by reference, it follows the buffer bytes before pos, see pack_blob_ref()
+typedef struct tiny_bits_ref {
+    size_t pos;             // buffer position of the payload (right after its header)
+    const void *data;       // the caller's bytes
+    size_t size;
+} tiny_bits_ref;
 
 typedef struct tiny_bits_packer {
     unsigned char *buffer;      // Pointer to the allocated buffer
     size_t capacity;         // Total allocated size of the buffer
     size_t current_pos;      // Current position in the buffer (write position)
     HashTable encode_table; // Add the hash table here
-    HashTable dictionary;
+    HashTable dictionary;   // Pre-shared strings (ids 0..next_id-1), see tiny_bits_packer_set_dictionary()
+    const char *dictionary_data; // Storage the dictionary entry offsets point into
+    unsigned char *strings;      // When set, registered strings are copied here and encode_table offsets point into it
+    size_t strings_size;         // Bytes used in strings
+    size_t strings_capacity;     // Bytes allocated for strings
+    uint32_t session_window;     // Ids kept across messages before a reset, 0 when not in a session
+    tiny_bits_flush_fn flush;    // Set on a streaming packer, see tiny_bits_packer_set_flush()
+    void *flush_context;         // Passed to flush
+    size_t flushed;              // Bytes handed to flush so far
+    uint32_t deferred_open;      // Containers started by pack_arr_begin()/pack_map_begin() and not ended yet
+    const tiny_bits_allocator *allocator; // Where the buffer, dedupe table and strings come from, NULL for malloc()
+    struct tiny_bits_buffer_pool *pool; // When set the buffer is borrowed from it, see tiny_bits_packer_set_pool()
+    size_t pool_keep;            // Largest buffer kept across resets, larger ones go back to the pool
+    tiny_bits_ref *refs;         // Payloads packed by reference, in buffer order
+    uint32_t refs_count;
+    uint32_t refs_capacity;
+    size_t refs_size;            // Bytes they add to the message
+    uint8_t measuring;           // Only counts the bytes, see tiny_bits_packer_set_measure()
+    size_t measured_peak;        // Most bytes held at once while measuring, before deferred headers shrank
     uint8_t features;
+    int8_t float_places;         // Decimal places of the last double packed, tried first on the next one (-1 for none)
     // Add any other encoder-specific state here if needed (e.g., string deduplication table later)
 } tiny_bits_packer;
 
+static inline int tiny_bits_packer_flush(tiny_bits_packer *encoder);
+
 static inline unsigned char *tiny_bits_packer_ensure_capacity(tiny_bits_packer *encoder, size_t needed_size) {
     if (!encoder) return NULL;
 
     size_t available_space = encoder->capacity - encoder->current_pos;
+    if (needed_size > available_space && encoder->flush && !encoder->deferred_open && encoder->current_pos) {
+        // streaming: write out what is packed so far, this is always called before a value is written
+        if (!tiny_bits_packer_flush(encoder)) return NULL;
+        available_space = encoder->capacity;
+    }
+#if defined(TB_WITH_POOL)
+    if (needed_size > available_space && encoder->pool) {
+        // the next size class up, what was packed so far moves over
+        size_t new_capacity;
+        unsigned char *new_buffer = (unsigned char *)tiny_bits_pool_acquire(encoder->pool, encoder->current_pos + needed_size, &new_capacity);
+        if (!new_buffer) return NULL;
+        memcpy(new_buffer, encoder->buffer, encoder->current_pos);
+        tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+        encoder->buffer = new_buffer;
+        encoder->capacity = new_capacity;
+        available_space = new_capacity - encoder->current_pos;
+    }
+#endif
     if (needed_size > available_space) {
         size_t new_capacity = encoder->capacity + needed_size + (encoder->capacity);
-        unsigned char *new_buffer = (unsigned char *)realloc(encoder->buffer, new_capacity);
+        unsigned char *new_buffer = (unsigned char *)_tb_realloc(encoder->allocator, encoder->buffer, new_capacity);
         if (!new_buffer) return NULL;
         encoder->buffer = new_buffer;
         encoder->capacity = new_capacity;
@@ -28,63 +78,314 @@ static inline unsigned char *tiny_bits_packer_ensure_capacity(tiny_bits_packer *
 }
 
 /**
- * @brief allocates and initializes a new packer
+ * @brief allocates and initializes a new packer, taking all its memory from an allocator
  * 
+ * @param initial_capacity Initial buffer size
+ * @param features TB_FEATURE_* flags
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
  * @return pointer to new packer instance
  * 
- * @note the returned packer object must be freed using tiny_bits_packer_destroy()
+ * @note the returned packer object must be freed using tiny_bits_packer_destroy(), unless it comes from an
+ * arena that is reset or destroyed as a whole. The allocator must outlive the packer.
  */
-tiny_bits_packer *tiny_bits_packer_create(size_t initial_capacity, uint8_t features) {
-    tiny_bits_packer *encoder = (tiny_bits_packer *)malloc(sizeof(tiny_bits_packer));
+tiny_bits_packer *tiny_bits_packer_create_with(size_t initial_capacity, uint8_t features, const tiny_bits_allocator *allocator) {
+    tiny_bits_packer *encoder = (tiny_bits_packer *)_tb_alloc(allocator, sizeof(tiny_bits_packer));
     if (!encoder) return NULL;
 
-    encoder->buffer = (unsigned char *)malloc(initial_capacity);
+    encoder->buffer = (unsigned char *)_tb_alloc(allocator, initial_capacity);
     if (!encoder->buffer) {
-        free(encoder);
+        _tb_free(allocator, encoder);
         return NULL;
     }
     encoder->capacity = initial_capacity;
     encoder->current_pos = 0;
     encoder->features = features;
+    memset(&encoder->dictionary, 0, sizeof(HashTable));
+    encoder->dictionary_data = NULL;
+    encoder->strings = NULL;
+    encoder->strings_size = 0;
+    encoder->strings_capacity = 0;
+    encoder->session_window = 0;
+    encoder->flush = NULL;
+    encoder->flush_context = NULL;
+    encoder->flushed = 0;
+    encoder->deferred_open = 0;
+    encoder->allocator = allocator;
+    encoder->pool = NULL;
+    encoder->pool_keep = 0;
+    encoder->refs = NULL;
+    encoder->refs_count = 0;
+    encoder->refs_capacity = 0;
+    encoder->refs_size = 0;
+    encoder->measuring = 0;
+    encoder->measured_peak = 0;
+    encoder->float_places = -1;
 
     // Only allocate hash table if deduplication is enabled
     if (features & TB_FEATURE_STRING_DEDUPE) {
-        encoder->encode_table.cache = (HashEntry*)malloc(sizeof(HashEntry) * TB_HASH_CACHE_SIZE);
-        if (!encoder->encode_table.cache) {
-            //free(encoder->encode_table.buckets);
-            free(encoder->buffer);
-            free(encoder);
+        if (!hash_table_init_with(&encoder->encode_table, TB_HASH_CACHE_SIZE, TB_HASH_CACHE_SIZE, TB_DEDUPE_POLICY_STOP, allocator)) {
+            _tb_free(allocator, encoder->buffer);
+            _tb_free(allocator, encoder);
             return NULL;
         }
-        encoder->encode_table.cache_size = TB_HASH_CACHE_SIZE;
-        encoder->encode_table.cache_pos = 0;
-        encoder->encode_table.next_id = 0;
     } else {
-        encoder->encode_table.cache = NULL;
-        encoder->encode_table.cache_size = 0;
-        encoder->encode_table.cache_pos = 0;
-        encoder->encode_table.next_id = 0;
+        memset(&encoder->encode_table, 0, sizeof(HashTable));
     }
 
     return encoder;
 }
 
+/**
+ * @brief allocates and initializes a new packer
+ * 
+ * @return pointer to new packer instance
+ * 
+ * @note the returned packer object must be freed using tiny_bits_packer_destroy()
+ */
+tiny_bits_packer *tiny_bits_packer_create(size_t initial_capacity, uint8_t features) {
+    return tiny_bits_packer_create_with(initial_capacity, features, NULL);
+}
+
+static inline void _packer_clear_strings(tiny_bits_packer *encoder) {
+    if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
+        hash_table_clear(&encoder->encode_table);
+    }
+    encoder->strings_size = 0;
+}
+
+/**
+ * @brief Packs a marker telling the unpacker to forget all deduplicated strings
+ * 
+ * @param encoder Pointer to the packer instance
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note Strings packed after the marker are numbered from scratch (after the dictionary, if any)
+ */
+static inline int pack_strings_reset(tiny_bits_packer *encoder){
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 2);
+    if (!buffer) return 0; // Handle error
+    buffer[0] = TB_NXT_TAG;
+    buffer[1] = TB_NXT_RST;
+    encoder->current_pos += 2;
+    _packer_clear_strings(encoder);
+    return 2;
+}
+
 /**
  * @brief Resets internal data structure of the packer object
  * 
  * @param encoder The packer instance
  *
  * @note This function allows for more efficient packing by reusing the same packer object
+ * @note In a session, deduplicated strings are kept for the next message, unless the session
+ * window is exhausted. Then they are dropped and the next message starts with a reset marker.
  */
-inline void tiny_bits_packer_reset(tiny_bits_packer *encoder) {
+static inline void tiny_bits_packer_reset(tiny_bits_packer *encoder) {
     if (!encoder) return;
     encoder->current_pos = 0;  
-    if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
-        encoder->encode_table.next_id = 0;
-        encoder->encode_table.cache_pos = 0;
-        memset(encoder->encode_table.bins, 0, TB_HASH_SIZE * sizeof(uint8_t));
+    encoder->deferred_open = 0;
+    encoder->refs_count = 0;
+    encoder->refs_size = 0;
+    if (encoder->measuring) {
+        encoder->flushed = 0;
+        encoder->measured_peak = 0;
     }
-    
+#if defined(TB_WITH_POOL)
+    if (encoder->pool && encoder->capacity > encoder->pool_keep) {
+        // give an outgrown buffer back, keep working with a typical one
+        size_t capacity;
+        unsigned char *buffer = (unsigned char *)tiny_bits_pool_acquire(encoder->pool, encoder->pool_keep, &capacity);
+        if (buffer) {
+            tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+            encoder->buffer = buffer;
+            encoder->capacity = capacity;
+        }
+    }
+#endif
+    if (encoder->session_window) {
+        HashTable *table = &encoder->encode_table;
+        // a full table that stopped registering would never reach the window
+        if (table->next_id >= encoder->session_window
+            || (table->policy == TB_DEDUPE_POLICY_STOP && table->cache_pos >= table->cache_limit)) {
+            pack_strings_reset(encoder);
+        }
+        return;
+    }
+    _packer_clear_strings(encoder);
+}
+
+/**
+ * @brief Starts a session, where deduplicated strings persist across messages
+ * 
+ * @param encoder The packer instance, it must have TB_FEATURE_STRING_DEDUPE
+ * @param window Number of string ids the session may accumulate, once exceeded the strings
+ *               are reset at the start of the next message (see tiny_bits_packer_reset())
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer at the start of a stream, the unpacker on the other end must be in
+ * a session as well (see tiny_bits_unpacker_begin_session()). Registered strings are copied aside since the
+ * buffer is reused between messages.
+ */
+static inline int tiny_bits_packer_begin_session(tiny_bits_packer *encoder, uint32_t window) {
+    if (!encoder || !(encoder->features & TB_FEATURE_STRING_DEDUPE) || window < 1) return 0;
+    if (!encoder->strings) {
+        encoder->strings_capacity = 1024;
+        encoder->strings = (unsigned char *)_tb_alloc(encoder->allocator, encoder->strings_capacity);
+        if (!encoder->strings) return 0;
+    }
+    _packer_clear_strings(encoder);
+    encoder->session_window = window;
+    return 1;
+}
+
+/**
+ * @brief Makes the packer stream its output through a callback instead of growing its buffer
+ * 
+ * @param encoder The packer instance
+ * @param flush Called with the packed bytes whenever the buffer is full (and by tiny_bits_packer_flush()),
+ *              NULL turns streaming off
+ * @param context Passed to flush
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer. The buffer keeps the capacity the packer was created with and is
+ * only written out between values, so output of any size is packed in constant memory, except for single values
+ * (or containers started by pack_arr_begin()/pack_map_begin(), which stay in the buffer until ended) larger than
+ * the buffer. Deduplicated strings are copied aside as in a session. Call tiny_bits_packer_flush() once done.
+ */
+static inline int tiny_bits_packer_set_flush(tiny_bits_packer *encoder, tiny_bits_flush_fn flush, void *context) {
+    if (!encoder) return 0;
+    if (flush && (encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->strings) {
+        encoder->strings_capacity = 1024;
+        encoder->strings = (unsigned char *)_tb_alloc(encoder->allocator, encoder->strings_capacity);
+        if (!encoder->strings) return 0;
+        _packer_clear_strings(encoder);
+    }
+    encoder->flush = flush;
+    encoder->flush_context = context;
+    encoder->flushed = 0;
+    return 1;
+}
+
+/**
+ * @brief Hands the packed bytes to the flush callback and empties the buffer
+ * 
+ * @param encoder The packer instance, with a flush callback set
+ * @return 1 on success, 0 on error (no callback, the callback failed, or a container started by
+ *         pack_arr_begin()/pack_map_begin() is still open)
+ *
+ * @note Deduplicated strings stay registered, later strings may reference the flushed ones. Payloads packed by
+ * reference (see pack_blob_ref()) are passed to the callback as they are, between the buffer bytes around them.
+ */
+static inline int tiny_bits_packer_flush(tiny_bits_packer *encoder) {
+    if (!encoder || !encoder->flush || encoder->deferred_open) return 0;
+    // payloads packed by reference go out between the buffer bytes around them
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        if (ref->pos > start && !encoder->flush(encoder->flush_context, encoder->buffer + start, ref->pos - start)) return 0;
+        if (!encoder->flush(encoder->flush_context, (const uint8_t *)ref->data, ref->size)) return 0;
+        encoder->flushed += ref->pos - start + ref->size;
+        start = ref->pos;
+    }
+    if (encoder->current_pos > start) {
+        if (!encoder->flush(encoder->flush_context, encoder->buffer + start, encoder->current_pos - start)) return 0;
+        encoder->flushed += encoder->current_pos - start;
+    }
+    encoder->current_pos = 0;
+    encoder->refs_count = 0;
+    encoder->refs_size = 0;
+    return 1;
+}
+
+static inline int _packer_discard(void *context, const uint8_t *data, size_t size) {
+    (void)context;
+    (void)data;
+    (void)size;
+    return 1;
+}
+
+/**
+ * @brief Makes the packer measure messages instead of keeping them
+ * 
+ * @param encoder The packer instance, created with the features of the packer the message is meant for
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh packer. The same encoding runs (float compression, deduplication), but the bytes
+ * are dropped as the buffer fills and large payloads are never copied, tiny_bits_packer_measured() then gives
+ * the size of the buffer the message needs. A packer created with that capacity packs the message without
+ * growing its buffer.
+ * tiny_bits_packer_reset() starts the next measure.
+ */
+static inline int tiny_bits_packer_set_measure(tiny_bits_packer *encoder) {
+    if (!encoder || encoder->flush || encoder->current_pos) return 0;
+    if (!tiny_bits_packer_set_flush(encoder, _packer_discard, NULL)) return 0;
+    encoder->measuring = 1;
+    return 1;
+}
+
+/**
+ * @brief Size of the message packed since the last reset by a measuring packer
+ * 
+ * @param encoder The packer instance, see tiny_bits_packer_set_measure()
+ * @return Number of bytes
+ *
+ * @note Containers started with pack_arr_begin() or pack_map_begin() hold a 6 byte header until they end, and
+ * only then shrink it. The buffer has to hold it meanwhile, so up to 5 bytes more than the message are counted
+ * for each of those.
+ */
+static inline size_t tiny_bits_packer_measured(tiny_bits_packer *encoder) {
+    if (!encoder) return 0;
+    size_t size = encoder->flushed + encoder->current_pos + encoder->refs_size;
+    return size > encoder->measured_peak ? size : encoder->measured_peak;
+}
+
+#if defined(TB_WITH_POOL)
+/**
+ * @brief Makes the packer borrow its buffer from a shared pool
+ * 
+ * @param encoder The packer instance
+ * @param pool The pool, shared by any number of packers and threads
+ * @param keep_capacity Buffer size the packer keeps across resets, a buffer grown beyond it for a large
+ *                      message goes back to the pool on tiny_bits_packer_reset() (and on destroy)
+ * @return 1 on success, 0 on error
+ *
+ * @note Call this on a fresh (or reset) packer. Buffers come in power of two size classes, so growing
+ * doubles the buffer. The pool must outlive the packer. Only there when TB_WITH_POOL is defined.
+ */
+static inline int tiny_bits_packer_set_pool(tiny_bits_packer *encoder, tiny_bits_buffer_pool *pool, size_t keep_capacity) {
+    if (!encoder || !pool || encoder->pool || encoder->current_pos) return 0;
+    size_t capacity;
+    unsigned char *buffer = (unsigned char *)tiny_bits_pool_acquire(pool, keep_capacity, &capacity);
+    if (!buffer) return 0;
+    _tb_free(encoder->allocator, encoder->buffer);
+    encoder->buffer = buffer;
+    encoder->capacity = capacity;
+    encoder->pool = pool;
+    encoder->pool_keep = capacity;
+    return 1;
+}
+#endif // TB_WITH_POOL
+
+/**
+ * @brief Sets how many distinct strings the packer deduplicates per message
+ * 
+ * @param encoder The packer instance
+ * @param max_entries Maximum number of strings in the dedupe table, the table grows up to it as needed
+ * @param policy What happens once the table is full, TB_DEDUPE_POLICY_STOP (send new strings inline
+ *               without registering them) or TB_DEDUPE_POLICY_LRU (forget the least recently used ones)
+ * @return 1 on success, 0 on error
+ *
+ * @note The default is TB_HASH_CACHE_SIZE (256) entries with TB_DEDUPE_POLICY_STOP, the only setting older
+ * unpackers (limited to 256 strings) can decode. This clears the table, call it between messages.
+ */
+static inline int tiny_bits_packer_set_dedupe_limit(tiny_bits_packer *encoder, uint32_t max_entries, uint8_t policy) {
+    if (!encoder || !(encoder->features & TB_FEATURE_STRING_DEDUPE) || max_entries < 1) return 0;
+    HashTable table;
+    uint32_t initial = max_entries < TB_HASH_CACHE_SIZE ? max_entries : TB_HASH_CACHE_SIZE;
+    if (!hash_table_init_with(&table, initial, max_entries, policy, encoder->allocator)) return 0;
+    hash_table_free(&encoder->encode_table);
+    encoder->encode_table = table;
+    return 1;
 }
 
 /**
@@ -97,10 +398,18 @@ void tiny_bits_packer_destroy(tiny_bits_packer *encoder) {
     if (!encoder) return;
     
     if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
-        free(encoder->encode_table.cache);
+        hash_table_free(&encoder->encode_table);
     }
-    free(encoder->buffer);
-    free(encoder);
+    _tb_free(encoder->allocator, encoder->strings);
+    _tb_free(encoder->allocator, encoder->refs);
+#if defined(TB_WITH_POOL)
+    if (encoder->pool) {
+        tiny_bits_pool_release(encoder->pool, encoder->buffer, encoder->capacity);
+        encoder->buffer = NULL;
+    }
+#endif
+    _tb_free(encoder->allocator, encoder->buffer);
+    _tb_free(encoder->allocator, encoder);
 }
 
 /**
@@ -171,41 +480,168 @@ static inline int pack_map(tiny_bits_packer *encoder, int map_len){
     return written;
 }
 
+// Reserves a container header with a 4 byte count (tag, varint prefix 251 and 4 bytes), see pack_arr_begin()
+static inline int _pack_deferred_begin(tiny_bits_packer *encoder, uint8_t tag, size_t *mark){
+    if (encoder && encoder->flush && !encoder->deferred_open && encoder->current_pos > encoder->capacity / 2) {
+        // the container stays in the buffer until ended, give it room
+        if (!tiny_bits_packer_flush(encoder)) return 0;
+    }
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, TB_DEFERRED_HEADER_SIZE);
+    if (!buffer || !mark) return 0;
+    *mark = encoder->current_pos;
+    buffer[0] = tag;
+    buffer[1] = 251;
+    encoder->current_pos += TB_DEFERRED_HEADER_SIZE;
+    encoder->deferred_open++;
+    return TB_DEFERRED_HEADER_SIZE;
+}
+
+// Patches the header reserved at mark with the count, shrinking it to its smallest form when the body is short
+static inline int _pack_deferred_end(tiny_bits_packer *encoder, uint8_t tag, uint8_t embedded_len, size_t mark, uint32_t count){
+    if (!encoder || mark + TB_DEFERRED_HEADER_SIZE > encoder->current_pos) return 0;
+    uint8_t *header = encoder->buffer + mark;
+    if (header[0] != (tag | embedded_len) || header[1] != 251 || !encoder->deferred_open) return 0; // not a reserved header
+    encoder->deferred_open--;
+    if (encoder->measuring) {
+        // the real buffer holds the whole header until here
+        size_t held = encoder->flushed + encoder->current_pos + encoder->refs_size;
+        if (held > encoder->measured_peak) encoder->measured_peak = held;
+    }
+    size_t body = mark + TB_DEFERRED_HEADER_SIZE;
+    size_t body_size = encoder->current_pos - body;
+    if (body_size > TB_DEFERRED_SHIFT_LIMIT && count >= embedded_len) {
+        // too long to move, keep the 4 byte count (a longer varint than needed decodes all the same)
+        uint32_t value = count - embedded_len;
+        header[2] = (uint8_t)(value >> 24);
+        header[3] = (uint8_t)(value >> 16);
+        header[4] = (uint8_t)(value >> 8);
+        header[5] = (uint8_t)value;
+        return TB_DEFERRED_HEADER_SIZE;
+    }
+    uint8_t compact[TB_DEFERRED_HEADER_SIZE];
+    int header_size = 1;
+    if (count < embedded_len) {
+        compact[0] = tag | (uint8_t)count;
+    } else {
+        compact[0] = tag | embedded_len;
+        header_size += encode_varint((uint64_t)(count - embedded_len), compact + 1);
+    }
+    size_t shift = TB_DEFERRED_HEADER_SIZE - header_size;
+    memcpy(header, compact, header_size);
+    if (shift) {
+        memmove(header + header_size, header + TB_DEFERRED_HEADER_SIZE, body_size);
+        encoder->current_pos -= shift;
+        // deduplicated strings in the body moved with it
+        if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->strings) {
+            HashTable *table = &encoder->encode_table;
+            for (uint32_t i = 0; i < table->cache_pos; i++) {
+                if (table->cache[i].offset >= body) table->cache[i].offset -= (uint32_t)shift;
+            }
+        }
+        for (uint32_t i = encoder->refs_count; i > 0 && encoder->refs[i - 1].pos >= body; i--) {
+            encoder->refs[i - 1].pos -= shift;
+        }
+    }
+    return header_size;
+}
+
 /**
- * @brief Packs an integer value into the buffer
- * 
+ * @brief Starts an array whose length is only known once its elements are packed
+ *
  * @param encoder Pointer to the packer instance
- * @param value The integer value to pack
+ * @param mark Set to the position of the header, to pass to pack_arr_end()
  * @return Number of bytes written, or 0 on error
- * 
- * @note Uses a compact representation for small values and SQLite4 like integer encoding for larger values
+ *
+ * @note A 6 byte header is reserved, pack_arr_end() writes the length into it. Containers started this way
+ * must be ended in reverse order, an inner one before the one holding it.
  */
-static inline int pack_int(tiny_bits_packer *encoder, int64_t value){
-    int written = 0;
-    int needed_size = 10;
-    uint8_t *buffer;
-    buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
-    if (!buffer) return 0; // Handle error
-    //printf("value is %ld\n", value);
+static inline int pack_arr_begin(tiny_bits_packer *encoder, size_t *mark){
+    return _pack_deferred_begin(encoder, TB_ARR_TAG | TB_ARR_LEN, mark);
+}
+
+/**
+ * @brief Ends an array started with pack_arr_begin()
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark The position set by pack_arr_begin()
+ * @param arr_len Number of elements packed since
+ * @return Size of the header as finally written, or 0 on error
+ *
+ * @note Unless the elements take more than TB_DEFERRED_SHIFT_LIMIT bytes, they are moved back so the header
+ * takes the same bytes as with pack_arr(). Longer arrays keep the reserved header.
+ */
+static inline int pack_arr_end(tiny_bits_packer *encoder, size_t mark, uint32_t arr_len){
+    return _pack_deferred_end(encoder, TB_ARR_TAG, TB_ARR_LEN, mark, arr_len);
+}
+
+/**
+ * @brief Starts a map whose length is only known once its key-value pairs are packed
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark Set to the position of the header, to pass to pack_map_end()
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note See pack_arr_begin()
+ */
+static inline int pack_map_begin(tiny_bits_packer *encoder, size_t *mark){
+    return _pack_deferred_begin(encoder, TB_MAP_TAG | TB_MAP_LEN, mark);
+}
+
+/**
+ * @brief Ends a map started with pack_map_begin()
+ *
+ * @param encoder Pointer to the packer instance
+ * @param mark The position set by pack_map_begin()
+ * @param map_len Number of key-value pairs packed since
+ * @return Size of the header as finally written, or 0 on error
+ *
+ * @note See pack_arr_end()
+ */
+static inline int pack_map_end(tiny_bits_packer *encoder, size_t mark, uint32_t map_len){
+    return _pack_deferred_end(encoder, TB_MAP_TAG, TB_MAP_LEN, mark, map_len);
+}
 
+static inline int _encode_int(uint8_t *buffer, int64_t value){
     if (value >= 0 && value < 120) {
         buffer[0] = (uint8_t)(TB_INT_TAG | value);  // No continuation
-        //printf("value is %ld, wrote to buffer %x\n", value, buffer[0]);
-        encoder->current_pos += 1;
         return 1;
     } else if (value >= 120) {
         buffer[0] = 248;  // Tag for positive with continuation
         value -= 120;
     } else if (value > -7) {
         buffer[0] = (uint8_t)(248 + (-value));  // No continuation
-        encoder->current_pos += 1;
         return 1;
     } else {
         buffer[0] = 255;  // Tag for negative with continuation
         value = -(value + 7);  // Store positive magnitude
     }
     // Encode continuation bytes in BER format (7 bits per byte)
-    written += encode_varint(value, buffer + 1) + 1 ;
+    return encode_varint(value, buffer + 1) + 1;
+}
+
+// Number of bytes _encode_int() writes for value
+static inline int _int_size(int64_t value){
+    if (value >= 0 && value < 120) return 1;
+    if (value >= 120) return 1 + varint_size((uint64_t)value - 120);
+    if (value > -7) return 1;
+    return 1 + varint_size((uint64_t)-(value + 7));
+}
+
+/**
+ * @brief Packs an integer value into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param value The integer value to pack
+ * @return Number of bytes written, or 0 on error
+ * 
+ * @note Uses a compact representation for small values and SQLite4 like integer encoding for larger values
+ */
+static inline int pack_int(tiny_bits_packer *encoder, int64_t value){
+    int written = 0;
+    uint8_t *buffer;
+    buffer = tiny_bits_packer_ensure_capacity(encoder, _int_size(value));
+    if (!buffer) return 0; // Handle error
+    written = _encode_int(buffer, value);
     encoder->current_pos += written;
     return written;
 }
@@ -289,6 +725,107 @@ static inline int pack_negative_infinity(tiny_bits_packer *encoder){
     return _pack_tag_only(encoder, (uint8_t)TB_NNF_TAG);
 }
 
+// Writes the header of a payload packed by reference and records where the caller's bytes go
+static inline int _pack_ref(tiny_bits_packer *encoder, uint8_t tag, uint8_t embedded_len, const void *data, size_t size){
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 1 + varint_size((uint64_t)(size - embedded_len)));
+    if (!buffer) return 0;
+    if (!encoder->measuring && encoder->refs_count == encoder->refs_capacity) {
+        uint32_t new_capacity = encoder->refs_capacity ? encoder->refs_capacity * 2 : 16;
+        tiny_bits_ref *new_refs = (tiny_bits_ref *)_tb_realloc(encoder->allocator, encoder->refs, new_capacity * sizeof(tiny_bits_ref));
+        if (!new_refs) return 0;
+        encoder->refs = new_refs;
+        encoder->refs_capacity = new_capacity;
+    }
+    buffer[0] = tag | embedded_len;
+    int written = 1 + encode_varint((uint64_t)(size - embedded_len), buffer + 1);
+    encoder->current_pos += written;
+    if (encoder->measuring) {
+        encoder->flushed += size; // counted, never copied
+        return written + (int)size;
+    }
+    tiny_bits_ref *ref = &encoder->refs[encoder->refs_count++];
+    ref->pos = encoder->current_pos;
+    ref->data = data;
+    ref->size = size;
+    encoder->refs_size += size;
+    return written + (int)size;
+}
+
+/**
+ * @brief Number of bytes pack_str() writes for a string of str_len bytes sent inline
+ *
+ * @note A deduplicated string takes less, measure the message (see tiny_bits_packer_set_measure()) to account
+ * for deduplication
+ */
+static inline size_t tiny_bits_size_of_str(uint32_t str_len){
+    return (str_len < TB_STR_LEN ? 1 : 1 + varint_size(str_len - TB_STR_LEN)) + (size_t)str_len;
+}
+
+// Looks a string up in the dictionary, then in the dedupe table. Returns 1 and sets id when found, the hash code
+// is set whenever the string may be registered.
+static inline int _packer_find_str(tiny_bits_packer *encoder, const char *str, uint32_t str_len, uint32_t *id, uint32_t *hash_code) {
+    uint32_t dictionary_size = encoder->dictionary.next_id;
+    if (((encoder->features & TB_FEATURE_STRING_DEDUPE) || dictionary_size) && str_len >= 2 && str_len <= 128) {
+        *hash_code = string_hash_32(str, str_len);
+        HashEntry *entry = NULL;
+        if (dictionary_size) {
+            entry = hash_table_lookup(&encoder->dictionary, (const unsigned char *)encoder->dictionary_data, 
+                                      str, str_len, *hash_code);
+            if (entry) {
+                *id = entry->id;
+                return 1;
+            }
+        }
+        if (encoder->features & TB_FEATURE_STRING_DEDUPE) {
+            const unsigned char *base = encoder->strings ? encoder->strings : encoder->buffer;
+            entry = hash_table_lookup(&encoder->encode_table, base, str, str_len, *hash_code);
+            if (entry) {
+                // message strings are numbered after the dictionary ones
+                *id = dictionary_size + entry->id;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Writes the id of a deduplicated string
+static inline int _encode_str_id(uint8_t *buffer, uint32_t id) {
+    if (id < TB_REF_LEN) {
+        buffer[0] = TB_REF_TAG | id;
+        return 1;
+    }
+    buffer[0] = TB_REF_TAG | TB_REF_LEN;
+    return 1 + encode_varint(id - TB_REF_LEN, buffer + 1);
+}
+
+// Writes a string inline, header and bytes
+static inline int _encode_str(uint8_t *buffer, const char *str, uint32_t str_len) {
+    if (str_len < TB_STR_LEN) {
+        buffer[0] = TB_STR_TAG | str_len;
+        fast_memcpy(buffer + 1, str, str_len);
+        return 1 + str_len;
+    }
+    buffer[0] = TB_STR_TAG | TB_STR_LEN;
+    int written = 1 + encode_varint(str_len - TB_STR_LEN, buffer + 1);
+    memcpy(buffer + written, str, str_len);
+    return written + str_len;
+}
+
+// Registers a string just written inline at buffer position pos, copying it aside when strings is set (the caller
+// makes room for it there)
+static inline void _packer_keep_str(tiny_bits_packer *encoder, uint32_t hash_code, const char *str, uint32_t str_len, size_t pos) {
+    if (encoder->strings) {
+        uint32_t offset = encoder->strings_size;
+        if (hash_table_insert(&encoder->encode_table, hash_code, str_len, offset)) {
+            memcpy(encoder->strings + offset, str, str_len);
+            encoder->strings_size += str_len;
+        }
+    } else {
+        hash_table_insert(&encoder->encode_table, hash_code, str_len, (uint32_t)pos);
+    }
+}
+
 /**
  * @brief Packs a string into the buffer
  * 
@@ -301,114 +838,73 @@ static inline int pack_negative_infinity(tiny_bits_packer *encoder){
  */
 static inline int pack_str(tiny_bits_packer *encoder, char* str, uint32_t str_len) {
     uint32_t id = 0;
-    int found = 0;
+    uint32_t hash_code = 0;
     int written = 0;
-    int needed_size = 0;
+    int written_reset = 0;
     uint8_t *buffer;
-    uint32_t hash_code = 0;
-    uint32_t hash = 0;
-    if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128) {
-        hash_code = fast_hash_32(str, str_len);
-        hash = hash_code % TB_HASH_SIZE;
-        uint8_t index = encoder->encode_table.bins[hash];
-        while (index > 0) {
-            HashEntry entry = encoder->encode_table.cache[index - 1];
-            if (hash_code == entry.hash 
-                && str_len == entry.length
-                && fast_memcmp(str, encoder->buffer + entry.offset, str_len) == 0 ) {
-                id = index - 1;
-                found = 1;
-                break;
-            }
-            index = entry.next_index;
-        }
-    }
 
-    if (found) {
+    if (_packer_find_str(encoder, str, str_len, &id, &hash_code)) {
         // Encode existing string ID
-        if (id < 31) {
-            needed_size = 1;
-        } else {
-            needed_size = 1 + varint_size(id - 31);
-        }
-        buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
+        buffer = tiny_bits_packer_ensure_capacity(encoder, id < TB_REF_LEN ? 1 : 1 + varint_size(id - TB_REF_LEN));
         if (!buffer) return 0;
-
-        if (id < TB_REF_LEN) {
-            buffer[0] = TB_REF_TAG | id;
-            written = 1;
-        } else {
-            buffer[0] = TB_REF_TAG | TB_REF_LEN;
-            written = 1;
-            written += encode_varint(id - TB_REF_LEN, buffer + written);
-        }
+        written = _encode_str_id(buffer, id);
     } else {
-       needed_size = 10 + str_len;
-        buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
-        if (!buffer) return 0;
-
-        if (str_len < TB_STR_LEN) {
-            buffer[0] = TB_STR_TAG | str_len;
-            written = 1;
-            fast_memcpy(buffer + written, str, str_len);
-            written += str_len;
-        } else {
-            buffer[0] = TB_STR_TAG | TB_STR_LEN;
-            written = 1;
-            written += encode_varint(str_len - TB_STR_LEN, buffer + written);
-            memcpy(buffer + written, str, str_len);
-            written += str_len;
+        int keep = (encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128;
+        if (keep && encoder->strings) {
+            HashTable *table = &encoder->encode_table;
+            if (encoder->flush && !encoder->measuring && encoder->strings_size + str_len > encoder->strings_capacity
+                && table->policy == TB_DEDUPE_POLICY_LRU && table->cache_pos >= table->cache_limit) {
+                // a streaming packer never resets on its own, start over instead of keeping evicted strings
+                if (!pack_strings_reset(encoder)) return 0;
+                written_reset = 2;
+            }
+            // copy aside first, failing here leaves the packer untouched
+            if (encoder->strings_size + str_len > encoder->strings_capacity) {
+                size_t new_capacity = encoder->strings_capacity + str_len + encoder->strings_capacity;
+                unsigned char *new_strings = (unsigned char *)_tb_realloc(encoder->allocator, encoder->strings, new_capacity);
+                if (!new_strings) return 0;
+                encoder->strings = new_strings;
+                encoder->strings_capacity = new_capacity;
+            }
         }
-        
-        if ((encoder->features & TB_FEATURE_STRING_DEDUPE) 
-            && encoder->encode_table.cache_pos < TB_HASH_CACHE_SIZE
-            && str_len >= 2 && str_len <= 128){ 
-            HashEntry* new_entry = &encoder->encode_table.cache[encoder->encode_table.cache_pos++];
-            new_entry->hash = hash_code; 
-            new_entry->length = str_len;
-            new_entry->offset = encoder->current_pos + written - str_len;
-            new_entry->next_index = encoder->encode_table.bins[hash];
-            encoder->encode_table.bins[hash] = encoder->encode_table.cache_pos;
+        if (!keep && encoder->measuring && !encoder->deferred_open && str_len >= TB_REF_MIN_SIZE) {
+            return _pack_ref(encoder, TB_STR_TAG, TB_STR_LEN, str, str_len); // only counted
         }
-
+        buffer = tiny_bits_packer_ensure_capacity(encoder, tiny_bits_size_of_str(str_len));
+        if (!buffer) return 0;
+        written = _encode_str(buffer, str, str_len);
+        if (keep) _packer_keep_str(encoder, hash_code, str, str_len, encoder->current_pos + written - str_len);
     }
 
     encoder->current_pos += written;
-    return written;
+    return written + written_reset;
 }
 
-/**
- * @brief Packs a double-precision floating point value into the buffer
- * 
- * @param encoder Pointer to the packer instance
- * @param val The double value to pack
- * @return Number of bytes written, or 0 on error
- * 
- * @note If TB_FEATURE_COMPRESS_FLOATS is enabled, this will use a more compact representation for some values
- */
-static inline int pack_double(tiny_bits_packer *encoder, double val) {
+// Same as _encode_double() given the decimal places of the value, see decimal_places_count()
+static inline int _encode_double_places(uint8_t *buffer, double val, uint8_t features, int multiplies, double scaled) {
     int written = 0;
-    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 10);
-    if (!buffer) return 0;
     if(isnan(val)){
-      return pack_nan(encoder);
+      buffer[0] = TB_NAN_TAG;
+      return 1;
     } 
     if(isinf(val)){
-      if(val > 0){
-        return pack_infinity(encoder);
-      } else {
-        return pack_negative_infinity(encoder);
-      }
+      buffer[0] = val > 0 ? TB_INF_TAG : TB_NNF_TAG;
+      return 1;
+    }
+    // narrower IEEE 754 formats, only when they hold the exact same value
+    int narrow_size = 9;
+    float narrow_float = 0;
+    uint16_t narrow_half = 0;
+    if (features & TB_FEATURE_NARROW_FLOATS) {
+        if (double_to_float_exact(val, &narrow_float)) {
+            narrow_size = float_to_half_exact(narrow_float, &narrow_half) ? 3 : 5;
+        }
     }
     // scaled varint encoding
-    if (encoder->features & TB_FEATURE_COMPRESS_FLOATS) {
-        double abs_val = fabs(val); ///val >= 0 ? val : -val;
-        double scaled; //= abs_val;
-        int multiplies = decimal_places_count(abs_val, &scaled);
+    if (features & TB_FEATURE_COMPRESS_FLOATS) {
         if(multiplies >= 0){
             uint64_t integer = (uint64_t)scaled;
             if(integer < (1ULL << 48)) {
-                if (!buffer) return 0;
                 if(val >= 0){
                     buffer[0] = TB_PFP_TAG | (multiplies);
                 } else {
@@ -416,21 +912,229 @@ static inline int pack_double(tiny_bits_packer *encoder, double val) {
                 }
                 written++;
                 written += encode_varint(integer, buffer + written);
-                encoder->current_pos += written;
-                return written;
+                if (written <= narrow_size) return written;
             }
         }
 
     }
+    if (narrow_size == 3) {
+        buffer[0] = TB_F16_TAG;
+        buffer[1] = (uint8_t)(narrow_half >> 8);
+        buffer[2] = (uint8_t)narrow_half;
+        return 3;
+    }
+    if (narrow_size == 5) {
+        uint32_t bits;
+        memcpy(&bits, &narrow_float, 4);
+        buffer[0] = TB_F32_TAG;
+        buffer[1] = (uint8_t)(bits >> 24);
+        buffer[2] = (uint8_t)(bits >> 16);
+        buffer[3] = (uint8_t)(bits >> 8);
+        buffer[4] = (uint8_t)bits;
+        return 5;
+    }
     // Fallback to raw double
     buffer[0] = TB_F64_TAG;
-    written++;
+    written = 1;
     encode_uint64(dtoi_bits(val), buffer + written);
     written += 8;
+    return written;
+}
+
+// Same as _encode_double(), trying the decimal places in *places first and leaving those of val there
+static inline int _encode_double_near(uint8_t *buffer, double val, uint8_t features, int8_t *places) {
+    double scaled = 0;
+    int multiplies = -1;
+    if ((features & TB_FEATURE_COMPRESS_FLOATS) && isfinite(val)) {
+        multiplies = decimal_places_count_near(fabs(val), *places, &scaled);
+        *places = (int8_t)multiplies;
+    }
+    return _encode_double_places(buffer, val, features, multiplies, scaled);
+}
+
+// Writes a double (tag and payload), the caller reserves 10 bytes
+static inline int _encode_double(uint8_t *buffer, double val, uint8_t features) {
+    int8_t places = -1;
+    return _encode_double_near(buffer, val, features, &places);
+}
+
+/**
+ * @brief Packs a double-precision floating point value into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param val The double value to pack
+ * @return Number of bytes written, or 0 on error
+ * 
+ * @note If TB_FEATURE_COMPRESS_FLOATS is enabled, this will use a more compact representation for some values
+ * @note If TB_FEATURE_NARROW_FLOATS is enabled, values a float (or a half) holds exactly are packed as such,
+ * in 5 (or 3) bytes instead of 9. The smallest lossless form is used when both features are enabled.
+ */
+static inline int pack_double(tiny_bits_packer *encoder, double val) {
+    int written = 0;
+    uint8_t scratch[10];
+    if (!encoder) return 0;
+    if (encoder->capacity - encoder->current_pos < 10) {
+        // near the end of the buffer reserve only what the value takes, a buffer sized by measuring never grows
+        written = _encode_double_near(scratch, val, encoder->features, &encoder->float_places);
+        uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, written);
+        if (!buffer) return 0;
+        memcpy(buffer, scratch, written);
+    } else {
+        written = _encode_double_near(encoder->buffer + encoder->current_pos, val, encoder->features,
+                                      &encoder->float_places);
+    }
     encoder->current_pos += written;
     return written;
 }
 
+// Writes an array header, the caller reserves 10 bytes
+static inline int _encode_arr_header(uint8_t *buffer, size_t arr_len){
+    if(arr_len < TB_ARR_LEN){
+      buffer[0] = TB_ARR_TAG | arr_len;
+      return 1;
+    }
+    buffer[0] = TB_ARR_TAG | TB_ARR_LEN;
+    return 1 + encode_varint((uint64_t)(arr_len - TB_ARR_LEN), buffer + 1);
+}
+
+// Writes integers as pack_int() does, the caller reserves 10 bytes per value
+static inline size_t _encode_int_values(uint8_t *buffer, const int64_t *values, size_t count){
+    size_t written = 0;
+    size_t blocks = count & ~(size_t)7;
+    size_t i = 0;
+    for (; i < blocks; i += 8) {
+        const int64_t *v = values + i;
+        // branchless check, compiles to a vector compare
+        int small = ((uint64_t)v[0] < 120) & ((uint64_t)v[1] < 120) & ((uint64_t)v[2] < 120) & ((uint64_t)v[3] < 120)
+                  & ((uint64_t)v[4] < 120) & ((uint64_t)v[5] < 120) & ((uint64_t)v[6] < 120) & ((uint64_t)v[7] < 120);
+        if (small) {
+            for (int j = 0; j < 8; j++) buffer[written + j] = (uint8_t)(TB_INT_TAG | v[j]);
+            written += 8;
+        } else {
+            for (int j = 0; j < 8; j++) written += _encode_int(buffer + written, v[j]);
+        }
+    }
+    for (; i < count; i++) {
+        written += _encode_int(buffer + written, values[i]);
+    }
+    return written;
+}
+
+// Writes doubles as pack_double() does, the caller reserves 10 bytes per value
+static inline size_t _encode_double_values(uint8_t *buffer, const double *values, size_t count, uint8_t features){
+    size_t written = 0;
+    if (!(features & TB_FEATURE_COMPRESS_FLOATS)) {
+        for (size_t i = 0; i < count; i++) {
+            written += _encode_double(buffer + written, values[i], features);
+        }
+        return written;
+    }
+    // decimal places are found a chunk at a time
+    double abs_vals[64], scaled[64];
+    int8_t places[64];
+    for (size_t start = 0; start < count; start += 64) {
+        size_t n = count - start < 64 ? count - start : 64;
+        for (size_t i = 0; i < n; i++) abs_vals[i] = fabs(values[start + i]);
+        decimal_places_count_batch(abs_vals, n, places, scaled);
+        for (size_t i = 0; i < n; i++) {
+            written += _encode_double_places(buffer + written, values[start + i], features, places[i], scaled[i]);
+        }
+    }
+    return written;
+}
+
+// Number of bytes _encode_int_values() writes
+static inline size_t _int_values_size(const int64_t *values, size_t count){
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) size += _int_size(values[i]);
+    return size;
+}
+
+// Number of bytes _encode_double_values() writes, found by encoding a chunk at a time
+static inline size_t _double_values_size(const double *values, size_t count, uint8_t features){
+    uint8_t scratch[64 * 10];
+    size_t size = 0;
+    for (size_t start = 0; start < count; start += 64) {
+        size += _encode_double_values(scratch, values + start, count - start < 64 ? count - start : 64, features);
+    }
+    return size;
+}
+
+// Number of array elements reserved at once: all of them, unless a streaming packer's buffer can't hold them
+static inline size_t _packer_slice(tiny_bits_packer *encoder, size_t count){
+    if (!encoder->flush || 10 + count * 10 <= encoder->capacity) return count;
+    size_t slice = encoder->capacity > 20 ? (encoder->capacity - 10) / 10 : 1;
+    return slice < count ? slice : count;
+}
+
+static inline size_t tiny_bits_size_of_arr(size_t arr_len);
+
+// Shared by pack_int_array() and pack_double_array(), one of ints or doubles is set
+static inline int _pack_array_values(tiny_bits_packer *encoder, const int64_t *ints, const double *doubles, size_t count){
+    if (!encoder || (!ints && !doubles && count)) return 0;
+    if (count > (INT32_MAX - 10) / 10) return 0; // the byte count must fit the return value
+    uint8_t features = encoder->features;
+    size_t slice = _packer_slice(encoder, count);
+    size_t reserved = 10 + slice * 10;
+    size_t available = encoder->capacity - encoder->current_pos;
+    size_t header_size = tiny_bits_size_of_arr(count);
+    if (slice == count && reserved > available && header_size + count <= available) {
+        // the values may still fit, reserve what they take so that a buffer sized by measuring never grows
+        reserved = header_size + (ints ? _int_values_size(ints, count) : _double_values_size(doubles, count, features));
+    }
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, reserved);
+    if (!buffer) return 0; // Handle error
+
+    size_t header = _encode_arr_header(buffer, count);
+    encoder->current_pos += header;
+    size_t written = header;
+    for (size_t start = 0; start < count; start += slice) {
+        size_t n = count - start < slice ? count - start : slice;
+        if (start) {
+            // later slices of a streamed array, the buffer may be flushed in between
+            buffer = tiny_bits_packer_ensure_capacity(encoder, n * 10);
+            if (!buffer) return 0;
+        } else {
+            buffer += header;
+        }
+        size_t part = ints ? _encode_int_values(buffer, ints + start, n)
+                           : _encode_double_values(buffer, doubles + start, n, features);
+        encoder->current_pos += part;
+        written += part;
+    }
+    return (int)written;
+}
+
+/**
+ * @brief Packs an array of integers, same as pack_arr() followed by pack_int() for each element
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the integers
+ * @param count Number of integers
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note Space is reserved once for the whole array and runs of small positive integers
+ * (0-119, one byte each) are written eight at a time. A streaming packer reserves space for
+ * as many elements as its buffer holds at a time.
+ */
+static inline int pack_int_array(tiny_bits_packer *encoder, const int64_t *values, size_t count){
+    if (!values && count) return 0;
+    return _pack_array_values(encoder, values, NULL, count);
+}
+
+/**
+ * @brief Packs an array of doubles, same as pack_arr() followed by pack_double() for each element
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the doubles
+ * @param count Number of doubles
+ * @return Number of bytes written, or 0 on error
+ */
+static inline int pack_double_array(tiny_bits_packer *encoder, const double *values, size_t count){
+    if (!values && count) return 0;
+    return _pack_array_values(encoder, NULL, values, count);
+}
+
 /**
  * @brief Packs a unixtime double-precision floating point value, along with a time zone offset into the buffer
  * 
@@ -442,7 +1146,7 @@ static inline int pack_double(tiny_bits_packer *encoder, double val) {
  */
 static inline int pack_datetime(tiny_bits_packer *encoder, double val, int16_t offset) {
     int written = 0;
-    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 11);
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, 10);
     if (!buffer) return 0;
     buffer[0] = TB_DTM_TAG;
     buffer[1] = (int8_t) ((offset % 86400) / (60*15)); // convert seconds to multiples of 15 minutes
@@ -467,6 +1171,9 @@ static inline int pack_blob(tiny_bits_packer *encoder, const char* blob, int blo
     int needed_size;
     uint8_t *buffer;
 
+    if (encoder && encoder->measuring && !encoder->deferred_open && blob_size >= TB_REF_MIN_SIZE) {
+        return _pack_ref(encoder, TB_BLB_TAG, 0, blob, (size_t)blob_size); // only counted
+    }
     needed_size = 1 + varint_size((uint64_t)blob_size) + blob_size;
     buffer = tiny_bits_packer_ensure_capacity(encoder, needed_size);
     if (!buffer) return 0; // Handle error
@@ -480,4 +1187,439 @@ static inline int pack_blob(tiny_bits_packer *encoder, const char* blob, int blo
     return written;
 }
 
+/**
+ * @brief Packs a binary blob without copying it, only its header goes into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param blob Pointer to the binary data, it must stay valid and unchanged until the message is written out
+ * @param blob_size Size of the binary data in bytes
+ * @return Number of bytes the blob adds to the message, or 0 on error
+ *
+ * @note The message is then no longer the buffer alone, write it out with tiny_bits_packer_iovec() (or copy it
+ * with tiny_bits_packer_gather()). A streaming packer hands the blob to its flush callback as is. Blobs shorter
+ * than TB_REF_MIN_SIZE are copied, as by pack_blob().
+ */
+static inline int pack_blob_ref(tiny_bits_packer *encoder, const char* blob, int blob_size){
+    if (!encoder || blob_size < 0) return 0;
+    if (blob_size < TB_REF_MIN_SIZE) return pack_blob(encoder, blob, blob_size);
+    return _pack_ref(encoder, TB_BLB_TAG, 0, blob, (size_t)blob_size);
+}
+
+/**
+ * @brief Packs a string without copying it, only its header goes into the buffer
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param str Pointer to the string data, it must stay valid and unchanged until the message is written out
+ * @param str_len Length of the string in bytes
+ * @return Number of bytes the string adds to the message, or 0 on error
+ *
+ * @note Same as pack_blob_ref(). Strings shorter than TB_REF_MIN_SIZE are copied by pack_str(), longer ones are
+ * never deduplicated anyway.
+ */
+static inline int pack_str_ref(tiny_bits_packer *encoder, const char* str, uint32_t str_len){
+    if (!encoder) return 0;
+    if (str_len < TB_REF_MIN_SIZE) return pack_str(encoder, (char *)str, str_len);
+    return _pack_ref(encoder, TB_STR_TAG, TB_STR_LEN, str, str_len);
+}
+
+/**
+ * @brief Size of the packed message, including the payloads packed by reference
+ * 
+ * @param encoder The packer instance
+ * @return Number of bytes
+ */
+static inline size_t tiny_bits_packer_size(tiny_bits_packer *encoder) {
+    return encoder ? encoder->current_pos + encoder->refs_size : 0;
+}
+
+/**
+ * @brief Number of entries tiny_bits_packer_iovec() fills for the packed message
+ * 
+ * @param encoder The packer instance
+ * @return Number of entries, at most twice the number of payloads packed by reference plus one
+ */
+static inline int tiny_bits_packer_iovec_count(tiny_bits_packer *encoder) {
+    if (!encoder) return 0;
+    size_t last = encoder->refs_count ? encoder->refs[encoder->refs_count - 1].pos : 0;
+    return (int)encoder->refs_count * 2 + (encoder->current_pos > last);
+}
+
+// struct iovec comes from <sys/uio.h>, so tiny_bits_packer_iovec() is only there when TB_WITH_IOVEC is defined
+#if defined(TB_WITH_IOVEC)
+#include <sys/uio.h>
+
+/**
+ * @brief Describes the packed message as a list of segments for writev()/sendmsg()
+ * 
+ * @param encoder The packer instance
+ * @param iov Filled with the buffer slices and, between them, the payloads packed by reference
+ * @param iov_max Number of entries in iov, see tiny_bits_packer_iovec_count()
+ * @return Number of entries filled, or 0 on error (iov too small) or when nothing is packed
+ *
+ * @note The segments point into the buffer and the caller's data, they are valid until the packer is reset or
+ * packs again. writev() takes at most IOV_MAX (usually 1024) entries per call.
+ */
+static inline int tiny_bits_packer_iovec(tiny_bits_packer *encoder, struct iovec *iov, int iov_max) {
+    if (!encoder || !iov || tiny_bits_packer_iovec_count(encoder) > iov_max) return 0;
+    int count = 0;
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        // every payload follows its header, so no buffer slice is empty
+        iov[count].iov_base = encoder->buffer + start;
+        iov[count].iov_len = ref->pos - start;
+        iov[count + 1].iov_base = (void *)ref->data;
+        iov[count + 1].iov_len = ref->size;
+        count += 2;
+        start = ref->pos;
+    }
+    if (encoder->current_pos > start) {
+        iov[count].iov_base = encoder->buffer + start;
+        iov[count].iov_len = encoder->current_pos - start;
+        count++;
+    }
+    return count;
+}
+#endif // TB_WITH_IOVEC
+
+/**
+ * @brief Copies the packed message, including the payloads packed by reference, into one contiguous block
+ * 
+ * @param encoder The packer instance
+ * @param dest Destination, at least tiny_bits_packer_size() bytes
+ * @param dest_size Size of dest
+ * @return Number of bytes copied, or 0 on error (dest too small)
+ */
+static inline size_t tiny_bits_packer_gather(tiny_bits_packer *encoder, void *dest, size_t dest_size) {
+    size_t size = tiny_bits_packer_size(encoder);
+    if (!encoder || !dest || size > dest_size) return 0;
+    uint8_t *out = (uint8_t *)dest;
+    size_t start = 0;
+    for (uint32_t i = 0; i < encoder->refs_count; i++) {
+        tiny_bits_ref *ref = &encoder->refs[i];
+        memcpy(out, encoder->buffer + start, ref->pos - start);
+        out += ref->pos - start;
+        memcpy(out, ref->data, ref->size);
+        out += ref->size;
+        start = ref->pos;
+    }
+    memcpy(out, encoder->buffer + start, encoder->current_pos - start);
+    return size;
+}
+
+// Integer stored by a packed double array for value, see pack_packed_doubles()
+static inline int64_t _packed_double_to_int(double value, uint8_t scale) {
+    if (scale == TB_PACKED_RAW) return (int64_t)dtoi_bits(value);
+    double scaled = value * powers[scale];
+    return (int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// Writes a packed array: tag, subtag, count, [scale,] width, base, then each value minus base on width bits.
+// Either ints or doubles (converted with scale) are given.
+static inline int _pack_packed(tiny_bits_packer *encoder, uint8_t subtag, const int64_t *ints, const double *doubles,
+                               uint8_t scale, size_t count, int64_t base, uint8_t width){
+    size_t bits_size = (count * width + 7) / 8;
+    size_t header_size = 3 + (subtag == TB_NXT_PKD) + varint_size((uint64_t)count) + varint_size(zigzag_encode(base));
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, header_size + bits_size);
+    if (!buffer) return 0; // Handle error
+    // bits are OR-ed 8 bytes at a time, which takes 9 bytes of slack after them, else a byte at a time
+    int slack = encoder->capacity - encoder->current_pos >= header_size + bits_size + 9;
+
+    size_t written = 0;
+    buffer[written++] = TB_NXT_TAG;
+    buffer[written++] = subtag;
+    written += encode_varint((uint64_t)count, buffer + written);
+    if (subtag == TB_NXT_PKD) buffer[written++] = scale;
+    buffer[written++] = width;
+    written += encode_varint(zigzag_encode(base), buffer + written);
+
+    uint8_t *bits = buffer + written;
+    memset(bits, 0, bits_size + (slack ? 9 : 0));
+    if (width) {
+        size_t bit = 0;
+        for (size_t i = 0; i < count; i++, bit += width) {
+            int64_t value = ints ? ints[i] : _packed_double_to_int(doubles[i], scale);
+            uint64_t delta = (uint64_t)value - (uint64_t)base;
+            size_t pos = bit >> 3;
+            unsigned shift = bit & 7;
+            if (slack) {
+                _store_le64(bits + pos, _load_le64(bits + pos) | (delta << shift));
+                if (shift + width > 64) bits[pos + 8] |= (uint8_t)(delta >> (64 - shift));
+            } else {
+                unsigned bytes = (shift + width + 7) / 8;
+                uint64_t low = delta << shift;
+                for (unsigned k = 0; k < bytes && k < 8; k++) bits[pos + k] |= (uint8_t)(low >> (8 * k));
+                if (bytes > 8) bits[pos + 8] |= (uint8_t)(delta >> (64 - shift));
+            }
+        }
+    }
+    written += bits_size;
+    encoder->current_pos += written;
+    return (int)written;
+}
+
+/**
+ * @brief Packs an array of integers as a packed array: the smallest value followed by the
+ * difference of every value to it, all stored on the same (minimal) number of bits
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the integers
+ * @param count Number of integers
+ * @return Number of bytes written, or 0 on error
+ *
+ * @note The result is a single TINY_BITS_PACKED_INT value, not an array, unpackers must support
+ * packed arrays (see unpack_packed_ints() and unpack_int_array())
+ */
+static inline int pack_packed_ints(tiny_bits_packer *encoder, const int64_t *values, size_t count){
+    if (!encoder || (!values && count)) return 0;
+    if (count > (INT32_MAX - 64) / 8) return 0; // the byte count must fit the return value
+    int64_t min = count ? values[0] : 0;
+    int64_t max = min;
+    for (size_t i = 1; i < count; i++) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    uint8_t width = bit_width_64((uint64_t)max - (uint64_t)min);
+    return _pack_packed(encoder, TB_NXT_PKI, values, NULL, 0, count, min, width);
+}
+
+/**
+ * @brief Packs an array of doubles as a packed array
+ * 
+ * @param encoder Pointer to the packer instance
+ * @param values Pointer to the doubles
+ * @param count Number of doubles
+ * @return Number of bytes written, or 0 on error
+ *
+ * When every value has at most 12 decimal places, the values are scaled to integers by the same
+ * power of 10 and packed as in pack_packed_ints(). Otherwise their IEEE 754 bits are packed instead,
+ * which still saves the high bits shared by values of similar magnitude.
+ * Values always unpack to the exact same doubles.
+ *
+ * @note The result is a single TINY_BITS_PACKED_DOUBLE value, not an array, unpackers must support
+ * packed arrays (see unpack_packed_doubles() and unpack_double_array())
+ */
+static inline int pack_packed_doubles(tiny_bits_packer *encoder, const double *values, size_t count){
+    if (!encoder || (!values && count)) return 0;
+    if (count > (INT32_MAX - 64) / 8) return 0; // the byte count must fit the return value
+    // smallest power of 10 turning every value into an integer the unpacker divides back exactly
+    int scale = 0;
+    int64_t min = 0, max = 0;
+    for (size_t i = 0; i < count && scale >= 0; i++) {
+        if (!isfinite(values[i]) || (values[i] == 0 && signbit(values[i]))) { scale = -1; break; }
+        while (fabs(values[i] * powers[scale]) >= 9007199254740992.0 // 2^53
+               || (double)_packed_double_to_int(values[i], (uint8_t)scale) / powers[scale] != values[i]) {
+            if (++scale > 12) { scale = -1; break; }
+        }
+    }
+    // a larger scale is not always exact for the values checked before it was raised
+    for (size_t i = 0; i < count && scale >= 0; i++) {
+        if (fabs(values[i] * powers[scale]) >= 9007199254740992.0) { scale = -1; break; }
+        int64_t integer = _packed_double_to_int(values[i], (uint8_t)scale);
+        if ((double)integer / powers[scale] != values[i]) { scale = -1; break; }
+        if (i == 0 || integer < min) min = integer;
+        if (i == 0 || integer > max) max = integer;
+    }
+    if (scale < 0) {
+        scale = TB_PACKED_RAW;
+        for (size_t i = 0; i < count; i++) {
+            int64_t integer = _packed_double_to_int(values[i], TB_PACKED_RAW);
+            if (i == 0 || integer < min) min = integer;
+            if (i == 0 || integer > max) max = integer;
+        }
+    }
+    uint8_t width = bit_width_64((uint64_t)max - (uint64_t)min);
+    return _pack_packed(encoder, TB_NXT_PKD, NULL, values, (uint8_t)scale, count, min, width);
+}
+
+/**
+ * @brief Reserves room for values written with the put_*() functions, which don't check the room left
+ * 
+ * @param encoder The packer instance
+ * @param size Bytes reserved, at least what the values take (see tiny_bits_size_of_*()) or a bound of 10 bytes
+ *             per number or header, plus the length of strings and blobs
+ * @return Cursor to write at, pass it to the put_*() functions then to tiny_bits_packer_commit(), or NULL on error
+ *
+ * @note Nothing else may be packed until the cursor is committed. With deduplicated strings copied aside (in a
+ * session or when streaming) room is made for them as well, so put_str() never allocates.
+ */
+static inline uint8_t *tiny_bits_packer_reserve(tiny_bits_packer *encoder, size_t size) {
+    uint8_t *buffer = tiny_bits_packer_ensure_capacity(encoder, size);
+    if (!buffer) return NULL;
+    if (encoder->strings && encoder->strings_size + size > encoder->strings_capacity) {
+        size_t new_capacity = encoder->strings_capacity + size + encoder->strings_capacity;
+        unsigned char *new_strings = (unsigned char *)_tb_realloc(encoder->allocator, encoder->strings, new_capacity);
+        if (!new_strings) return NULL;
+        encoder->strings = new_strings;
+        encoder->strings_capacity = new_capacity;
+    }
+    return buffer;
+}
+
+/**
+ * @brief Ends writing with a cursor returned by tiny_bits_packer_reserve()
+ * 
+ * @param encoder The packer instance
+ * @param cursor The cursor, as advanced by the put_*() functions
+ * @return Number of bytes written since the reserve, or 0 on error (not a cursor into the reserved room)
+ */
+static inline int tiny_bits_packer_commit(tiny_bits_packer *encoder, uint8_t *cursor) {
+    if (!encoder || !cursor) return 0;
+    uint8_t *start = encoder->buffer + encoder->current_pos;
+    if (cursor < start || cursor > encoder->buffer + encoder->capacity) return 0;
+    encoder->current_pos += (size_t)(cursor - start);
+    return (int)(cursor - start);
+}
+
+/**
+ * @brief Writes an integer at cursor, as pack_int() does
+ * 
+ * @return The cursor past the integer
+ */
+static inline uint8_t *put_int(uint8_t *cursor, int64_t value){
+    return cursor + _encode_int(cursor, value);
+}
+
+/**
+ * @brief Writes a double at cursor, as pack_double() does with the given TB_FEATURE_* flags
+ * 
+ * @return The cursor past the double
+ */
+static inline uint8_t *put_double(uint8_t *cursor, double val, uint8_t features){
+    return cursor + _encode_double(cursor, val, features);
+}
+
+/**
+ * @brief Writes an array header at cursor, as pack_arr() does
+ * 
+ * @return The cursor past the header
+ */
+static inline uint8_t *put_arr(uint8_t *cursor, size_t arr_len){
+    return cursor + _encode_arr_header(cursor, arr_len);
+}
+
+/**
+ * @brief Writes a map header at cursor, as pack_map() does
+ * 
+ * @return The cursor past the header
+ */
+static inline uint8_t *put_map(uint8_t *cursor, size_t map_len){
+    if (map_len < TB_MAP_LEN) {
+        *cursor = TB_MAP_TAG | (uint8_t)map_len;
+        return cursor + 1;
+    }
+    *cursor = TB_MAP_TAG | TB_MAP_LEN;
+    return cursor + 1 + encode_varint((uint64_t)(map_len - TB_MAP_LEN), cursor + 1);
+}
+
+/**
+ * @brief Writes a null, true or false value at cursor
+ * 
+ * @return The cursor past the value
+ */
+static inline uint8_t *put_null(uint8_t *cursor){
+    *cursor = TB_NIL_TAG;
+    return cursor + 1;
+}
+
+static inline uint8_t *put_true(uint8_t *cursor){
+    *cursor = TB_TRU_TAG;
+    return cursor + 1;
+}
+
+static inline uint8_t *put_false(uint8_t *cursor){
+    *cursor = TB_FLS_TAG;
+    return cursor + 1;
+}
+
+/**
+ * @brief Writes a binary blob at cursor, as pack_blob() does
+ * 
+ * @return The cursor past the blob
+ */
+static inline uint8_t *put_blob(uint8_t *cursor, const char *blob, size_t blob_size){
+    *cursor = TB_BLB_TAG;
+    cursor += 1 + encode_varint((uint64_t)blob_size, cursor + 1);
+    memcpy(cursor, blob, blob_size);
+    return cursor + blob_size;
+}
+
+/**
+ * @brief Writes a string at cursor, as pack_str() does (deduplicated strings included)
+ * 
+ * @param encoder The packer the cursor was reserved from
+ * @return The cursor past the string
+ */
+static inline uint8_t *put_str(tiny_bits_packer *encoder, uint8_t *cursor, const char *str, uint32_t str_len){
+    uint32_t id = 0;
+    uint32_t hash_code = 0;
+    if (_packer_find_str(encoder, str, str_len, &id, &hash_code)) {
+        return cursor + _encode_str_id(cursor, id);
+    }
+    int written = _encode_str(cursor, str, str_len);
+    if ((encoder->features & TB_FEATURE_STRING_DEDUPE) && str_len >= 2 && str_len <= 128) {
+        _packer_keep_str(encoder, hash_code, str, str_len, (size_t)(cursor - encoder->buffer) + written - str_len);
+    }
+    return cursor + written;
+}
+
+/**
+ * @brief Number of bytes pack_int() writes for value
+ */
+static inline size_t tiny_bits_size_of_int(int64_t value){
+    return _int_size(value);
+}
+
+/**
+ * @brief Number of bytes pack_double() writes for val, with the given TB_FEATURE_* flags
+ *
+ * @note With TB_FEATURE_COMPRESS_FLOATS this runs the same decimal places search as packing
+ */
+static inline size_t tiny_bits_size_of_double(double val, uint8_t features){
+    uint8_t scratch[10];
+    return _encode_double(scratch, val, features);
+}
+
+/**
+ * @brief Number of bytes pack_blob() (or pack_blob_ref()) adds for a blob of blob_size bytes
+ */
+static inline size_t tiny_bits_size_of_blob(size_t blob_size){
+    return 1 + varint_size(blob_size) + blob_size;
+}
+
+/**
+ * @brief Number of bytes pack_arr() writes for an array header
+ */
+static inline size_t tiny_bits_size_of_arr(size_t arr_len){
+    return arr_len < TB_ARR_LEN ? 1 : 1 + varint_size(arr_len - TB_ARR_LEN);
+}
+
+/**
+ * @brief Number of bytes pack_map() writes for a map header
+ */
+static inline size_t tiny_bits_size_of_map(size_t map_len){
+    return map_len < TB_MAP_LEN ? 1 : 1 + varint_size(map_len - TB_MAP_LEN);
+}
+
+/**
+ * @brief Number of bytes pack_datetime() writes
+ */
+static inline size_t tiny_bits_size_of_datetime(void){
+    return 10;
+}
+
+/**
+ * @brief Number of bytes pack_int_array() writes
+ */
+static inline size_t tiny_bits_size_of_int_array(const int64_t *values, size_t count){
+    return tiny_bits_size_of_arr(count) + _int_values_size(values, count);
+}
+
+/**
+ * @brief Number of bytes pack_double_array() writes, with the given TB_FEATURE_* flags
+ */
+static inline size_t tiny_bits_size_of_double_array(const double *values, size_t count, uint8_t features){
+    return tiny_bits_size_of_arr(count) + _double_values_size(values, count, features);
+}
+
 #endif // TINY_BITS_PACKER_H
@@ -0,0 +1,334 @@
+#ifndef TINY_BITS_PARALLEL_H
+#define TINY_BITS_PARALLEL_H
+
+#include "unpacker.h"
+#include "dictionary.h"
+
+// A run of bytes that decodes on its own, without the separator that ends it
+typedef struct tiny_bits_frame {
+    size_t offset;
+    size_t size;
+} tiny_bits_frame;
+
+/**
+ * Where the messages of a buffer of messages joined by pack_separator() start, so that they can be decoded
+ * out of order. A message using deduplicated strings of the messages before it is put in the same frame as
+ * them, each frame numbers its strings from scratch (after the dictionary, if any).
+ */
+typedef struct tiny_bits_frame_index {
+    tiny_bits_frame *frames;
+    size_t count;
+    size_t capacity;
+    size_t messages;    // messages indexed, more than count when some could not be framed on their own
+    const tiny_bits_allocator *allocator;
+} tiny_bits_frame_index;
+
+/**
+ * @brief allocates and initializes a new frame index, taking all its memory from an allocator
+ *
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
+ * @return pointer to new frame index instance
+ *
+ * @note the returned frame index object must be freed using tiny_bits_frame_index_destroy(), unless it comes
+ * from an arena that is reset or destroyed as a whole
+ */
+static inline tiny_bits_frame_index *tiny_bits_frame_index_create_with(const tiny_bits_allocator *allocator) {
+    tiny_bits_frame_index *index = (tiny_bits_frame_index *)_tb_alloc(allocator, sizeof(tiny_bits_frame_index));
+    if (!index) return NULL;
+    memset(index, 0, sizeof(tiny_bits_frame_index));
+    index->allocator = allocator;
+    return index;
+}
+
+/**
+ * @brief allocates and initializes a new frame index
+ *
+ * @return pointer to new frame index instance
+ *
+ * @note the returned frame index object must be freed using tiny_bits_frame_index_destroy()
+ */
+static inline tiny_bits_frame_index *tiny_bits_frame_index_create(void) {
+    return tiny_bits_frame_index_create_with(NULL);
+}
+
+/**
+ * @brief Deallocate the frame index object and its frames
+ *
+ * @param index The frame index instance
+ */
+static inline void tiny_bits_frame_index_destroy(tiny_bits_frame_index *index) {
+    if (!index) return;
+    _tb_free(index->allocator, index->frames);
+    _tb_free(index->allocator, index);
+}
+
+// Records the message from offset to end: a frame of its own, or the end of the frames it depends on
+static inline int _frame_index_add(tiny_bits_frame_index *index, size_t offset, size_t end, int dependent, size_t clean) {
+    index->messages++;
+    if (dependent && index->count) {
+        // back to the last frame that started with the strings of the unpacker, all the frames after it
+        // number their strings from the wrong id as well
+        index->count = clean + 1;
+        index->frames[clean].size = end - index->frames[clean].offset;
+        return 1;
+    }
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        tiny_bits_frame *frames = (tiny_bits_frame *)_tb_realloc(index->allocator, index->frames, capacity * sizeof(tiny_bits_frame));
+        if (!frames) return 0;
+        index->frames = frames;
+        index->capacity = capacity;
+    }
+    index->frames[index->count].offset = offset;
+    index->frames[index->count].size = end - offset;
+    index->count++;
+    return 1;
+}
+
+/**
+ * @brief Finds the messages of a buffer of messages joined by pack_separator()
+ *
+ * @param index The frame index instance, its previous frames are dropped
+ * @param buffer The messages
+ * @param size Size of the buffer
+ * @param dict The dictionary the messages were packed with, NULL for none
+ * @return 1 on success, 0 on malformed input or allocation failure
+ *
+ * @note Values are jumped over without being decoded, at the cost of a tag lookup each, so separator bytes
+ * inside strings or numbers are never taken for boundaries. Messages without values get no frame. A message that
+ * refers to strings numbered before it, without a reset marker first, stays in the frame of the messages
+ * it depends on: calling pack_strings_reset() after each pack_separator() gives every message its own frame.
+ */
+static inline int tiny_bits_frame_index_build(tiny_bits_frame_index *index, const unsigned char *buffer, size_t size,
+                                              const tiny_bits_dictionary *dict) {
+    if (!index || (!buffer && size)) return 0;
+    size_t base = dict ? dict->table.next_id : 0; // ids taken by the dictionary
+    size_t strings = base;          // strings numbered so far, as the unpacker numbers them
+    size_t message_strings = base;  // the same at the start of the current message
+    size_t pending = 0;             // values left in the open containers
+    size_t start = 0, clean = 0, pos = 0;
+    int reset = 0, dependent = 0, empty = 1;
+    index->count = 0;
+    index->messages = 0;
+    while (pos < size) {
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length, id;
+        uint8_t read;
+        if (tag == TB_SEP_TAG && !pending) {
+            if (!empty) {
+                if (!dependent && message_strings == base) clean = index->count;
+                if (!_frame_index_add(index, start, pos - 1, dependent, clean)) return 0;
+            }
+            start = pos;
+            message_strings = strings;
+            reset = dependent = 0;
+            empty = 1;
+            continue;
+        }
+        if (tag == TB_NXT_TAG && pos < size && buffer[pos] == TB_NXT_RST) {
+            // not a value, strings are numbered from scratch again
+            strings = base;
+            if (pos - 1 == start) message_strings = base; // as if the message had started clean
+            reset = 1;
+            pos++;
+            continue;
+        }
+        empty = 0;
+        if (pending) pending--;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) continue;
+            length = tag & info->mask;
+            break;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) continue;
+            length += info->bias;
+            break;
+        case TB_OP_STR:
+        case TB_OP_STR_VARINT:
+            length = tag & info->mask;
+            if (info->op == TB_OP_STR_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &length)) || length > SIZE_MAX - info->bias) return 0;
+                pos += read;
+                length += info->bias;
+            }
+            if (length > size - pos) return 0;
+            if (length >= 2 && length <= TB_DDP_STR_LEN_MAX) strings++;
+            pos += length;
+            continue;
+        case TB_OP_REF:
+        case TB_OP_REF_VARINT:
+            id = tag & info->mask;
+            if (info->op == TB_OP_REF_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &id)) || id > SIZE_MAX - info->bias) return 0;
+                pos += read;
+                id += info->bias;
+            }
+            if (id >= strings) return 0;
+            // ids of the strings of this message are shifted too when it starts with those of others
+            if (id >= base && !reset && message_strings != base) dependent = 1;
+            continue;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+            pos += varint_length(buffer[pos]);
+            continue;
+        case TB_OP_F16: length = 2; goto jump;
+        case TB_OP_F32: length = 4; goto jump;
+        case TB_OP_F64: length = 8; goto jump;
+        case TB_OP_DATETIME: length = 9; goto jump;
+        case TB_OP_BLOB:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            goto jump;
+        case TB_OP_NXT: {
+            if (pos >= size) return 0;
+            uint8_t kind = buffer[pos++];
+            uint64_t count, width;
+            if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) return 0;
+            if (!(read = decode_varint(buffer, size, pos, &count))) return 0;
+            pos += read;
+            if (kind == TB_NXT_PKD) pos++; // scale
+            if (pos >= size) return 0;
+            width = buffer[pos++];
+            if (width > 64 || count > (1ULL << 56)) return 0;
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0; // base
+            pos += read;
+            length = (count * width + 7) / 8;
+            goto jump;
+        }
+        default:
+            return 0;
+        }
+        // every value takes a byte at least, larger counts can only be malformed
+        if (length > size) return 0;
+        pending += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (pending > size - pos) return 0;
+        continue;
+    jump:
+        if (length > size - pos) return 0;
+        pos += length;
+    }
+    if (pending) return 0; // the last message is cut short
+    if (!empty) {
+        if (!dependent && message_strings == base) clean = index->count;
+        if (!_frame_index_add(index, start, size, dependent, clean)) return 0;
+    }
+    return 1;
+}
+
+// Decoding on several threads uses pthreads, it is only there when TB_WITH_THREADS is defined before including tinybits
+#if defined(TB_WITH_THREADS)
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define TB_FRAMES_PER_CLAIM 8 // frames a worker takes per thread and round, see tiny_bits_decode_frames()
+
+/**
+ * Called by tiny_bits_decode_frames() for each frame, with an unpacker set to it. Returns 1 to go on and 0 to
+ * stop decoding.
+ */
+typedef int (*tiny_bits_frame_fn)(void *context, tiny_bits_unpacker *decoder, size_t frame);
+
+// What the workers of tiny_bits_decode_frames() share
+typedef struct tiny_bits_frames_job {
+    pthread_mutex_t lock;
+    const tiny_bits_frame_index *index;
+    const unsigned char *buffer;
+    const tiny_bits_dictionary *dict;
+    tiny_bits_frame_fn fn;
+    void *context;
+    size_t next;    // first frame not taken yet
+    size_t claim;   // frames taken at once
+    int failed;
+} tiny_bits_frames_job;
+
+// A worker, decoding frames with an unpacker of its own until none are left
+static inline void *_tb_frames_worker(void *argument) {
+    tiny_bits_frames_job *job = (tiny_bits_frames_job *)argument;
+    tiny_bits_unpacker *decoder = tiny_bits_unpacker_create();
+    if (!decoder || (job->dict && !tiny_bits_unpacker_set_dictionary(decoder, job->dict))) {
+        pthread_mutex_lock(&job->lock);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->lock);
+        tiny_bits_unpacker_destroy(decoder);
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t first = job->next;
+        size_t last = job->failed || first >= job->index->count ? first : first + job->claim;
+        if (last > job->index->count) last = job->index->count;
+        job->next = last;
+        pthread_mutex_unlock(&job->lock);
+        if (first == last) break;
+        for (size_t i = first; i < last; i++) {
+            const tiny_bits_frame *frame = &job->index->frames[i];
+            tiny_bits_unpacker_set_buffer(decoder, job->buffer + frame->offset, frame->size);
+            if (!job->fn(job->context, decoder, i)) {
+                pthread_mutex_lock(&job->lock);
+                job->failed = 1;
+                pthread_mutex_unlock(&job->lock);
+                break;
+            }
+        }
+    }
+    tiny_bits_unpacker_destroy(decoder);
+    return NULL;
+}
+
+/**
+ * @brief Decodes the frames of an index on several threads, each with an unpacker of its own
+ *
+ * @param index The frame index, built from buffer
+ * @param buffer The messages
+ * @param dict The dictionary the messages were packed with, NULL for none
+ * @param threads Threads to decode on, the calling one included, 0 for one per online core
+ * @param fn Called for each frame with an unpacker set to it (and to dict), on any of the threads
+ * @param context Passed to fn
+ * @return 1 once all the frames were decoded, 0 when fn returned 0 or on allocation failure
+ *
+ * @note Frames are taken a few at a time in index order, but fn runs concurrently and in no particular order:
+ * it should only write to what belongs to its frame (results indexed by frame for instance), or lock.
+ * Strings point into buffer. When threads can not be started, the remaining ones decode all the frames.
+ * Only there when TB_WITH_THREADS is defined.
+ */
+static inline int tiny_bits_decode_frames(const tiny_bits_frame_index *index, const unsigned char *buffer,
+                                          const tiny_bits_dictionary *dict, unsigned int threads,
+                                          tiny_bits_frame_fn fn, void *context) {
+    if (!index || !fn || (!buffer && index->count)) return 0;
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if (threads > index->count) threads = index->count ? (unsigned int)index->count : 1;
+    tiny_bits_frames_job job;
+    if (pthread_mutex_init(&job.lock, NULL) != 0) return 0;
+    job.index = index;
+    job.buffer = buffer;
+    job.dict = dict;
+    job.fn = fn;
+    job.context = context;
+    job.next = 0;
+    // small claims balance frames of uneven sizes, larger ones take the lock less often
+    job.claim = index->count / ((size_t)threads * TB_FRAMES_PER_CLAIM);
+    if (job.claim < 1) job.claim = 1;
+    job.failed = 0;
+    pthread_t *workers = threads > 1 ? (pthread_t *)malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    unsigned int started = 0;
+    while (workers && started < threads - 1 && pthread_create(&workers[started], NULL, _tb_frames_worker, &job) == 0) {
+        started++;
+    }
+    _tb_frames_worker(&job);
+    for (unsigned int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+    return !job.failed && job.next == index->count;
+}
+
+#endif // TB_WITH_THREADS
+
+#endif // TINY_BITS_PARALLEL_H
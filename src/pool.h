@@ -0,0 +1,209 @@
+#ifndef TINY_BITS_POOL_H
+#define TINY_BITS_POOL_H
+
+// The pool locks with pthreads, so it is only there when TB_WITH_POOL is defined before including tinybits
+#if defined(TB_WITH_POOL)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+
+#define TB_POOL_MIN_SHIFT 10     // smallest size class, 1KB
+#define TB_POOL_MAX_SHIFT 26     // largest size class, 64MB, larger buffers are never cached
+#define TB_POOL_CLASSES (TB_POOL_MAX_SHIFT - TB_POOL_MIN_SHIFT + 1)
+
+typedef struct tiny_bits_pool_stats {
+    uint64_t acquired;      // buffers handed out
+    uint64_t reused;        // of which came from the cache
+    uint64_t released;      // buffers given back
+    uint64_t dropped;       // of which were freed instead of cached (over the limit or too large)
+    size_t cached_bytes;    // bytes sitting in the cache
+    size_t borrowed_bytes;  // bytes currently handed out
+    size_t peak_borrowed_bytes;
+} tiny_bits_pool_stats;
+
+/**
+ * A thread safe cache of buffers in power of two size classes, shared by packers (see tiny_bits_packer_set_pool())
+ * so that large buffers forced by an occasional large message go back to the pool when the packer is reset,
+ * instead of staying with it. The cache holds at most max_cached_bytes, buffers released beyond it are freed.
+ */
+typedef struct tiny_bits_buffer_pool {
+    pthread_mutex_t lock;
+    void *free_lists[TB_POOL_CLASSES]; // cached buffers, each holding the pointer to the next one
+    size_t max_cached_bytes;
+    tiny_bits_pool_stats stats;
+} tiny_bits_buffer_pool;
+
+// Size class of a buffer of at least size bytes, TB_POOL_CLASSES when it is too large to cache
+static inline int _tb_pool_class(size_t size) {
+    if (size <= ((size_t)1 << TB_POOL_MIN_SHIFT)) return 0;
+    int shift = 64 - _tb_clz64(size - 1);
+    return shift > TB_POOL_MAX_SHIFT ? TB_POOL_CLASSES : shift - TB_POOL_MIN_SHIFT;
+}
+
+/**
+ * @brief allocates and initializes a new buffer pool
+ *
+ * @param max_cached_bytes Most bytes kept in the cache, released buffers beyond it are freed
+ * @return pointer to new pool instance
+ *
+ * @note the returned pool object must be freed using tiny_bits_pool_destroy(), once no packer uses it
+ */
+static inline tiny_bits_buffer_pool *tiny_bits_pool_create(size_t max_cached_bytes) {
+    tiny_bits_buffer_pool *pool = (tiny_bits_buffer_pool *)malloc(sizeof(tiny_bits_buffer_pool));
+    if (!pool) return NULL;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+    memset(&pool->stats, 0, sizeof(pool->stats));
+    pool->max_cached_bytes = max_cached_bytes;
+    return pool;
+}
+
+/**
+ * @brief Borrows a buffer of at least size bytes
+ *
+ * @param pool The pool instance
+ * @param size Bytes needed
+ * @param capacity Set to the actual size of the buffer (its size class)
+ * @return The buffer, or NULL on allocation failure
+ *
+ * @note Give it back with tiny_bits_pool_release() and the same capacity
+ */
+static inline void *tiny_bits_pool_acquire(tiny_bits_buffer_pool *pool, size_t size, size_t *capacity) {
+    int size_class = _tb_pool_class(size);
+    size_t class_size = size_class < TB_POOL_CLASSES ? (size_t)1 << (size_class + TB_POOL_MIN_SHIFT) : size;
+    void *buffer = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (size_class < TB_POOL_CLASSES && pool->free_lists[size_class]) {
+        buffer = pool->free_lists[size_class];
+        memcpy(&pool->free_lists[size_class], buffer, sizeof(void *));
+        pool->stats.cached_bytes -= class_size;
+        pool->stats.reused++;
+    }
+    pool->stats.acquired++;
+    pool->stats.borrowed_bytes += class_size;
+    if (pool->stats.borrowed_bytes > pool->stats.peak_borrowed_bytes) {
+        pool->stats.peak_borrowed_bytes = pool->stats.borrowed_bytes;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!buffer) {
+        buffer = malloc(class_size);
+        if (!buffer) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.acquired--;
+            pool->stats.borrowed_bytes -= class_size;
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+    }
+    *capacity = class_size;
+    return buffer;
+}
+
+/**
+ * @brief Gives back a buffer borrowed with tiny_bits_pool_acquire()
+ *
+ * @param pool The pool instance
+ * @param buffer The buffer
+ * @param capacity Its size, as set by tiny_bits_pool_acquire()
+ */
+static inline void tiny_bits_pool_release(tiny_bits_buffer_pool *pool, void *buffer, size_t capacity) {
+    if (!buffer) return;
+    int size_class = _tb_pool_class(capacity);
+    int cache = 0;
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.released++;
+    pool->stats.borrowed_bytes -= capacity;
+    if (size_class < TB_POOL_CLASSES && ((size_t)1 << (size_class + TB_POOL_MIN_SHIFT)) == capacity
+        && pool->stats.cached_bytes + capacity <= pool->max_cached_bytes) {
+        memcpy(buffer, &pool->free_lists[size_class], sizeof(void *));
+        pool->free_lists[size_class] = buffer;
+        pool->stats.cached_bytes += capacity;
+        cache = 1;
+    } else {
+        pool->stats.dropped++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!cache) free(buffer);
+}
+
+/**
+ * @brief Frees cached buffers, largest first, until the cache holds at most max_bytes
+ *
+ * @param pool The pool instance
+ * @param max_bytes Bytes the cache may keep, 0 empties it
+ * @return Number of bytes freed
+ */
+static inline size_t tiny_bits_pool_trim(tiny_bits_buffer_pool *pool, size_t max_bytes) {
+    void *to_free = NULL;
+    size_t freed = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int size_class = TB_POOL_CLASSES - 1; size_class >= 0 && pool->stats.cached_bytes > max_bytes; size_class--) {
+        size_t class_size = (size_t)1 << (size_class + TB_POOL_MIN_SHIFT);
+        while (pool->free_lists[size_class] && pool->stats.cached_bytes > max_bytes) {
+            void *buffer = pool->free_lists[size_class];
+            memcpy(&pool->free_lists[size_class], buffer, sizeof(void *));
+            pool->stats.cached_bytes -= class_size;
+            freed += class_size;
+            // free outside of the lock
+            memcpy(buffer, &to_free, sizeof(void *));
+            to_free = buffer;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    while (to_free) {
+        void *next;
+        memcpy(&next, to_free, sizeof(void *));
+        free(to_free);
+        to_free = next;
+    }
+    return freed;
+}
+
+/**
+ * @brief Sets the most bytes the cache keeps, trimming it if needed
+ *
+ * @param pool The pool instance
+ * @param max_cached_bytes Most bytes kept in the cache
+ */
+static inline void tiny_bits_pool_set_limit(tiny_bits_buffer_pool *pool, size_t max_cached_bytes) {
+    pthread_mutex_lock(&pool->lock);
+    pool->max_cached_bytes = max_cached_bytes;
+    pthread_mutex_unlock(&pool->lock);
+    tiny_bits_pool_trim(pool, max_cached_bytes);
+}
+
+/**
+ * @brief Copies the pool counters
+ *
+ * @param pool The pool instance
+ * @param stats Set to the current counters
+ */
+static inline void tiny_bits_pool_get_stats(tiny_bits_buffer_pool *pool, tiny_bits_pool_stats *stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Deallocate the pool object and the buffers it caches
+ *
+ * @param pool The pool instance
+ *
+ * @note Borrowed buffers are not tracked, packers using the pool must be destroyed first
+ */
+static inline void tiny_bits_pool_destroy(tiny_bits_buffer_pool *pool) {
+    if (!pool) return;
+    tiny_bits_pool_trim(pool, 0);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+#endif // TB_WITH_POOL
+
+#endif // TINY_BITS_POOL_H
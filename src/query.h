@@ -0,0 +1,244 @@
+#ifndef TINY_BITS_QUERY_H
+#define TINY_BITS_QUERY_H
+
+#include "unpacker.h"
+
+#define TB_QUERY_MAX_PATHS 64 // most paths tiny_bits_query_many() looks up in one pass
+
+// One step of a path, a map key or an array index
+typedef struct tiny_bits_path_step {
+    const char *key;    // NULL for an array index
+    uint32_t key_len;
+    uint32_t index;
+} tiny_bits_path_step;
+
+/**
+ * A compiled path expression, such as user.children[2].first_name. Keys are matched against the string keys
+ * of maps, [n] picks the nth element of an array. The steps and their keys are stored in the same allocation.
+ */
+typedef struct tiny_bits_path {
+    uint32_t count;
+    tiny_bits_path_step steps[];
+} tiny_bits_path;
+
+/**
+ * @brief Compiles a path expression
+ *
+ * @param expression Keys separated by dots and array indexes in brackets: a.b[2][0].c, an empty expression
+ * is the value itself. A backslash makes the next character part of the key (a\.b is the key "a.b")
+ * @return The compiled path, NULL on a syntax error or allocation failure
+ *
+ * @note the returned path must be freed using tiny_bits_path_destroy()
+ */
+static inline tiny_bits_path *tiny_bits_path_compile(const char *expression) {
+    if (!expression) return NULL;
+    size_t expression_len = strlen(expression);
+    // every step takes one character at least, keys are never longer than the expression
+    size_t max_steps = expression_len + 1;
+    tiny_bits_path *path = (tiny_bits_path *)malloc(sizeof(tiny_bits_path) + max_steps * sizeof(tiny_bits_path_step) + expression_len);
+    if (!path) return NULL;
+    char *keys = (char *)(path->steps + max_steps);
+    const char *p = expression;
+    path->count = 0;
+    while (*p) {
+        tiny_bits_path_step *step = &path->steps[path->count];
+        if (*p == '[') {
+            uint64_t index = 0;
+            p++;
+            if (*p < '0' || *p > '9') goto fail;
+            while (*p >= '0' && *p <= '9') {
+                index = index * 10 + (uint64_t)(*p++ - '0');
+                if (index > UINT32_MAX) goto fail;
+            }
+            if (*p++ != ']') goto fail;
+            step->key = NULL;
+            step->key_len = 0;
+            step->index = (uint32_t)index;
+        } else {
+            if (*p == '.') {
+                if (path->count == 0) goto fail;
+                p++;
+            } else if (path->count > 0) {
+                goto fail; // a key follows a dot
+            }
+            step->key = keys;
+            while (*p && *p != '.' && *p != '[') {
+                if (*p == ']') goto fail;
+                if (*p == '\\' && p[1]) p++;
+                *keys++ = *p++;
+            }
+            step->key_len = (uint32_t)(keys - step->key);
+            step->index = 0;
+            if (step->key_len == 0) goto fail;
+        }
+        path->count++;
+    }
+    return path;
+fail:
+    free(path);
+    return NULL;
+}
+
+/**
+ * @brief Deallocate a compiled path
+ *
+ * @param path The path instance
+ */
+static inline void tiny_bits_path_destroy(tiny_bits_path *path) {
+    free(path);
+}
+
+// Skips what is left of the container opened at level, unless reading its last value closed it already
+static inline int _query_leave(tiny_bits_unpacker *decoder, uint32_t level) {
+    return decoder->depth == level ? tiny_bits_leave_container(decoder) : 1;
+}
+
+// Skips a value nothing is looked for in, as _query_walk() returns
+static inline int _query_skip(tiny_bits_unpacker *decoder) {
+    enum tiny_bits_type type = tiny_bits_skip_value(decoder);
+    return type == TINY_BITS_ERROR ? 0 : type == TINY_BITS_NEED_MORE ? -1 : 1;
+}
+
+// Reads the next value, the active paths have matched it with their first depth steps. Returns 1 when done,
+// 0 on malformed input and -1 when an incremental unpacker has only part of the value
+static inline int _query_walk(tiny_bits_unpacker *decoder, const tiny_bits_path **paths, uint32_t depth, uint64_t active,
+                                     uint64_t *pending, tiny_bits_value *values, enum tiny_bits_type *types) {
+    tiny_bits_value value;
+    enum tiny_bits_type type = tiny_bits_read_value(decoder, &value);
+    if (type == TINY_BITS_ERROR) return 0;
+    if (type == TINY_BITS_NEED_MORE) return -1;
+    if (type == TINY_BITS_FINISHED) return 1;
+    uint64_t deeper = 0; // paths going on into this value
+    for (uint64_t rest = active; rest; rest &= rest - 1) {
+        int p = _tb_ctz64(rest);
+        if (paths[p]->count == depth) {
+            values[p] = value;
+            types[p] = type;
+            *pending &= ~(1ULL << p);
+        } else {
+            deeper |= 1ULL << p;
+        }
+    }
+    // once everything is found the rest is left unread
+    if (!*pending) return 1;
+    if (type != TINY_BITS_ARRAY && type != TINY_BITS_MAP) return 1;
+    uint32_t level = decoder->depth;
+    if (!value.length) return 1;
+    if (!deeper) return tiny_bits_leave_container(decoder);
+    size_t length = value.length;
+    if (type == TINY_BITS_ARRAY) {
+        int64_t last = -1; // highest index looked for
+        for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+            const tiny_bits_path_step *step = &paths[_tb_ctz64(rest)]->steps[depth];
+            if (!step->key && (int64_t)step->index > last) last = step->index;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if ((int64_t)i > last) return _query_leave(decoder, level);
+            uint64_t child = 0;
+            for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+                int p = _tb_ctz64(rest);
+                if (!paths[p]->steps[depth].key && paths[p]->steps[depth].index == i) child |= 1ULL << p;
+            }
+            int done = child ? _query_walk(decoder, paths, depth + 1, child, pending, values, types) : _query_skip(decoder);
+            if (done <= 0) return done;
+            if (!*pending) return 1;
+        }
+        return 1;
+    }
+    uint64_t unmatched = 0; // paths still looking for their key in this map
+    for (uint64_t rest = deeper; rest; rest &= rest - 1) {
+        int p = _tb_ctz64(rest);
+        if (paths[p]->steps[depth].key) unmatched |= 1ULL << p;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!unmatched) return _query_leave(decoder, level);
+        tiny_bits_value key;
+        enum tiny_bits_type key_type = tiny_bits_read_value(decoder, &key);
+        if (key_type == TINY_BITS_NEED_MORE) return -1;
+        if (key_type == TINY_BITS_ERROR || key_type == TINY_BITS_FINISHED) return 0;
+        uint64_t child = 0;
+        if (key_type == TINY_BITS_STR) {
+            for (uint64_t rest = unmatched; rest; rest &= rest - 1) {
+                int p = _tb_ctz64(rest);
+                const tiny_bits_path_step *step = &paths[p]->steps[depth];
+                if (step->key_len == key.str_blob_val.length && memcmp(step->key, key.str_blob_val.data, step->key_len) == 0) {
+                    child |= 1ULL << p;
+                }
+            }
+        }
+        unmatched &= ~child;
+        int done = child ? _query_walk(decoder, paths, depth + 1, child, pending, values, types) : _query_skip(decoder);
+        if (done <= 0) return done;
+        if (!*pending) return 1;
+    }
+    return 1;
+}
+
+// Nothing found yet, the value is not all there
+static inline int _query_need_more(enum tiny_bits_type *types, size_t count) {
+    for (size_t i = 0; i < count; i++) types[i] = TINY_BITS_NEED_MORE;
+    return 0;
+}
+
+/**
+ * @brief Looks up several paths in the next value, in a single pass
+ *
+ * @param decoder The unpacker instance
+ * @param paths Compiled paths, at most TB_QUERY_MAX_PATHS
+ * @param count Number of paths
+ * @param[out] values Set to the value found at each path
+ * @param[out] types Set to the type of the value found at each path, TINY_BITS_NOT_FOUND if there is none
+ * @return Number of paths found, -1 on malformed input or too many paths. An incremental unpacker returns 0,
+ * with every type set to TINY_BITS_NEED_MORE and the unpacker left as it was, until all of the value is there
+ *
+ * @note Values that no path leads into are skipped without being decoded, and reading stops as soon as every
+ * path is found. The unpacker is then left right after the last value found (inside its container when it is
+ * an array or a map, whose elements can be read next). The containers around it are tracked as with
+ * tiny_bits_read_value(), tiny_bits_leave_container() moves on past them.
+ */
+static inline int tiny_bits_query_many(tiny_bits_unpacker *decoder, const tiny_bits_path **paths, size_t count,
+                                       tiny_bits_value *values, enum tiny_bits_type *types) {
+    if (!decoder || !paths || !values || !types || count > TB_QUERY_MAX_PATHS) return -1;
+    if (count == 0) return 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!paths[i]) return -1;
+        types[i] = TINY_BITS_NOT_FOUND;
+    }
+    tiny_bits_unpacker_mark mark;
+    if (_unpacker_awaits(decoder)) return _query_need_more(types, count);
+    _unpacker_mark(decoder, &mark);
+    // reading the value counts it off the container it is in, going back counts it again
+    uint32_t depth = decoder->depth;
+    size_t left = depth ? decoder->frames[depth - 1] : 0;
+    uint64_t active = count == 64 ? ~0ULL : (1ULL << count) - 1;
+    uint64_t pending = active;
+    int done = _query_walk(decoder, paths, 0, active, &pending, values, types);
+    if (done == 0) return -1;
+    if (done < 0) {
+        if (_unpacker_rewind(decoder, &mark) != TINY_BITS_NEED_MORE) return -1;
+        decoder->depth = depth;
+        if (depth) decoder->frames[depth - 1] = left;
+        return _query_need_more(types, count);
+    }
+    return (int)(count - (size_t)_tb_popcount64(pending));
+}
+
+/**
+ * @brief Looks up a path in the next value
+ *
+ * @param decoder The unpacker instance
+ * @param path A compiled path
+ * @param[out] value Set to the value found
+ * @return The type of the value found, TINY_BITS_NOT_FOUND if there is none, TINY_BITS_ERROR on malformed input.
+ * An incremental unpacker returns TINY_BITS_NEED_MORE, reading nothing, until all of the value is there.
+ *
+ * @note Leaves the unpacker as tiny_bits_query_many() does
+ */
+static inline enum tiny_bits_type tiny_bits_query(tiny_bits_unpacker *decoder, const tiny_bits_path *path,
+                                                  tiny_bits_value *value) {
+    enum tiny_bits_type type;
+    if (tiny_bits_query_many(decoder, &path, 1, value, &type) < 0) return TINY_BITS_ERROR;
+    return type;
+}
+
+#endif // TINY_BITS_QUERY_H
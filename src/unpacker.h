@@ -25,7 +25,11 @@ enum tiny_bits_type {
     TINY_BITS_SEP,      // No balue
     TINY_BITS_FINISHED, // End of buffer
     TINY_BITS_ERROR,     // Parsing error
-    TINY_BITS_DATETIME   // double_val: double value
+    TINY_BITS_DATETIME,  // double_val: double value
+    TINY_BITS_PACKED_INT,   // packed_val.count: number of integers, decode with unpack_packed_ints()
+    TINY_BITS_PACKED_DOUBLE, // packed_val.count: number of doubles, decode with unpack_packed_doubles()
+    TINY_BITS_NOT_FOUND,    // No value at the path given to tiny_bits_query()
+    TINY_BITS_NEED_MORE     // The value goes on past the input of an incremental unpacker, see tiny_bits_unpacker_append()
 };
 
 // value union
@@ -42,8 +46,23 @@ typedef union tiny_bits_value {
         double unixtime;
         size_t offset;
     } datetime_val;   
+    struct {            // TINY_BITS_PACKED_INT, TINY_BITS_PACKED_DOUBLE
+        const uint8_t *data; // packed array layout, following the element count
+        size_t count;
+        uint8_t kind;        // TB_NXT_PKI or TB_NXT_PKD
+    } packed_val;
 } tiny_bits_value;
 
+// Storage for strings that must outlive the buffer they came from, blocks never move
+typedef struct tiny_bits_string_block {
+    struct tiny_bits_string_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} tiny_bits_string_block;
+
+#define TB_STRING_BLOCK_SIZE 4096
+
 // The unpacker data structure
 typedef struct tiny_bits_unpacker {
     const unsigned char *buffer;  // Input buffer (read-only)
@@ -55,31 +74,109 @@ typedef struct tiny_bits_unpacker {
     } *strings;           // Array of decoded strings
     size_t strings_size;  // Capacity of strings array
     size_t strings_count; // Number of strings stored
-    HashTable dictionary;
+    HashTable dictionary; // Pre-shared strings occupying strings[0..next_id-1], see tiny_bits_unpacker_set_dictionary()
+    tiny_bits_string_block *string_blocks; // Copies of the strings kept across buffers, newest block first
+    uint8_t session;      // Strings persist across buffers, see tiny_bits_unpacker_begin_session() (2 when only for incremental input)
+    uint32_t resets;      // Times the strings were forgotten, see _unpacker_rewind()
+    const tiny_bits_allocator *allocator; // Where the strings array and blocks come from, NULL for malloc()
+    size_t frames[TB_MAX_DEPTH]; // Values left in each open container, see tiny_bits_read_value()
+    uint32_t depth;       // Number of open containers
+    uint8_t stream;       // Incremental, buffer is input and grows with tiny_bits_unpacker_append()
+    unsigned char *input; // Bytes appended to an incremental unpacker, the consumed ones are dropped on the next append
+    size_t input_capacity;
 } tiny_bits_unpacker;
 
 /**
- * @brief allocates and initializes a new unpacker
+ * @brief allocates and initializes a new unpacker, taking all its memory from an allocator
  * 
+ * @param allocator Memory functions (for instance the allocator of a tiny_bits_arena), NULL for malloc()
  * @return pointer to new unpacker instance
  * 
- * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy()
+ * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy(), unless it comes from an
+ * arena that is reset or destroyed as a whole. The allocator must outlive the unpacker.
  */
-tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
+tiny_bits_unpacker *tiny_bits_unpacker_create_with(const tiny_bits_allocator *allocator) {
 
-    tiny_bits_unpacker *decoder = (tiny_bits_unpacker *)malloc(sizeof(tiny_bits_unpacker));
+    tiny_bits_unpacker *decoder = (tiny_bits_unpacker *)_tb_alloc(allocator, sizeof(tiny_bits_unpacker));
     if (!decoder) return NULL;
     // String array setup
     decoder->strings_size = 8; // Initial capacity
-    decoder->strings = (void *)malloc(decoder->strings_size * sizeof(*decoder->strings));
+    decoder->strings = (void *)_tb_alloc(allocator, decoder->strings_size * sizeof(*decoder->strings));
     if (!decoder->strings) {
-        free(decoder);
+        _tb_free(allocator, decoder);
         return NULL;
     }
     decoder->strings_count = 0;
+    memset(&decoder->dictionary, 0, sizeof(HashTable));
+    decoder->string_blocks = NULL;
+    decoder->session = 0;
+    decoder->resets = 0;
+    decoder->allocator = allocator;
+    decoder->depth = 0;
+    decoder->stream = 0;
+    decoder->input = NULL;
+    decoder->input_capacity = 0;
     return decoder;
 }
 
+/**
+ * @brief allocates and initializes a new unpacker
+ * 
+ * @return pointer to new unpacker instance
+ * 
+ * @note the returned unpacker object must be freed using tiny_bits_unpacker_destroy()
+ */
+tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
+    return tiny_bits_unpacker_create_with(NULL);
+}
+
+// Forgets all deduplicated strings, keeping only the dictionary ones
+static inline void _unpacker_clear_strings(tiny_bits_unpacker *decoder) {
+    decoder->strings_count = decoder->dictionary.next_id;
+    decoder->resets++;
+    tiny_bits_string_block *block = decoder->string_blocks;
+    if (!block) return;
+    while (block->next) {
+        tiny_bits_string_block *next = block->next->next;
+        _tb_free(decoder->allocator, block->next);
+        block->next = next;
+    }
+    block->used = 0;
+}
+
+// Copies a string to storage owned by the unpacker, returns NULL on allocation failure
+static TB_NOINLINE char *_unpacker_keep_string(tiny_bits_unpacker *decoder, const char *str, size_t len) {
+    tiny_bits_string_block *block = decoder->string_blocks;
+    if (!block || block->used + len > block->size) {
+        size_t size = len > TB_STRING_BLOCK_SIZE ? len : TB_STRING_BLOCK_SIZE;
+        block = (tiny_bits_string_block *)_tb_alloc(decoder->allocator, sizeof(tiny_bits_string_block) + size);
+        if (!block) return NULL;
+        block->next = decoder->string_blocks;
+        block->used = 0;
+        block->size = size;
+        decoder->string_blocks = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, str, len);
+    block->used += len;
+    return copy;
+}
+
+/**
+ * @brief Starts a session, where deduplicated strings persist across buffers
+ * 
+ * @param decoder The unpacker instance
+ *
+ * @note The packer on the other end must be in a session as well (see tiny_bits_packer_begin_session()).
+ * Deduplicatable strings are copied aside so the buffers can be released once unpacked, strings returned
+ * by unpack_value() remain valid until the packer resets the strings or tiny_bits_unpacker_reset() is called.
+ */
+static inline void tiny_bits_unpacker_begin_session(tiny_bits_unpacker *decoder) {
+    if (!decoder) return;
+    _unpacker_clear_strings(decoder);
+    decoder->session = 1;
+}
+
 /**
  * @breif Provides a buffer to the unpacker for unpacking
  * 
@@ -90,6 +187,8 @@ tiny_bits_unpacker *tiny_bits_unpacker_create(void) {
  * @param size Size of the region to be unpacked
  *
  * @note This function implicitly resets the unpacker object so no need to call tiny_bits_unpacker_reset()
+ * @note An incremental unpacker (see tiny_bits_unpacker_append()) drops what is left of its input, and the
+ * strings it kept unless a session was begun
  */
 static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, const unsigned char *buffer, size_t size) {
     if (!decoder) return;
@@ -97,7 +196,14 @@ static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, co
     decoder->buffer = buffer;
     decoder->size = size;
     decoder->current_pos = 0;
-    decoder->strings_count = 0;
+    decoder->depth = 0;
+    decoder->stream = 0;
+    if (decoder->session == 2) {
+        // the session only came with the incremental input, a plain buffer starts from scratch
+        decoder->session = 0;
+        _unpacker_clear_strings(decoder);
+    }
+    if (!decoder->session) decoder->strings_count = decoder->dictionary.next_id;
 }
 
 /**
@@ -106,11 +212,89 @@ static inline void tiny_bits_unpacker_set_buffer(tiny_bits_unpacker *decoder, co
  * @param decoder The unpacker instance
  *
  * @note This function is useful if you want to operate on the same buffer again for some reason
+ * @note In a session this forgets the strings of previous buffers as well
+ * @note An incremental unpacker drops its input instead, to start over with a new stream
  */
 static inline void tiny_bits_unpacker_reset(tiny_bits_unpacker *decoder) {
     if (!decoder) return;
     decoder->current_pos = 0;
-    decoder->strings_count = 0;
+    decoder->depth = 0;
+    if (decoder->stream) decoder->size = 0;
+    _unpacker_clear_strings(decoder);
+}
+
+/**
+ * @brief Makes room for more input of an incremental unpacker, to be read into directly (from a socket for
+ * instance) and then added with tiny_bits_unpacker_commit()
+ *
+ * @param decoder The unpacker instance
+ * @param size Bytes to make room for
+ * @return Where to write them, NULL on allocation failure
+ *
+ * @note The first call turns the unpacker incremental, see tiny_bits_unpacker_append()
+ */
+static inline unsigned char *tiny_bits_unpacker_reserve(tiny_bits_unpacker *decoder, size_t size) {
+    if (!decoder) return NULL;
+    if (!decoder->stream) {
+        // strings are copied aside as in a session, the input they come from moves or goes away
+        _unpacker_clear_strings(decoder);
+        if (!decoder->session) decoder->session = 2;
+        decoder->stream = 1;
+        decoder->size = 0;
+        decoder->current_pos = 0;
+        decoder->depth = 0;
+    }
+    // slide what is not consumed yet to the front, it is at most the value in progress
+    size_t pending = decoder->size - decoder->current_pos;
+    if (decoder->current_pos) {
+        memmove(decoder->input, decoder->input + decoder->current_pos, pending);
+        decoder->size = pending;
+        decoder->current_pos = 0;
+    }
+    if (size > decoder->input_capacity - pending) {
+        if (size > SIZE_MAX / 2 - pending) return NULL;
+        size_t capacity = decoder->input_capacity ? decoder->input_capacity : 1024;
+        while (capacity < pending + size) capacity *= 2;
+        unsigned char *input = (unsigned char *)_tb_realloc(decoder->allocator, decoder->input, capacity);
+        if (!input) return NULL;
+        decoder->input = input;
+        decoder->input_capacity = capacity;
+    }
+    decoder->buffer = decoder->input;
+    return decoder->input + decoder->size;
+}
+
+/**
+ * @brief Adds bytes written where tiny_bits_unpacker_reserve() pointed to the input
+ *
+ * @param decoder The unpacker instance
+ * @param size Bytes written, at most the size reserved
+ */
+static inline void tiny_bits_unpacker_commit(tiny_bits_unpacker *decoder, size_t size) {
+    if (!decoder || !decoder->stream || size > decoder->input_capacity - decoder->size) return;
+    decoder->size += size;
+}
+
+/**
+ * @brief Appends bytes to the input of an incremental unpacker, for decoding as they arrive
+ *
+ * @param decoder The unpacker instance
+ * @param data The bytes
+ * @param size Their number
+ * @return 1 on success, 0 on allocation failure
+ *
+ * @note The first call turns the unpacker incremental: it owns its input, and unpack_value() returns
+ * TINY_BITS_NEED_MORE for a value cut short by the end of it, leaving the unpacker as it was before the value.
+ * Consumed bytes are dropped on the next append, so the input holds little more than the value in progress.
+ * Strings and blobs returned point into the input and are valid until then (deduplicated strings are copied
+ * aside and remain valid as in a session). tiny_bits_unpacker_set_buffer() makes it a plain unpacker again.
+ */
+static inline int tiny_bits_unpacker_append(tiny_bits_unpacker *decoder, const void *data, size_t size) {
+    unsigned char *input = tiny_bits_unpacker_reserve(decoder, size);
+    if (!input) return 0;
+    if (size) memcpy(input, data, size);
+    decoder->size += size;
+    return 1;
 }
 
 
@@ -123,92 +307,335 @@ static inline void tiny_bits_unpacker_reset(tiny_bits_unpacker *decoder) {
 void tiny_bits_unpacker_destroy(tiny_bits_unpacker *decoder) {
     if (!decoder) return;
     if (decoder->strings) {
-        free(decoder->strings);
+        _tb_free(decoder->allocator, decoder->strings);
     }
-    free(decoder);
+    while (decoder->string_blocks) {
+        tiny_bits_string_block *next = decoder->string_blocks->next;
+        _tb_free(decoder->allocator, decoder->string_blocks);
+        decoder->string_blocks = next;
+    }
+    _tb_free(decoder->allocator, decoder->input);
+    _tb_free(decoder->allocator, decoder);
 }
 
-static inline enum tiny_bits_type _unpack_int(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 248) { // Small positive (128-247)
-            value->int_val = tag - 128;
-            return TINY_BITS_INT;
-        } else if (tag == 248) { // Positive with continuation
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->int_val = val + 120;
-            decoder->current_pos += read;
-            return TINY_BITS_INT;
-        } else if (tag > 248 && tag < 255) { // Small negative (248-254)
-            value->int_val = -(tag - 248);
-            return TINY_BITS_INT;
-        } else { // 255: Negative with continuation
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->int_val = -(val + 7);
-            decoder->current_pos += read;
-            return TINY_BITS_INT;
-        }
-}
+// How unpack_value() reads what follows a tag, see tag_table
+enum tiny_bits_tag_op {
+    TB_OP_INLINE,       // nothing follows, the value is tag & mask, negated when sign is set (0 for valueless types)
+    TB_OP_VARINT,       // integer or array/map length, varint + bias, negated when sign is set
+    TB_OP_STR,          // string, its length in the tag (tag & mask)
+    TB_OP_STR_VARINT,   // string, its length varint + bias
+    TB_OP_REF,          // deduplicated string, its id in the tag (tag & mask)
+    TB_OP_REF_VARINT,   // deduplicated string, its id varint + bias
+    TB_OP_FP,           // compressed double, decimal places in the tag (tag & mask), sign in bit 0x10
+    TB_OP_F16,
+    TB_OP_F32,
+    TB_OP_F64,
+    TB_OP_BLOB,
+    TB_OP_DATETIME,
+    TB_OP_NXT
+};
 
-static inline enum tiny_bits_type _unpack_arr(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 0b00001111) { // Small array (0-30)
-            value->length = tag & 0b00000111;
-        } else { // Large array
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->length = val + 7;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_ARRAY;
-}
+typedef struct tiny_bits_tag_info {
+    uint8_t type;   // enum tiny_bits_type of the value
+    uint8_t op;     // enum tiny_bits_tag_op
+    uint8_t mask;   // tag bits holding a small value, length or id
+    uint8_t bias;   // added to the varint following the tag
+    int8_t sign;    // -1 for negative integers, 0 otherwise
+} tiny_bits_tag_info;
 
-static inline enum tiny_bits_type _unpack_map(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag < 0x1F) { // Small map (0-14)
-            value->length = tag & 0x0F;
-        } else { // Large map
-            uint8_t read;
-            uint64_t val;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &val);
-            if(read == 0) return TINY_BITS_ERROR;
-            value->length = val + 15;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_MAP;
+// Every tag, so that unpack_value() dispatches with a single lookup (written out in full, ranges are a GNU extension)
+static const tiny_bits_tag_info tag_table[256] = {
+    // 0x00: constants, blob, extensions and datetime
+    { TINY_BITS_FALSE, TB_OP_INLINE, 0, 0, 0 }, // 0x00 TB_FLS_TAG
+    { TINY_BITS_TRUE, TB_OP_INLINE, 0, 0, 0 }, // 0x01 TB_TRU_TAG
+    { TINY_BITS_NULL, TB_OP_INLINE, 0, 0, 0 }, // 0x02 TB_NIL_TAG
+    { TINY_BITS_BLOB, TB_OP_BLOB, 0, 0, 0 }, // 0x03 TB_BLB_TAG
+    { TINY_BITS_EXT, TB_OP_INLINE, 0, 0, 0 }, // 0x04 TB_EXT_TAG
+    { TINY_BITS_SEP, TB_OP_INLINE, 0, 0, 0 }, // 0x05 TB_SEP_TAG
+    { TINY_BITS_ERROR, TB_OP_NXT, 0, 0, 0 }, // 0x06 TB_NXT_TAG
+    { TINY_BITS_DATETIME, TB_OP_DATETIME, 0, 0, 0 }, // 0x07 TB_DTM_TAG
+    // 0x08: arrays, length in the tag
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x08
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x09
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0A
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0B
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0C
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0D
+    { TINY_BITS_ARRAY, TB_OP_INLINE, 0x07, 0, 0 }, // 0x0E
+    // 0x0F: array, length varint
+    { TINY_BITS_ARRAY, TB_OP_VARINT, 0, TB_ARR_LEN, 0 }, // 0x0F
+    // 0x10: maps, length in the tag
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x10
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x11
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x12
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x13
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x14
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x15
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x16
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x17
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x18
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x19
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1A
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1B
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1C
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1D
+    { TINY_BITS_MAP, TB_OP_INLINE, 0x0F, 0, 0 }, // 0x1E
+    // 0x1F: map, length varint
+    { TINY_BITS_MAP, TB_OP_VARINT, 0, TB_MAP_LEN, 0 }, // 0x1F
+    // 0x20: positive compressed doubles, decimal places in the tag
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x20
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x21
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x22
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x23
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x24
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x25
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x26
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x27
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x28
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x29
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2A
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2B
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x2C
+    // 0x2D: NaN, -Infinity, float
+    { TINY_BITS_NAN, TB_OP_INLINE, 0, 0, 0 }, // 0x2D TB_NAN_TAG
+    { TINY_BITS_N_INF, TB_OP_INLINE, 0, 0, 0 }, // 0x2E TB_NNF_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F32, 0, 0, 0 }, // 0x2F TB_F32_TAG
+    // 0x30: negative compressed doubles
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x30
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x31
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x32
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x33
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x34
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x35
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x36
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x37
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x38
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x39
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3A
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3B
+    { TINY_BITS_DOUBLE, TB_OP_FP, 0x0F, 0, 0 }, // 0x3C
+    // 0x3D: Infinity, f16, double
+    { TINY_BITS_INF, TB_OP_INLINE, 0, 0, 0 }, // 0x3D TB_INF_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F16, 0, 0, 0 }, // 0x3E TB_F16_TAG
+    { TINY_BITS_DOUBLE, TB_OP_F64, 0, 0, 0 }, // 0x3F TB_F64_TAG
+    // 0x40: strings, length in the tag
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x40
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x41
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x42
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x43
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x44
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x45
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x46
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x47
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x48
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x49
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4A
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4B
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4C
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4D
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4E
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x4F
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x50
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x51
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x52
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x53
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x54
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x55
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x56
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x57
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x58
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x59
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5A
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5B
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5C
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5D
+    { TINY_BITS_STR, TB_OP_STR, 0x1F, 0, 0 }, // 0x5E
+    // 0x5F: string, length varint
+    { TINY_BITS_STR, TB_OP_STR_VARINT, 0, TB_STR_LEN, 0 }, // 0x5F
+    // 0x60: references, id in the tag
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x60
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x61
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x62
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x63
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x64
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x65
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x66
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x67
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x68
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x69
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6A
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6B
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6C
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6D
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6E
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x6F
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x70
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x71
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x72
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x73
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x74
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x75
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x76
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x77
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x78
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x79
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7A
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7B
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7C
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7D
+    { TINY_BITS_STR, TB_OP_REF, 0x1F, 0, 0 }, // 0x7E
+    // 0x7F: reference, id varint
+    { TINY_BITS_STR, TB_OP_REF_VARINT, 0, TB_REF_LEN, 0 }, // 0x7F
+    // 0x80: integers 0 to 119
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x80
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x81
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x82
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x83
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x84
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x85
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x86
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x87
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x88
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x89
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8A
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8B
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8C
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8D
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8E
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x8F
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x90
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x91
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x92
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x93
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x94
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x95
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x96
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x97
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x98
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x99
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9A
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9B
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9C
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9D
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9E
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0x9F
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xA9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xAF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xB9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xBF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xC9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xCF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xD9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xDF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE7
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE8
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xE9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xED
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEE
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xEF
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF0
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF1
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF2
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF3
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF4
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF5
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x7F, 0, 0 }, // 0xF7
+    // 0xF8: integer 120 and up, varint
+    { TINY_BITS_INT, TB_OP_VARINT, 0, 120, 0 }, // 0xF8
+    // 0xF9: integers -1 to -6
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xF9
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFA
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFB
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFC
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFD
+    { TINY_BITS_INT, TB_OP_INLINE, 0x07, 0, -1 }, // 0xFE
+    // 0xFF: integer -7 and down, varint
+    { TINY_BITS_INT, TB_OP_VARINT, 0, 7, -1 }, // 0xFF
+};
+
+// magnitude, negated when sign is -1, without a branch (in unsigned arithmetic, it may wrap)
+static inline int64_t _tb_signed(uint64_t magnitude, int8_t sign){
+    uint64_t mask = (uint64_t)(int64_t)sign;
+    return (int64_t)((magnitude ^ mask) - mask);
 }
 
-static inline enum tiny_bits_type _unpack_double(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        if (tag == TB_F64_TAG) { // Raw double
-            if(pos + 8 > decoder->size) return TINY_BITS_ERROR;
-            uint64_t number = decode_uint64(decoder->buffer + pos);
-            value->double_val = itod_bits(number);
-            decoder->current_pos += 8;
-        } else { // Compressed double
-            uint8_t read;
-            uint64_t number;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &number);
-            if(read == 0) return TINY_BITS_ERROR;
-            int order = (tag & 0x0F); 
-            double fractional = (double)number / powers[order];
-            if(tag & 0x10) fractional = -fractional;        
-            value->double_val = fractional;
-            decoder->current_pos += read;
-        }
-        return TINY_BITS_DOUBLE;
+// Reads the varint following a tag, returns its size (0 on error)
+static inline uint8_t _unpack_varint(tiny_bits_unpacker *decoder, uint64_t *number){
+    uint8_t read = decode_varint(decoder->buffer, decoder->size, decoder->current_pos, number);
+    decoder->current_pos += read;
+    return read;
 }
 
 static inline enum tiny_bits_type _unpack_datetime(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
     size_t pos = decoder->current_pos;
-    if(pos + 8 > decoder->size) return TINY_BITS_ERROR;
+    if(pos + 9 > decoder->size) return TINY_BITS_ERROR;
     value->datetime_val.offset = decoder->buffer[pos] * (60*15); // convert offset back to seconds (from multiples of 15 minutes)
     uint64_t unixtime = decode_uint64(decoder->buffer + pos + 1);
     value->datetime_val.unixtime = itod_bits(unixtime);
@@ -222,68 +649,330 @@ static inline enum tiny_bits_type _unpack_blob(tiny_bits_unpacker *decoder, uint
         size_t read; 
         read = decode_varint(decoder->buffer, decoder->size, pos, &len);
         if(read == 0) return TINY_BITS_ERROR;
-        if((pos + read + len) > decoder->size) return TINY_BITS_ERROR; 
-        value->str_blob_val.data =  (const char *)decoder->buffer + pos;
+        if(len > decoder->size - pos - read) return TINY_BITS_ERROR; 
+        value->str_blob_val.data =  (const char *)decoder->buffer + pos + read;
         value->str_blob_val.length = len; 
         decoder->current_pos = pos + read + len;
         return TINY_BITS_BLOB;
 }
 
-static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
-        size_t pos = decoder->current_pos;
-        size_t len;
-        if (tag < 0x5F) { // Small string (0-30)
-            len = tag & 0x1F;
-            if(pos + len > decoder->size) return TINY_BITS_ERROR;
-            value->str_blob_val.data =  (const char *)decoder->buffer + pos;
-            value->str_blob_val.length = len; 
-            decoder->current_pos += len;
-        } else if (tag == 0x5F) { // Large string
-            size_t read;
-            read = decode_varint(decoder->buffer, decoder->size, pos, &len);
-            if(read == 0) return TINY_BITS_ERROR;
-            len += 31;
-            if(pos + read + len > decoder->size) return TINY_BITS_ERROR;
-            value->str_blob_val.data =  (const char *)decoder->buffer + pos;
-            value->str_blob_val.length = len; 
-            decoder->current_pos += (read + len);
-        } else { // Deduplicated (small: < 0x7F, large: 0x7F)
-            size_t id;
-            size_t read;
-            if(tag < 0x7F){
-                id = tag & 0x1F;
-            }else {
-                read = decode_varint(decoder->buffer, decoder->size, pos, &id);
-                if(read == 0) return TINY_BITS_ERROR;
-                id += 31; 
-                decoder->current_pos += read; // Update pos after varint
-            } 
-            if (id >= decoder->strings_count) return TINY_BITS_ERROR;
-            len = decoder->strings[id].length;
-            value->str_blob_val.data = decoder->strings[id].str;
-            value->str_blob_val.length = len;
-            value->str_blob_val.id = id + 1;
-            return TINY_BITS_STR;
+// Doubles the room for numbered strings, kept out of the decoding paths
+static TB_NOINLINE int _unpacker_grow_strings(tiny_bits_unpacker *decoder){
+        size_t new_size = decoder->strings_size * 2;
+        void *new_strings = _tb_realloc(decoder->allocator, decoder->strings, new_size * sizeof(*decoder->strings));
+        if (!new_strings) return 0;
+        decoder->strings = new_strings;
+        decoder->strings_size = new_size;
+        return 1;
+}
+
+// Numbers a string that may be referenced later, returns its id (negative) or 0 on allocation failure
+static inline int32_t _unpacker_number_string(tiny_bits_unpacker *decoder, const char *str, size_t len){
+        if (decoder->strings_count >= decoder->strings_size && !_unpacker_grow_strings(decoder)) return 0;
+        if (decoder->session) {
+            char *copy = _unpacker_keep_string(decoder, str, len);
+            if (!copy) return 0;
+            decoder->strings[decoder->strings_count].str = copy;
+        } else {
+            decoder->strings[decoder->strings_count].str = (char *)str;
+        }
+        decoder->strings[decoder->strings_count].length = len;
+        decoder->strings_count++;
+        return -1 * (int32_t)decoder->strings_count;
+}
+
+// Where the token at pos ends, 0 when it goes on past the end of the buffer and SIZE_MAX when it is malformed
+static inline size_t _unpacker_token_end(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    uint64_t length;
+    uint8_t read;
+    if (pos >= size) return 0;
+    uint8_t tag = buffer[pos++];
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    if (info->op == TB_OP_INLINE || info->op == TB_OP_REF) return pos;
+    if (pos >= size) return 0;
+    switch (info->op) {
+    case TB_OP_VARINT:
+    case TB_OP_REF_VARINT:
+    case TB_OP_FP:
+        length = varint_length(buffer[pos]);
+        break;
+    case TB_OP_STR:
+        length = tag & info->mask;
+        break;
+    case TB_OP_STR_VARINT:
+    case TB_OP_BLOB:
+        if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+        pos += read;
+        if (info->op == TB_OP_STR_VARINT) {
+            if (length > SIZE_MAX - info->bias) return SIZE_MAX;
+            length += info->bias;
         }
+        break;
+    case TB_OP_F16: length = 2; break;
+    case TB_OP_F32: length = 4; break;
+    case TB_OP_F64: length = 8; break;
+    case TB_OP_DATETIME: length = 9; break;
+    case TB_OP_NXT: {
+        // packed array: count, scale for doubles, width, base, then the bits
+        uint8_t kind = buffer[pos++];
+        if (kind == TB_NXT_RST) return pos;
+        if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) return SIZE_MAX;
+        if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+        pos += read;
+        size_t header = kind == TB_NXT_PKD ? 2 : 1;
+        if (header > size - pos) return 0;
+        uint8_t width = buffer[pos + header - 1];
+        pos += header;
+        if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+        pos += varint_length(buffer[pos]);
+        if (width > 64 || length > (1ULL << 56)) return SIZE_MAX;
+        length = (length * width + 7) / 8;
+        break;
+    }
+    default:
+        return SIZE_MAX;
+    }
+    return length > size - pos ? 0 : pos + length;
+}
+
+// Whether the value at pos goes on past the end of the buffer, rather than being malformed
+static inline int _unpacker_incomplete(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) pos += 2;
+    return _unpacker_token_end(decoder, pos) == 0;
+}
+
+// Same for the value at pos with everything it contains, without numbering or forgetting strings on the way:
+// an incremental unpacker checks it before decoding a whole value, so that it never stops halfway through one
+static TB_NOINLINE int _unpacker_incomplete_value(const tiny_bits_unpacker *decoder, size_t pos){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    size_t count = 1;
+    while (count) {
+        size_t end = _unpacker_token_end(decoder, pos);
+        if (end == 0) return 1;
+        if (end == SIZE_MAX) return 0;
+        uint8_t tag = buffer[pos];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length = tag & info->mask;
+        if (info->op == TB_OP_NXT && buffer[pos + 1] == TB_NXT_RST) {
+            pos = end; // not a value
+            continue;
+        }
+        count--;
+        if (info->type <= TINY_BITS_MAP && info->op == TB_OP_VARINT) {
+            if (!decode_varint(buffer, size, pos + 1, &length)) return 0;
+            if (length > size) return 1;
+            length += info->bias;
+        }
+        pos = end;
+        if (info->type > TINY_BITS_MAP || (info->op != TB_OP_INLINE && info->op != TB_OP_VARINT)) continue;
+        // every value takes a byte at least, more of them than bytes left cannot all be there yet
+        if (length > size - pos) return 1;
+        count += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (count > size - pos) return 1;
+    }
+    return 0;
+}
+
+// Whether an incremental unpacker has only part of the next value, for those decoding values as a whole
+static inline int _unpacker_awaits(const tiny_bits_unpacker *decoder){
+    return decoder->stream && decoder->current_pos < decoder->size && _unpacker_incomplete_value(decoder, decoder->current_pos);
+}
+
+// A value that failed at start: when an incremental unpacker has only part of it, it is read again once more input came
+static TB_NOINLINE enum tiny_bits_type _unpacker_cut_short(tiny_bits_unpacker *decoder, size_t start){
+    if (!decoder->stream || !_unpacker_incomplete(decoder, start)) return TINY_BITS_ERROR;
+    decoder->current_pos = start;
+    return TINY_BITS_NEED_MORE;
+}
+
+// A string of len bytes sent inline (its tag at start), numbered when it may be referenced later
+static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint64_t len, tiny_bits_value *value, size_t start){
+        size_t pos = decoder->current_pos;
+        if(len > decoder->size - pos) return _unpacker_cut_short(decoder, start);
+        value->str_blob_val.data =  (const char *)decoder->buffer + pos;
+        value->str_blob_val.length = len; 
         value->str_blob_val.id = 0;
-        // Handle new string (not deduplicated)
-        if(decoder->strings_count < TB_HASH_CACHE_SIZE && len >= 2 && len <= 128){
-            if (decoder->strings_count >= decoder->strings_size) {
-                size_t new_size = decoder->strings_size * 2;
-                void *new_strings = realloc(decoder->strings, new_size * sizeof(*decoder->strings));
-                if (!new_strings) return TINY_BITS_ERROR;
-                decoder->strings = new_strings;
-                decoder->strings_size = new_size;
-            }
-            
-            decoder->strings[decoder->strings_count].str =  (char *)decoder->buffer + pos;
-            decoder->strings[decoder->strings_count].length = len;
-            decoder->strings_count++;
-            value->str_blob_val.id = -1 * decoder->strings_count;
+        decoder->current_pos += len;
+        // every deduplicatable string gets an id since the packer may be configured to deduplicate
+        // any number of them (see tiny_bits_packer_set_dedupe_limit())
+        if(len >= 2 && len <= 128){
+            value->str_blob_val.id = _unpacker_number_string(decoder, (const char *)decoder->buffer + pos, len);
+            if (!value->str_blob_val.id) return TINY_BITS_ERROR;
         }
         return TINY_BITS_STR;
 }
 
+// A deduplicated string, the id-th one numbered so far
+static inline enum tiny_bits_type _unpack_ref(tiny_bits_unpacker *decoder, uint64_t id, tiny_bits_value *value){
+        if (id >= decoder->strings_count) return TINY_BITS_ERROR;
+        value->str_blob_val.data = decoder->strings[id].str;
+        value->str_blob_val.length = decoder->strings[id].length;
+        value->str_blob_val.id = id + 1;
+        return TINY_BITS_STR;
+}
+
+static inline enum tiny_bits_type unpack_value(tiny_bits_unpacker *decoder, tiny_bits_value *value);
+
+// Where a value starts, to go back to it with _unpacker_rewind()
+typedef struct tiny_bits_unpacker_mark {
+    size_t start;
+    size_t strings_count;
+    tiny_bits_string_block *block; // the newest block of string copies and how much of it was used
+    size_t used;
+    uint32_t resets;
+} tiny_bits_unpacker_mark;
+
+static inline void _unpacker_mark(const tiny_bits_unpacker *decoder, tiny_bits_unpacker_mark *mark){
+    mark->start = decoder->current_pos;
+    mark->strings_count = decoder->strings_count;
+    mark->block = decoder->string_blocks;
+    mark->used = mark->block ? mark->block->used : 0;
+    mark->resets = decoder->resets;
+}
+
+// Back to a mark, forgetting the strings numbered since and their copies. When the strings were reset in
+// between only the position goes back: those before the reset are gone, and reading it again resets them again
+static TB_NOINLINE void _unpacker_restore(tiny_bits_unpacker *decoder, const tiny_bits_unpacker_mark *mark){
+    decoder->current_pos = mark->start;
+    if (decoder->resets != mark->resets) return;
+    decoder->strings_count = mark->strings_count;
+    while (decoder->string_blocks != mark->block) {
+        tiny_bits_string_block *next = decoder->string_blocks->next;
+        _tb_free(decoder->allocator, decoder->string_blocks);
+        decoder->string_blocks = next;
+    }
+    if (mark->block) mark->block->used = mark->used;
+}
+
+// Gives up on a value of an incremental unpacker that went on past the input: back to its mark, to read it
+// again once more input came. TINY_BITS_ERROR otherwise, or when the strings were reset within the value
+static TB_NOINLINE enum tiny_bits_type _unpacker_rewind(tiny_bits_unpacker *decoder, const tiny_bits_unpacker_mark *mark){
+    if (!decoder->stream || decoder->resets != mark->resets) return TINY_BITS_ERROR;
+    _unpacker_restore(decoder, mark);
+    return TINY_BITS_NEED_MORE;
+}
+
+static inline enum tiny_bits_type _unpack_packed(tiny_bits_unpacker *decoder, uint8_t kind, tiny_bits_value *value){
+        size_t pos = decoder->current_pos;
+        uint64_t count, base;
+        uint8_t read = decode_varint(decoder->buffer, decoder->size, pos, &count);
+        if(read == 0) return TINY_BITS_ERROR;
+        pos += read;
+        const uint8_t *data = decoder->buffer + pos;
+        if (kind == TB_NXT_PKD) {
+            if(pos >= decoder->size) return TINY_BITS_ERROR;
+            uint8_t scale = decoder->buffer[pos++];
+            if(scale > 12 && scale != TB_PACKED_RAW) return TINY_BITS_ERROR;
+        }
+        if(pos >= decoder->size) return TINY_BITS_ERROR;
+        uint8_t width = decoder->buffer[pos++];
+        if(width > 64) return TINY_BITS_ERROR;
+        read = decode_varint(decoder->buffer, decoder->size, pos, &base);
+        if(read == 0) return TINY_BITS_ERROR;
+        pos += read;
+        if(count > (1ULL << 56)) return TINY_BITS_ERROR;
+        uint64_t bits_size = (count * width + 7) / 8;
+        if(bits_size > decoder->size - pos) return TINY_BITS_ERROR;
+        value->packed_val.data = data;
+        value->packed_val.count = count;
+        value->packed_val.kind = kind;
+        decoder->current_pos = pos + bits_size;
+        return kind == TB_NXT_PKI ? TINY_BITS_PACKED_INT : TINY_BITS_PACKED_DOUBLE;
+}
+
+static inline enum tiny_bits_type _unpack_nxt(tiny_bits_unpacker *decoder, tiny_bits_value *value){
+        if(decoder->current_pos >= decoder->size) return TINY_BITS_ERROR;
+        uint8_t ext = decoder->buffer[decoder->current_pos++];
+        if (ext == TB_NXT_RST) { // not a value, forget the strings and go on with the next one
+            _unpacker_clear_strings(decoder);
+            // a run of markers is consumed here, the value after it is not one (no recursion for each)
+            const uint8_t *buffer = decoder->buffer;
+            size_t pos = decoder->current_pos;
+            while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) pos += 2;
+            decoder->current_pos = pos;
+            return unpack_value(decoder, value);
+        }
+        if (ext == TB_NXT_PKI || ext == TB_NXT_PKD) {
+            return _unpack_packed(decoder, ext, value);
+        }
+        return TINY_BITS_ERROR; // Unknown native extension
+}
+
+// Unpacks the value following a tag (already read), dispatching on tag_table
+static inline enum tiny_bits_type _unpack_tag(tiny_bits_unpacker *decoder, uint8_t tag, tiny_bits_value *value){
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    size_t pos = decoder->current_pos;
+    const uint8_t *p = decoder->buffer + pos;
+    uint64_t number;
+    enum tiny_bits_type type;
+    switch (info->op) {
+    case TB_OP_INLINE:
+        value->int_val = _tb_signed(tag & info->mask, info->sign);
+        return (enum tiny_bits_type)info->type;
+    case TB_OP_VARINT:
+        if (!_unpack_varint(decoder, &number)) goto fail;
+        // lengths share the storage of int_val
+        value->int_val = _tb_signed(number + info->bias, info->sign);
+        return (enum tiny_bits_type)info->type;
+    case TB_OP_STR:
+        return _unpack_str(decoder, tag & info->mask, value, pos - 1);
+    case TB_OP_STR_VARINT:
+        if (!_unpack_varint(decoder, &number) || number > SIZE_MAX - info->bias) goto fail;
+        return _unpack_str(decoder, number + info->bias, value, pos - 1);
+    case TB_OP_REF:
+        type = _unpack_ref(decoder, tag & info->mask, value);
+        break;
+    case TB_OP_REF_VARINT:
+        if (!_unpack_varint(decoder, &number) || number > SIZE_MAX - info->bias) goto fail;
+        type = _unpack_ref(decoder, number + info->bias, value);
+        break;
+    case TB_OP_FP: {
+        if (!_unpack_varint(decoder, &number)) goto fail;
+        double fractional = (double)number / powers[tag & info->mask];
+        value->double_val = (tag & 0x10) ? -fractional : fractional;
+        return TINY_BITS_DOUBLE;
+    }
+    case TB_OP_F16:
+        if (pos + 2 > decoder->size) goto fail;
+        value->double_val = half_to_double((uint16_t)((p[0] << 8) | p[1]));
+        decoder->current_pos += 2;
+        return TINY_BITS_DOUBLE;
+    case TB_OP_F32: {
+        if (pos + 4 > decoder->size) goto fail;
+        uint32_t bits = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        float number32;
+        memcpy(&number32, &bits, 4);
+        value->double_val = number32;
+        decoder->current_pos += 4;
+        return TINY_BITS_DOUBLE;
+    }
+    case TB_OP_F64:
+        if (pos + 8 > decoder->size) goto fail;
+        value->double_val = itod_bits(decode_uint64(p));
+        decoder->current_pos += 8;
+        return TINY_BITS_DOUBLE;
+    case TB_OP_BLOB:
+        type = _unpack_blob(decoder, tag, value);
+        break;
+    case TB_OP_DATETIME:
+        type = _unpack_datetime(decoder, tag, value);
+        break;
+    case TB_OP_NXT:
+        type = _unpack_nxt(decoder, value);
+        break;
+    default:
+        goto fail; // Unknown tag
+    }
+    if (type != TINY_BITS_ERROR) return type;
+fail:
+    // malformed, or cut short by the end of the input of an incremental unpacker
+    return _unpacker_cut_short(decoder, pos - 1);
+}
+
 /**
  * @brief Unpacks a value and returns its type while setting its value
  *
@@ -299,6 +988,9 @@ static inline enum tiny_bits_type _unpack_str(tiny_bits_unpacker *decoder, uint8
  * TINY_BITS_SEP means the current object was fully unpacked, and that there is potentially another one
  * this is specifically for stream unpacking multiple objects one after the other as they are being recieved 
  *
+ * TINY_BITS_NEED_MORE means an incremental unpacker (see tiny_bits_unpacker_append()) has only the start of
+ * the next value, it is left before it and unpacks it once the rest is appended
+ *
  * The location of the value you need in the value union will depend on the returned type as follows
  * 
  * TINY_BITS_TRUE, TINY_BITS_FALSE, TINY_BITS_NULL, TINY_BITS_NAN, TINY_BITS_INF & TINY_BITS_N_INF all
@@ -327,41 +1019,358 @@ static inline enum tiny_bits_type unpack_value(tiny_bits_unpacker *decoder, tiny
     if (!decoder || !value || decoder->current_pos >= decoder->size) {
         return (decoder && decoder->current_pos >= decoder->size) ? TINY_BITS_FINISHED : TINY_BITS_ERROR;
     }
-
+    size_t start = decoder->current_pos;
     uint8_t tag = decoder->buffer[decoder->current_pos++];
-    // Dispatch based on tag
-    if ((tag & TB_INT_TAG) == TB_INT_TAG) { // Integers
-        return _unpack_int(decoder, tag, value);
-    } else if ((tag & TB_STR_TAG) == TB_STR_TAG) { // Strings
-        return _unpack_str(decoder, tag, value);
-    } else if (tag == TB_NIL_TAG) {
-        return TINY_BITS_NULL;
-    } else if (tag == TB_NAN_TAG) {
-        return TINY_BITS_NAN;
-    } else if (tag == TB_INF_TAG) {
-        return TINY_BITS_INF;
-    } else if (tag == TB_NNF_TAG) {
-        return TINY_BITS_N_INF;
-    } else if ((tag & TB_DBL_TAG) == TB_DBL_TAG) { // Doubles
-        return _unpack_double(decoder, tag, value);
-    } else if ((tag & TB_MAP_TAG) == TB_MAP_TAG) { // Maps
-        return _unpack_map(decoder, tag, value);
-    } else if ((tag & TB_ARR_TAG) == TB_ARR_TAG) { // Arrays
-        return _unpack_arr(decoder, tag, value);
-    } else if (tag == TB_BLB_TAG) { // Blob
-        return _unpack_blob(decoder, tag, value);
-    } else if (tag == TB_DTM_TAG) {
-        return _unpack_datetime(decoder, tag, value);
-    } else if (tag == TB_SEP_TAG) {
-        return TINY_BITS_SEP;
-    } else if (tag == TB_EXT_TAG) {
-        return TINY_BITS_EXT;
-    } else if (tag == TB_TRU_TAG) {
-        return TINY_BITS_TRUE;
-    } else if (tag == TB_FLS_TAG) {
-        return TINY_BITS_FALSE;
+    const tiny_bits_tag_info *info = &tag_table[tag];
+    if (info->op == TB_OP_INLINE) {
+        // the most common values (small integers, short array and map headers, constants) without a branch
+        value->int_val = _tb_signed(tag & info->mask, info->sign);
+        return (enum tiny_bits_type)info->type;
+    }
+    // short strings and references come next, the rest goes through the full dispatch
+    if (info->op == TB_OP_STR) return _unpack_str(decoder, tag & info->mask, value, start);
+    if (info->op == TB_OP_REF) return _unpack_ref(decoder, tag & info->mask, value);
+    return _unpack_tag(decoder, tag, value);
+}
+
+// Skips count values and everything they contain, returns 0 on malformed input
+static inline int _skip_values(tiny_bits_unpacker *decoder, size_t count){
+    const uint8_t *buffer = decoder->buffer;
+    size_t size = decoder->size;
+    size_t pos = decoder->current_pos;
+    tiny_bits_value scratch;
+    while (count) {
+        if (pos >= size) return 0;
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length;
+        uint8_t read;
+        count--;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) continue;
+            length = tag & info->mask;
+            break;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) return 0;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) continue;
+            length += info->bias;
+            break;
+        case TB_OP_STR:
+            length = tag & info->mask;
+            if (length > size - pos) return 0;
+            // strings are jumped over but still numbered, for later references to them
+            if (length >= 2 && !_unpacker_number_string(decoder, (const char *)buffer + pos, length)) return 0;
+            pos += length;
+            continue;
+        case TB_OP_REF:
+            if ((size_t)(tag & info->mask) >= decoder->strings_count) return 0;
+            continue;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) return 0;
+            pos += varint_length(buffer[pos]);
+            continue;
+        case TB_OP_F64:
+            if (8 > size - pos) return 0;
+            pos += 8;
+            continue;
+        case TB_OP_NXT:
+            if (pos < size && buffer[pos] == TB_NXT_RST) {
+                // not a value
+                _unpacker_clear_strings(decoder);
+                pos++;
+                count++;
+                continue;
+            }
+            // fall through
+        default:
+            decoder->current_pos = pos;
+            enum tiny_bits_type type = _unpack_tag(decoder, tag, &scratch);
+            if (type == TINY_BITS_ERROR || type == TINY_BITS_NEED_MORE) return 0;
+            pos = decoder->current_pos;
+            continue;
+        }
+        // every value takes a byte at least, larger counts can only be malformed
+        if (length > size) return 0;
+        count += info->type == TINY_BITS_MAP ? 2 * length : length;
+        if (count > size - pos) return 0;
+    }
+    decoder->current_pos = pos;
+    return 1;
+}
+
+// Accounts for a value read at the current depth, opening its container if it has values
+static inline int _unpacker_track(tiny_bits_unpacker *decoder, enum tiny_bits_type type, size_t length){
+    if (decoder->depth) decoder->frames[decoder->depth - 1]--;
+    if ((type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) && length) {
+        if (decoder->depth == TB_MAX_DEPTH || length > SIZE_MAX / 2) return 0;
+        decoder->frames[decoder->depth++] = type == TINY_BITS_MAP ? 2 * length : length;
+    }
+    while (decoder->depth && decoder->frames[decoder->depth - 1] == 0) decoder->depth--;
+    return 1;
+}
+
+/**
+ * @brief Unpacks a value like unpack_value(), keeping track of the containers it is in
+ *
+ * @param decoder The unpacker instance
+ * @param[out] value A supplied tiny_bits_value instance
+ * @return enum tiny_bits_type, TINY_BITS_ERROR as well when containers nest deeper than TB_MAX_DEPTH
+ *
+ * @note Use it instead of unpack_value() along with tiny_bits_skip_value() and tiny_bits_leave_container(),
+ * so that tiny_bits_unpacker_depth() stays accurate
+ */
+static inline enum tiny_bits_type tiny_bits_read_value(tiny_bits_unpacker *decoder, tiny_bits_value *value){
+    enum tiny_bits_type type = unpack_value(decoder, value);
+    if (type == TINY_BITS_ERROR || type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) return type;
+    size_t length = (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) ? value->length : 0;
+    return _unpacker_track(decoder, type, length) ? type : TINY_BITS_ERROR;
+}
+
+/**
+ * @brief Skips the next value, with everything it contains when it is an array or a map
+ *
+ * @param decoder The unpacker instance
+ * @return The type of the skipped value, TINY_BITS_FINISHED at the end of the buffer or TINY_BITS_ERROR
+ * on malformed input. An incremental unpacker returns TINY_BITS_NEED_MORE, skipping nothing, until all of the
+ * value is there.
+ *
+ * @note Nothing is materialized, but skipped strings are still numbered so that later references to
+ * them resolve. Costs about a tag lookup per value, strings and blobs are jumped over.
+ */
+static inline enum tiny_bits_type tiny_bits_skip_value(tiny_bits_unpacker *decoder){
+    if (!decoder) return TINY_BITS_ERROR;
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    const uint8_t *buffer = decoder->buffer;
+    size_t pos = decoder->current_pos;
+    while (pos + 1 < decoder->size && buffer[pos] == TB_NXT_TAG && buffer[pos + 1] == TB_NXT_RST) {
+        _unpacker_clear_strings(decoder);
+        pos += 2;
+    }
+    decoder->current_pos = pos;
+    if (pos >= decoder->size) return TINY_BITS_FINISHED;
+    enum tiny_bits_type type = (enum tiny_bits_type)tag_table[buffer[pos]].type;
+    if (buffer[pos] == TB_NXT_TAG && pos + 1 < decoder->size) {
+        type = buffer[pos + 1] == TB_NXT_PKI ? TINY_BITS_PACKED_INT : TINY_BITS_PACKED_DOUBLE;
+    }
+    if (!_skip_values(decoder, 1)) return TINY_BITS_ERROR;
+    _unpacker_track(decoder, type, 0);
+    return type;
+}
+
+/**
+ * @brief Skips what is left of the innermost container opened by tiny_bits_read_value()
+ *
+ * @param decoder The unpacker instance
+ * @return 1 on success, the next value read is the one following the container, 0 on malformed input
+ * or when no container is open
+ */
+static inline int tiny_bits_leave_container(tiny_bits_unpacker *decoder){
+    if (!decoder || !decoder->depth) return 0;
+    if (!_skip_values(decoder, decoder->frames[decoder->depth - 1])) return 0;
+    decoder->frames[decoder->depth - 1] = 0;
+    while (decoder->depth && decoder->frames[decoder->depth - 1] == 0) decoder->depth--;
+    return 1;
+}
+
+/**
+ * @brief Number of containers tiny_bits_read_value() is in, 0 at the top level
+ *
+ * @param decoder The unpacker instance
+ */
+static inline uint32_t tiny_bits_unpacker_depth(const tiny_bits_unpacker *decoder){
+    return decoder ? decoder->depth : 0;
+}
+
+// Decodes a packed array (validated by unpack_value()) into either ints or doubles
+static inline void _unpack_packed_values(const tiny_bits_value *value, int64_t *ints, double *doubles){
+    const uint8_t *data = value->packed_val.data;
+    size_t count = value->packed_val.count;
+    uint8_t scale = 0;
+    uint64_t base;
+    if (value->packed_val.kind == TB_NXT_PKD) scale = *data++;
+    uint8_t width = *data++;
+    data += decode_varint(data, varint_length(*data), 0, &base); // validated by _unpack_packed()
+    int64_t first = zigzag_decode(base);
+
+    size_t bits_size = (count * width + 7) / 8;
+    uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    size_t bit = 0;
+    for (size_t i = 0; i < count; i++, bit += width) {
+        size_t pos = bit >> 3;
+        unsigned shift = bit & 7;
+        uint64_t word = 0;
+        if (pos + 8 <= bits_size) {
+            word = _load_le64(data + pos) >> shift;
+            // a value may spill into a ninth byte
+            if (shift + width > 64) word |= (uint64_t)data[pos + 8] << (64 - shift);
+        } else {
+            for (size_t b = pos; b < bits_size; b++) word |= (uint64_t)data[b] << (8 * (b - pos));
+            word >>= shift;
+        }
+        int64_t integer = (int64_t)((uint64_t)first + (word & mask));
+        if (ints) {
+            ints[i] = integer;
+        } else if (scale == TB_PACKED_RAW) {
+            doubles[i] = itod_bits((uint64_t)integer);
+        } else {
+            doubles[i] = (double)integer / powers[scale];
+        }
+    }
+}
+
+/**
+ * @brief Decodes a packed integer array
+ * 
+ * @param value A value of type TINY_BITS_PACKED_INT returned by unpack_value()
+ * @param values Where to store the integers, room for value->packed_val.count of them
+ * @return 1 on success, 0 if value is not a packed integer array
+ *
+ * @note The packed data is read from the unpacker buffer, which must still be around
+ */
+static inline int unpack_packed_ints(const tiny_bits_value *value, int64_t *values){
+    if (!value || value->packed_val.kind != TB_NXT_PKI) return 0;
+    _unpack_packed_values(value, values, NULL);
+    return 1;
+}
+
+/**
+ * @brief Decodes a packed double (or integer) array
+ * 
+ * @param value A value of type TINY_BITS_PACKED_DOUBLE or TINY_BITS_PACKED_INT returned by unpack_value()
+ * @param values Where to store the doubles, room for value->packed_val.count of them
+ * @return 1 on success, 0 if value is not a packed array
+ *
+ * @note The packed data is read from the unpacker buffer, which must still be around
+ */
+static inline int unpack_packed_doubles(const tiny_bits_value *value, double *values){
+    if (!value || (value->packed_val.kind != TB_NXT_PKD && value->packed_val.kind != TB_NXT_PKI)) return 0;
+    _unpack_packed_values(value, NULL, values);
+    return 1;
+}
+
+/**
+ * @brief Unpacks an array of integers, as packed by pack_int_array() (or pack_arr() and pack_int() calls)
+ * or pack_packed_ints()
+ * 
+ * @param decoder The unpacker instance
+ * @param values Where to store the integers
+ * @param max_count Capacity of values
+ * @param count Set to the number of integers in the array
+ * @return TINY_BITS_ARRAY on success, TINY_BITS_ERROR if the next value is not an array of integers
+ * or it has more than max_count elements (TINY_BITS_NEED_MORE if it goes on past the input of an incremental
+ * unpacker), the unpacker (position and numbered strings) is left as it was in that case
+ *
+ * @note Runs of small positive integers (one byte each) are decoded eight at a time
+ */
+static inline enum tiny_bits_type unpack_int_array(tiny_bits_unpacker *decoder, int64_t *values, size_t max_count, size_t *count){
+    if (!decoder || !count) return TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark start; // a string read first was numbered, going back forgets it
+    _unpacker_mark(decoder, &start);
+    size_t at = start.start; // the value being read, to tell a short input from a malformed one
+    tiny_bits_value value;
+    enum tiny_bits_type type = unpack_value(decoder, &value);
+    if (type == TINY_BITS_PACKED_INT) {
+        if (value.packed_val.count > max_count) goto fail;
+        unpack_packed_ints(&value, values);
+        *count = value.packed_val.count;
+        return TINY_BITS_ARRAY;
+    }
+    if (type != TINY_BITS_ARRAY || value.length > max_count) goto fail;
+    size_t length = value.length;
+    const uint8_t *buffer = decoder->buffer;
+    for (size_t i = 0; i < length; i++) {
+        at = decoder->current_pos;
+        if (decoder->current_pos >= decoder->size) goto fail;
+        uint8_t tag = buffer[decoder->current_pos];
+        if (tag >= 128 && tag < 248 && i + 8 <= length && decoder->current_pos + 8 <= decoder->size) {
+            uint64_t word;
+            memcpy(&word, buffer + decoder->current_pos, 8);
+            // are all eight bytes small positive int tags? 0x80 to 0xF7: high bit set and not 0xF8 or above
+            uint64_t big = (word & 0xF8F8F8F8F8F8F8F8ULL) ^ 0xF8F8F8F8F8F8F8F8ULL; // zero bytes mark 0xF8 or above
+            uint64_t has_big = (big - 0x0101010101010101ULL) & ~big & 0x8080808080808080ULL;
+            if ((word & 0x8080808080808080ULL) == 0x8080808080808080ULL && !has_big) {
+                const uint8_t *tags = buffer + decoder->current_pos;
+                for (int j = 0; j < 8; j++) values[i + j] = tags[j] - 128;
+                decoder->current_pos += 8;
+                i += 7;
+                continue;
+            }
+        }
+        decoder->current_pos++;
+        if (tag_table[tag].type != TINY_BITS_INT || _unpack_tag(decoder, tag, &value) != TINY_BITS_INT) goto fail;
+        values[i] = value.int_val;
+    }
+    *count = length;
+    return TINY_BITS_ARRAY;
+fail:
+    _unpacker_restore(decoder, &start);
+    // an incremental unpacker may only be missing the rest of the array
+    return decoder->stream && _unpacker_incomplete(decoder, at) ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;
+}
+
+/**
+ * @brief Unpacks an array of doubles, as packed by pack_double_array() (or pack_arr() and pack_double() calls)
+ * or pack_packed_doubles()
+ * 
+ * @param decoder The unpacker instance
+ * @param values Where to store the doubles
+ * @param max_count Capacity of values
+ * @param count Set to the number of doubles in the array
+ * @return TINY_BITS_ARRAY on success, TINY_BITS_ERROR if the next value is not an array of numbers
+ * or it has more than max_count elements (TINY_BITS_NEED_MORE if it goes on past the input of an incremental
+ * unpacker), the unpacker (position and numbered strings) is left as it was in that case
+ *
+ * @note NaN and infinities are returned as such, integer elements are converted to double
+ */
+static inline enum tiny_bits_type unpack_double_array(tiny_bits_unpacker *decoder, double *values, size_t max_count, size_t *count){
+    if (!decoder || !count) return TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark start; // a string read first was numbered, going back forgets it
+    _unpacker_mark(decoder, &start);
+    size_t at = start.start; // the value being read, to tell a short input from a malformed one
+    tiny_bits_value value;
+    enum tiny_bits_type type = unpack_value(decoder, &value);
+    if (type == TINY_BITS_PACKED_DOUBLE || type == TINY_BITS_PACKED_INT) {
+        if (value.packed_val.count > max_count) goto fail;
+        unpack_packed_doubles(&value, values);
+        *count = value.packed_val.count;
+        return TINY_BITS_ARRAY;
+    }
+    if (type != TINY_BITS_ARRAY || value.length > max_count) goto fail;
+    size_t length = value.length;
+    for (size_t i = 0; i < length; i++) {
+        at = decoder->current_pos;
+        if (decoder->current_pos >= decoder->size) goto fail;
+        uint8_t tag = decoder->buffer[decoder->current_pos++];
+        switch (tag_table[tag].type) {
+        case TINY_BITS_INT:
+            if (_unpack_tag(decoder, tag, &value) != TINY_BITS_INT) goto fail;
+            values[i] = (double)value.int_val;
+            break;
+        case TINY_BITS_DOUBLE:
+            if (_unpack_tag(decoder, tag, &value) != TINY_BITS_DOUBLE) goto fail;
+            values[i] = value.double_val;
+            break;
+        case TINY_BITS_NAN:
+            values[i] = NAN;
+            break;
+        case TINY_BITS_INF:
+            values[i] = INFINITY;
+            break;
+        case TINY_BITS_N_INF:
+            values[i] = -INFINITY;
+            break;
+        default:
+            goto fail;
+        }
     }
-    return TINY_BITS_ERROR; // Unknown tag
+    *count = length;
+    return TINY_BITS_ARRAY;
+fail:
+    _unpacker_restore(decoder, &start);
+    // an incremental unpacker may only be missing the rest of the array
+    return decoder->stream && _unpacker_incomplete(decoder, at) ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;
 }
 
 #endif // TINY_BITS_UNPACKER_H
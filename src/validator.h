@@ -0,0 +1,190 @@
+#ifndef TINY_BITS_VALIDATOR_H
+#define TINY_BITS_VALIDATOR_H
+
+#include "unpacker.h"
+#include "dictionary.h"
+
+// What tiny_bits_validate() found wrong first
+enum tiny_bits_validity {
+    TINY_BITS_VALID,
+    TINY_BITS_INVALID_TAG,      // a separator inside a container, or an unknown native extension or packed scale
+    TINY_BITS_TRUNCATED,        // a value, or the elements of a container, go on past the buffer
+    TINY_BITS_INVALID_REF,      // a reference to a string not numbered yet
+    TINY_BITS_INVALID_COUNT,    // an array or map with more elements than bytes left to hold them
+    TINY_BITS_TOO_DEEP,         // containers nested deeper than the limit
+    TINY_BITS_TOO_LARGE         // over the size, length or value limit
+};
+
+// Budget for tiny_bits_validate(), 0 leaves a limit out
+typedef struct tiny_bits_limits {
+    uint32_t max_depth;     // deepest nesting of arrays and maps, at most (and 0 for) TB_MAX_DEPTH
+    size_t max_size;        // largest buffer
+    size_t max_values;      // most values in all, elements of containers included
+    size_t max_length;      // longest string or blob, most elements in an array, map (pairs) or packed array
+} tiny_bits_limits;
+
+/**
+ * @brief Checks that a buffer is well formed before decoding it, in a single pass without decoding values
+ *
+ * @param buffer The buffer, values (and messages, separated by pack_separator()) back to back
+ * @param size Size of the buffer
+ * @param dict The dictionary the buffer was packed with, NULL for none
+ * @param limits The budget, NULL for no other limit than TB_MAX_DEPTH
+ * @param offset Set to where the first problem is (to size when the buffer ends too early), NULL if not needed
+ * @return TINY_BITS_VALID, or what is wrong with the buffer
+ *
+ * @note Beyond what unpack_value() checks, arrays and maps must hold as many values as they declare, and
+ * separators may only come between values. A valid buffer decodes without TINY_BITS_ERROR, with
+ * tiny_bits_read_value() as well. References to strings of previous buffers of a session are invalid.
+ */
+static inline enum tiny_bits_validity tiny_bits_validate(const unsigned char *buffer, size_t size, const tiny_bits_dictionary *dict,
+                                                         const tiny_bits_limits *limits, size_t *offset) {
+    size_t frames[TB_MAX_DEPTH];    // values left in the containers around the innermost one
+    size_t left = SIZE_MAX;         // values left in the innermost container, never running out at the top
+    uint32_t depth = 0;
+    uint32_t max_depth = limits && limits->max_depth && limits->max_depth < TB_MAX_DEPTH ? limits->max_depth : TB_MAX_DEPTH;
+    size_t max_values = limits && limits->max_values ? limits->max_values : SIZE_MAX;
+    size_t max_length = limits && limits->max_length ? limits->max_length : SIZE_MAX;
+    size_t base = dict ? dict->table.next_id : 0;
+    size_t strings = base;  // strings numbered so far, as the unpacker numbers them
+    size_t values = 0;
+    size_t pos = 0, at = 0;
+    enum tiny_bits_validity result = TINY_BITS_VALID;
+    if (!buffer && size) {
+        result = TINY_BITS_TRUNCATED;
+        goto done;
+    }
+    if (limits && limits->max_size && size > limits->max_size) {
+        result = TINY_BITS_TOO_LARGE;
+        goto done;
+    }
+    while (pos < size) {
+        at = pos;
+        uint8_t tag = buffer[pos++];
+        const tiny_bits_tag_info *info = &tag_table[tag];
+        uint64_t length, id;
+        uint8_t read;
+        switch (info->op) {
+        case TB_OP_INLINE:
+            if (info->type > TINY_BITS_MAP) {
+                if (tag != TB_SEP_TAG) goto value;
+                // between messages, not a value
+                if (depth) { result = TINY_BITS_INVALID_TAG; goto done; }
+                continue;
+            }
+            length = tag & info->mask;
+            goto container;
+        case TB_OP_VARINT:
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+            pos += read;
+            if (info->type > TINY_BITS_MAP) goto value;
+            if (length > SIZE_MAX - info->bias) goto too_large;
+            length += info->bias;
+            goto container;
+        case TB_OP_STR:
+        case TB_OP_STR_VARINT:
+            length = tag & info->mask;
+            if (info->op == TB_OP_STR_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+                pos += read;
+                if (length > SIZE_MAX - info->bias) goto truncated;
+                length += info->bias;
+            }
+            if (length > max_length) goto too_large;
+            if (length > size - pos) goto truncated;
+            if (length >= 2 && length <= TB_DDP_STR_LEN_MAX) strings++;
+            pos += length;
+            goto value;
+        case TB_OP_REF:
+        case TB_OP_REF_VARINT:
+            id = tag & info->mask;
+            if (info->op == TB_OP_REF_VARINT) {
+                if (!(read = decode_varint(buffer, size, pos, &id))) goto truncated;
+                pos += read;
+                if (id > SIZE_MAX - info->bias) { result = TINY_BITS_INVALID_REF; goto done; }
+                id += info->bias;
+            }
+            if (id >= strings) { result = TINY_BITS_INVALID_REF; goto done; }
+            goto value;
+        case TB_OP_FP:
+            if (pos >= size || varint_length(buffer[pos]) > size - pos) goto truncated;
+            pos += varint_length(buffer[pos]);
+            goto value;
+        case TB_OP_F16: length = 2; goto jump;
+        case TB_OP_F32: length = 4; goto jump;
+        case TB_OP_F64: length = 8; goto jump;
+        case TB_OP_DATETIME: length = 9; goto jump;
+        case TB_OP_BLOB:
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated;
+            pos += read;
+            if (length > max_length) goto too_large;
+            goto jump;
+        case TB_OP_NXT: {
+            if (pos >= size) goto truncated;
+            uint8_t kind = buffer[pos++];
+            uint64_t count, width;
+            if (kind == TB_NXT_RST) {
+                // not a value, strings are numbered from scratch again
+                strings = base;
+                continue;
+            }
+            if (kind != TB_NXT_PKI && kind != TB_NXT_PKD) { result = TINY_BITS_INVALID_TAG; goto done; }
+            if (!(read = decode_varint(buffer, size, pos, &count))) goto truncated;
+            pos += read;
+            if (count > max_length) goto too_large;
+            if (kind == TB_NXT_PKD) {
+                if (pos >= size) goto truncated;
+                uint8_t scale = buffer[pos++];
+                if (scale > 12 && scale != TB_PACKED_RAW) { result = TINY_BITS_INVALID_TAG; goto done; }
+            }
+            if (pos >= size) goto truncated;
+            width = buffer[pos++];
+            if (width > 64) { result = TINY_BITS_INVALID_TAG; goto done; }
+            if (count > (1ULL << 56)) goto too_large;
+            if (!(read = decode_varint(buffer, size, pos, &length))) goto truncated; // base
+            pos += read;
+            length = (count * width + 7) / 8;
+            goto jump;
+        }
+        default:
+            result = TINY_BITS_INVALID_TAG;
+            goto done;
+        }
+    container:
+        // an array or a map of length elements (pairs)
+        if (length > max_length || ++values > max_values) goto too_large;
+        if (!length) goto counted;
+        if (depth == max_depth) { result = TINY_BITS_TOO_DEEP; goto done; }
+        // every value takes a byte at least
+        if (length > size || (info->type == TINY_BITS_MAP ? 2 * length : length) > size - pos) {
+            result = TINY_BITS_INVALID_COUNT;
+            goto done;
+        }
+        frames[depth++] = left - 1;
+        left = info->type == TINY_BITS_MAP ? 2 * length : length;
+        continue;
+    jump:
+        if (length > size - pos) goto truncated;
+        pos += length;
+    value:
+        if (++values > max_values) goto too_large;
+    counted:
+        // close the containers this value completed
+        if (--left == 0) {
+            do left = frames[--depth]; while (left == 0);
+        }
+    }
+    at = size;
+    if (depth) goto truncated;
+    goto done;
+truncated:
+    result = TINY_BITS_TRUNCATED;
+    goto done;
+too_large:
+    result = TINY_BITS_TOO_LARGE;
+done:
+    if (offset) *offset = result == TINY_BITS_VALID ? size : at;
+    return result;
+}
+
+#endif // TINY_BITS_VALIDATOR_H
@@ -0,0 +1,155 @@
+#ifndef TINY_BITS_WALKER_H
+#define TINY_BITS_WALKER_H
+
+#include "unpacker.h"
+
+/**
+ * Callbacks for tiny_bits_walk(), each returns 1 to go on and 0 to stop the walk. NULL callbacks are skipped,
+ * the values they would have been given go to on_value when it is set. Map elements come as key, value,
+ * key, value... between on_map_begin and on_map_end.
+ */
+typedef struct tiny_bits_visitor {
+    int (*on_int)(void *context, int64_t value);
+    int (*on_double)(void *context, double value);      // NaN and infinities too
+    int (*on_str)(void *context, const char *data, size_t length);
+    int (*on_blob)(void *context, const char *data, size_t length);
+    int (*on_bool)(void *context, int value);
+    int (*on_null)(void *context);
+    int (*on_datetime)(void *context, double unixtime, size_t offset);
+    int (*on_array_begin)(void *context, size_t length);
+    int (*on_array_end)(void *context);
+    int (*on_map_begin)(void *context, size_t length);  // number of key-value pairs
+    int (*on_map_end)(void *context);
+    // any other value (packed arrays, separators), and the ones above whose callback is NULL
+    int (*on_value)(void *context, enum tiny_bits_type type, const tiny_bits_value *value);
+} tiny_bits_visitor;
+
+// One open container while walking
+typedef struct tiny_bits_walk_frame {
+    size_t left;    // values still to come, keys and values for maps
+    uint8_t map;
+} tiny_bits_walk_frame;
+
+// Calls the visitor for one value, 0 when it stops the walk
+static TB_ALWAYS_INLINE int _walk_visit(const tiny_bits_visitor *visitor, void *context, enum tiny_bits_type type,
+                                        const tiny_bits_value *value) {
+    switch (type) {
+    case TINY_BITS_INT:
+        if (visitor->on_int) return visitor->on_int(context, value->int_val);
+        break;
+    case TINY_BITS_DOUBLE:
+        if (visitor->on_double) return visitor->on_double(context, value->double_val);
+        break;
+    case TINY_BITS_NAN:
+        if (visitor->on_double) return visitor->on_double(context, NAN);
+        break;
+    case TINY_BITS_INF:
+        if (visitor->on_double) return visitor->on_double(context, INFINITY);
+        break;
+    case TINY_BITS_N_INF:
+        if (visitor->on_double) return visitor->on_double(context, -INFINITY);
+        break;
+    case TINY_BITS_STR:
+        if (visitor->on_str) return visitor->on_str(context, value->str_blob_val.data, value->str_blob_val.length);
+        break;
+    case TINY_BITS_BLOB:
+        if (visitor->on_blob) return visitor->on_blob(context, value->str_blob_val.data, value->str_blob_val.length);
+        break;
+    case TINY_BITS_TRUE:
+    case TINY_BITS_FALSE:
+        if (visitor->on_bool) return visitor->on_bool(context, type == TINY_BITS_TRUE);
+        break;
+    case TINY_BITS_NULL:
+        if (visitor->on_null) return visitor->on_null(context);
+        break;
+    case TINY_BITS_DATETIME:
+        if (visitor->on_datetime) return visitor->on_datetime(context, value->datetime_val.unixtime, value->datetime_val.offset);
+        break;
+    case TINY_BITS_ARRAY:
+        if (visitor->on_array_begin) return visitor->on_array_begin(context, value->length);
+        break;
+    case TINY_BITS_MAP:
+        if (visitor->on_map_begin) return visitor->on_map_begin(context, value->length);
+        break;
+    default:
+        break;
+    }
+    return visitor->on_value ? visitor->on_value(context, type, value) : 1;
+}
+
+// The walk itself, always inlined so that a constant visitor turns into direct (and inlinable) calls
+static TB_ALWAYS_INLINE enum tiny_bits_type _tiny_bits_walk(tiny_bits_unpacker *decoder, const tiny_bits_visitor *visitor,
+                                                            void *context) {
+    tiny_bits_walk_frame stack[TB_MAX_DEPTH]; // the containers around the current one
+    tiny_bits_walk_frame current = { 1, 0 };  // kept out of the stack, it changes with every value
+    uint32_t depth = 0;
+    enum tiny_bits_type root = TINY_BITS_ERROR;
+    tiny_bits_unpacker_mark mark;
+    // an incremental unpacker waits for all of the value, the callbacks never see part of one
+    if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;
+    _unpacker_mark(decoder, &mark);
+    for (;;) {
+        tiny_bits_value value;
+        enum tiny_bits_type type = unpack_value(decoder, &value);
+        if (type == TINY_BITS_FINISHED && root == TINY_BITS_ERROR) return TINY_BITS_FINISHED;
+        if (type == TINY_BITS_ERROR) return TINY_BITS_ERROR;
+        if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) return _unpacker_rewind(decoder, &mark);
+        if (root == TINY_BITS_ERROR) root = type;
+        current.left--;
+        if (!_walk_visit(visitor, context, type, &value)) return TINY_BITS_ERROR;
+        if (type == TINY_BITS_ARRAY || type == TINY_BITS_MAP) {
+            // every value takes a byte at least, larger counts are malformed (or not all there yet)
+            if (value.length > decoder->size - decoder->current_pos) return _unpacker_rewind(decoder, &mark);
+            if (depth == TB_MAX_DEPTH) return TINY_BITS_ERROR;
+            stack[depth++] = current;
+            current.left = type == TINY_BITS_MAP ? 2 * value.length : value.length;
+            current.map = type == TINY_BITS_MAP;
+        }
+        // close the containers this value completed
+        while (current.left == 0) {
+            if (depth == 0) return root;
+            if (current.map ? visitor->on_map_end && !visitor->on_map_end(context)
+                            : visitor->on_array_end && !visitor->on_array_end(context)) {
+                return TINY_BITS_ERROR;
+            }
+            current = stack[--depth];
+        }
+    }
+}
+
+/**
+ * @brief Walks the next value of an unpacker, with everything it contains, calling the visitor for each value
+ * and for the end of each container
+ *
+ * @param decoder The unpacker, left after the value
+ * @param visitor The callbacks
+ * @param context Passed to every callback
+ * @return The type of the value walked, TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_ERROR on malformed
+ * input, nesting deeper than TB_MAX_DEPTH or when a callback returned 0 (the unpacker is then left after
+ * the value it was given). An incremental unpacker returns TINY_BITS_NEED_MORE, without calling any callback,
+ * until all of the value has been appended.
+ *
+ * @note Strings and blobs point into the buffer (or session copies) and are only valid as long as it is.
+ * When the visitor is known at compile time, TINY_BITS_WALKER() defines a walk specialized for it.
+ */
+static inline enum tiny_bits_type tiny_bits_walk(tiny_bits_unpacker *decoder, const tiny_bits_visitor *visitor, void *context) {
+    if (!decoder || !visitor) return TINY_BITS_ERROR;
+    return _tiny_bits_walk(decoder, visitor, context);
+}
+
+/**
+ * Defines name(decoder, context), a tiny_bits_walk() with visitor (a static const tiny_bits_visitor) built in:
+ * the unused callbacks disappear and static callbacks can be inlined into the loop.
+ *
+ *     static const tiny_bits_visitor sum_visitor = { .on_int = add_int };
+ *     TINY_BITS_WALKER(sum_walk, sum_visitor)
+ *     ...
+ *     sum_walk(unpacker, &total);
+ */
+#define TINY_BITS_WALKER(name, visitor)                                                      \
+    static inline enum tiny_bits_type name(tiny_bits_unpacker *decoder, void *context) {    \
+        if (!decoder) return TINY_BITS_ERROR;                                                \
+        return _tiny_bits_walk(decoder, &(visitor), context);                                \
+    }
+
+#endif // TINY_BITS_WALKER_H
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dist/tinybits.h"
+
+// Regression tests for the packer, see test/run.sh
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+// A buffer of the measured size holds the array without growing (it reserved 10 bytes for the header, and
+// went from 138 to 422 bytes for 50 ints)
+static void measured_arrays_fit(void) {
+    int64_t ints[50];
+    double doubles[40];
+    for (int i = 0; i < 50; i++) ints[i] = i * 37;
+    for (int i = 0; i < 40; i++) doubles[i] = i * 1.25;
+
+    size_t size = tiny_bits_size_of_int_array(ints, 50);
+    tiny_bits_packer *packer = tiny_bits_packer_create(size, 0);
+    CHECK(packer->capacity == size);
+    CHECK(pack_int_array(packer, ints, 50) == (int)size);
+    CHECK(packer->capacity == size && packer->current_pos == size);
+    tiny_bits_packer_destroy(packer);
+
+    size = tiny_bits_size_of_double_array(doubles, 40, TB_FEATURE_COMPRESS_FLOATS);
+    packer = tiny_bits_packer_create(size, TB_FEATURE_COMPRESS_FLOATS);
+    CHECK(pack_double_array(packer, doubles, 40) == (int)size);
+    CHECK(packer->capacity == size && packer->current_pos == size);
+    tiny_bits_packer_destroy(packer);
+}
+
+static void pack_deferred(tiny_bits_packer *packer, int items) {
+    size_t outer, inner;
+    pack_map_begin(packer, &outer);
+    for (int i = 0; i < items; i++) {
+        pack_int(packer, i);
+        pack_arr_begin(packer, &inner);
+        pack_double(packer, i * 0.5);
+        pack_str(packer, "value", 5);
+        pack_arr_end(packer, inner, 2);
+    }
+    pack_map_end(packer, outer, (uint32_t)items);
+}
+
+// A buffer of the measured size holds containers started with pack_arr_begin()/pack_map_begin(): their
+// 6 byte header is held until they end ([1] measured 2 bytes, and a buffer of 2 grew to 10)
+static void measured_deferred_fit(void) {
+    for (int items = 0; items < 40; items += 3) {
+        tiny_bits_packer *measure = tiny_bits_packer_create(16, 0);
+        CHECK(tiny_bits_packer_set_measure(measure));
+        pack_deferred(measure, items);
+        size_t size = tiny_bits_packer_measured(measure);
+        tiny_bits_packer *packer = tiny_bits_packer_create(size, 0);
+        pack_deferred(packer, items);
+        CHECK(packer->capacity == size && packer->current_pos <= size);
+        tiny_bits_packer_destroy(packer);
+        tiny_bits_packer_destroy(measure);
+    }
+}
+
+// pack_double() tries the decimal places of the previous double first: whatever came before, each value
+// is packed as it is on its own
+static void double_guesses_exact(void) {
+    static const double values[] = { 12.5, 12.25, 3.0, 1.1, 1.10000000000000009, 0.0, 7e-12, 120.0, 123.456,
+                                     -0.5, 281474976710655.0, 1e300, 12.34, 12.340000000000002 };
+    const size_t count = sizeof(values) / sizeof(values[0]);
+    tiny_bits_packer *packer = tiny_bits_packer_create(16, TB_FEATURE_COMPRESS_FLOATS);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < count; j++) {
+            uint8_t expected[10];
+            size_t size = (size_t)(put_double(expected, values[j], TB_FEATURE_COMPRESS_FLOATS) - expected);
+            tiny_bits_packer_reset(packer);
+            pack_double(packer, values[i]);
+            size_t pos = packer->current_pos;
+            CHECK(pack_double(packer, values[j]) == (int)size);
+            CHECK(!memcmp(packer->buffer + pos, expected, size));
+        }
+    }
+    tiny_bits_packer_destroy(packer);
+}
+
+// "ab", "cd", ref 1: an array read failing on the first string used to leave it numbered, read again it
+// became string 1 and the reference gave "ab"
+static void failed_array_read_unnumbers(void) {
+    tiny_bits_packer *packer = tiny_bits_packer_create(64, TB_FEATURE_STRING_DEDUPE);
+    pack_str(packer, "ab", 2);
+    pack_str(packer, "cd", 2);
+    pack_str(packer, "cd", 2);
+    for (int kind = 0; kind < 2; kind++) {
+        tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+        tiny_bits_unpacker_set_buffer(unpacker, packer->buffer, packer->current_pos);
+        int64_t ints[4];
+        double doubles[4];
+        size_t count;
+        CHECK((kind ? unpack_double_array(unpacker, doubles, 4, &count)
+                    : unpack_int_array(unpacker, ints, 4, &count)) == TINY_BITS_ERROR);
+        const char *expected[] = { "ab", "cd", "cd" };
+        for (int i = 0; i < 3; i++) {
+            tiny_bits_value value;
+            CHECK(unpack_value(unpacker, &value) == TINY_BITS_STR);
+            CHECK(value.str_blob_val.length == 2 && !memcmp(value.str_blob_val.data, expected[i], 2));
+        }
+        tiny_bits_unpacker_destroy(unpacker);
+    }
+    tiny_bits_packer_destroy(packer);
+}
+
+int main() {
+    measured_arrays_fit();
+    measured_deferred_fit();
+    double_guesses_exact();
+    failed_array_read_unnumbers();
+    return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# Builds the amalgamated header, then builds and runs every test with the address and undefined behavior sanitizers
+set -e
+cd "$(dirname "$0")/.."
+./build.sh > /dev/null
+mkdir -p test/bin
+for test in test/*.c; do
+    name=$(basename "$test" .c)
+    gcc -O1 -g -Wall -fsanitize=address,undefined -fno-sanitize-recover=undefined "$test" -o "test/bin/$name" -lm -lpthread
+    if "test/bin/$name"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        exit 1
+    fi
+done
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dist/tinybits.h"
+
+// Regression tests for incremental unpackers (tiny_bits_unpacker_append()), see test/run.sh
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+// An allocator keeping count of the bytes in use, and of the most ever in use
+typedef struct counter {
+    size_t live;
+    size_t peak;
+} counter;
+
+static void *count_alloc(void *context, size_t size) {
+    counter *c = (counter *)context;
+    size_t *block = (size_t *)malloc(sizeof(size_t) + size);
+    if (!block) return NULL;
+    *block = size;
+    c->live += size;
+    if (c->live > c->peak) c->peak = c->live;
+    return block + 1;
+}
+
+static void count_free(void *context, void *ptr) {
+    size_t *block = (size_t *)ptr - 1;
+    ((counter *)context)->live -= *block;
+    free(block);
+}
+
+static void *count_realloc(void *context, void *ptr, size_t size) {
+    if (!ptr) return count_alloc(context, size);
+    size_t old = ((size_t *)ptr)[-1];
+    void *copy = count_alloc(context, size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, old < size ? old : size);
+    count_free(context, ptr);
+    return copy;
+}
+
+// The strings walked, the last one and the first ones joined by commas
+typedef struct strings_seen {
+    size_t count;
+    char last[16];
+    char joined[64];
+} strings_seen;
+
+static int on_str(void *context, const char *str, size_t length) {
+    strings_seen *seen = (strings_seen *)context;
+    CHECK(length < sizeof(seen->last));
+    memcpy(seen->last, str, length);
+    seen->last[length] = 0;
+    if (strlen(seen->joined) + length + 2 <= sizeof(seen->joined)) {
+        if (seen->count) strcat(seen->joined, ",");
+        strcat(seen->joined, seen->last);
+    }
+    seen->count++;
+    return 1;
+}
+
+static const tiny_bits_visitor strings_visitor = { .on_str = on_str };
+
+// An array of 5000 short strings walked as it arrives 64 bytes at a time: the string copies made by the walks
+// that ran out of input used to stay around, 21.7MB for a 55KB message
+static void string_copies_bounded(void) {
+    tiny_bits_packer *packer = tiny_bits_packer_create(1024, 0);
+    char str[32];
+    pack_arr(packer, 5000);
+    for (int i = 0; i < 5000; i++) pack_str(packer, str, (uint32_t)snprintf(str, sizeof(str), "string %04d", i));
+
+    counter c = { 0, 0 };
+    tiny_bits_allocator allocator = { count_alloc, count_realloc, count_free, &c };
+    tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create_with(&allocator);
+    strings_seen seen = { 0, "", "" };
+    enum tiny_bits_type type = TINY_BITS_NEED_MORE;
+    for (size_t pos = 0; pos < packer->current_pos; pos += 64) {
+        size_t size = packer->current_pos - pos < 64 ? packer->current_pos - pos : 64;
+        CHECK(type == TINY_BITS_NEED_MORE);
+        CHECK(tiny_bits_unpacker_append(unpacker, packer->buffer + pos, size));
+        type = tiny_bits_walk(unpacker, &strings_visitor, &seen);
+    }
+    CHECK(type == TINY_BITS_ARRAY);
+    // the input, the copies of the strings and their table, once each (grown by doubling)
+    CHECK(c.peak < 4 * packer->current_pos + 4 * 5000 * sizeof(*unpacker->strings));
+    CHECK(seen.count == 5000 && !strcmp(seen.last, "string 4999"));
+    tiny_bits_unpacker_destroy(unpacker);
+    CHECK(c.live == 0);
+    tiny_bits_packer_destroy(packer);
+}
+
+// msg1 is "ab", msg2 is [ref 0, reset, "cd", ref 0, 5]: cut anywhere, the reset used to be consumed by the
+// walk that ran out of input, and the first reference was then read as "cd" once the rest came
+static void reset_inside_cut_short_value(void) {
+    static const unsigned char msg1[] = { 0x42, 'a', 'b' };
+    static const unsigned char msg2[] = { 0x0C, 0x60, TB_NXT_TAG, TB_NXT_RST, 0x42, 'c', 'd', 0x60, 0x85 };
+    for (size_t cut = 1; cut < sizeof(msg2); cut++) {
+        tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+        tiny_bits_document *doc = tiny_bits_document_create();
+        strings_seen seen = { 0, "", "" };
+        CHECK(tiny_bits_unpacker_append(unpacker, msg1, sizeof(msg1)));
+        CHECK(tiny_bits_walk(unpacker, &strings_visitor, &seen) == TINY_BITS_STR);
+        CHECK(tiny_bits_unpacker_append(unpacker, msg2, cut));
+        CHECK(tiny_bits_walk(unpacker, &strings_visitor, &seen) == TINY_BITS_NEED_MORE);
+        CHECK(tiny_bits_document_parse(doc, unpacker) == TINY_BITS_NEED_MORE);
+        CHECK(tiny_bits_skip_value(unpacker) == TINY_BITS_NEED_MORE);
+        CHECK(tiny_bits_unpacker_append(unpacker, msg2 + cut, sizeof(msg2) - cut));
+        CHECK(tiny_bits_walk(unpacker, &strings_visitor, &seen) == TINY_BITS_ARRAY);
+        CHECK(!strcmp(seen.joined, "ab,ab,cd,cd"));
+        tiny_bits_document_destroy(doc);
+        tiny_bits_unpacker_destroy(unpacker);
+    }
+}
+
+// After incremental input a plain buffer ["new", ref 0] read as "new", "old": the strings kept for the
+// input stayed numbered
+static void set_buffer_ends_stream_strings(void) {
+    tiny_bits_packer *packer = tiny_bits_packer_create(64, TB_FEATURE_STRING_DEDUPE);
+    pack_str(packer, "old", 3);
+    tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+    tiny_bits_value value;
+    CHECK(tiny_bits_unpacker_append(unpacker, packer->buffer, packer->current_pos));
+    CHECK(unpack_value(unpacker, &value) == TINY_BITS_STR);
+
+    tiny_bits_packer *plain = tiny_bits_packer_create(64, TB_FEATURE_STRING_DEDUPE);
+    pack_str(plain, "new", 3);
+    pack_str(plain, "new", 3);
+    tiny_bits_unpacker_set_buffer(unpacker, plain->buffer, plain->current_pos);
+    for (int i = 0; i < 2; i++) {
+        CHECK(unpack_value(unpacker, &value) == TINY_BITS_STR);
+        CHECK(value.str_blob_val.length == 3 && !memcmp(value.str_blob_val.data, "new", 3));
+    }
+    tiny_bits_unpacker_destroy(unpacker);
+    tiny_bits_packer_destroy(plain);
+    tiny_bits_packer_destroy(packer);
+}
+
+// {"id": 7, "tags": ["a1", "b2"], "name": "abc"} cut anywhere: queries found nothing or failed, and left the
+// unpacker inside the map
+static void query_cut_short(void) {
+    tiny_bits_packer *packer = tiny_bits_packer_create(64, 0);
+    pack_map(packer, 3);
+    pack_str(packer, "id", 2);
+    pack_int(packer, 7);
+    pack_str(packer, "tags", 4);
+    pack_arr(packer, 2);
+    pack_str(packer, "a1", 2);
+    pack_str(packer, "b2", 2);
+    pack_str(packer, "name", 4);
+    pack_str(packer, "abc", 3);
+    tiny_bits_path *name = tiny_bits_path_compile("name");
+    tiny_bits_path *tag = tiny_bits_path_compile("tags[1]");
+    const tiny_bits_path *paths[] = { tag, name };
+    for (size_t cut = 1; cut < packer->current_pos; cut++) {
+        tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+        tiny_bits_value values[2];
+        enum tiny_bits_type types[2];
+        CHECK(tiny_bits_unpacker_append(unpacker, packer->buffer, cut));
+        CHECK(tiny_bits_query(unpacker, name, &values[1]) == TINY_BITS_NEED_MORE);
+        CHECK(tiny_bits_query_many(unpacker, paths, 2, values, types) == 0);
+        CHECK(types[0] == TINY_BITS_NEED_MORE && types[1] == TINY_BITS_NEED_MORE);
+        CHECK(unpacker->current_pos == 0 && tiny_bits_unpacker_depth(unpacker) == 0);
+        CHECK(tiny_bits_unpacker_append(unpacker, packer->buffer + cut, packer->current_pos - cut));
+        CHECK(tiny_bits_query_many(unpacker, paths, 2, values, types) == 2);
+        CHECK(types[0] == TINY_BITS_STR && !memcmp(values[0].str_blob_val.data, "b2", 2));
+        CHECK(types[1] == TINY_BITS_STR && !memcmp(values[1].str_blob_val.data, "abc", 3));
+        tiny_bits_unpacker_destroy(unpacker);
+    }
+    tiny_bits_path_destroy(tag);
+    tiny_bits_path_destroy(name);
+    tiny_bits_packer_destroy(packer);
+}
+
+int main() {
+    string_copies_bounded();
+    reset_inside_cut_short_value();
+    set_buffer_ends_stream_strings();
+    query_cut_short();
+    return 0;
+}
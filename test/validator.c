@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../dist/tinybits.h"
+
+// Regression tests for tiny_bits_validate(), see test/run.sh
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+// A million reset markers before an int: valid, so it must decode (once, a marker at a time, it overflowed the stack)
+static void reset_marker_run(void) {
+    size_t markers = 1000000, size = 2 * markers + 1;
+    unsigned char *buffer = (unsigned char *)malloc(size);
+    for (size_t i = 0; i < markers; i++) {
+        buffer[2 * i] = TB_NXT_TAG;
+        buffer[2 * i + 1] = TB_NXT_RST;
+    }
+    buffer[size - 1] = 0x85; // 5
+    CHECK(tiny_bits_validate(buffer, size, NULL, NULL, NULL) == TINY_BITS_VALID);
+
+    tiny_bits_unpacker *unpacker = tiny_bits_unpacker_create();
+    tiny_bits_value value;
+    tiny_bits_unpacker_set_buffer(unpacker, buffer, size);
+    CHECK(unpack_value(unpacker, &value) == TINY_BITS_INT && value.int_val == 5);
+    CHECK(unpack_value(unpacker, &value) == TINY_BITS_FINISHED);
+    tiny_bits_unpacker_set_buffer(unpacker, buffer, size);
+    CHECK(tiny_bits_read_value(unpacker, &value) == TINY_BITS_INT && value.int_val == 5);
+    tiny_bits_unpacker_set_buffer(unpacker, buffer, size);
+    CHECK(tiny_bits_skip_value(unpacker) == TINY_BITS_INT);
+    CHECK(unpack_value(unpacker, &value) == TINY_BITS_FINISHED);
+    tiny_bits_unpacker_destroy(unpacker);
+    free(buffer);
+}
+
+int main() {
+    reset_marker_run();
+    return 0;
+}
@@ -0,0 +1,619 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generates specialized pack and unpack functions for the structs of a schema, see README.md
+// Build with: gcc -O2 tools/tinybits_gen.c -o tinybits_gen
+// Run with: tinybits_gen [-i tinybits.h] schema.tb [output.h]
+//
+// A schema is a list of structs, fields are one of int, double, bool, string, blob or a struct, or an
+// array of them (type[]). Structs held by value must be declared before, arrays can hold any struct:
+//
+//     struct person {
+//         string first_name;
+//         int age;
+//         person[] children;
+//     }
+
+#define MAX_STRUCTS 256
+#define MAX_FIELDS 256
+#define MAX_NAME 128    // longest struct or field name, fields are packed as a one byte header and their name
+
+enum field_kind { KIND_INT, KIND_DOUBLE, KIND_BOOL, KIND_STRING, KIND_BLOB, KIND_STRUCT };
+
+typedef struct field {
+    char name[MAX_NAME];
+    char type[MAX_NAME];
+    enum field_kind kind;
+    int target;     // KIND_STRUCT: index of the struct
+    int array;
+    int line;
+} field;
+
+typedef struct schema_struct {
+    char name[MAX_NAME];
+    field fields[MAX_FIELDS];
+    int count;
+} schema_struct;
+
+static schema_struct structs[MAX_STRUCTS];
+static int structs_count;
+
+static const char *source;   // the schema text
+static const char *path;
+static size_t at;
+static int line = 1;
+static FILE *out;
+
+static void fail(int where, const char *format, ...) {
+    va_list args;
+    fprintf(stderr, "%s:%d: ", path, where);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+// Skips blanks and comments (# and //)
+static void skip_blank(void) {
+    for (;;) {
+        char c = source[at];
+        if (c == '\n') line++;
+        if (isspace((unsigned char)c)) {
+            at++;
+        } else if (c == '#' || (c == '/' && source[at + 1] == '/')) {
+            while (source[at] && source[at] != '\n') at++;
+        } else {
+            return;
+        }
+    }
+}
+
+// Reads an identifier into name, 0 when there is none
+static int read_name(char *name) {
+    skip_blank();
+    size_t length = 0;
+    if (!isalpha((unsigned char)source[at]) && source[at] != '_') return 0;
+    while (isalnum((unsigned char)source[at]) || source[at] == '_') {
+        if (length + 1 >= MAX_NAME) fail(line, "name longer than %d characters", MAX_NAME - 1);
+        name[length++] = source[at++];
+    }
+    name[length] = 0;
+    return 1;
+}
+
+static int accept(char c) {
+    skip_blank();
+    if (source[at] != c) return 0;
+    at++;
+    return 1;
+}
+
+static void expect(char c) {
+    if (!accept(c)) fail(line, "expected '%c'", c);
+}
+
+// C keywords, and the names generated code gives its variables (a struct of the same name would hide its type)
+static const char *const reserved[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern", "float",
+    "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short", "signed", "sizeof",
+    "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while", "_Bool", "bool",
+    "allocator", "cursor", "decoder", "depth", "encoder", "expected", "field", "header", "i", "item", "key",
+    "length", "mark", "pair", "size", "type", "value", NULL
+};
+
+static void check_name(const char *name) {
+    for (int i = 0; reserved[i]; i++) {
+        if (!strcmp(reserved[i], name)) fail(line, "'%s' is reserved", name);
+    }
+}
+
+static int find_struct(const char *name) {
+    for (int i = 0; i < structs_count; i++) {
+        if (!strcmp(structs[i].name, name)) return i;
+    }
+    return -1;
+}
+
+static void parse(void) {
+    char word[MAX_NAME];
+    while (read_name(word)) {
+        if (strcmp(word, "struct")) fail(line, "expected 'struct', got '%s'", word);
+        if (structs_count == MAX_STRUCTS) fail(line, "more than %d structs", MAX_STRUCTS);
+        schema_struct *s = &structs[structs_count];
+        if (!read_name(s->name)) fail(line, "expected a struct name");
+        check_name(s->name);
+        if (find_struct(s->name) >= 0) fail(line, "struct %s declared twice", s->name);
+        structs_count++;
+        expect('{');
+        while (!accept('}')) {
+            if (s->count == MAX_FIELDS) fail(line, "more than %d fields in %s", MAX_FIELDS, s->name);
+            field *f = &s->fields[s->count];
+            if (!read_name(f->type)) fail(line, "expected a field type");
+            f->line = line;
+            f->array = accept('[');
+            if (f->array) expect(']');
+            if (!read_name(f->name)) fail(line, "expected a field name");
+            check_name(f->name);
+            expect(';');
+            f->target = -1;
+            if (!strcmp(f->type, "int")) f->kind = KIND_INT;
+            else if (!strcmp(f->type, "double")) f->kind = KIND_DOUBLE;
+            else if (!strcmp(f->type, "bool")) f->kind = KIND_BOOL;
+            else if (!strcmp(f->type, "string")) f->kind = KIND_STRING;
+            else if (!strcmp(f->type, "blob")) f->kind = KIND_BLOB;
+            else {
+                f->kind = KIND_STRUCT;
+                f->target = find_struct(f->type);
+                // arrays are pointers, they may hold any struct (looked up once all are read)
+                if (!f->array && (f->target < 0 || f->target == structs_count - 1)) {
+                    fail(line, "struct %s held by value must be declared before %s", f->type, s->name);
+                }
+            }
+            for (int i = 0; i < s->count; i++) {
+                const field *other = &s->fields[i];
+                if (!strcmp(other->name, f->name)) fail(line, "field %s declared twice in %s", f->name, s->name);
+                // the member holding the length of an array is its name and _count
+                size_t length = strlen(other->name);
+                if (other->array && !strncmp(f->name, other->name, length) && !strcmp(f->name + length, "_count")) {
+                    fail(line, "field %s clashes with the length of array %s", f->name, other->name);
+                }
+                length = strlen(f->name);
+                if (f->array && !strncmp(other->name, f->name, length) && !strcmp(other->name + length, "_count")) {
+                    fail(line, "array %s clashes with field %s", f->name, other->name);
+                }
+            }
+            s->count++;
+        }
+        if (!s->count) fail(line, "struct %s has no fields", s->name);
+        accept(';');
+    }
+    skip_blank();
+    if (source[at]) fail(line, "unexpected '%c'", source[at]);
+    for (int i = 0; i < structs_count; i++) {
+        for (int j = 0; j < structs[i].count; j++) {
+            field *f = &structs[i].fields[j];
+            if (f->kind != KIND_STRUCT || f->target >= 0) continue;
+            f->target = find_struct(f->type);
+            if (f->target < 0) fail(f->line, "unknown type %s", f->type);
+        }
+    }
+}
+
+static void emit(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+static const char *element_type(const field *f) {
+    switch (f->kind) {
+    case KIND_INT: return "int64_t";
+    case KIND_DOUBLE: return "double";
+    case KIND_BOOL: return "int";
+    case KIND_STRING:
+    case KIND_BLOB: return "tiny_bits_bytes";
+    default: return structs[f->target].name;
+    }
+}
+
+// Writes one value held in expression, at cursor
+static void emit_put(const field *f, const char *value, const char *indent) {
+    switch (f->kind) {
+    case KIND_INT:
+        emit("%scursor = put_int(cursor, %s);\n", indent, value);
+        break;
+    case KIND_DOUBLE:
+        emit("%scursor = put_double(cursor, %s, encoder->features);\n", indent, value);
+        break;
+    case KIND_BOOL:
+        emit("%scursor = %s ? put_true(cursor) : put_false(cursor);\n", indent, value);
+        break;
+    case KIND_STRING:
+        emit("%scursor = put_str(encoder, cursor, %s.data ? %s.data : \"\", (uint32_t)%s.length);\n", indent, value, value, value);
+        break;
+    case KIND_BLOB:
+        emit("%scursor = put_blob(cursor, %s.data ? %s.data : \"\", %s.length);\n", indent, value, value, value);
+        break;
+    case KIND_STRUCT:
+        emit("%scursor = _%s_put(encoder, cursor, &%s);\n", indent, structs[f->target].name, value);
+        break;
+    }
+}
+
+// Most bytes one value held in expression takes
+static void emit_bound(const field *f, const char *value, const char *indent) {
+    switch (f->kind) {
+    case KIND_BOOL: emit("%ssize += 1;\n", indent); break;
+    case KIND_STRING:
+    case KIND_BLOB: emit("%ssize += 10 + %s.length;\n", indent, value); break;
+    case KIND_STRUCT: emit("%ssize += _%s_bound(&%s);\n", indent, structs[f->target].name, value); break;
+    default: emit("%ssize += 10;\n", indent); break;
+    }
+}
+
+// Stores the value unpacked in type and item into target, on a type mismatch returns
+static void emit_read(const field *f, const char *target, const char *indent) {
+    switch (f->kind) {
+    case KIND_INT:
+        emit("%sif (type != TINY_BITS_INT) return _tb_gen_mismatch(type);\n", indent);
+        emit("%s%s = item.int_val;\n", indent, target);
+        break;
+    case KIND_DOUBLE:
+        emit("%sif (type == TINY_BITS_DOUBLE) %s = item.double_val;\n", indent, target);
+        emit("%selse if (type == TINY_BITS_INT) %s = (double)item.int_val;\n", indent, target);
+        emit("%selse if (type == TINY_BITS_NAN) %s = NAN;\n", indent, target);
+        emit("%selse if (type == TINY_BITS_INF) %s = INFINITY;\n", indent, target);
+        emit("%selse if (type == TINY_BITS_N_INF) %s = -INFINITY;\n", indent, target);
+        emit("%selse return _tb_gen_mismatch(type);\n", indent);
+        break;
+    case KIND_BOOL:
+        emit("%sif (type != TINY_BITS_TRUE && type != TINY_BITS_FALSE) return _tb_gen_mismatch(type);\n", indent);
+        emit("%s%s = type == TINY_BITS_TRUE;\n", indent, target);
+        break;
+    case KIND_STRING:
+    case KIND_BLOB:
+        emit("%sif (type != %s) return _tb_gen_mismatch(type);\n", indent, f->kind == KIND_STRING ? "TINY_BITS_STR" : "TINY_BITS_BLOB");
+        emit("%s%s.data = item.str_blob_val.data;\n", indent, target);
+        emit("%s%s.length = item.str_blob_val.length;\n", indent, target);
+        break;
+    case KIND_STRUCT:
+        emit("%sif (type != TINY_BITS_MAP) return _tb_gen_mismatch(type);\n", indent);
+        emit("%stype = _%s_read(decoder, item.length, &%s, allocator, depth + 1);\n", indent, structs[f->target].name, target);
+        emit("%sif (type != TINY_BITS_MAP) return type;\n", indent);
+        break;
+    }
+}
+
+// The key of a field as pack_str() writes it when it is not deduplicated
+static void emit_key(const char *name) {
+    size_t length = strlen(name);
+    if (length < 31) emit("\"\\x%02x\" \"%s\", %zu", 0x40 | (unsigned int)length, name, length + 1);
+    else emit("\"\\x5f\\x%02x\" \"%s\", %zu", (unsigned int)(length - 31), name, length + 2);
+}
+
+// Reads the pairs of a map into a struct, maps of nested structs count towards depth
+static void emit_read_signature(const char *n) {
+    int indent = (int)strlen("static inline enum tiny_bits_type _") + (int)strlen(n) + (int)strlen("_read(");
+    emit("static inline enum tiny_bits_type _%s_read(tiny_bits_unpacker *decoder, size_t length, %s *value,\n", n, n);
+    emit("%*sconst tiny_bits_allocator *allocator, uint32_t depth)", indent, "");
+}
+
+static void emit_struct_type(const schema_struct *s) {
+    emit("struct %s {\n", s->name);
+    for (int i = 0; i < s->count; i++) {
+        const field *f = &s->fields[i];
+        if (f->array) {
+            emit("    %s *%s;\n", element_type(f), f->name);
+            emit("    size_t %s_count;\n", f->name);
+        } else {
+            emit("    %s %s;\n", element_type(f), f->name);
+        }
+    }
+    emit("};\n\n");
+}
+
+static void emit_struct_functions(const schema_struct *s) {
+    const char *n = s->name;
+    char value[MAX_NAME + 32];
+
+    emit("static const char *const _%s_names[] = {", n);
+    for (int i = 0; i < s->count; i++) emit(" \"%s\"%s", s->fields[i].name, i + 1 < s->count ? "," : "");
+    emit(" };\n");
+    emit("static const uint8_t _%s_lengths[] = {", n);
+    for (int i = 0; i < s->count; i++) emit(" %zu%s", strlen(s->fields[i].name), i + 1 < s->count ? "," : "");
+    emit(" };\n\n");
+
+    emit("static inline size_t _%s_bound(const %s *value) {\n", n, n);
+    emit("    size_t size = 10;\n");
+    int sized = 0;  // a field of variable size
+    for (int i = 0; i < s->count; i++) sized |= s->fields[i].array || s->fields[i].kind >= KIND_STRING;
+    if (!sized) emit("    (void)value;\n");
+    for (int i = 0; i < s->count; i++) {
+        const field *f = &s->fields[i];
+        emit("    size += %zu;\n", strlen(f->name) + 10);
+        if (f->array) {
+            emit("    size += 10;\n");
+            emit("    for (size_t i = 0; i < value->%s_count; i++) {\n", f->name);
+            snprintf(value, sizeof value, "value->%s[i]", f->name);
+            emit_bound(f, value, "        ");
+            emit("    }\n");
+        } else {
+            snprintf(value, sizeof value, "value->%s", f->name);
+            emit_bound(f, value, "    ");
+        }
+    }
+    emit("    return size;\n}\n\n");
+
+    emit("static inline uint8_t *_%s_put(tiny_bits_packer *encoder, uint8_t *cursor, const %s *value) {\n", n, n);
+    emit("    cursor = put_map(cursor, %d);\n", s->count);
+    for (int i = 0; i < s->count; i++) {
+        const field *f = &s->fields[i];
+        emit("    cursor = _tb_gen_put_key(encoder, cursor, ");
+        emit_key(f->name);
+        emit(", \"%s\", %zu);\n", f->name, strlen(f->name));
+        if (f->array) {
+            emit("    cursor = put_arr(cursor, value->%s_count);\n", f->name);
+            emit("    for (size_t i = 0; i < value->%s_count; i++) {\n", f->name);
+            snprintf(value, sizeof value, "value->%s[i]", f->name);
+            emit_put(f, value, "        ");
+            emit("    }\n");
+        } else {
+            snprintf(value, sizeof value, "value->%s", f->name);
+            emit_put(f, value, "    ");
+        }
+    }
+    emit("    return cursor;\n}\n\n");
+
+    emit("static inline void _%s_release(%s *value, const tiny_bits_allocator *allocator) {\n", n, n);
+    int releases = 0;
+    for (int i = 0; i < s->count; i++) {
+        const field *f = &s->fields[i];
+        if (f->kind == KIND_STRUCT && !f->array) {
+            emit("    _%s_release(&value->%s, allocator);\n", structs[f->target].name, f->name);
+            releases++;
+        } else if (f->array) {
+            if (f->kind == KIND_STRUCT) {
+                emit("    for (size_t i = 0; i < value->%s_count; i++) _%s_release(&value->%s[i], allocator);\n",
+                     f->name, structs[f->target].name, f->name);
+            }
+            emit("    _tb_free(allocator, value->%s);\n", f->name);
+            releases++;
+        }
+    }
+    if (!releases) emit("    (void)value;\n    (void)allocator;\n");
+    emit("}\n\n");
+
+    emit_read_signature(n);
+    emit(" {\n");
+    emit("    if (depth >= TB_MAX_DEPTH) return TINY_BITS_ERROR;\n");
+    int allocates = 0;  // arrays, or structs holding some
+    for (int i = 0; i < s->count; i++) allocates |= s->fields[i].array || s->fields[i].kind == KIND_STRUCT;
+    if (!allocates) emit("    (void)allocator;\n");
+    emit("    tiny_bits_value key, item;\n");
+    emit("    enum tiny_bits_type type;\n");
+    emit("    int expected = 0;\n");
+    emit("    for (size_t pair = 0; pair < length; pair++) {\n");
+    emit("        type = unpack_value(decoder, &key);\n");
+    emit("        if (type != TINY_BITS_STR) return _tb_gen_mismatch(type);\n");
+    emit("        int field = _tb_gen_field(&key, _%s_names, _%s_lengths, %d, expected);\n", n, n, s->count);
+    emit("        if (field < 0) {\n");
+    emit("            // not in the schema (a newer one perhaps)\n");
+    emit("            type = tiny_bits_skip_value(decoder);\n");
+    emit("            if (type == TINY_BITS_ERROR || type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE) {\n");
+    emit("                return _tb_gen_mismatch(type);\n");
+    emit("            }\n");
+    emit("            continue;\n");
+    emit("        }\n");
+    emit("        expected = field + 1;\n");
+    emit("        type = unpack_value(decoder, &item);\n");
+    emit("        if (type == TINY_BITS_NULL) continue;\n");
+    emit("        switch (field) {\n");
+    for (int i = 0; i < s->count; i++) {
+        const field *f = &s->fields[i];
+        emit("        case %d: {\n", i);
+        if (f->array) {
+            const char *type = element_type(f);
+            emit("            if (value->%s) return TINY_BITS_ERROR; // twice in the map\n", f->name);
+            if (f->kind == KIND_INT || f->kind == KIND_DOUBLE) {
+                const char *packed = f->kind == KIND_INT ? "TINY_BITS_PACKED_INT" : "TINY_BITS_PACKED_DOUBLE";
+                emit("            if (type == %s) {\n", packed);
+                emit("                if (item.packed_val.count > TB_GEN_MAX_PACKED) return TINY_BITS_ERROR;\n");
+                emit("                value->%s = (%s *)_tb_gen_array(item.packed_val.count, sizeof(%s), allocator);\n",
+                     f->name, type, type);
+                emit("                if (!value->%s) return TINY_BITS_ERROR;\n", f->name);
+                emit("                value->%s_count = item.packed_val.count;\n", f->name);
+                emit("                %s(&item, value->%s);\n", f->kind == KIND_INT ? "unpack_packed_ints" : "unpack_packed_doubles", f->name);
+                emit("                break;\n");
+                emit("            }\n");
+            }
+            emit("            if (type != TINY_BITS_ARRAY) return _tb_gen_mismatch(type);\n");
+            emit("            // every element takes a byte at least\n");
+            emit("            if (item.length > decoder->size - decoder->current_pos) return TINY_BITS_NEED_MORE;\n");
+            emit("            value->%s = (%s *)_tb_gen_array(item.length, sizeof(%s), allocator);\n", f->name, type, type);
+            emit("            if (!value->%s) return TINY_BITS_ERROR;\n", f->name);
+            emit("            value->%s_count = item.length;\n", f->name);
+            emit("            for (size_t i = 0; i < value->%s_count; i++) {\n", f->name);
+            emit("                type = unpack_value(decoder, &item);\n");
+            snprintf(value, sizeof value, "value->%s[i]", f->name);
+            emit_read(f, value, "                ");
+            emit("            }\n");
+        } else {
+            snprintf(value, sizeof value, "value->%s", f->name);
+            emit_read(f, value, "            ");
+        }
+        emit("            break;\n");
+        emit("        }\n");
+    }
+    emit("        }\n");
+    emit("    }\n");
+    emit("    return TINY_BITS_MAP;\n}\n\n");
+
+    emit("/**\n");
+    emit(" * @brief Packs a %s as a map of its fields\n", n);
+    emit(" *\n");
+    emit(" * @param encoder The packer instance\n");
+    emit(" * @param value The %s\n", n);
+    emit(" * @return Number of bytes written, or 0 on error\n");
+    emit(" */\n");
+    emit("static inline int %s_pack(tiny_bits_packer *encoder, const %s *value) {\n", n, n);
+    emit("    if (!encoder || !value) return 0;\n");
+    emit("    uint8_t *cursor = tiny_bits_packer_reserve(encoder, _%s_bound(value));\n", n);
+    emit("    if (!cursor) return 0;\n");
+    emit("    return tiny_bits_packer_commit(encoder, _%s_put(encoder, cursor, value));\n", n);
+    emit("}\n\n");
+
+    emit("/**\n");
+    emit(" * @brief Unpacks the next value, a map of the fields of a %s\n", n);
+    emit(" *\n");
+    emit(" * @param decoder The unpacker instance\n");
+    emit(" * @param[out] value Set to the fields found, the others are zero\n");
+    emit(" * @param allocator Where arrays come from, NULL for malloc()\n");
+    emit(" * @return TINY_BITS_MAP, TINY_BITS_FINISHED at the end of the buffer, TINY_BITS_NEED_MORE for an incremental\n");
+    emit(" * unpacker (left before the map), or TINY_BITS_ERROR on malformed input or a field of the wrong type\n");
+    emit(" *\n");
+    emit(" * @note Strings and blobs point into the buffer. Free arrays with %s_release(), unless allocator is an arena.\n", n);
+    emit(" */\n");
+    emit("static inline enum tiny_bits_type %s_unpack(tiny_bits_unpacker *decoder, %s *value, const tiny_bits_allocator *allocator) {\n", n, n);
+    emit("    if (!decoder || !value) return TINY_BITS_ERROR;\n");
+    emit("    memset(value, 0, sizeof(%s));\n", n);
+    emit("    tiny_bits_unpacker_mark mark;\n");
+    emit("    tiny_bits_value header;\n");
+    emit("    enum tiny_bits_type type;\n");
+    emit("    do {\n");
+    emit("        // an incremental unpacker waits for all of the map\n");
+    emit("        if (_unpacker_awaits(decoder)) return TINY_BITS_NEED_MORE;\n");
+    emit("        _unpacker_mark(decoder, &mark);\n");
+    emit("    } while ((type = unpack_value(decoder, &header)) == TINY_BITS_SEP);\n");
+    emit("    if (type == TINY_BITS_FINISHED || type == TINY_BITS_NEED_MORE || type == TINY_BITS_ERROR) return type;\n");
+    emit("    if (type != TINY_BITS_MAP) return TINY_BITS_ERROR;\n");
+    emit("    type = _%s_read(decoder, header.length, value, allocator, 0);\n", n);
+    emit("    if (type == TINY_BITS_MAP) return type;\n");
+    emit("    _%s_release(value, allocator);\n", n);
+    emit("    memset(value, 0, sizeof(%s));\n", n);
+    emit("    return type == TINY_BITS_NEED_MORE ? _unpacker_rewind(decoder, &mark) : TINY_BITS_ERROR;\n");
+    emit("}\n\n");
+
+    emit("/**\n");
+    emit(" * @brief Frees the arrays of a %s unpacked with a malloc() style allocator\n", n);
+    emit(" *\n");
+    emit(" * @param value The %s\n", n);
+    emit(" * @param allocator The allocator given to %s_unpack()\n", n);
+    emit(" */\n");
+    emit("static inline void %s_release(%s *value, const tiny_bits_allocator *allocator) {\n", n, n);
+    emit("    if (!value) return;\n");
+    emit("    _%s_release(value, allocator);\n", n);
+    emit("    memset(value, 0, sizeof(%s));\n", n);
+    emit("}\n\n");
+}
+
+static const char *prologue =
+    "#ifndef TINY_BITS_GENERATED\n"
+    "#define TINY_BITS_GENERATED\n"
+    "\n"
+    "#ifndef TB_GEN_MAX_PACKED\n"
+    "#define TB_GEN_MAX_PACKED (1 << 24) // most elements unpacked from a packed array, they may take no bytes at all\n"
+    "#endif\n"
+    "\n"
+    "// A string or blob field, pointing into the buffer once unpacked\n"
+    "typedef struct tiny_bits_bytes {\n"
+    "    const char *data;\n"
+    "    size_t length;\n"
+    "} tiny_bits_bytes;\n"
+    "\n"
+    "// Index of the field named by key, the one expected next first (fields mostly come in schema order), -1 if unknown\n"
+    "static inline int _tb_gen_field(const tiny_bits_value *key, const char *const *names, const uint8_t *lengths, int count,\n"
+    "                                int expected) {\n"
+    "    size_t length = key->str_blob_val.length;\n"
+    "    if (expected < count && length == lengths[expected] && !memcmp(key->str_blob_val.data, names[expected], length)) {\n"
+    "        return expected;\n"
+    "    }\n"
+    "    for (int i = 0; i < count; i++) {\n"
+    "        if (length == lengths[i] && !memcmp(key->str_blob_val.data, names[i], length)) return i;\n"
+    "    }\n"
+    "    return -1;\n"
+    "}\n"
+    "\n"
+    "// Writes a key, as pack_str() would: bytes encoded beforehand unless the packer may send a reference instead\n"
+    "static inline uint8_t *_tb_gen_put_key(tiny_bits_packer *encoder, uint8_t *cursor, const char *encoded, size_t size,\n"
+    "                                       const char *name, uint32_t length) {\n"
+    "    if (!(encoder->features & TB_FEATURE_STRING_DEDUPE) && !encoder->dictionary.next_id) {\n"
+    "        memcpy(cursor, encoded, size);\n"
+    "        return cursor + size;\n"
+    "    }\n"
+    "    return put_str(encoder, cursor, name, length);\n"
+    "}\n"
+    "\n"
+    "// Zeroed room for count elements, not NULL for none either\n"
+    "static inline void *_tb_gen_array(size_t count, size_t size, const tiny_bits_allocator *allocator) {\n"
+    "    if (!count) count = 1;\n"
+    "    return _tb_calloc(allocator, count, size);\n"
+    "}\n"
+    "\n"
+    "// A value of the wrong type, or cut short (the input may go on, for an incremental unpacker)\n"
+    "static inline enum tiny_bits_type _tb_gen_mismatch(enum tiny_bits_type type) {\n"
+    "    return type == TINY_BITS_NEED_MORE || type == TINY_BITS_FINISHED ? TINY_BITS_NEED_MORE : TINY_BITS_ERROR;\n"
+    "}\n"
+    "\n"
+    "#endif // TINY_BITS_GENERATED\n"
+    "\n";
+
+static char *read_file(const char *name) {
+    FILE *file = fopen(name, "rb");
+    if (!file) return NULL;
+    size_t size = 0, capacity = 4096;
+    char *data = (char *)malloc(capacity);
+    size_t read;
+    while (data && (read = fread(data + size, 1, capacity - size - 1, file)) > 0) {
+        size += read;
+        if (size + 1 == capacity) {
+            capacity *= 2;
+            char *grown = (char *)realloc(data, capacity);
+            if (!grown) free(data);
+            data = grown;
+        }
+    }
+    fclose(file);
+    if (data) data[size] = 0;
+    return data;
+}
+
+int main(int argc, char **argv) {
+    const char *include = "tinybits.h";
+    int arg = 1;
+    if (arg + 1 < argc && !strcmp(argv[arg], "-i")) {
+        include = argv[arg + 1];
+        arg += 2;
+    }
+    if (arg >= argc || arg + 2 < argc) {
+        fprintf(stderr, "usage: %s [-i tinybits.h] schema.tb [output.h]\n", argv[0]);
+        return 2;
+    }
+    path = argv[arg];
+    source = read_file(path);
+    if (!source) {
+        fprintf(stderr, "%s: can not read\n", path);
+        return 1;
+    }
+    parse();
+    out = arg + 1 < argc ? fopen(argv[arg + 1], "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: can not write\n", argv[arg + 1]);
+        return 1;
+    }
+
+    // include guard from the schema file name
+    char guard[MAX_NAME + 16] = "TINY_BITS_GEN_";
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t length = strlen(guard);
+    for (; *base && *base != '.' && length + 3 < sizeof guard; base++) {
+        guard[length++] = isalnum((unsigned char)*base) ? (char)toupper((unsigned char)*base) : '_';
+    }
+    strcpy(guard + length, "_H");
+
+    emit("// Generated by tinybits_gen from %s, do not edit\n", path);
+    emit("#ifndef %s\n#define %s\n\n", guard, guard);
+    emit("#include \"%s\"\n\n", include);
+    emit("%s", prologue);
+    for (int i = 0; i < structs_count; i++) emit("typedef struct %s %s;\n", structs[i].name, structs[i].name);
+    emit("\n");
+    for (int i = 0; i < structs_count; i++) emit_struct_type(&structs[i]);
+    // any struct may hold an array of any other
+    for (int i = 0; i < structs_count; i++) {
+        const char *n = structs[i].name;
+        emit("static inline size_t _%s_bound(const %s *value);\n", n, n);
+        emit("static inline uint8_t *_%s_put(tiny_bits_packer *encoder, uint8_t *cursor, const %s *value);\n", n, n);
+        emit("static inline void _%s_release(%s *value, const tiny_bits_allocator *allocator);\n", n, n);
+        emit_read_signature(n);
+        emit(";\n");
+    }
+    emit("\n");
+    for (int i = 0; i < structs_count; i++) emit_struct_functions(&structs[i]);
+    emit("#endif // %s\n", guard);
+    if (out != stdout) fclose(out);
+    return 0;
+}